@@ -75,6 +75,11 @@ newoption {
 	allowed = {{"yes", "Enable option"}, {"no", "Disable option"}}
 }
 
+newoption {
+	trigger = "alloccount",
+	description = "Count heap allocations in the -carbench benchmark."
+}
+
 newaction {
 	trigger = "install",
 	description = "Install vdrift binary to bindir.",
@@ -142,6 +147,9 @@ solution "VDrift"
 		defines {"DEBUG"}
 		flags {"ExtraWarnings", "Symbols"}
 
+	configuration "alloccount"
+		defines {"ENABLE_ALLOCATION_COUNT"}
+
 	configuration {"windows", "codeblocks"}
 		links {"mingw32"}
 		linkoptions {"-static-libstdc++", "-static-libgcc"}
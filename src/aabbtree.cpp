@@ -20,8 +20,115 @@
 #include "aabbtree.h"
 #include "unittest.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// exact segment box test, clips the segment against the slabs of the box
+static bool SegmentHitsBox(const Aabb <float>::Ray & ray, const Aabb <float> & box)
+{
+	const Vec3 min = box.GetPos();
+	const Vec3 max = box.GetPos() + box.GetSize();
+	double t0 = 0, t1 = ray.seglen;
+	for (int k = 0; k < 3; ++k)
+	{
+		if (ray.dir[k] == 0)
+		{
+			if (ray.orig[k] < min[k] || ray.orig[k] > max[k])
+				return false;
+			continue;
+		}
+		double ta = (min[k] - double(ray.orig[k])) / ray.dir[k];
+		double tb = (max[k] - double(ray.orig[k])) / ray.dir[k];
+		if (ta > tb)
+			std::swap(ta, tb);
+		t0 = std::max(t0, ta);
+		t1 = std::min(t1, tb);
+		if (t0 > t1)
+			return false;
+	}
+	return true;
+}
+
 QT_TEST(aabb_space_partitioning_test)
 {
 	AabbTreeNode <int> testnode;
 	QT_CHECK_EQUAL(testnode.size(), 0);
 }
+
+QT_TEST(aabb_tree_query_test)
+{
+	// compare tree queries with a linear search
+	std::vector <Aabb <float> > boxes;
+	AabbTreeNode <int, 4> tree;
+	std::srand(1);
+	for (int i = 0; i < 500; ++i)
+	{
+		Vec3 min(std::rand() % 200, std::rand() % 200, std::rand() % 20);
+		Vec3 size(1 + std::rand() % 5, 1 + std::rand() % 5, 1 + std::rand() % 5);
+		boxes.push_back(Aabb <float> (min, min + size));
+		tree.Add(i, boxes.back());
+	}
+	tree.Optimize();
+	QT_CHECK_EQUAL(tree.size(), 500);
+
+	int mismatches = 0;
+	for (int i = 0; i < 100; ++i)
+	{
+		// moving half of the boxes
+		if (i == 50)
+		{
+			for (int n = 0; n < 500; n += 2)
+			{
+				Vec3 offset(std::rand() % 10, std::rand() % 10, 0);
+				boxes[n] = Aabb <float> (boxes[n].GetPos() + offset, boxes[n].GetPos() + boxes[n].GetSize() + offset);
+				tree.Update(n, boxes[n]);
+			}
+		}
+
+		// fractional origin, the segments never graze a box edge
+		Vec3 orig(std::rand() % 200 + 0.37f, std::rand() % 200 + 0.61f, 30);
+		Vec3 dir(std::rand() % 3 - 1, std::rand() % 3 - 1, -4);
+		dir = dir.Normalize();
+		Aabb <float>::Ray ray(orig, dir, 40);
+
+		std::vector <int> expected, result;
+		for (int n = 0; n < 500; ++n)
+		{
+			if (SegmentHitsBox(ray, boxes[n]))
+				expected.push_back(n);
+		}
+		tree.Query(ray, result);
+		std::sort(result.begin(), result.end());
+		mismatches += (expected != result);
+
+		Vec3 min(std::rand() % 200, std::rand() % 200, 0);
+		Aabb <float> box(min, min + Vec3(10, 10, 10));
+		expected.clear();
+		result.clear();
+		for (int n = 0; n < 500; ++n)
+		{
+			if (boxes[n].Intersect(box) != Aabb <float>::OUT)
+				expected.push_back(n);
+		}
+		tree.Query(box, result);
+		std::sort(result.begin(), result.end());
+		mismatches += (expected != result);
+	}
+	QT_CHECK_EQUAL(mismatches, 0);
+
+	// queries before Optimize test the objects directly
+	AabbTreeNode <int> single;
+	single.Add(0, Aabb <float> (Vec3(0, 0, 0), Vec3(1, 1, 1)));
+	std::vector <int> hits;
+	single.Query(Aabb <float>::Ray(Vec3(5, 5, 5), Vec3(0, 0, -1), 10), hits);
+	QT_CHECK(hits.empty());
+	single.Query(Aabb <float>::Ray(Vec3(0.5, 0.5, 5), Vec3(0, 0, -1), 10), hits);
+	QT_CHECK_EQUAL(hits.size(), 1);
+
+	tree.Delete(0);
+	QT_CHECK_EQUAL(tree.size(), 499);
+	std::vector <int> all;
+	tree.Query(Aabb <float>::IntersectAlways(), all);
+	QT_CHECK_EQUAL(all.size(), 499);
+}
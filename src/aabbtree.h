@@ -21,31 +21,38 @@
 #define _AABBTREE_H
 
 #include "aabb.h"
+#include "frustum.h"
 #include "mathvector.h"
 
+#include <algorithm>
 #include <list>
 #include <iostream>
-#include <map>
+#include <vector>
 
+/// Bounding volume hierarchy over objects with axis aligned bounding boxes.
+/// Objects are collected with Add, Optimize builds the tree with the surface
+/// area heuristic. Nodes are stored depth first in one array, an inner node is
+/// followed by its first child, so Query walks the tree without a stack.
 template <typename DataType, unsigned int ideal_objects_per_node = 1>
 class AabbTreeNode
 {
 public:
+	AabbTreeNode() : built(false) {}
+
 	void DebugPrint(int level, int & objectcount, bool verbose, std::ostream & output) const
 	{
-		if (verbose)
+		for (unsigned i = 0; i < nodes.size(); ++i)
 		{
-			for (int i = 0; i < level; ++i) output << "-";
-
-			output << "objects: " << objects.size() << ", child nodes: " << children.size() << ", aabb: ";
-			bbox.DebugPrint(output);
-		}
-
-		objectcount += objects.size();
+			const Node & node = nodes[i];
+			if (verbose)
+			{
+				for (int l = 0; l < level; ++l) output << "-";
 
-		for (typename childrenlist_type::const_iterator i = children.begin(); i != children.end(); ++i)
-		{
-			i->DebugPrint(level+1, objectcount, verbose, output);
+				output << "node: " << i << ", objects: " << node.count << ", aabb: "
+					<< node.min[0] << "," << node.min[1] << "," << node.min[2] << " to "
+					<< node.max[0] << "," << node.max[1] << "," << node.max[2] << std::endl;
+			}
+			objectcount += node.count;
 		}
 
 		if (level == 0)
@@ -58,292 +65,425 @@ public:
 		}
 	}
 
-	unsigned int size(unsigned int objectcount = 0) const
+	unsigned int size() const
 	{
-		unsigned int childcount = 0;
-
-		for (typename childrenlist_type::const_iterator i = children.begin(); i != children.end(); ++i)
-		{
-			childcount += i->size(objectcount);
-		}
-
-		objectcount += objects.size() + childcount;
-
-		return objectcount;
+		return objects.size();
 	}
 
+	/// build the tree from the added objects
 	void Optimize()
 	{
-		CollapseTo(*this);
+		nodes.clear();
+		parents.clear();
+		leaves.assign(objects.size(), 0);
+		built = true;
+		if (objects.empty()) return;
+
+		std::vector<int> order(objects.size());
+		std::vector<Vec3> centers(objects.size());
+		for (unsigned i = 0; i < objects.size(); ++i)
+		{
+			order[i] = i;
+			centers[i] = objects[i].second.GetCenter();
+		}
+
+		nodes.reserve(2 * objects.size() / ideal_objects_per_node + 1);
+		Build(order, centers, 0, order.size(), -1);
 
-		RemoveDuplicateObjects();
+		// objects of a leaf are contiguous
+		objectlist_type sorted(objects.size());
+		for (unsigned i = 0; i < order.size(); ++i)
+		{
+			sorted[i] = objects[order[i]];
+		}
+		objects.swap(sorted);
 
-		DistributeObjectsToChildren(0);
+		for (unsigned i = 0; i < nodes.size(); ++i)
+		{
+			if (nodes[i].count)
+			{
+				for (int n = nodes[i].offset; n < nodes[i].offset + nodes[i].count; ++n)
+					leaves[n] = i;
+			}
+		}
 	}
 
-	void Add(DataType & object, const Aabb <float> & newaabb)
+	/// add an object, takes effect in queries immediately, in the tree after Optimize
+	void Add(const DataType & object, const Aabb <float> & newaabb)
 	{
 		objects.push_back(std::pair <DataType, Aabb <float> > (object, newaabb));
-		if (objects.size() == 1) //don't combine if this is the first object, otherwise the AABB would be forced to include (0,0,0)
-			bbox = newaabb;
-		else
-			bbox.CombineWith(newaabb);
+		built = false;
 	}
 
-	///a slow delete that only requires the object
-	void Delete(DataType & object)
+	/// remove all instances of the object
+	void Delete(const DataType & object)
 	{
-		typename std::list <typename objectlist_type::iterator> todel;
-
-		//if we've got objects, test them
-		for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
-		{
-			if (i->first == object)
-			{
-				todel.push_back(i);
-			}
-		}
-
-		//do any deletions
-		for (typename std::list <typename objectlist_type::iterator>::iterator i = todel.begin(); i != todel.end(); ++i)
+		unsigned n = 0;
+		for (unsigned i = 0; i < objects.size(); ++i)
 		{
-			objects.erase(*i);
+			if (!(objects[i].first == object))
+				objects[n++] = objects[i];
 		}
+		if (n == objects.size()) return;
 
-		//if we have children, pass it on
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
-		{
-			i->Delete(object);
-		}
+		objects.resize(n);
+		if (built) Optimize();
 	}
 
-	///a faster delete that uses the supplied AABB to find the object
-	void Delete(DataType & object, const Aabb <float> & objaabb)
+	void Delete(const DataType & object, const Aabb <float> & /*objaabb*/)
 	{
-		typename std::list <typename objectlist_type::iterator> todel;
+		Delete(object);
+	}
 
-		//if we've got objects, test them
-		for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
+	/// update the bounding box of a moving object, refits the nodes above it
+	void Update(const DataType & object, const Aabb <float> & newaabb)
+	{
+		for (unsigned i = 0; i < objects.size(); ++i)
 		{
-			if (i->first == object)
-			{
-				todel.push_back(i);
-			}
-		}
+			if (!(objects[i].first == object)) continue;
 
-		//do any deletions
-		for (typename std::list <typename objectlist_type::iterator>::iterator i = todel.begin(); i != todel.end(); ++i)
-		{
-			objects.erase(*i);
-		}
+			objects[i].second = newaabb;
+			if (!built) continue;
 
-		//if we have children, pass it on
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
-		{
-			if (i->GetBBOX().Intersect(objaabb))
-			{
-				i->Delete(object, objaabb);
-			}
+			for (int n = leaves[i]; n >= 0; n = parents[n])
+				Refit(n);
 		}
 	}
 
+	/// refit all nodes to their objects, after many objects have moved
+	void Refit()
+	{
+		// children follow their parents
+		for (int n = int(nodes.size()) - 1; n >= 0; --n)
+			Refit(n);
+	}
+
 	///run a query for objects that collide with the given shape
 	template <typename T, typename U>
-	void Query(const T & shape, U &outputlist, bool testChildren=true) const
+	void Query(const T & shape, U &outputlist) const
 	{
-		//if we've got objects, test them
-		if (objects.size() > 1 && testChildren)
+		if (!built)
 		{
-			for (typename objectlist_type::const_iterator i = objects.begin(); i != objects.end(); ++i)
-			{
-				if (i->second.Intersect(shape) != Aabb<float>::OUT)
-				{
-					outputlist.push_back(i->first);
-				}
-			}
+			QueryObjects(0, objects.size(), shape, outputlist);
+			return;
 		}
-		else
+
+		const int nodes_num = nodes.size();
+		int i = 0;
+		while (i < nodes_num)
 		{
-			for (typename objectlist_type::const_iterator i = objects.begin(); i != objects.end(); ++i)
+			const Node & node = nodes[i];
+			const int next = node.count ? i + 1 : node.offset;
+			const Aabb<float>::IntersectionEnum intersection = Intersect(node, shape);
+			if (intersection == Aabb<float>::OUT)
 			{
-				outputlist.push_back(i->first);
+				i = next;
 			}
-		}
-
-		//if we have children, test them
-		for (typename childrenlist_type::const_iterator i = children.begin(); i != children.end(); ++i)
-		{
-			Aabb<float>::IntersectionEnum intersection = i->GetAabb().Intersect(shape);
-
-			if (intersection != Aabb<float>::OUT)
+			else if (intersection == Aabb<float>::IN)
 			{
-				//our child intersects with the segment, dispatch a query
-				//only bother to test children if we were partially intersecting (if fully in, then we know all children are fully in too)
-				i->Query(shape, outputlist, intersection == Aabb<float>::INTERSECT);
+				// subtree fully inside
+				for (; i < next; ++i)
+				{
+					for (int n = nodes[i].offset; n < nodes[i].offset + nodes[i].count; ++n)
+						outputlist.push_back(objects[n].first);
+				}
+			}
+			else
+			{
+				// a single object has the bounds of its leaf, tested above
+				if (node.count == 1)
+					outputlist.push_back(objects[node.offset].first);
+				else if (node.count)
+					QueryObjects(node.offset, node.offset + node.count, shape, outputlist);
+				++i;
 			}
 		}
 	}
 
-	bool Empty() const {return (objects.empty() && children.empty());}
+	bool Empty() const {return objects.empty();}
 
-	void Clear() {objects.clear(); children.clear();}
+	void Clear() {objects.clear(); nodes.clear(); parents.clear(); leaves.clear(); built = false;}
 
 	///traverse the entire tree putting pointers to all DataType objects into the given outputlist
 	void GetContainedObjects(std::list <DataType *> & outputlist)
 	{
-		//if we've got objects, add them
 		for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
 		{
 			outputlist.push_back(&i->first);
 		}
-
-		//if we have children, add them
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
-		{
-			i->GetContainedObjects(outputlist);
-		}
 	}
 
 private:
+	/// 32 byte node
+	struct Node
+	{
+		float min[3];
+		int offset; ///< leaf: first object, inner node: next node after the subtree
+		float max[3];
+		int count; ///< leaf: number of objects, inner node: 0
+	};
+
 	typedef std::vector <std::pair <DataType, Aabb <float> > > objectlist_type;
-	typedef std::vector <AabbTreeNode> childrenlist_type;
 	objectlist_type objects;
-	childrenlist_type children;
-	Aabb <float> bbox;
-
-	const Aabb <float> & GetAabb() const {return bbox;}
+	std::vector <Node> nodes;
+	std::vector <int> parents; ///< parent node index per node, -1 for the root
+	std::vector <int> leaves; ///< leaf node index per object
+	bool built;
 
-	///recursively send all objects and all childrens' objects to the target node, clearing out everything else
-	void CollapseTo(AabbTreeNode & collapse_target)
+	/// test objects with the node tests, so objects and nodes agree on hits
+	template <typename T, typename U>
+	void QueryObjects(int begin, int end, const T & shape, U &outputlist) const
 	{
-		if (this != &collapse_target)
+		for (int i = begin; i < end; ++i)
 		{
-			for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
+			Node node;
+			Vec3 min, max;
+			GetBounds(objects[i].second, min, max);
+			SetBounds(node, min, max);
+			if (Intersect(node, shape) != Aabb<float>::OUT)
 			{
-				collapse_target.Add(i->first, i->second);
+				outputlist.push_back(objects[i].first);
 			}
-			objects.clear();
-		}
-
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
-		{
-			i->CollapseTo(collapse_target);
 		}
-		children.clear();
 	}
 
-	///requires the DataType class implements operator< and operator==
-	void RemoveDuplicateObjects()
+	static void GetBounds(const Aabb <float> & box, Vec3 & min, Vec3 & max)
 	{
-		//TODO:  re-enable this code and make it compile
-		//objects.sort();
-		//objects.unique();
+		min = box.GetPos();
+		max = box.GetPos() + box.GetSize();
 	}
 
-	///intelligently add new child nodes and parse objects to them, recursively
-	void DistributeObjectsToChildren(const int level)
+	static void SetBounds(Node & node, const Vec3 & min, const Vec3 & max)
 	{
-		const unsigned int ideal_children_per_node(2);
-		const bool verbose(false);
-
-		//enforce the rules:  i don't want to start with any children,
-		// so tell all children to send me their objects, then delete them
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
+		for (int k = 0; k < 3; ++k)
 		{
-			i->CollapseTo(*this);
+			node.min[k] = min[k];
+			node.max[k] = max[k];
 		}
-		children.clear();
-
-		//only continue if we have more objects than we need
-		if (objects.size() <= ideal_objects_per_node) return;
+	}
 
-		children.resize(ideal_children_per_node);
+	static float HalfArea(const Vec3 & min, const Vec3 & max)
+	{
+		const Vec3 d = max - min;
+		return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+	}
 
-		//determine the average center position of all objects
-		Vec3 avgcenter;
-		int numobj = objects.size();
-		float incamount = 1.0 / numobj;
-		for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
+	static void Combine(Vec3 & min, Vec3 & max, const Vec3 & omin, const Vec3 & omax)
+	{
+		for (int k = 0; k < 3; ++k)
 		{
-			avgcenter = avgcenter + i->second.GetCenter() * incamount;
+			min[k] = std::min(min[k], omin[k]);
+			max[k] = std::max(max[k], omax[k]);
 		}
+	}
 
-		//find axis of maximum change, so we know where to split
-		Vec3 axismask(1,0,0);
-		Vec3 bboxsize = bbox.GetSize();
-		if (bboxsize[0] > bboxsize[1] && bboxsize[0] > bboxsize[2])
-		{
-			axismask.Set(1,0,0);
-		}
-		else if (bboxsize[1] > bboxsize[0] && bboxsize[1] > bboxsize[2])
+	/// build the subtree of objects order[begin, end), depth first
+	void Build(std::vector<int> & order, const std::vector<Vec3> & centers, int begin, int end, int parent)
+	{
+		const int index = nodes.size();
+		nodes.push_back(Node());
+		parents.push_back(parent);
+
+		Vec3 min, max, cmin, cmax;
+		GetBounds(objects[order[begin]].second, min, max);
+		cmin = cmax = centers[order[begin]];
+		for (int i = begin + 1; i < end; ++i)
 		{
-			axismask.Set(0,1,0);
+			Vec3 omin, omax;
+			GetBounds(objects[order[i]].second, omin, omax);
+			Combine(min, max, omin, omax);
+			Combine(cmin, cmax, centers[order[i]], centers[order[i]]);
 		}
-		else if (bboxsize[2] > bboxsize[1] && bboxsize[2] > bboxsize[0])
+		SetBounds(nodes[index], min, max);
+
+		const int count = end - begin;
+		if (count <= int(ideal_objects_per_node))
 		{
-			axismask.Set(0,0,1);
+			nodes[index].offset = begin;
+			nodes[index].count = count;
+			return;
 		}
 
-		//cout << level << endl;
-
-		//distribute objects to each child
-		float avgcentercoord = avgcenter.dot(axismask);
-		int distributor(0);
-		for (typename objectlist_type::iterator i = objects.begin(); i != objects.end(); ++i)
+		// binned surface area heuristic over the object centers
+		const int bins_num = 16;
+		int best_axis = -1;
+		int best_bin = 0;
+		float best_cost = 0;
+		for (int axis = 0; axis < 3; ++axis)
 		{
-			float objcentercoord = i->second.GetCenter().dot(axismask);
+			const float extent = cmax[axis] - cmin[axis];
+			if (extent <= 0) continue;
 
-			if (objcentercoord > avgcentercoord)
+			int bin_count[bins_num] = {0};
+			Vec3 bin_min[bins_num], bin_max[bins_num];
+			const float scale = bins_num * (1 - 1E-5f) / extent;
+			for (int i = begin; i < end; ++i)
 			{
-				children.front().Add(i->first, i->second);
+				const int b = int((centers[order[i]][axis] - cmin[axis]) * scale);
+				Vec3 omin, omax;
+				GetBounds(objects[order[i]].second, omin, omax);
+				if (bin_count[b]++)
+					Combine(bin_min[b], bin_max[b], omin, omax);
+				else
+					bin_min[b] = omin, bin_max[b] = omax;
 			}
-			else if (objcentercoord < avgcentercoord)
+
+			// sweep from the right, then from the left
+			float right_cost[bins_num];
+			Vec3 rmin, rmax;
+			int rcount = 0;
+			for (int b = bins_num - 1; b > 0; --b)
 			{
-				children.back().Add(i->first, i->second);
+				if (bin_count[b])
+				{
+					if (rcount) Combine(rmin, rmax, bin_min[b], bin_max[b]);
+					else rmin = bin_min[b], rmax = bin_max[b];
+					rcount += bin_count[b];
+				}
+				right_cost[b] = rcount ? rcount * HalfArea(rmin, rmax) : 0;
 			}
-			else
+
+			Vec3 lmin, lmax;
+			int lcount = 0;
+			for (int b = 0; b < bins_num - 1; ++b)
 			{
-				//cout << "unusual case #" << distributor << endl;
-				//distribute children that sit right on our average center in an even way
-				if (distributor % 2 == 0)
+				if (bin_count[b])
 				{
-					children.front().Add(i->first, i->second);
+					if (lcount) Combine(lmin, lmax, bin_min[b], bin_max[b]);
+					else lmin = bin_min[b], lmax = bin_max[b];
+					lcount += bin_count[b];
 				}
-				else
+				if (!lcount || lcount == count) continue;
+
+				const float cost = lcount * HalfArea(lmin, lmax) + right_cost[b + 1];
+				if (best_axis < 0 || cost < best_cost)
 				{
-					children.back().Add(i->first, i->second);
+					best_axis = axis;
+					best_bin = b;
+					best_cost = cost;
 				}
-				distributor++;
 			}
 		}
 
-		//we've given away all of our objects; clear them out
-		objects.clear();
+		int mid = begin + count / 2;
+		if (best_axis >= 0)
+		{
+			const float extent = cmax[best_axis] - cmin[best_axis];
+			const float scale = bins_num * (1 - 1E-5f) / extent;
+			const float axis_min = cmin[best_axis];
+			int * split = std::partition(&order[0] + begin, &order[0] + end, BinLess(centers, best_axis, axis_min, scale, best_bin));
+			mid = split - &order[0];
+		}
 
-		//count objects that belong to our children
-		int child1obj = children.front().objects.size();
-		int child2obj = children.back().objects.size();
+		Build(order, centers, begin, mid, index);
+		Build(order, centers, mid, end, index);
+		nodes[index].offset = nodes.size();
+		nodes[index].count = 0;
+	}
+
+	struct BinLess
+	{
+		const std::vector<Vec3> & centers;
+		int axis;
+		float min;
+		float scale;
+		int bin;
+
+		BinLess(const std::vector<Vec3> & centers, int axis, float min, float scale, int bin) :
+			centers(centers), axis(axis), min(min), scale(scale), bin(bin)
+		{
+			// ctor
+		}
 
-		if (verbose) std::cout << "Objects: " << objects.size() << ", Child nodes: " << children.size() << " L obj: " << child1obj << " R obj: " << child2obj << std::endl;
+		bool operator()(int i) const
+		{
+			return int((centers[i][axis] - min) * scale) <= bin;
+		}
+	};
 
-		//if one child doesn't have any objects, then delete both children and take back their objects
-		if (child1obj == 0 || child2obj == 0)
+	void Refit(int n)
+	{
+		Node & node = nodes[n];
+		Vec3 min, max, omin, omax;
+		if (node.count)
 		{
-			for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
+			GetBounds(objects[node.offset].second, min, max);
+			for (int i = node.offset + 1; i < node.offset + node.count; ++i)
 			{
-				for (typename objectlist_type::iterator n = i->objects.begin(); n != i->objects.end(); n++)
-				{
-					Add(n->first, n->second);
-				}
+				GetBounds(objects[i].second, omin, omax);
+				Combine(min, max, omin, omax);
 			}
+		}
+		else
+		{
+			// first child follows, the second child follows the first subtree
+			const Node & a = nodes[n + 1];
+			const Node & b = nodes[a.count ? n + 2 : a.offset];
+			min.Set(a.min[0], a.min[1], a.min[2]);
+			max.Set(a.max[0], a.max[1], a.max[2]);
+			Combine(min, max, Vec3(b.min[0], b.min[1], b.min[2]), Vec3(b.max[0], b.max[1], b.max[2]));
+		}
+		SetBounds(node, min, max);
+	}
 
-			children.clear();
+	template <typename T>
+	static Aabb<float>::IntersectionEnum Intersect(const Node & node, const T & shape)
+	{
+		return Aabb<float>(
+			Vec3(node.min[0], node.min[1], node.min[2]),
+			Vec3(node.max[0], node.max[1], node.max[2])).Intersect(shape);
+	}
+
+	static Aabb<float>::IntersectionEnum Intersect(const Node & node, const Aabb<float> & other)
+	{
+		const Vec3 & omin = other.GetPos();
+		const Vec3 omax = other.GetPos() + other.GetSize();
+		for (int k = 0; k < 3; ++k)
+		{
+			if (node.min[k] > omax[k] || node.max[k] < omin[k])
+				return Aabb<float>::OUT;
 		}
+		return Aabb<float>::INTERSECT;
+	}
 
-		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
+	static Aabb<float>::IntersectionEnum Intersect(const Node & node, const Aabb<float>::Ray & ray)
+	{
+		// separating axis test of the segment and the box
+		float segdir[3], diff[3], half[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			half[k] = 0.5f * (node.max[k] - node.min[k]);
+			segdir[k] = ray.dir[k] * (0.5f * ray.seglen);
+			diff[k] = ray.orig[k] + segdir[k] - (node.min[k] + half[k]);
+			if (std::abs(diff[k]) > half[k] + std::abs(segdir[k]))
+				return Aabb<float>::OUT;
+		}
+		for (int k = 0; k < 3; ++k)
 		{
-			i->DistributeObjectsToChildren(level + 1);
+			const int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+			const float cross = segdir[k1] * diff[k2] - segdir[k2] * diff[k1];
+			if (std::abs(cross) > half[k1] * std::abs(segdir[k2]) + half[k2] * std::abs(segdir[k1]))
+				return Aabb<float>::OUT;
+		}
+		return Aabb<float>::INTERSECT;
+	}
+
+	static Aabb<float>::IntersectionEnum Intersect(const Node & node, const Frustum & frustum)
+	{
+		// box projected on the plane normals
+		for (int i = 0; i < 6; ++i)
+		{
+			float rd = frustum.frustum[i][3];
+			float r = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				rd += frustum.frustum[i][k] * 0.5f * (node.min[k] + node.max[k]);
+				r += std::abs(frustum.frustum[i][k]) * 0.5f * (node.max[k] - node.min[k]);
+			}
+			if (rd < -r)
+				return Aabb<float>::OUT;
 		}
+		return Aabb<float>::INTERSECT;
 	}
 };
 
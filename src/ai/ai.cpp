@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "ai.h"
+#include "job_system.h"
 #include <cassert>
 // AI implementations:
 #include "ai_car_standard.h"
@@ -80,13 +81,12 @@ void Ai::ClearCars()
 	ai_cars.clear();
 }
 
-void Ai::Update(float dt, const CarDynamics cars[], const int cars_num)
+void Ai::Update(float dt, const CarDynamics cars[], const int cars_num, JobSystem & jobs)
 {
-	int size = ai_cars.size();
-	for (int i = 0; i < size; i++)
+	jobs.ParallelFor(0, ai_cars.size(), 1, [&](int i)
 	{
 		ai_cars[i]->Update(dt, cars, cars_num);
-	}
+	});
 }
 
 const std::vector<float> & Ai::GetInputs(const CarDynamics * car) const
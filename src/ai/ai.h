@@ -26,6 +26,7 @@
 #include <map>
 
 class AiFactory;
+class JobSystem;
 
 /// Manages all Ai cars.
 class Ai
@@ -41,7 +42,8 @@ public:
 
 	void ClearCars();
 
-	void Update(float dt, const CarDynamics cars[], const int cars_num);
+	/// Ai cars only read the shared car state, they are updated in parallel.
+	void Update(float dt, const CarDynamics cars[], const int cars_num, JobSystem & jobs);
 
 	///< Returns an empty vector if the car isn't AI-controlled.
 	const std::vector<float> & GetInputs(const CarDynamics * car) const;
@@ -26,7 +26,6 @@
 
 #include <cassert>
 #include <cmath>
-#include <ctime>
 #include <algorithm>
 #include <iostream>
 
@@ -41,7 +40,8 @@ AiCarExperimental::AiCarExperimental(const CarDynamics * new_car, float new_diff
 	lateral_mu(0.9),
 	last_patch(NULL),
 	use_racingline(true),
-	isRecovering(false)
+	isRecovering(false),
+	recoverTime(0)
 {
 	assert(car);
 }
@@ -109,6 +109,9 @@ void AiCarExperimental::Update(float dt, const CarDynamics cars[], const int car
 	float lastBreak = inputs[CarInput::BRAKE];
 	fill(inputs.begin(), inputs.end(), 0);
 
+	if (isRecovering)
+		recoverTime += dt;
+
 	AnalyzeOthers(dt, cars, cars_num);
 	UpdateGasBrake();
 	UpdateSteer();
@@ -550,7 +553,7 @@ bool AiCarExperimental::Recover(const Bezier * /*patch*/)
 			// Collision detected: we are probably trying to cross a wall.
 			// We need to drive backwards.
 			inputs[CarInput::REVERSE] = 1;
-			time (&recoverStartTime);
+			recoverTime = 0;
 			isRecovering = true;
 			return true;
 		} else {
@@ -562,11 +565,9 @@ bool AiCarExperimental::Recover(const Bezier * /*patch*/)
 	}
 	else if(isRecovering)
 	{
-		// If car is driving and it is in recover mode, count the time since start of recover mode.
-		time_t curr;
-		time (&curr);
-		float diff = difftime(curr, recoverStartTime);
-		if (diff > 3)
+		// If car is driving and it is in recover mode, check the time since start of recover mode.
+		// Simulation time instead of wall clock time keeps replays deterministic.
+		if (recoverTime > 3)
 		{
 			// Break to 0 after 3 secs of driving backwards.
 			// After breaking, it will trigger the "isRecovering = false" above and leave recover mode.
@@ -718,14 +719,14 @@ float AiCarExperimental::BrakeFromOthers(float speed_diff)
 	float mineta = 1000;
 	float mindistance = 1000;
 
-	for (std::map<const CarDynamics *, OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	for (std::vector <OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < horizontal_care)
+		if (i->active && std::abs(i->horizontal_distance) < horizontal_care)
 		{
-			if (i->second.fore_distance < mindistance)
+			if (i->fore_distance < mindistance)
 			{
-				mindistance = i->second.fore_distance;
-				mineta = i->second.eta;
+				mindistance = i->fore_distance;
+				mineta = i->eta;
 			}
 		}
 	}
@@ -763,12 +764,13 @@ void AiCarExperimental::AnalyzeOthers(float dt, const CarDynamics cars[], const
 	const float half_carlength = 1.25;
 	const btVector3 throttle_axis = Direction::forward;
 
+	othercars.resize(cars_num);
 	for (int i = 0; i != cars_num; ++i)
 	{
 		const CarDynamics * icar = &cars[i];
 		if (icar != car)
 		{
-			OtherCarInfo & info = othercars[icar];
+			OtherCarInfo & info = othercars[i];
 
 			// find direction of other cars in our frame
 			btVector3 relative_position = icar->GetCenterOfMass() - car->GetCenterOfMass();
@@ -832,12 +834,12 @@ float AiCarExperimental::SteerAwayFromOthers()
 	float eta = 1000;
 	float min_horizontal_distance = 1000;
 
-	for (std::map <const CarDynamics *, OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	for (std::vector <OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < std::abs(min_horizontal_distance))
+		if (i->active && std::abs(i->horizontal_distance) < std::abs(min_horizontal_distance))
 		{
-			min_horizontal_distance = i->second.horizontal_distance;
-			eta = i->second.eta;
+			min_horizontal_distance = i->horizontal_distance;
+			eta = i->eta;
 		}
 	}
 
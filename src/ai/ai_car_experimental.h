@@ -57,18 +57,18 @@ private:
 	const Bezier * last_patch;	///< last patch the car was on, used in case car is off track
 	bool use_racingline;		///< true allows the AI to take a proper racing line
 	bool isRecovering;			///< tries to get back to the road.
-	time_t recoverStartTime;
+	float recoverTime;			///< simulation time since recovering started
 
 	struct OtherCarInfo
 	{
-		OtherCarInfo() : active(false) {}
+		OtherCarInfo() : horizontal_distance(0), fore_distance(0), eta(0), active(false) {}
 
 		float horizontal_distance;
 		float fore_distance;
 		float eta;
 		bool active;
 	};
-	std::map <const CarDynamics *, OtherCarInfo> othercars;
+	std::vector <OtherCarInfo> othercars; ///< indexed like the cars, in car order for deterministic results
 
 	void UpdateGasBrake();
 
@@ -593,14 +593,14 @@ float AiCarStandard::BrakeFromOthers(float speed_diff)
 	float mineta = 1000;
 	float mindistance = 1000;
 
-	for (std::map <const CarDynamics *, OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	for (std::vector <OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < horizontal_care)
+		if (i->active && std::abs(i->horizontal_distance) < horizontal_care)
 		{
-			if (i->second.fore_distance < mindistance)
+			if (i->fore_distance < mindistance)
 			{
-				mindistance = i->second.fore_distance;
-				mineta = i->second.eta;
+				mindistance = i->fore_distance;
+				mineta = i->eta;
 			}
 		}
 	}
@@ -638,12 +638,13 @@ void AiCarStandard::AnalyzeOthers(float dt, const CarDynamics cars[], const int
 	const float half_carlength = 1.25;
 	const btVector3 throttle_axis = Direction::forward;
 
+	othercars.resize(cars_num);
 	for (int i = 0; i != cars_num; ++i)
 	{
 		const CarDynamics * icar = &cars[i];
 		if (icar != car)
 		{
-			OtherCarInfo & info = othercars[icar];
+			OtherCarInfo & info = othercars[i];
 
 			// find direction of other cars in our frame
 			btVector3 relative_position = icar->GetCenterOfMass() - car->GetCenterOfMass();
@@ -707,12 +708,12 @@ float AiCarStandard::SteerAwayFromOthers()
 	float eta = 1000;
 	float min_horizontal_distance = 1000;
 
-	for (std::map <const CarDynamics *, OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	for (std::vector <OtherCarInfo>::iterator i = othercars.begin(); i != othercars.end(); ++i)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < std::abs(min_horizontal_distance))
+		if (i->active && std::abs(i->horizontal_distance) < std::abs(min_horizontal_distance))
 		{
-			min_horizontal_distance = i->second.horizontal_distance;
-			eta = i->second.eta;
+			min_horizontal_distance = i->horizontal_distance;
+			eta = i->eta;
 		}
 	}
 
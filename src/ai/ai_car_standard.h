@@ -58,14 +58,14 @@ private:
 
 	struct OtherCarInfo
 	{
-		OtherCarInfo() : active(false) {}
+		OtherCarInfo() : horizontal_distance(0), fore_distance(0), eta(0), active(false) {}
 
 		float horizontal_distance;
 		float fore_distance;
 		float eta;
 		bool active;
 	};
-	std::map <const CarDynamics *, OtherCarInfo> othercars;
+	std::vector <OtherCarInfo> othercars; ///< indexed like the cars, in car order for deterministic results
 
 	void UpdateGasBrake();
 
@@ -18,9 +18,12 @@
 /************************************************************************/
 
 #include "bezier.h"
+#include "physics/ssemath.h"
 #include "unittest.h"
 
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 
 std::ostream & operator << (std::ostream &os, const Bezier & b)
 {
@@ -507,6 +510,71 @@ void Bezier::WriteTo(std::ostream &openfile) const
 	}
 }
 
+template <typename T>
+static void ReadValue(std::istream & s, T & value)
+{
+	s.read((char *)&value, sizeof(T));
+}
+
+template <typename T>
+static void WriteValue(std::ostream & s, const T & value)
+{
+	s.write((const char *)&value, sizeof(T));
+}
+
+static void ReadValue(std::istream & s, Vec3 & value)
+{
+	for (int i = 0; i < 3; i++)
+		ReadValue(s, value[i]);
+}
+
+static void WriteValue(std::ostream & s, const Vec3 & value)
+{
+	for (int i = 0; i < 3; i++)
+		WriteValue(s, value[i]);
+}
+
+void Bezier::ReadBinary(std::istream &openfile)
+{
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			ReadValue(openfile, points[x][y]);
+		}
+	}
+	ReadValue(openfile, center);
+	ReadValue(openfile, radius);
+	ReadValue(openfile, length);
+	ReadValue(openfile, dist_from_start);
+	ReadValue(openfile, track_radius);
+	ReadValue(openfile, turn);
+	ReadValue(openfile, track_curvature);
+	ReadValue(openfile, racing_line);
+	ReadValue(openfile, have_racingline);
+	next_patch = NULL;
+}
+
+void Bezier::WriteBinary(std::ostream &openfile) const
+{
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			WriteValue(openfile, points[x][y]);
+		}
+	}
+	WriteValue(openfile, center);
+	WriteValue(openfile, radius);
+	WriteValue(openfile, length);
+	WriteValue(openfile, dist_from_start);
+	WriteValue(openfile, track_radius);
+	WriteValue(openfile, turn);
+	WriteValue(openfile, track_curvature);
+	WriteValue(openfile, racing_line);
+	WriteValue(openfile, have_racingline);
+}
+
 bool Bezier::CollideSubDivQuadSimple(const Vec3 & origin, const Vec3 & direction, Vec3 &outtri) const
 {
 	Vec3 normal;
@@ -657,7 +725,7 @@ bool Bezier::IntersectQuadrilateralF(
 	const Vec3 & orig, const Vec3 & dir,
 	const Vec3 & v_00, const Vec3 & v_10,
 	const Vec3 & v_11, const Vec3 & v_01,
-	float &t, float &u, float &v) const
+	float &t, float &u, float &v)
 {
 	const float EPSILON = 0.000001;
 
@@ -769,6 +837,455 @@ bool Bezier::IntersectQuadrilateralF(
 	return true;
 }
 
+BezierPowerForm::BezierPowerForm()
+{
+	for (int k = 0; k < 3; ++k)
+		for (int i = 0; i < 16; ++i)
+			c[k][i] = 0;
+}
+
+void BezierPowerForm::Set(const Bezier & bezier)
+{
+	// power basis of Bezier::Bernstein, m[power][point]
+	const float m[4][4] = {
+		{0, 0, 0, 1},
+		{0, 0, 3, -3},
+		{0, 3, -6, 3},
+		{1, -3, 3, -1}};
+
+	min = max = bezier.points[0][0];
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				min[k] = std::min(min[k], bezier.points[r][i][k]);
+				max[k] = std::max(max[k], bezier.points[r][i][k]);
+			}
+		}
+	}
+	center = (min + max) * 0.5;
+
+	// the surface is inside of the control point hull, pad the bounds for rounding
+	Vec3 pad = (max - min) * 1E-3 + Vec3(1E-3, 1E-3, 1E-3);
+	min = min - center - pad;
+	max = max - center + pad;
+
+	for (int j = 0; j < 4; ++j)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			Vec3 sum;
+			for (int r = 0; r < 4; ++r)
+				for (int q = 0; q < 4; ++q)
+					sum = sum + (bezier.points[r][q] - center) * (m[j][r] * m[i][q]);
+			for (int k = 0; k < 3; ++k)
+				c[k][4 * j + i] = sum[k];
+		}
+	}
+}
+
+Vec3 BezierPowerForm::SurfCoord(float px, float py) const
+{
+	return LocalCoord(px, py) + center;
+}
+
+Vec3 BezierPowerForm::LocalCoord(float px, float py) const
+{
+	Vec3 p;
+	for (int k = 0; k < 3; ++k)
+	{
+		float s = 0;
+		for (int j = 3; j >= 0; --j)
+		{
+			const float * a = c[k] + 4 * j;
+			s = s * py + (((a[3] * px + a[2]) * px + a[1]) * px + a[0]);
+		}
+		p[k] = s;
+	}
+	return p;
+}
+
+Vec3 BezierPowerForm::SurfNorm(float px, float py) const
+{
+	Vec3 tu, tv;
+	for (int k = 0; k < 3; ++k)
+	{
+		float su = 0;
+		float sv = 0;
+		for (int j = 3; j >= 0; --j)
+		{
+			const float * a = c[k] + 4 * j;
+			su = su * py + ((3 * a[3] * px + 2 * a[2]) * px + a[1]);
+			if (j > 0)
+				sv = sv * py + j * (((a[3] * px + a[2]) * px + a[1]) * px + a[0]);
+		}
+		tu[k] = su;
+		tv[k] = sv;
+	}
+	return -tu.cross(tv).Normalize();
+}
+
+bool BezierPowerForm::Collide(const Vec3 & origin, const Vec3 & direction, Vec3 & outtri, Vec3 & normal) const
+{
+	const int COLLISION_QUAD_DIVS = 6;
+	const float areacut = 0.5;
+
+	// the first quad is inside of the bounds
+	const Vec3 orig = origin - center;
+	float tnear = 0;
+	float tfar = 1E30;
+	for (int k = 0; k < 3; ++k)
+	{
+		if (direction[k] == 0)
+		{
+			if (orig[k] < min[k] || orig[k] > max[k])
+			{
+				outtri = origin;
+				return false;
+			}
+			continue;
+		}
+		float t1 = (min[k] - orig[k]) / direction[k];
+		float t2 = (max[k] - orig[k]) / direction[k];
+		tnear = std::max(tnear, std::min(t1, t2));
+		tfar = std::min(tfar, std::max(t1, t2));
+	}
+	if (tnear > tfar)
+	{
+		outtri = origin;
+		return false;
+	}
+
+	float t, u, v;
+	float su = 0;
+	float sv = 0;
+	float umin = 0;
+	float umax = 1;
+	float vmin = 0;
+	float vmax = 1;
+	for (int i = 0; i < COLLISION_QUAD_DIVS; i++)
+	{
+		const float tu0 = std::max(umin, 0.0f);
+		const float tu1 = std::min(umax, 1.0f);
+		const float tv0 = std::max(vmin, 0.0f);
+		const float tv1 = std::min(vmax, 1.0f);
+		const Vec3 ul = LocalCoord(tu0, tv0);
+		const Vec3 ur = LocalCoord(tu1, tv0);
+		const Vec3 br = LocalCoord(tu1, tv1);
+		const Vec3 bl = LocalCoord(tu0, tv1);
+
+		if (!Bezier::IntersectQuadrilateralF(orig, direction, ul, ur, br, bl, t, u, v))
+		{
+			outtri = origin;
+			return false;
+		}
+
+		su = u * (tu1 - tu0) + tu0;
+		sv = v * (tv1 - tv0) + tv0;
+		vmax = sv + (0.5f * areacut) * (vmax - vmin);
+		vmin = sv - (0.5f * areacut) * (vmax - vmin);
+		umax = su + (0.5f * areacut) * (umax - umin);
+		umin = su - (0.5f * areacut) * (umax - umin);
+	}
+
+	outtri = SurfCoord(su, sv);
+	normal = SurfNorm(su, sv);
+	return true;
+}
+
+unsigned BezierPowerForm::Collide(
+	const BezierPowerForm * const forms[],
+	const Vec3 origins[],
+	const Vec3 directions[],
+	int count,
+	Vec3 outtri[],
+	Vec3 normal[])
+{
+	assert(count <= 32);
+	unsigned hits = 0;
+	for (int i = 0; i < count; i += 4)
+	{
+		const int n = std::min(count - i, 4);
+		hits |= Collide4(forms + i, origins + i, directions + i, n, outtri + i, normal + i) << i;
+	}
+	return hits;
+}
+
+#ifdef PHYSICS_SSE
+namespace
+{
+	using SseMath::Select;
+	using SseMath::Abs;
+
+	inline __m128 MulAdd(__m128 a, __m128 b, __m128 c)
+	{
+		return _mm_add_ps(_mm_mul_ps(a, b), c);
+	}
+
+	/// four lanes of 3d vectors
+	struct Vec3x4
+	{
+		__m128 x, y, z;
+
+		Vec3x4() {}
+		Vec3x4(__m128 x, __m128 y, __m128 z) : x(x), y(y), z(z) {}
+
+		Vec3x4 operator-(const Vec3x4 & o) const
+		{
+			return Vec3x4(_mm_sub_ps(x, o.x), _mm_sub_ps(y, o.y), _mm_sub_ps(z, o.z));
+		}
+
+		__m128 dot(const Vec3x4 & o) const
+		{
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, o.x), _mm_mul_ps(y, o.y)), _mm_mul_ps(z, o.z));
+		}
+
+		Vec3x4 cross(const Vec3x4 & o) const
+		{
+			return Vec3x4(
+				_mm_sub_ps(_mm_mul_ps(y, o.z), _mm_mul_ps(z, o.y)),
+				_mm_sub_ps(_mm_mul_ps(z, o.x), _mm_mul_ps(x, o.z)),
+				_mm_sub_ps(_mm_mul_ps(x, o.y), _mm_mul_ps(y, o.x)));
+		}
+	};
+
+	/// power basis coefficients of four forms, one per lane
+	struct PowerFormx4
+	{
+		__m128 c[3][16];
+
+		__m128 SurfCoord(int k, __m128 px, __m128 py) const
+		{
+			__m128 s = _mm_setzero_ps();
+			for (int j = 3; j >= 0; --j)
+			{
+				const __m128 * a = c[k] + 4 * j;
+				__m128 r = MulAdd(MulAdd(MulAdd(a[3], px, a[2]), px, a[1]), px, a[0]);
+				s = MulAdd(s, py, r);
+			}
+			return s;
+		}
+
+		Vec3x4 SurfCoord(__m128 px, __m128 py) const
+		{
+			return Vec3x4(SurfCoord(0, px, py), SurfCoord(1, px, py), SurfCoord(2, px, py));
+		}
+	};
+
+	/// Bezier::IntersectQuadrilateralF for four lanes, returns the hit mask
+	__m128 IntersectQuadrilateral(
+		const Vec3x4 & orig, const Vec3x4 & dir,
+		const Vec3x4 & v_00, const Vec3x4 & v_10,
+		const Vec3x4 & v_11, const Vec3x4 & v_01,
+		__m128 & u, __m128 & v)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1);
+		const __m128 eps = _mm_set1_ps(0.000001f);
+
+		const Vec3x4 E_01 = v_10 - v_00;
+		const Vec3x4 E_03 = v_01 - v_00;
+		const Vec3x4 P = dir.cross(E_03);
+		const __m128 det = E_01.dot(P);
+		__m128 reject = _mm_cmplt_ps(Abs(det), eps);
+
+		const Vec3x4 T = orig - v_00;
+		const __m128 alpha = _mm_div_ps(T.dot(P), det);
+		reject = _mm_or_ps(reject, _mm_cmplt_ps(alpha, zero));
+
+		const Vec3x4 Q = T.cross(E_01);
+		const __m128 beta = _mm_div_ps(dir.dot(Q), det);
+		reject = _mm_or_ps(reject, _mm_cmplt_ps(beta, zero));
+
+		// rays beyond the diagonal, test against the opposite corner
+		const __m128 second = _mm_cmpgt_ps(_mm_add_ps(alpha, beta), one);
+		const Vec3x4 E_23 = v_01 - v_11;
+		const Vec3x4 E_21 = v_10 - v_11;
+		const Vec3x4 P_prime = dir.cross(E_21);
+		const __m128 det_prime = E_23.dot(P_prime);
+		const Vec3x4 T_prime = orig - v_11;
+		const __m128 alpha_prime = _mm_div_ps(T_prime.dot(P_prime), det_prime);
+		const Vec3x4 Q_prime = T_prime.cross(E_23);
+		const __m128 beta_prime = _mm_div_ps(dir.dot(Q_prime), det_prime);
+		__m128 reject_prime = _mm_cmplt_ps(Abs(det_prime), eps);
+		reject_prime = _mm_or_ps(reject_prime, _mm_cmplt_ps(alpha_prime, zero));
+		reject_prime = _mm_or_ps(reject_prime, _mm_cmplt_ps(beta_prime, zero));
+		reject = _mm_or_ps(reject, _mm_and_ps(second, reject_prime));
+
+		const __m128 t = _mm_div_ps(E_03.dot(Q), det);
+		reject = _mm_or_ps(reject, _mm_cmplt_ps(t, zero));
+
+		// barycentric coordinates of the fourth vertex, projected on the dominant axis of n
+		const Vec3x4 E_02 = v_11 - v_00;
+		const Vec3x4 n = E_01.cross(E_03);
+		const __m128 nx = Abs(n.x), ny = Abs(n.y), nz = Abs(n.z);
+		const __m128 axis_x = _mm_and_ps(_mm_cmpge_ps(nx, ny), _mm_cmpge_ps(nx, nz));
+		const __m128 axis_y = _mm_andnot_ps(axis_x, _mm_and_ps(_mm_cmpge_ps(ny, nx), _mm_cmpge_ps(ny, nz)));
+		const Vec3x4 a = E_02.cross(E_03);
+		const Vec3x4 b = E_01.cross(E_02);
+		const __m128 alpha_11 = Select(axis_x, _mm_div_ps(a.x, n.x),
+			Select(axis_y, _mm_div_ps(a.y, n.y), _mm_div_ps(a.z, n.z)));
+		const __m128 beta_11 = Select(axis_x, _mm_div_ps(b.x, n.x),
+			Select(axis_y, _mm_div_ps(b.y, n.y), _mm_div_ps(b.z, n.z)));
+
+		// bilinear coordinates of the intersection point
+		const __m128 alpha_11m1 = _mm_sub_ps(alpha_11, one);
+		const __m128 beta_11m1 = _mm_sub_ps(beta_11, one);
+		const __m128 alpha_trap = _mm_cmplt_ps(Abs(alpha_11m1), eps);
+		const __m128 beta_trap = _mm_cmplt_ps(Abs(beta_11m1), eps);
+
+		// alpha_11 == 1, a trapezium or a parallelogram
+		const __m128 u1 = alpha;
+		const __m128 v1 = Select(beta_trap, beta, _mm_div_ps(beta, MulAdd(u1, beta_11m1, one)));
+
+		// beta_11 == 1, a trapezium
+		const __m128 denom2 = MulAdd(beta, alpha_11m1, one);
+		const __m128 u2 = _mm_div_ps(alpha, denom2);
+		const __m128 v2 = beta;
+
+		// general quadrilateral
+		const __m128 A = _mm_sub_ps(one, beta_11);
+		const __m128 B = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(alpha, beta_11m1), _mm_mul_ps(beta, alpha_11m1)), one);
+		const __m128 C = alpha;
+		const __m128 D = _mm_sub_ps(_mm_mul_ps(B, B), _mm_mul_ps(_mm_set1_ps(4), _mm_mul_ps(A, C)));
+		const __m128 sign = Select(_mm_cmplt_ps(B, zero), _mm_set1_ps(-1), one);
+		const __m128 Q3 = _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_add_ps(B, _mm_mul_ps(sign, _mm_sqrt_ps(D))));
+		__m128 u3 = _mm_div_ps(Q3, A);
+		u3 = Select(_mm_or_ps(_mm_cmplt_ps(u3, zero), _mm_cmpgt_ps(u3, one)), _mm_div_ps(C, Q3), u3);
+		const __m128 v3 = _mm_div_ps(beta, MulAdd(u3, beta_11m1, one));
+
+		const __m128 case2 = _mm_andnot_ps(alpha_trap, beta_trap);
+		const __m128 case3 = _mm_andnot_ps(_mm_or_ps(alpha_trap, beta_trap), _mm_cmpeq_ps(zero, zero));
+		reject = _mm_or_ps(reject, _mm_and_ps(case2, _mm_cmpeq_ps(denom2, zero)));
+		reject = _mm_or_ps(reject, _mm_and_ps(case3, _mm_cmplt_ps(D, zero)));
+
+		u = Select(alpha_trap, u1, Select(beta_trap, u2, u3));
+		v = Select(alpha_trap, v1, Select(beta_trap, v2, v3));
+		return _mm_andnot_ps(reject, _mm_cmpeq_ps(zero, zero));
+	}
+}
+
+unsigned BezierPowerForm::Collide4(
+	const BezierPowerForm * const forms[],
+	const Vec3 origins[],
+	const Vec3 directions[],
+	int count,
+	Vec3 outtri[],
+	Vec3 normal[])
+{
+	// unused lanes repeat the first one
+	const BezierPowerForm * f[4];
+	Vec3 o[4], d[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		const int l = i < count ? i : 0;
+		f[i] = forms[l];
+		o[i] = origins[l] - forms[l]->center;
+		d[i] = directions[l];
+	}
+
+	PowerFormx4 form;
+	for (int k = 0; k < 3; ++k)
+		for (int i = 0; i < 16; ++i)
+			form.c[k][i] = _mm_setr_ps(f[0]->c[k][i], f[1]->c[k][i], f[2]->c[k][i], f[3]->c[k][i]);
+
+	const Vec3x4 orig(
+		_mm_setr_ps(o[0][0], o[1][0], o[2][0], o[3][0]),
+		_mm_setr_ps(o[0][1], o[1][1], o[2][1], o[3][1]),
+		_mm_setr_ps(o[0][2], o[1][2], o[2][2], o[3][2]));
+	const Vec3x4 dir(
+		_mm_setr_ps(d[0][0], d[1][0], d[2][0], d[3][0]),
+		_mm_setr_ps(d[0][1], d[1][1], d[2][1], d[3][1]),
+		_mm_setr_ps(d[0][2], d[1][2], d[2][2], d[3][2]));
+
+	// the first quad is inside of the bounds, a NaN slab (ray in the slab plane) is ignored
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	__m128 tnear = zero;
+	__m128 tfar = _mm_set1_ps(1E30f);
+	const __m128 * origk[3] = {&orig.x, &orig.y, &orig.z};
+	const __m128 * dirk[3] = {&dir.x, &dir.y, &dir.z};
+	for (int k = 0; k < 3; ++k)
+	{
+		const __m128 lo = _mm_setr_ps(f[0]->min[k], f[1]->min[k], f[2]->min[k], f[3]->min[k]);
+		const __m128 hi = _mm_setr_ps(f[0]->max[k], f[1]->max[k], f[2]->max[k], f[3]->max[k]);
+		const __m128 inv = _mm_div_ps(one, *dirk[k]);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(lo, *origk[k]), inv);
+		const __m128 t2 = _mm_mul_ps(_mm_sub_ps(hi, *origk[k]), inv);
+		tnear = _mm_max_ps(_mm_min_ps(t1, t2), tnear);
+		tfar = _mm_min_ps(_mm_max_ps(t1, t2), tfar);
+	}
+	__m128 active = _mm_cmple_ps(tnear, tfar);
+
+	const int COLLISION_QUAD_DIVS = 6;
+	const __m128 areacut = _mm_set1_ps(0.5f * 0.5f);
+	__m128 su = zero;
+	__m128 sv = zero;
+	__m128 umin = zero;
+	__m128 umax = one;
+	__m128 vmin = zero;
+	__m128 vmax = one;
+	for (int i = 0; i < COLLISION_QUAD_DIVS && _mm_movemask_ps(active); i++)
+	{
+		const __m128 tu0 = _mm_max_ps(umin, zero);
+		const __m128 tu1 = _mm_min_ps(umax, one);
+		const __m128 tv0 = _mm_max_ps(vmin, zero);
+		const __m128 tv1 = _mm_min_ps(vmax, one);
+		const Vec3x4 ul = form.SurfCoord(tu0, tv0);
+		const Vec3x4 ur = form.SurfCoord(tu1, tv0);
+		const Vec3x4 br = form.SurfCoord(tu1, tv1);
+		const Vec3x4 bl = form.SurfCoord(tu0, tv1);
+
+		__m128 u, v;
+		active = _mm_and_ps(active, IntersectQuadrilateral(orig, dir, ul, ur, br, bl, u, v));
+
+		su = MulAdd(u, _mm_sub_ps(tu1, tu0), tu0);
+		sv = MulAdd(v, _mm_sub_ps(tv1, tv0), tv0);
+		vmax = MulAdd(areacut, _mm_sub_ps(vmax, vmin), sv);
+		vmin = _mm_sub_ps(sv, _mm_mul_ps(areacut, _mm_sub_ps(vmax, vmin)));
+		umax = MulAdd(areacut, _mm_sub_ps(umax, umin), su);
+		umin = _mm_sub_ps(su, _mm_mul_ps(areacut, _mm_sub_ps(umax, umin)));
+	}
+
+	float pu[4], pv[4];
+	_mm_storeu_ps(pu, su);
+	_mm_storeu_ps(pv, sv);
+	const unsigned hits = _mm_movemask_ps(active) & ((1 << count) - 1);
+	for (int i = 0; i < count; ++i)
+	{
+		if (hits & (1 << i))
+		{
+			outtri[i] = forms[i]->SurfCoord(pu[i], pv[i]);
+			normal[i] = forms[i]->SurfNorm(pu[i], pv[i]);
+		}
+		else
+		{
+			outtri[i] = origins[i];
+		}
+	}
+	return hits;
+}
+#else
+unsigned BezierPowerForm::Collide4(
+	const BezierPowerForm * const forms[],
+	const Vec3 origins[],
+	const Vec3 directions[],
+	int count,
+	Vec3 outtri[],
+	Vec3 normal[])
+{
+	unsigned hits = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		if (forms[i]->Collide(origins[i], directions[i], outtri[i], normal[i]))
+			hits |= 1 << i;
+	}
+	return hits;
+}
+#endif
+
 QT_TEST(bezier_test)
 {
 	Vec3 p[4], l[4], r[4];
@@ -791,3 +1308,46 @@ QT_TEST(bezier_test)
 	b.SetFromCorners(Vec3(1,0,1),Vec3(-1,0,1),Vec3(1,0,-1),Vec3(-1,0,-1));
 	QT_CHECK(!b.CheckForProblems());
 }
+
+QT_TEST(bezier_power_form_test)
+{
+	// curved patch, rays spread over and beyond it
+	Bezier b;
+	std::stringstream points;
+	for (int x = 0; x < 4; ++x)
+		for (int y = 0; y < 4; ++y)
+			points << 100 + x * 4 << " " << -50 + y * 3 + 0.3 * x << " " << 0.5 * x * y - 0.2 * y * y << " ";
+	b.ReadFrom(points);
+
+	BezierPowerForm f;
+	f.Set(b);
+	QT_CHECK_CLOSE((f.SurfCoord(0.3, 0.7) - b.SurfCoord(0.3, 0.7)).Magnitude(), 0, 1E-4);
+	QT_CHECK_CLOSE((f.SurfNorm(0.3, 0.7) - b.SurfNorm(0.3, 0.7)).Magnitude(), 0, 1E-4);
+
+	const int n = 11;
+	const BezierPowerForm * forms[n];
+	Vec3 origins[n], directions[n], points_ref[n], normals_ref[n], points_out[n], normals_out[n];
+	unsigned hits_ref = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		Vec3 target = b.SurfCoord(-0.1 + 1.2 * i / (n - 1), 0.1 + 0.08 * i);
+		forms[i] = &f;
+		directions[i] = Vec3(0.05 * i - 0.2, 0.1, -1).Normalize();
+		origins[i] = target - directions[i] * 2;
+		if (b.CollideSubDivQuadSimpleNorm(origins[i], directions[i], points_ref[i], normals_ref[i]))
+			hits_ref |= 1 << i;
+	}
+
+	unsigned hits = BezierPowerForm::Collide(forms, origins, directions, n, points_out, normals_out);
+	QT_CHECK_EQUAL(hits, hits_ref);
+	for (int i = 0; i < n; ++i)
+	{
+		Vec3 p, nrm;
+		QT_CHECK_EQUAL(f.Collide(origins[i], directions[i], p, nrm), bool(hits_ref & (1 << i)));
+		if (!(hits_ref & (1 << i)))
+			continue;
+		QT_CHECK_CLOSE((p - points_ref[i]).Magnitude(), 0, 1E-3);
+		QT_CHECK_CLOSE((points_out[i] - points_ref[i]).Magnitude(), 0, 1E-3);
+		QT_CHECK_CLOSE((normals_out[i] - normals_ref[i]).Magnitude(), 0, 1E-3);
+	}
+}
@@ -27,11 +27,15 @@
 
 class Track;
 class RoadPatch;
+class RoadStrip;
+class BezierPowerForm;
 
 class Bezier
 {
 friend class Track;
 friend class RoadPatch;
+friend class RoadStrip;
+friend class BezierPowerForm;
 
 public:
 	Bezier();
@@ -70,6 +74,11 @@ public:
 	void ReadFromYZX(std::istream & openfile);
 	void WriteTo(std::ostream & openfile) const;
 
+	///read/write IO operations (native binary format, used by the track cache)
+	///all state except the next patch link is stored
+	void ReadBinary(std::istream & openfile);
+	void WriteBinary(std::ostream & openfile) const;
+
 	///flip points on both axes
 	void Reverse();
 
@@ -139,14 +148,14 @@ private:
 
 	///return true if the ray at orig with direction dir intersects the given quadrilateral.
 	/// also put the collision depth in t and the collision coordinates in u,v
-	bool IntersectQuadrilateralF(
+	static bool IntersectQuadrilateralF(
 		const Vec3 & orig,
 		const Vec3 & dir,
 		const Vec3 & v_00,
 		const Vec3 & v_10,
 		const Vec3 & v_11,
 		const Vec3 & v_01,
-		float &t, float &u, float &v) const;
+		float &t, float &u, float &v);
 
 	Vec3 points[4][4];
 	Vec3 center;
@@ -164,4 +173,52 @@ private:
 
 std::ostream & operator << (std::ostream &os, const Bezier & b);
 
+///power basis form of a bezier patch, coefficients are relative to the patch center.
+/// precomputed for the ray intersection, which runs the CollideSubDivQuadSimpleNorm
+/// subdivision on up to four ray/patch pairs at once with SSE
+class BezierPowerForm
+{
+public:
+	BezierPowerForm();
+
+	///precompute the power basis and bounds of the bezier, call again after modifying it
+	void Set(const Bezier & bezier);
+
+	///return the 3D point on the surface at the given normalized coordinates px and py
+	Vec3 SurfCoord(float px, float py) const;
+
+	///return the normal of the surface at the given normalized coordinates px and py
+	Vec3 SurfNorm(float px, float py) const;
+
+	///same as Bezier::CollideSubDivQuadSimpleNorm
+	bool Collide(const Vec3 & origin, const Vec3 & direction, Vec3 & outtri, Vec3 & normal) const;
+
+	///intersect ray i with form i for i < count, count <= 32.
+	/// returns a bit per ray, set if it hit its form, output like Collide
+	static unsigned Collide(
+		const BezierPowerForm * const forms[],
+		const Vec3 origins[],
+		const Vec3 directions[],
+		int count,
+		Vec3 outtri[],
+		Vec3 normal[]);
+
+private:
+	///coefficient of u^i v^j is c[axis][4 * j + i]
+	float c[3][16];
+	Vec3 center;
+	Vec3 min;
+	Vec3 max;
+
+	Vec3 LocalCoord(float px, float py) const;
+
+	static unsigned Collide4(
+		const BezierPowerForm * const forms[],
+		const Vec3 origins[],
+		const Vec3 directions[],
+		int count,
+		Vec3 outtri[],
+		Vec3 normal[]);
+};
+
 #endif
@@ -370,18 +370,35 @@ void CarGraphics::Update(const std::vector<float> & inputs)
 }
 
 void CarGraphics::Update(const CarDynamics & dynamics)
+{
+	State state;
+	GetState(dynamics, state);
+	Update(state);
+}
+
+void CarGraphics::GetState(const CarDynamics & dynamics, State & state) const
+{
+	state.bodies.resize(dynamics.GetNumBodies());
+	for (unsigned i = 0; i < state.bodies.size(); ++i)
+	{
+		state.bodies[i].SetTranslation(ToMathVector<float>(dynamics.GetPosition(i)));
+		state.bodies[i].SetRotation(ToQuaternion<float>(dynamics.GetOrientation(i)));
+	}
+	state.steer_rotation = steer_rotation;
+	state.brakes = applied_brakes;
+	state.reverse = dynamics.GetTransmission().GetGear() < 0;
+}
+
+void CarGraphics::Update(const State & state)
 {
 	if (!bodynode.valid()) return;
-	assert(dynamics.GetNumBodies() == topnode.GetNodeList().size());
+	assert(state.bodies.size() == topnode.GetNodeList().size());
 
 	unsigned i = 0;
 	SceneNode::List & childlist = topnode.GetNodeList();
 	for (SceneNode::List::iterator ni = childlist.begin(); ni != childlist.end(); ++ni, ++i)
 	{
-		Vec3 pos = ToMathVector<float>(dynamics.GetPosition(i));
-		Quat rot = ToQuaternion<float>(dynamics.GetOrientation(i));
-		ni->GetTransform().SetTranslation(pos);
-		ni->GetTransform().SetRotation(rot);
+		ni->GetTransform() = state.bodies[i];
 	}
 
 	// brake/reverse lights
@@ -390,24 +407,24 @@ void CarGraphics::Update(const CarDynamics & dynamics)
 	{
 		SceneNode & node = bodynoderef.GetNode(i->node);
 		Drawable & draw = node.GetDrawList().lights_omni.get(i->draw);
-		draw.SetDrawEnable(applied_brakes > 0);
+		draw.SetDrawEnable(state.brakes > 0);
 	}
 	if (brakelights.valid())
 	{
 		Drawable & draw = bodynoderef.GetDrawList().lights_emissive.get(brakelights);
-		draw.SetDrawEnable(applied_brakes > 0);
+		draw.SetDrawEnable(state.brakes > 0);
 	}
 	if (reverselights.valid())
 	{
 		Drawable & draw = bodynoderef.GetDrawList().lights_emissive.get(reverselights);
-		draw.SetDrawEnable(dynamics.GetTransmission().GetGear() < 0);
+		draw.SetDrawEnable(state.reverse);
 	}
 
 	// steering
 	if (steernode.valid())
 	{
 		SceneNode & steernoderef = bodynoderef.GetNode(steernode);
-		steernoderef.GetTransform().SetRotation(steer_rotation);
+		steernoderef.GetTransform().SetRotation(state.steer_rotation);
 	}
 }
 
@@ -23,12 +23,14 @@
 #include "graphics/scenenode.h"
 #include "mathvector.h"
 #include "quaternion.h"
+#include "transform.h"
 
 #include <memory>
 #include <iosfwd>
 #include <string>
 #include <list>
 #include <set>
+#include <vector>
 
 class Camera;
 class Texture;
@@ -40,6 +42,15 @@ class ContentManager;
 class CarGraphics
 {
 public:
+	/// car state the scene graph update depends on
+	struct State
+	{
+		std::vector<Transform> bodies;
+		Quat steer_rotation;
+		float brakes;
+		bool reverse;
+	};
+
 	CarGraphics();
 
 	CarGraphics(const CarGraphics & other);
@@ -66,6 +77,12 @@ public:
 	/// update graphics from car dynamics state
 	void Update(const CarDynamics & dynamics);
 
+	/// capture the state needed by Update, does not touch the scene graph
+	void GetState(const CarDynamics & dynamics, State & state) const;
+
+	/// update graphics from a captured state
+	void Update(const State & state);
+
 	void SetColor(float r, float g, float b);
 
 	void EnableInteriorView(bool value);
@@ -18,19 +18,266 @@
 /************************************************************************/
 
 #include "contentmanager.h"
+#include "graphics/texture.h"
+#include "unittest.h"
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_timer.h>
+#include <cassert>
+
+ContentManager::Request::Request(int priority) :
+	priority(priority)
+{
+	SDL_AtomicSet(&state, QUEUED);
+}
+
+ContentManager::Request::~Request()
+{
+	// dtor
+}
+
+ContentManager::Request::State ContentManager::Request::getState() const
+{
+	return State(SDL_AtomicGet(&state));
+}
 
 ContentManager::ContentManager(std::ostream & error) :
-	error(error)
+	error(error),
+	mutex(SDL_CreateMutex()),
+	work_available(SDL_CreateCond()),
+	work_done(SDL_CreateCond()),
+	quit(false)
 {
 	// ctor
 }
 
 ContentManager::~ContentManager()
 {
+	deinitAsync();
+	SDL_DestroyCond(work_done);
+	SDL_DestroyCond(work_available);
+	SDL_DestroyMutex(mutex);
 	sweep();
 	_logleaks();
 }
 
+void ContentManager::initAsync(unsigned thread_count)
+{
+	assert(threads.empty());
+	quit = false;
+	for (unsigned i = 0; i < thread_count; ++i)
+	{
+		SDL_Thread * thread = SDL_CreateThread(LoaderThread, "ContentLoader", this);
+		if (!thread)
+		{
+			error << "Failed to create content loader thread: " << SDL_GetError() << std::endl;
+			break;
+		}
+		threads.push_back(thread);
+	}
+}
+
+void ContentManager::deinitAsync()
+{
+	SDL_LockMutex(mutex);
+	quit = true;
+	for (RequestQueue::iterator i = queue.begin(); i != queue.end(); ++i)
+	{
+		SDL_AtomicSet(&i->second->state, Request::CANCELED);
+		pending.erase(i->second->key);
+	}
+	queue.clear();
+	SDL_CondBroadcast(work_available);
+	SDL_UnlockMutex(mutex);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		SDL_WaitThread(threads[i], 0);
+	}
+	threads.clear();
+
+	// requests already decoded still go into the cache
+	update();
+}
+
+bool ContentManager::cancel(const RequestPtr & request)
+{
+	SDL_LockMutex(mutex);
+	bool canceled = SDL_AtomicCAS(&request->state, Request::QUEUED, Request::CANCELED);
+	if (canceled)
+	{
+		_dequeue(request);
+		pending.erase(request->key);
+	}
+	SDL_UnlockMutex(mutex);
+	return canceled;
+}
+
+void ContentManager::update()
+{
+	// no loader threads, load queued requests here
+	if (threads.empty())
+	{
+		while (!queue.empty())
+		{
+			RequestPtr request = queue.begin()->second;
+			queue.erase(queue.begin());
+			SDL_AtomicSet(&request->state, Request::LOADING);
+			request->decode();
+			SDL_AtomicSet(&request->state, Request::DECODED);
+			decoded.push_back(request);
+		}
+	}
+
+	std::vector<RequestPtr> completed;
+	SDL_LockMutex(mutex);
+	completed.swap(decoded);
+	SDL_UnlockMutex(mutex);
+
+	for (size_t i = 0; i < completed.size(); ++i)
+	{
+		// may have been completed by load already
+		if (completed[i]->getState() == Request::DECODED)
+			_complete(completed[i]);
+	}
+}
+
+int ContentManager::LoaderThread(void * data)
+{
+	ContentManager & content = *static_cast<ContentManager *>(data);
+	SDL_LockMutex(content.mutex);
+	while (true)
+	{
+		while (!content.quit && content.queue.empty())
+			SDL_CondWait(content.work_available, content.mutex);
+
+		if (content.quit)
+			break;
+
+		RequestPtr request = content.queue.begin()->second;
+		content.queue.erase(content.queue.begin());
+		SDL_AtomicSet(&request->state, Request::LOADING);
+		SDL_UnlockMutex(content.mutex);
+
+		request->decode();
+
+		SDL_LockMutex(content.mutex);
+		SDL_AtomicSet(&request->state, Request::DECODED);
+		content.decoded.push_back(request);
+		SDL_CondBroadcast(content.work_done);
+	}
+	SDL_UnlockMutex(content.mutex);
+	return 0;
+}
+
+void ContentManager::_queue(const RequestPtr & request)
+{
+	SDL_LockMutex(mutex);
+	pending[request->key] = request;
+	queue.insert(std::make_pair(request->priority, request));
+	SDL_CondSignal(work_available);
+	SDL_UnlockMutex(mutex);
+}
+
+void ContentManager::_dequeue(const RequestPtr & request)
+{
+	typedef RequestQueue::iterator Iter;
+	std::pair<Iter, Iter> range = queue.equal_range(request->priority);
+	for (Iter i = range.first; i != range.second; ++i)
+	{
+		if (i->second == request)
+		{
+			queue.erase(i);
+			return;
+		}
+	}
+}
+
+void ContentManager::_complete(const RequestPtr & request)
+{
+	SDL_LockMutex(mutex);
+	pending.erase(request->key);
+	SDL_UnlockMutex(mutex);
+
+	request->finish(*this);
+	SDL_AtomicSet(&request->state, Request::DONE);
+}
+
+bool ContentManager::_haspending()
+{
+	SDL_LockMutex(mutex);
+	bool haspending = !pending.empty();
+	SDL_UnlockMutex(mutex);
+	return haspending;
+}
+
+ContentManager::RequestPtr ContentManager::_getpending(const PendingKey & key)
+{
+	RequestPtr request;
+	SDL_LockMutex(mutex);
+	std::map<PendingKey, RequestPtr>::const_iterator i = pending.find(key);
+	if (i != pending.end())
+		request = i->second;
+	SDL_UnlockMutex(mutex);
+	return request;
+}
+
+void ContentManager::_wait(const void * cache, const std::string & name)
+{
+	SDL_LockMutex(mutex);
+	std::map<PendingKey, RequestPtr>::iterator i = pending.find(PendingKey(cache, name));
+	if (i == pending.end())
+	{
+		SDL_UnlockMutex(mutex);
+		return;
+	}
+	RequestPtr request = i->second;
+
+	// not started yet, load it here
+	if (SDL_AtomicCAS(&request->state, Request::QUEUED, Request::LOADING))
+	{
+		_dequeue(request);
+		SDL_UnlockMutex(mutex);
+		request->decode();
+		SDL_AtomicSet(&request->state, Request::DECODED);
+		_complete(request);
+		return;
+	}
+
+	while (request->getState() == Request::LOADING)
+		SDL_CondWait(work_done, mutex);
+	SDL_UnlockMutex(mutex);
+
+	if (request->getState() == Request::DECODED)
+		_complete(request);
+}
+
+bool ContentManager::_decode(
+	Factory<Texture> & /*factory*/,
+	std::shared_ptr<Texture> & /*sptr*/,
+	std::ostream & error,
+	const std::string & basepath,
+	const std::string & path,
+	const std::string & name,
+	TextureInfo & param,
+	std::vector<unsigned char> & buffer)
+{
+	const std::string abspath = basepath + "/" + path + "/" + name;
+	return Texture::Decode(abspath, param, buffer, error);
+}
+
+bool ContentManager::_finish(
+	Factory<Texture> & factory,
+	std::shared_ptr<Texture> & sptr,
+	std::ostream & error,
+	const std::string & basepath,
+	const std::string & path,
+	const std::string & name,
+	TextureInfo & param)
+{
+	return factory.create(sptr, error, basepath, path, name, param);
+}
+
 void ContentManager::addSharedPath(const std::string & path)
 {
 	sharedpaths.push_back(path);
@@ -85,3 +332,141 @@ bool ContentManager::_logerror(
 	error << std::endl;
 	return false;
 }
+
+// trivial content type for the async tests
+struct AsyncTestContent
+{
+	std::string name;
+};
+
+// creation of "held" blocks while held is set
+template <>
+class Factory<AsyncTestContent>
+{
+public:
+	struct empty {};
+
+	Factory() : m_default(new AsyncTestContent())
+	{
+		SDL_AtomicSet(&held, 0);
+		SDL_AtomicSet(&created, 0);
+	}
+
+	template <class P>
+	bool create(
+		std::shared_ptr<AsyncTestContent> & sptr,
+		std::ostream & /*error*/,
+		const std::string & /*basepath*/,
+		const std::string & path,
+		const std::string & name,
+		const P & /*param*/)
+	{
+		SDL_AtomicAdd(&created, 1);
+		while (name == "held" && SDL_AtomicGet(&held))
+			SDL_Delay(1);
+		sptr.reset(new AsyncTestContent());
+		sptr->name = path + name;
+		return true;
+	}
+
+	const std::shared_ptr<AsyncTestContent> & getDefault() const
+	{
+		return m_default;
+	}
+
+	SDL_atomic_t held;
+	SDL_atomic_t created;
+
+private:
+	std::shared_ptr<AsyncTestContent> m_default;
+};
+
+static void WaitForState(
+	const ContentManager::RequestPtr & request,
+	ContentManager::Request::State state)
+{
+	while (request->getState() < state)
+		SDL_Delay(1);
+}
+
+QT_TEST(contentmanager_async_test)
+{
+	typedef ContentManager::Request Request;
+	typedef ContentManager::RequestPtr RequestPtr;
+
+	std::ostringstream error;
+	ContentManager content(error);
+	content.addPath("data");
+	Factory<AsyncTestContent> & factory = content.getFactory<AsyncTestContent>();
+	std::shared_ptr<AsyncTestContent> sptr;
+
+	// without loader threads requests are loaded by update
+	RequestPtr a = content.loadAsync<AsyncTestContent>("path/", "a");
+	QT_CHECK_EQUAL(a->getState(), Request::QUEUED);
+	QT_CHECK(!content.get(sptr, "path/", "a"));
+	content.update();
+	QT_CHECK_EQUAL(a->getState(), Request::DONE);
+	QT_CHECK(content.get(sptr, "path/", "a"));
+	QT_CHECK(sptr && sptr->name == "path/a");
+	QT_CHECK(content.loadAsync<AsyncTestContent>("path/", "a")->done());
+	QT_CHECK(!content.cancel(a));
+
+	// pending request is shared, load takes it over
+	RequestPtr b = content.loadAsync<AsyncTestContent>("path/", "b");
+	QT_CHECK(content.loadAsync<AsyncTestContent>("path/", "b") == b);
+	QT_CHECK(content.load(sptr, "path/", "b"));
+	QT_CHECK_EQUAL(b->getState(), Request::DONE);
+	QT_CHECK(sptr && sptr->name == "path/b");
+	content.update();
+	QT_CHECK_EQUAL(SDL_AtomicGet(&factory.created), 2);
+
+	// canceled before decode starts
+	RequestPtr c = content.loadAsync<AsyncTestContent>("path/", "c");
+	QT_CHECK(content.cancel(c));
+	QT_CHECK_EQUAL(c->getState(), Request::CANCELED);
+	content.update();
+	QT_CHECK(!content.get(sptr, "path/", "c"));
+	QT_CHECK_EQUAL(SDL_AtomicGet(&factory.created), 2);
+}
+
+QT_TEST(contentmanager_async_thread_test)
+{
+	typedef ContentManager::Request Request;
+	typedef ContentManager::RequestPtr RequestPtr;
+
+	std::ostringstream error;
+	ContentManager content(error);
+	content.addPath("data");
+	content.initAsync(1);
+	Factory<AsyncTestContent> & factory = content.getFactory<AsyncTestContent>();
+	std::shared_ptr<AsyncTestContent> sptr;
+
+	// keep the loader thread busy, too late to cancel
+	SDL_AtomicSet(&factory.held, 1);
+	RequestPtr held = content.loadAsync<AsyncTestContent>("path/", "held");
+	WaitForState(held, Request::LOADING);
+	QT_CHECK(!content.cancel(held));
+
+	// queued behind it, load takes it over
+	RequestPtr a = content.loadAsync<AsyncTestContent>("path/", "a", 1);
+	RequestPtr b = content.loadAsync<AsyncTestContent>("path/", "b");
+	QT_CHECK_EQUAL(a->getState(), Request::QUEUED);
+	QT_CHECK(content.load(sptr, "path/", "a"));
+	QT_CHECK_EQUAL(a->getState(), Request::DONE);
+	QT_CHECK(sptr && sptr->name == "path/a");
+
+	// canceled before decode starts
+	QT_CHECK(content.cancel(b));
+	QT_CHECK_EQUAL(b->getState(), Request::CANCELED);
+
+	// update moves the decoded request into the cache
+	SDL_AtomicSet(&factory.held, 0);
+	WaitForState(held, Request::DECODED);
+	QT_CHECK(!content.get(sptr, "path/", "held"));
+	content.update();
+	QT_CHECK_EQUAL(held->getState(), Request::DONE);
+	QT_CHECK(content.get(sptr, "path/", "held"));
+	QT_CHECK(sptr && sptr->name == "path/held");
+	QT_CHECK(!content.get(sptr, "path/", "b"));
+	QT_CHECK_EQUAL(SDL_AtomicGet(&factory.created), 2);
+}
@@ -24,12 +24,59 @@
 #include "texturefactory.h"
 #include "modelfactory.h"
 #include "configfactory.h"
+#include <SDL2/SDL_atomic.h>
+#include <cassert>
+#include <functional>
+#include <sstream>
 #include <vector>
 #include <map>
 
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
 class ContentManager
 {
 public:
+	/// background load request, see loadAsync
+	class Request
+	{
+	public:
+		enum State
+		{
+			QUEUED,		///< waiting for a loader thread
+			LOADING,	///< read and decoded by a loader thread
+			DECODED,	///< waiting for update to move it into the cache
+			DONE,		///< content is in the cache (or failed to load)
+			CANCELED	///< dropped before loading started
+		};
+
+		Request(int priority);
+
+		virtual ~Request();
+
+		State getState() const;
+
+		bool done() const { return getState() >= DONE; }
+
+		int getPriority() const { return priority; }
+
+	private:
+		friend class ContentManager;
+
+		/// read and decode, runs on a loader thread
+		virtual void decode() = 0;
+
+		/// cache decoded content, runs on the thread calling update
+		virtual void finish(ContentManager & content) = 0;
+
+		std::pair<const void *, std::string> key;
+		std::ostringstream error;
+		int priority;
+		mutable SDL_atomic_t state;
+	};
+	typedef std::shared_ptr<Request> RequestPtr;
+
 	ContentManager(std::ostream & error);
 
 	~ContentManager();
@@ -56,6 +103,43 @@ public:
 		const std::string & name,
 		const P & param);
 
+	/// put shared object into cache, loaded elsewhere (e.g. on a worker thread)
+	template <class T>
+	void set(
+		const std::shared_ptr<T> & sptr,
+		const std::string & path,
+		const std::string & name);
+
+	/// start background loader threads, without them requests are loaded by update
+	void initAsync(unsigned thread_count);
+
+	/// drop queued requests and stop the loader threads
+	void deinitAsync();
+
+	/// queue a load on the loader threads, higher priority requests are loaded first
+	/// update moves the loaded content into the cache, load returns it from there
+	/// load of content with a pending request completes that request instead
+	/// like the cache, requests are keyed by path and name only: a request for content
+	/// already pending returns the pending request, loaded with the param it was queued with
+	template <class T>
+	RequestPtr loadAsync(
+		const std::string & path,
+		const std::string & name,
+		int priority = 0);
+
+	template <class T, class P>
+	RequestPtr loadAsync(
+		const std::string & path,
+		const std::string & name,
+		const P & param,
+		int priority = 0);
+
+	/// drop a request that has not started loading yet, returns false if too late
+	bool cancel(const RequestPtr & request);
+
+	/// cache loaded requests, call regularly from the thread using the content
+	void update();
+
 	/// add shared content directory path
 	void addSharedPath(const std::string & path);
 
@@ -72,6 +156,7 @@ public:
 private:
 	struct Cache
 	{
+		virtual ~Cache() {}
 		virtual void log(std::ostream & log) const = 0;
 		virtual size_t size() const = 0;
 		virtual void sweep() = 0;
@@ -112,6 +197,39 @@ private:
 			#undef INIT
 		}
 
+		/// other content types are registered on first use, not thread safe
+		template <class T>
+		struct Extra : public CacheShared<T>
+		{
+			Factory<T> factory;
+		};
+		std::map<const void *, Cache*> m_extra;
+
+		template <class T>
+		Extra<T> & getExtra()
+		{
+			static const char type_id = 0;
+			Cache * & cache = m_extra[&type_id];
+			if (!cache)
+			{
+				cache = new Extra<T>();
+				m_caches.push_back(cache);
+			}
+			return static_cast<Extra<T> &>(*cache);
+		}
+
+		template <class T>
+		operator Factory<T>&() {return getExtra<T>().factory;}
+
+		template <class T>
+		operator CacheShared<T>&() {return getExtra<T>();}
+
+		~FactoryCached()
+		{
+			for (std::map<const void *, Cache*>::iterator i = m_extra.begin(); i != m_extra.end(); ++i)
+				delete i->second;
+		}
+
 	} factory_cached;
 
 	/// content paths
@@ -121,6 +239,93 @@ private:
 	/// error log
 	std::ostream & error;
 
+	/// background loading
+	typedef std::pair<const void *, std::string> PendingKey;
+	std::map<PendingKey, RequestPtr> pending;
+	typedef std::multimap<int, RequestPtr, std::greater<int> > RequestQueue;
+	RequestQueue queue;
+	std::vector<RequestPtr> decoded;
+	std::vector<SDL_Thread *> threads;
+	SDL_mutex * mutex;
+	SDL_cond * work_available;
+	SDL_cond * work_done;
+	bool quit;
+
+	template <class T, class P>
+	class AsyncRequest;
+
+	static int LoaderThread(void * data);
+
+	void _queue(const RequestPtr & request);
+
+	void _dequeue(const RequestPtr & request);
+
+	void _complete(const RequestPtr & request);
+
+	/// pending requests are read under the mutex
+	bool _haspending();
+
+	/// pending request of the key, null if there is none
+	RequestPtr _getpending(const PendingKey & key);
+
+	/// complete pending request of the given cache entry
+	void _wait(const void * cache, const std::string & name);
+
+	/// loader thread part of a load, the factory has to be thread safe
+	template <class T, class P>
+	static bool _decode(
+		Factory<T> & factory,
+		std::shared_ptr<T> & sptr,
+		std::ostream & error,
+		const std::string & basepath,
+		const std::string & path,
+		const std::string & name,
+		P & param,
+		std::vector<unsigned char> & buffer);
+
+	/// configs resolve includes through the content manager, not thread safe
+	template <class P>
+	static bool _decode(
+		Factory<PTree> & factory,
+		std::shared_ptr<PTree> & sptr,
+		std::ostream & error,
+		const std::string & basepath,
+		const std::string & path,
+		const std::string & name,
+		P & param,
+		std::vector<unsigned char> & buffer);
+
+	/// textures are decoded into buffer, uploaded by _finish
+	static bool _decode(
+		Factory<Texture> & factory,
+		std::shared_ptr<Texture> & sptr,
+		std::ostream & error,
+		const std::string & basepath,
+		const std::string & path,
+		const std::string & name,
+		TextureInfo & param,
+		std::vector<unsigned char> & buffer);
+
+	/// main thread part of a load
+	template <class T, class P>
+	static bool _finish(
+		Factory<T> & factory,
+		std::shared_ptr<T> & sptr,
+		std::ostream & error,
+		const std::string & basepath,
+		const std::string & path,
+		const std::string & name,
+		P & param);
+
+	static bool _finish(
+		Factory<Texture> & factory,
+		std::shared_ptr<Texture> & sptr,
+		std::ostream & error,
+		const std::string & basepath,
+		const std::string & path,
+		const std::string & name,
+		TextureInfo & param);
+
 	/// content leak logger
 	bool _logleaks();
 
@@ -177,6 +382,13 @@ inline bool ContentManager::load(
 	const std::string & name,
 	const P & param)
 {
+	// finish a background load of the same content first
+	if (_haspending())
+	{
+		CacheShared<T> & cache = factory_cached;
+		_wait(&cache, path + name);
+	}
+
 	// check for the specialised version in basepaths
 	// fall back to the generic one in shared paths
 	return 	_load(sptr, basepaths, path, name, param) ||
@@ -185,6 +397,175 @@ inline bool ContentManager::load(
 			_logerror(path, name);
 }
 
+template <class T, class P>
+class ContentManager::AsyncRequest : public ContentManager::Request
+{
+public:
+	AsyncRequest(
+		ContentManager & content,
+		const std::string & path,
+		const std::string & name,
+		const P & param,
+		int priority) :
+		Request(priority),
+		factory(content.getFactory<T>()),
+		basepaths(content.basepaths),
+		sharedpaths(content.sharedpaths),
+		path(path),
+		name(name),
+		param(param),
+		found(false)
+	{
+		// ctor
+	}
+
+private:
+	Factory<T> & factory;
+	std::vector<std::string> basepaths;
+	std::vector<std::string> sharedpaths;
+	std::string path;
+	std::string name;
+	std::string basepath;
+	std::string cachepath;
+	P param;
+	std::vector<unsigned char> buffer;
+	std::shared_ptr<T> sptr;
+	bool found;
+
+	void decode()
+	{
+		// same lookup order as load
+		for (size_t i = 0; i < basepaths.size() && !found; ++i)
+		{
+			if (_decode(factory, sptr, error, basepaths[i], path, name, param, buffer))
+			{
+				basepath = basepaths[i];
+				cachepath = path;
+				found = true;
+			}
+		}
+		for (size_t i = 0; i < sharedpaths.size() && !found; ++i)
+		{
+			if (_decode(factory, sptr, error, sharedpaths[i], "", name, param, buffer))
+			{
+				basepath = sharedpaths[i];
+				cachepath = "";
+				found = true;
+			}
+		}
+	}
+
+	void finish(ContentManager & content)
+	{
+		if (found && _finish(factory, sptr, error, basepath, cachepath, name, param) && sptr)
+		{
+			content.error << error.str();
+			content.set(sptr, cachepath, name);
+		}
+		else
+		{
+			// synchronous load reports the errors
+			std::shared_ptr<T> temp;
+			content.load(temp, path, name, param);
+		}
+		sptr.reset();
+		buffer.clear();
+	}
+};
+
+template <class T>
+inline ContentManager::RequestPtr ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	int priority)
+{
+	return loadAsync<T>(path, name, typename Factory<T>::empty(), priority);
+}
+
+template <class T, class P>
+inline ContentManager::RequestPtr ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	const P & param,
+	int priority)
+{
+	CacheShared<T> & cache = factory_cached;
+	const PendingKey key(&cache, path + name);
+
+	RequestPtr duplicate = _getpending(key);
+	if (duplicate)
+	{
+		// duplicates have to use the same param type
+		typedef AsyncRequest<T, P> RequestType;
+		assert(dynamic_cast<RequestType *>(duplicate.get()));
+		return duplicate;
+	}
+
+	RequestPtr request(new AsyncRequest<T, P>(*this, path, name, param, priority));
+	request->key = key;
+
+	std::shared_ptr<T> sptr;
+	if (_get(sptr, path + name) || _get(sptr, name))
+	{
+		SDL_AtomicSet(&request->state, Request::DONE);
+		return request;
+	}
+
+	_queue(request);
+	return request;
+}
+
+template <class T, class P>
+inline bool ContentManager::_decode(
+	Factory<T> & factory,
+	std::shared_ptr<T> & sptr,
+	std::ostream & error,
+	const std::string & basepath,
+	const std::string & path,
+	const std::string & name,
+	P & param,
+	std::vector<unsigned char> & /*buffer*/)
+{
+	return factory.create(sptr, error, basepath, path, name, param);
+}
+
+template <class P>
+inline bool ContentManager::_decode(
+	Factory<PTree> & /*factory*/,
+	std::shared_ptr<PTree> & /*sptr*/,
+	std::ostream & /*error*/,
+	const std::string & /*basepath*/,
+	const std::string & /*path*/,
+	const std::string & /*name*/,
+	P & /*param*/,
+	std::vector<unsigned char> & /*buffer*/)
+{
+	return false;
+}
+
+template <class T, class P>
+inline bool ContentManager::_finish(
+	Factory<T> & /*factory*/,
+	std::shared_ptr<T> & /*sptr*/,
+	std::ostream & /*error*/,
+	const std::string & /*basepath*/,
+	const std::string & /*path*/,
+	const std::string & /*name*/,
+	P & /*param*/)
+{
+	return true;
+}
+
+template <class T>
+inline void ContentManager::set(
+	const std::shared_ptr<T> & sptr,
+	const std::string & path,
+	const std::string & name)
+{
+	CacheShared<T> & cache = factory_cached;
+	cache[path + name] = sptr;
+}
+
 template <class T>
 inline bool ContentManager::_get(
 	std::shared_ptr<T> & sptr,
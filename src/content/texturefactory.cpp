@@ -27,7 +27,8 @@ Factory<Texture>::Factory() :
 	m_zero(new Texture()),
 	m_size(TextureInfo::LARGE),
 	m_compress(true),
-	m_srgb(false)
+	m_srgb(false),
+	m_headless(false)
 {
 	// ctor
 }
@@ -58,6 +59,11 @@ void Factory<Texture>::init(int max_size, bool use_srgb, bool compress)
 	m_zero->Load("", info, error);
 }
 
+void Factory<Texture>::initHeadless()
+{
+	m_headless = true;
+}
+
 template <>
 bool Factory<Texture>::create(
 	std::shared_ptr<Texture> & sptr,
@@ -67,6 +73,12 @@ bool Factory<Texture>::create(
 	const std::string & name,
 	const TextureInfo& info)
 {
+	if (m_headless)
+	{
+		sptr = m_default;
+		return true;
+	}
+
 	const std::string abspath = basepath + "/" + path + "/" + name;
 	if (info.data || std::ifstream(abspath.c_str()))
 	{
@@ -38,6 +38,10 @@ public:
 	/// limit texture size to max size
 	void init(int max_size, bool use_srgb, bool compress);
 
+	/// headless mode: skip image decoding and texture uploads, all requests
+	/// resolve to the (empty) default texture, no GL context required
+	void initHeadless();
+
 	template <class P>
 	bool create(
 		std::shared_ptr<Texture> & sptr,
@@ -59,6 +63,7 @@ private:
 	int m_size;
 	bool m_compress;
 	bool m_srgb;
+	bool m_headless;
 };
 
 #endif // _TEXTUREFACTORY_H
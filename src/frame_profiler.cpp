@@ -0,0 +1,487 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "frame_profiler.h"
+#include "unittest.h"
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_timer.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	struct Event
+	{
+		Uint64 begin;
+		Uint64 end;
+		unsigned int zone;
+	};
+
+	struct CounterEvent
+	{
+		Uint64 time;
+		unsigned int counter;
+		float value;
+	};
+
+	struct OpenZone
+	{
+		Uint64 begin;
+		unsigned int zone;
+	};
+
+	struct Total
+	{
+		Total() : calls(0), ticks(0) {}
+		unsigned long long calls;
+		Uint64 ticks;
+	};
+
+	/// Owned by one thread, read by the exporting thread under lock.
+	/// The open zone stack is only ever touched by the owner.
+	struct ThreadBuffer
+	{
+		std::string name;
+		std::vector<Event> events;
+		unsigned long long written;
+		std::vector<Total> totals;
+		std::vector<CounterEvent> counters;
+		unsigned long long counters_written;
+		std::vector<std::vector<float> > samples;
+		std::vector<OpenZone> stack;
+		SDL_SpinLock lock;
+	};
+
+	struct Registry
+	{
+		std::vector<const char *> zones;
+		std::vector<ThreadBuffer *> threads;
+		SDL_SpinLock lock;
+		SDL_TLSID tls;
+		Uint64 start;
+
+		Registry() : lock(0), tls(SDL_TLSCreate()), start(SDL_GetPerformanceCounter())
+		{
+			// keep zone 0 free, makes uninitialized ids stand out
+			zones.push_back("invalid");
+		}
+
+		~Registry()
+		{
+			for (size_t i = 0; i < threads.size(); ++i)
+				delete threads[i];
+		}
+	};
+
+	Registry & GetRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	ThreadBuffer & GetThreadBuffer()
+	{
+		Registry & registry = GetRegistry();
+		ThreadBuffer * buffer = (ThreadBuffer *)SDL_TLSGet(registry.tls);
+		if (!buffer)
+		{
+			buffer = new ThreadBuffer();
+			buffer->written = 0;
+			buffer->counters_written = 0;
+			buffer->stack.reserve(32);
+			buffer->lock = 0;
+
+			SDL_AtomicLock(&registry.lock);
+			std::ostringstream name;
+			name << "thread " << registry.threads.size();
+			buffer->name = name.str();
+			registry.threads.push_back(buffer);
+			SDL_AtomicUnlock(&registry.lock);
+
+			SDL_TLSSet(registry.tls, buffer, NULL);
+		}
+		return *buffer;
+	}
+
+	/// Copy of the recorded data, so the exporters don't block the profiled threads.
+	struct Snapshot
+	{
+		struct Thread
+		{
+			std::string name;
+			std::vector<Event> events;
+			std::vector<CounterEvent> counters;
+			std::vector<Total> totals;
+		};
+		std::vector<const char *> zones;
+		std::vector<Thread> threads;
+		Uint64 start;
+	};
+
+	void GetSnapshot(Snapshot & snapshot)
+	{
+		Registry & registry = GetRegistry();
+		SDL_AtomicLock(&registry.lock);
+		snapshot.zones = registry.zones;
+		snapshot.start = registry.start;
+		snapshot.threads.resize(registry.threads.size());
+		for (size_t i = 0; i < registry.threads.size(); ++i)
+		{
+			ThreadBuffer & buffer = *registry.threads[i];
+			Snapshot::Thread & thread = snapshot.threads[i];
+			SDL_AtomicLock(&buffer.lock);
+			thread.name = buffer.name;
+			thread.totals = buffer.totals;
+			const unsigned long long count = std::min<unsigned long long>(buffer.written, FrameProfiler::buffer_size);
+			thread.events.reserve(count);
+			for (unsigned long long n = buffer.written - count; n < buffer.written; ++n)
+				thread.events.push_back(buffer.events[n & (FrameProfiler::buffer_size - 1)]);
+			const unsigned long long counters = std::min<unsigned long long>(buffer.counters_written, FrameProfiler::buffer_size);
+			thread.counters.reserve(counters);
+			for (unsigned long long n = buffer.counters_written - counters; n < buffer.counters_written; ++n)
+				thread.counters.push_back(buffer.counters[n & (FrameProfiler::buffer_size - 1)]);
+			SDL_AtomicUnlock(&buffer.lock);
+		}
+		SDL_AtomicUnlock(&registry.lock);
+	}
+}
+
+bool FrameProfiler::enabled = false;
+bool FrameProfiler::keep_samples = false;
+
+unsigned int FrameProfiler::RegisterZone(const char * name)
+{
+	Registry & registry = GetRegistry();
+	SDL_AtomicLock(&registry.lock);
+	unsigned int zone = 1;
+	while (zone < registry.zones.size() && std::strcmp(registry.zones[zone], name) != 0)
+		++zone;
+	if (zone == registry.zones.size())
+		registry.zones.push_back(name);
+	SDL_AtomicUnlock(&registry.lock);
+	return zone;
+}
+
+void FrameProfiler::Enable(bool value)
+{
+	enabled = value;
+}
+
+void FrameProfiler::SetThreadName(const std::string & name)
+{
+	ThreadBuffer & buffer = GetThreadBuffer();
+	SDL_AtomicLock(&buffer.lock);
+	buffer.name = name;
+	SDL_AtomicUnlock(&buffer.lock);
+}
+
+void FrameProfiler::Begin(unsigned int zone)
+{
+	ThreadBuffer & buffer = GetThreadBuffer();
+	OpenZone open = {SDL_GetPerformanceCounter(), zone};
+	buffer.stack.push_back(open);
+}
+
+void FrameProfiler::End()
+{
+	const Uint64 end = SDL_GetPerformanceCounter();
+	ThreadBuffer & buffer = GetThreadBuffer();
+	assert(!buffer.stack.empty());
+	const OpenZone open = buffer.stack.back();
+	buffer.stack.pop_back();
+
+	SDL_AtomicLock(&buffer.lock);
+	if (buffer.events.empty())
+		buffer.events.resize(buffer_size);
+	Event & event = buffer.events[buffer.written & (buffer_size - 1)];
+	event.begin = open.begin;
+	event.end = end;
+	event.zone = open.zone;
+	buffer.written++;
+	if (open.zone >= buffer.totals.size())
+		buffer.totals.resize(open.zone + 1);
+	Total & total = buffer.totals[open.zone];
+	total.calls++;
+	total.ticks += end - open.begin;
+	if (keep_samples)
+	{
+		if (open.zone >= buffer.samples.size())
+			buffer.samples.resize(open.zone + 1);
+		buffer.samples[open.zone].push_back((end - open.begin) * 1E6f / SDL_GetPerformanceFrequency());
+	}
+	SDL_AtomicUnlock(&buffer.lock);
+}
+
+void FrameProfiler::SetCounter(unsigned int counter, float value)
+{
+	const Uint64 time = SDL_GetPerformanceCounter();
+	ThreadBuffer & buffer = GetThreadBuffer();
+	SDL_AtomicLock(&buffer.lock);
+	if (buffer.counters.empty())
+		buffer.counters.resize(buffer_size);
+	CounterEvent & event = buffer.counters[buffer.counters_written & (buffer_size - 1)];
+	event.time = time;
+	event.counter = counter;
+	event.value = value;
+	buffer.counters_written++;
+	SDL_AtomicUnlock(&buffer.lock);
+}
+
+void FrameProfiler::EnableSamples(bool value)
+{
+	keep_samples = value;
+}
+
+void FrameProfiler::Clear()
+{
+	Registry & registry = GetRegistry();
+	SDL_AtomicLock(&registry.lock);
+	for (size_t i = 0; i < registry.threads.size(); ++i)
+	{
+		ThreadBuffer & buffer = *registry.threads[i];
+		SDL_AtomicLock(&buffer.lock);
+		buffer.written = 0;
+		buffer.counters_written = 0;
+		buffer.totals.clear();
+		buffer.samples.clear();
+		SDL_AtomicUnlock(&buffer.lock);
+	}
+	registry.start = SDL_GetPerformanceCounter();
+	SDL_AtomicUnlock(&registry.lock);
+}
+
+void FrameProfiler::GetSamples(const std::string & name, std::vector<float> & samples)
+{
+	samples.clear();
+
+	Registry & registry = GetRegistry();
+	SDL_AtomicLock(&registry.lock);
+	unsigned int zone = 1;
+	while (zone < registry.zones.size() && name != registry.zones[zone])
+		++zone;
+	for (size_t i = 0; i < registry.threads.size() && zone < registry.zones.size(); ++i)
+	{
+		ThreadBuffer & buffer = *registry.threads[i];
+		SDL_AtomicLock(&buffer.lock);
+		if (zone < buffer.samples.size())
+			samples.insert(samples.end(), buffer.samples[zone].begin(), buffer.samples[zone].end());
+		SDL_AtomicUnlock(&buffer.lock);
+	}
+	SDL_AtomicUnlock(&registry.lock);
+}
+
+float FrameProfiler::GetPercentile(std::vector<float> & samples, float fraction)
+{
+	if (samples.empty())
+		return 0;
+
+	const float rank = std::ceil(fraction * samples.size());
+	const size_t n = std::min(std::max(rank, 1.0f), float(samples.size())) - 1;
+	std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+	return samples[n];
+}
+
+void FrameProfiler::GetSummary(std::ostream & out)
+{
+	Snapshot snapshot;
+	GetSnapshot(snapshot);
+
+	std::vector<Total> totals(snapshot.zones.size());
+	for (size_t i = 0; i < snapshot.threads.size(); ++i)
+	{
+		const std::vector<Total> & thread_totals = snapshot.threads[i].totals;
+		for (size_t zone = 0; zone < thread_totals.size(); ++zone)
+		{
+			totals[zone].calls += thread_totals[zone].calls;
+			totals[zone].ticks += thread_totals[zone].ticks;
+		}
+	}
+
+	// most expensive zones first
+	std::vector<std::pair<Uint64, unsigned int> > order;
+	for (unsigned int zone = 0; zone < totals.size(); ++zone)
+	{
+		if (totals[zone].calls)
+			order.push_back(std::make_pair(totals[zone].ticks, zone));
+	}
+	std::sort(order.rbegin(), order.rend());
+
+	const double us_per_tick = 1E6 / SDL_GetPerformanceFrequency();
+	const std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(1);
+	out << std::left << std::setw(20) << "zone" << std::right
+		<< std::setw(10) << "calls"
+		<< std::setw(12) << "total ms"
+		<< std::setw(10) << "avg us" << "\n";
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const Total & total = totals[order[i].second];
+		const double total_us = total.ticks * us_per_tick;
+		out << std::left << std::setw(20) << snapshot.zones[order[i].second] << std::right
+			<< std::setw(10) << total.calls
+			<< std::setw(12) << total_us * 1E-3
+			<< std::setw(10) << total_us / total.calls << "\n";
+	}
+
+	// last and maximum counter values, events are in time order per thread
+	std::vector<CounterEvent> last(snapshot.zones.size());
+	std::vector<float> max(snapshot.zones.size());
+	std::vector<bool> set(snapshot.zones.size(), false);
+	for (size_t i = 0; i < snapshot.threads.size(); ++i)
+	{
+		const std::vector<CounterEvent> & counters = snapshot.threads[i].counters;
+		for (size_t n = 0; n < counters.size(); ++n)
+		{
+			const CounterEvent & event = counters[n];
+			if (!set[event.counter] || event.time >= last[event.counter].time)
+				last[event.counter] = event;
+			if (!set[event.counter] || event.value > max[event.counter])
+				max[event.counter] = event.value;
+			set[event.counter] = true;
+		}
+	}
+	if (std::find(set.begin(), set.end(), true) != set.end())
+	{
+		out << std::left << std::setw(20) << "counter" << std::right
+			<< std::setw(10) << "last"
+			<< std::setw(12) << "max" << "\n";
+		for (size_t counter = 0; counter < set.size(); ++counter)
+		{
+			if (!set[counter])
+				continue;
+			out << std::left << std::setw(20) << snapshot.zones[counter] << std::right
+				<< std::setw(10) << last[counter].value
+				<< std::setw(12) << max[counter] << "\n";
+		}
+	}
+	out.flags(flags);
+}
+
+void FrameProfiler::WriteChromeTrace(std::ostream & out)
+{
+	Snapshot snapshot;
+	GetSnapshot(snapshot);
+
+	const double us_per_tick = 1E6 / SDL_GetPerformanceFrequency();
+	const std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(3);
+	out << "{\"traceEvents\":[\n";
+	for (size_t tid = 0; tid < snapshot.threads.size(); ++tid)
+	{
+		const Snapshot::Thread & thread = snapshot.threads[tid];
+		if (tid)
+			out << ",\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << thread.name << "\"}}";
+
+		for (size_t i = 0; i < thread.events.size(); ++i)
+		{
+			const Event & event = thread.events[i];
+			const double begin = double(Sint64(event.begin - snapshot.start)) * us_per_tick;
+			const double duration = double(event.end - event.begin) * us_per_tick;
+			out << ",\n{\"name\":\"" << snapshot.zones[event.zone]
+				<< "\",\"cat\":\"vdrift\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << begin << ",\"dur\":" << duration << "}";
+		}
+
+		for (size_t i = 0; i < thread.counters.size(); ++i)
+		{
+			const CounterEvent & event = thread.counters[i];
+			const double time = double(Sint64(event.time - snapshot.start)) * us_per_tick;
+			out << ",\n{\"name\":\"" << snapshot.zones[event.counter]
+				<< "\",\"cat\":\"vdrift\",\"ph\":\"C\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << time << ",\"args\":{\"value\":" << event.value << "}}";
+		}
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	out.flags(flags);
+}
+
+bool FrameProfiler::WriteChromeTrace(const std::string & filename, std::ostream & error_output)
+{
+	std::ofstream out(filename.c_str());
+	if (!out)
+	{
+		error_output << "Unable to write profiler trace to " << filename << std::endl;
+		return false;
+	}
+	WriteChromeTrace(out);
+	return true;
+}
+
+QT_TEST(frame_profiler_test)
+{
+	const bool was_enabled = FrameProfiler::Enabled();
+	FrameProfiler::Enable(true);
+	FrameProfiler::EnableSamples(true);
+	FrameProfiler::Clear();
+	FrameProfiler::SetThreadName("profiler test");
+
+	QT_CHECK_EQUAL(FrameProfiler::RegisterZone("test outer"), FrameProfiler::RegisterZone("test outer"));
+
+	for (int i = 0; i < 3; ++i)
+	{
+		PROFILE_ZONE("test outer");
+		{
+			PROFILE_ZONE("test inner");
+		}
+		PROFILE_COUNTER("test counter", float(i));
+	}
+
+	std::ostringstream trace;
+	FrameProfiler::WriteChromeTrace(trace);
+	const std::string json = trace.str();
+	QT_CHECK(json.find("\"args\":{\"name\":\"profiler test\"}") != std::string::npos);
+	int inner = 0, outer = 0;
+	for (size_t n = json.find("\"name\":\"test inner\""); n != std::string::npos; n = json.find("\"name\":\"test inner\"", n + 1))
+		inner++;
+	for (size_t n = json.find("\"name\":\"test outer\""); n != std::string::npos; n = json.find("\"name\":\"test outer\"", n + 1))
+		outer++;
+	QT_CHECK_EQUAL(inner, 3);
+	QT_CHECK_EQUAL(outer, 3);
+
+	std::ostringstream summary;
+	FrameProfiler::GetSummary(summary);
+	QT_CHECK(summary.str().find("test inner") != std::string::npos);
+	QT_CHECK(summary.str().find("test counter") != std::string::npos);
+	QT_CHECK(json.find("\"ph\":\"C\"") != std::string::npos);
+
+	std::vector<float> inner_samples;
+	FrameProfiler::GetSamples("test inner", inner_samples);
+	QT_CHECK_EQUAL(inner_samples.size(), 3);
+
+	float values[] = {5, 1, 4, 2, 3, 6, 8, 7, 10, 9};
+	std::vector<float> samples(values, values + 10);
+	QT_CHECK_EQUAL(FrameProfiler::GetPercentile(samples, 0.5), 5);
+	QT_CHECK_EQUAL(FrameProfiler::GetPercentile(samples, 0.95), 10);
+	QT_CHECK_EQUAL(FrameProfiler::GetPercentile(samples, 0), 1);
+
+	FrameProfiler::Clear();
+	FrameProfiler::EnableSamples(false);
+	FrameProfiler::Enable(was_enabled);
+}
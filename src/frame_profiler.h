@@ -0,0 +1,128 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _FRAME_PROFILER_H
+#define _FRAME_PROFILER_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/// Thread safe profiler recording nested zones into per thread ring buffers.
+/// Zones are interned once per call site, a disabled zone costs a flag test,
+/// an enabled zone two counter reads and one uncontended spin lock.
+/// Usage:
+/// FrameProfiler::Enable(true);
+/// ...
+/// {
+///     PROFILE_ZONE("physics");
+///     dynamics.update(dt);
+/// }
+/// ...
+/// FrameProfiler::WriteChromeTrace("trace.json", error_output);
+class FrameProfiler
+{
+public:
+	/// Zone events kept per thread, older events are overwritten.
+	static const unsigned int buffer_size = 1 << 16;
+
+	/// Return the id of zone name, name has to be a string literal.
+	static unsigned int RegisterZone(const char * name);
+
+	/// Not synchronized, toggle while no profiled threads run.
+	static void Enable(bool value);
+
+	static bool Enabled() { return enabled; }
+
+	/// Name the calling thread in exported traces.
+	static void SetThreadName(const std::string & name);
+
+	/// Open a zone on the calling thread.
+	static void Begin(unsigned int zone);
+
+	/// Close the innermost open zone of the calling thread.
+	static void End();
+
+	/// Record the value of a counter registered with RegisterZone, see PROFILE_COUNTER.
+	static void SetCounter(unsigned int counter, float value);
+
+	/// Keep the duration of every zone call, not just the buffered ones.
+	/// Not synchronized, toggle while no profiled threads run.
+	static void EnableSamples(bool value);
+
+	/// Drop all recorded events, totals and samples.
+	static void Clear();
+
+	/// Get the recorded call durations of zone name in microseconds, over all threads.
+	static void GetSamples(const std::string & name, std::vector<float> & samples);
+
+	/// Nearest rank percentile, fraction in [0, 1], reorders samples.
+	static float GetPercentile(std::vector<float> & samples, float fraction);
+
+	/// Per zone call count, total and average time over all threads,
+	/// followed by the last and maximum value of each counter.
+	static void GetSummary(std::ostream & out);
+
+	/// Chrome trace event json, open with chrome://tracing or about://tracing.
+	static void WriteChromeTrace(std::ostream & out);
+
+	static bool WriteChromeTrace(const std::string & filename, std::ostream & error_output);
+
+private:
+	static bool enabled;
+	static bool keep_samples;
+};
+
+/// Profiles the enclosing scope, see PROFILE_ZONE.
+class ProfileScope
+{
+public:
+	ProfileScope(unsigned int zone) : active(FrameProfiler::Enabled())
+	{
+		if (active)
+			FrameProfiler::Begin(zone);
+	}
+
+	~ProfileScope()
+	{
+		if (active)
+			FrameProfiler::End();
+	}
+
+private:
+	bool active;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+/// Profile the rest of the enclosing scope as zone name.
+#define PROFILE_ZONE(name) \
+	static const unsigned int PROFILE_CONCAT(profile_zone_, __LINE__) = FrameProfiler::RegisterZone(name); \
+	ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_CONCAT(profile_zone_, __LINE__))
+
+/// Record value of counter name, shown as a graph in the trace.
+#define PROFILE_COUNTER(name, value) \
+	do { \
+		static const unsigned int PROFILE_CONCAT(profile_counter_, __LINE__) = FrameProfiler::RegisterZone(name); \
+		if (FrameProfiler::Enabled()) \
+			FrameProfiler::SetCounter(PROFILE_CONCAT(profile_counter_, __LINE__), value); \
+	} while (0)
+
+#endif // _FRAME_PROFILER_H
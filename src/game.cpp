@@ -27,9 +27,11 @@
 #include "numprocessors.h"
 #include "performance_testing.h"
 #include "quickprof.h"
+#include "frame_profiler.h"
 #include "utils.h"
 #include "graphics/graphics_gl2.h"
 #include "graphics/graphics_gl3v.h"
+#include "graphics/graphics_null.h"
 #include "cfg/ptree.h"
 #include "svn_sourceforge.h"
 #include "game_downloader.h"
@@ -102,10 +104,17 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 	fps_min(0),
 	fps_max(0),
 	multithreaded(false),
+	parallelphysics(false),
+	deterministic(false),
 	profilingmode(false),
 	benchmode(false),
 	dumpfps(false),
 	pause(true),
+	headless(false),
+	carscaling(false),
+	headless_frames(0),
+	headless_aicars(0),
+	carbench_duration(30),
 	controlgrab_id(0),
 	controlgrab(false),
 	garage_camera("garagecam"),
@@ -127,10 +136,14 @@ Game::Game(std::ostream & info_out, std::ostream & error_out) :
 	particle_timer(0),
 	track(),
 	replay(timestep),
-	http("/tmp")
+	http("/tmp"),
+	snapshot_lock(0),
+	snapshot_ready(false),
+	tick_count(0)
 {
 	carcontrols_local.first = NULL;
 	dynamics.setContactAddedCallback(&CarDynamics::WheelContactCallback);
+	frame_tasks.Add([this]() { SimulateFrame(); });
 	RegisterActions();
 }
 
@@ -139,6 +152,15 @@ Game::~Game()
 	// dtor
 }
 
+Game::FrameSnapshot::FrameSnapshot() :
+	camera_fov(0),
+	camera(false),
+	interior_car(-1),
+	interior_view(false)
+{
+	hud.valid = false;
+}
+
 /* Start the game with the given arguments... */
 void Game::Start(std::list <std::string> & args)
 {
@@ -147,6 +169,23 @@ void Game::Start(std::list <std::string> & args)
 		return;
 	}
 
+	// no window or game loop, only the content and the settings of the profile
+	if (!carbench_file.empty())
+	{
+		pathmanager.Init(info_output, error_output);
+		settings.Load(pathmanager.GetSettingsFile(), error_output);
+		content.getFactory<Texture>().initHeadless();
+		content.getFactory<PTree>().init(read_ini, write_ini, content);
+		content.addPath(pathmanager.GetWriteableDataPath());
+		content.addPath(pathmanager.GetDataPath());
+		content.addSharedPath(pathmanager.GetCarPartsPath());
+		content.addSharedPath(pathmanager.GetTrackPartsPath());
+
+		const std::string trackname = carbench_track.empty() ? settings.GetTrack() : carbench_track;
+		BenchmarkCars(carbench_file, carbench_duration, trackname);
+		return;
+	}
+
 	info_output << "Starting VDrift: " << VERSION << ", Revision: " << REVISION << ", O/S: " << OS_NAME << std::endl;
 
 	if (!InitCoreSubsystems())
@@ -154,6 +193,10 @@ void Game::Start(std::list <std::string> & args)
 		return;
 	}
 
+	FrameProfiler::SetThreadName("main");
+
+	InitThreading();
+
 	// Load controls.
 	info_output << "Loading car controls from: " << pathmanager.GetCarControlsFile() << std::endl;
 	if (!carcontrols_local.second.Load(pathmanager.GetCarControlsFile(), info_output, error_output))
@@ -166,6 +209,34 @@ void Game::Start(std::list <std::string> & args)
 	// Load player car info from settings
 	InitPlayerCar();
 
+	if (headless)
+	{
+		// Skip the menus, sound and garage, go straight to the simulation.
+		Vec3 smokedir(0.4, 0.2, 1.0);
+		tire_smoke.Load(pathmanager.GetEffectsTextureDir(), "smoke.png", settings.GetAnisotropy(), content);
+		tire_smoke.SetParameters(settings.GetParticles(), 0.4,0.9, 1,4, 0.3,0.6, 0.02,0.06, smokedir);
+
+		if (carscaling)
+		{
+			BenchmarkCarScaling();
+			DoneStartingUp();
+			End();
+			return;
+		}
+
+		bool success = benchmode ? NewGame(true) : NewGame(false, car_info.size() > 1, settings.GetNumberOfLaps());
+		if (!success)
+			error_output << "Error loading headless simulation" << std::endl;
+
+		DoneStartingUp();
+
+		if (success)
+			HeadlessLoop();
+
+		End();
+		return;
+	}
+
 	// Init car update manager
 	if (!carupdater.Init(
 			pathmanager.GetUpdateManagerFileBase(),
@@ -243,7 +314,14 @@ void Game::Start(std::list <std::string> & args)
 /* Do any necessary cleanup... */
 void Game::End()
 {
-	if (benchmode)
+	if (headless)
+	{
+		info_output << "Simulated time: " << frame * timestep << " seconds in " << frame << " ticks\n";
+		info_output << "Elapsed time: " << clocktime << " seconds\n";
+		if (clocktime > 0)
+			info_output << "Simulation rate: " << frame / clocktime << " ticks per second" << std::endl;
+	}
+	else if (benchmode)
 	{
 		float mean_fps = displayframe / clocktime;
 		info_output << "Elapsed time: " << clocktime << " seconds\n";
@@ -252,17 +330,32 @@ void Game::End()
 	}
 
 	if (profilingmode)
-		info_output << "Profiling summary:\n" << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+	{
+		info_output << "Profiling summary:\n";
+		FrameProfiler::GetSummary(info_output);
+		info_output << std::endl;
+	}
+
+	if (benchmode)
+		WriteBenchmarkResults(benchmark_file);
+
+	if (!trace_file.empty() && FrameProfiler::WriteChromeTrace(trace_file, error_output))
+		info_output << "Profiler trace written to " << trace_file << std::endl;
 
 	info_output << "Shutting down..." << std::endl;
 
 	LeaveGame();
 
+	// Pending background loads may upload textures, finish them while there is a context.
+	content.deinitAsync();
+
 	// Save settings first incase later deinits cause crashes.
 	settings.Save(pathmanager.GetSettingsFile(), error_output);
 
 	graphics->Deinit();
 	delete graphics;
+
+	jobs.Deinit();
 }
 
 /* Initialize the most important, basic subsystems... */
@@ -294,6 +387,35 @@ bool Game::InitCoreSubsystems()
 	}
 	BeginStartingUp();
 
+	if (headless)
+	{
+		// No window, no OpenGL context, content is loaded without gpu resources.
+		graphics = new GraphicsNull();
+		content.getFactory<Texture>().initHeadless();
+	}
+	else if (!InitGraphics(texture_size))
+	{
+		return false;
+	}
+
+	// Init content factories
+	content.getFactory<PTree>().init(read_ini, write_ini, content);
+
+	// Init content paths
+	// Always add writeable data paths first so they are checked first
+	content.addPath(pathmanager.GetWriteableDataPath());
+	content.addPath(pathmanager.GetDataPath());
+	content.addSharedPath(pathmanager.GetCarPartsPath());
+	content.addSharedPath(pathmanager.GetTrackPartsPath());
+
+	if (!headless)
+		eventsystem.Init(info_output);
+
+	return true;
+}
+
+bool Game::InitGraphics(int texture_size)
+{
 	// choose renderer
 	std::string renderer = settings.GetRenderer();
 	if (!renderconfigfile.empty())
@@ -381,20 +503,28 @@ bool Game::InitCoreSubsystems()
 	graphics->SetLocalTime(settings.GetSkyTime());
 	graphics->SetLocalTimeSpeed(settings.GetSkyTimeSpeed());
 
-	// Init content factories
 	content.getFactory<Texture>().init(texture_size, using_gl3, settings.GetTextureCompress());
-	content.getFactory<PTree>().init(read_ini, write_ini, content);
 
-	// Init content paths
-	// Always add writeable data paths first so they are checked first
-	content.addPath(pathmanager.GetWriteableDataPath());
-	content.addPath(pathmanager.GetDataPath());
-	content.addSharedPath(pathmanager.GetCarPartsPath());
-	content.addSharedPath(pathmanager.GetTrackPartsPath());
+	return true;
+}
 
-	eventsystem.Init(info_output);
+void Game::InitThreading()
+{
+	// The main thread executes jobs too, start one worker per additional processor.
+	unsigned int workers = 0;
+	if (multithreaded)
+	{
+		unsigned int processors = NUMPROCESSORS::GetNumProcessors();
+		if (processors > 1)
+			workers = processors - 1;
+	}
+	jobs.Init(workers);
 
-	return true;
+	// Disk reads and image decoding run on their own threads, independent of the job workers.
+	content.initAsync(multithreaded ? 2 : 0);
+
+	if (parallelphysics)
+		dynamics.setJobSystem(&jobs);
 }
 
 void Game::InitPlayerCar()
@@ -410,6 +540,13 @@ void Game::InitPlayerCar()
 	car_info[0].ailevel = settings.GetAILevel();
 	car_info[0].hsv = hsv;
 	player_car_id = 0;
+
+	if (headless)
+	{
+		// Nobody is at the wheel, let the ai drive the player car and its clones.
+		car_info[0].driver = Ai::default_type;
+		car_info.resize(headless_aicars + 1, car_info[0]);
+	}
 }
 
 bool Game::InitGUI()
@@ -550,6 +687,18 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-cartest CAR"] = "Run car performance testing on given CAR.";
 
+	// the benchmark runs in Start, after all arguments and the settings
+	if (!argmap["-carbench"].empty())
+	{
+		carbench_file = argmap["-carbench"];
+		if (!argmap["-carbenchtime"].empty())
+			carbench_duration = cast<float>(argmap["-carbenchtime"]);
+		carbench_track = argmap["-carbenchtrack"];
+	}
+	arghelp["-carbench FILE"] = "Benchmark the physics of all cars, write results to FILE (.csv or .json).";
+	arghelp["-carbenchtime SECONDS"] = "Simulated time per car and surface for -carbench, default 30.";
+	arghelp["-carbenchtrack TRACK"] = "Track used by -carbench in addition to a flat plane.";
+
 	if (!argmap["-profile"].empty())
 	{
 		pathmanager.SetProfile(argmap["-profile"]);
@@ -558,11 +707,18 @@ bool Game::ParseArguments(std::list <std::string> & args)
 
 	if (argmap.find("-profiling") != argmap.end() || argmap.find("-benchmark") != argmap.end())
 	{
-		PROFILER.init(20);
+		FrameProfiler::Enable(true);
 		profilingmode = true;
 	}
 	arghelp["-profiling"] = "Display game performance data.";
 
+	if (!argmap["-trace"].empty())
+	{
+		FrameProfiler::Enable(true);
+		trace_file = argmap["-trace"];
+	}
+	arghelp["-trace FILE"] = "Record a profiler trace, write it to FILE on exit (Chrome trace json).";
+
 	if (argmap.find("-dumpfps") != argmap.end())
 	{
 		info_output << "Dumping the frame-rate to log." << std::endl;
@@ -612,8 +768,16 @@ bool Game::ParseArguments(std::list <std::string> & args)
 			info_output << "Multi-processor system detected.  Run with -multithreaded argument to enable multithreading (EXPERIMENTAL)." << std::endl;
 	}
 	arghelp["-multithreaded"] = "Use multithreading where possible.";
+
+	if (argmap.find("-parallelphysics") != argmap.end())
+		parallelphysics = true;
+	arghelp["-parallelphysics"] = "Solve physics islands and update cars in parallel, requires -multithreaded. Replays are played back in the mode they were recorded in.";
 	#endif
 
+	if (argmap.find("-deterministic") != argmap.end())
+		deterministic = true;
+	arghelp["-deterministic"] = "Record replays as inputs and state hashes only, playback reports the first diverging frame.";
+
 	if (argmap.find("-nosound") != argmap.end())
 		sound.Disable();
 	arghelp["-nosound"] = "Disable all sound.";
@@ -622,8 +786,46 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	{
 		info_output << "Entering benchmark mode." << std::endl;
 		benchmode = true;
+		benchmark_replay = "benchmark.vdr";
+		if (!argmap["-benchmark"].empty())
+			benchmark_replay = argmap["-benchmark"];
+
+		benchmark_file = "benchmark.csv";
+		if (!argmap["-benchmarkout"].empty())
+			benchmark_file = argmap["-benchmarkout"];
+
+		FrameProfiler::EnableSamples(true);
+	}
+	arghelp["-benchmark [REPLAY]"] = "Play REPLAY (default benchmark.vdr) one tick per frame and record timings.";
+	arghelp["-benchmarkout FILE"] = "Write benchmark timing percentiles to FILE, default benchmark.csv.";
+
+	if (argmap.find("-headless") != argmap.end())
+	{
+		// a benchmark runs to the end of its replay unless the time is given
+		float seconds = benchmode ? 0 : 60;
+		if (!argmap["-headless"].empty())
+			seconds = cast<float>(argmap["-headless"]);
+		headless_frames = seconds / timestep;
+		headless = true;
+		sound.Disable();
+		if (benchmode && !headless_frames)
+			info_output << "Entering headless mode: until the replay ends." << std::endl;
+		else
+			info_output << "Entering headless mode: " << headless_frames << " ticks." << std::endl;
+	}
+	arghelp["-headless SECONDS"] = "Simulate SECONDS of game time (default 60, with -benchmark the whole replay) at a fixed timestep without window, graphics or sound.";
+
+	if (!argmap["-aicars"].empty())
+	{
+		headless_aicars = cast<unsigned int>(argmap["-aicars"]);
+	}
+	arghelp["-aicars N"] = "Number of ai opponents in headless mode.";
+
+	if (argmap.find("-carscaling") != argmap.end())
+	{
+		carscaling = true;
 	}
-	arghelp["-benchmark"] = "Run in benchmark mode.";
+	arghelp["-carscaling"] = "In headless mode, time the car updates with 1, 4 and 16 ai cars, serial and on all threads.";
 
 	arghelp["-render FILE"] = "Load the specified render configuration file instead of the default gl3/deferred.conf.";
 	if (!argmap["-render"].empty())
@@ -672,6 +874,192 @@ bool Game::ParseArguments(std::list <std::string> & args)
 	return continue_game;
 }
 
+void Game::BenchmarkCars(const std::string & filename, float duration, const std::string & trackname)
+{
+	GuiOption::List carlist;
+	PopulateCarList(carlist, false);
+
+	std::vector<PerformanceTesting::BenchmarkResult> results;
+	results.reserve(carlist.size() * 2);
+
+	PerformanceTesting::BenchmarkPatches(info_output);
+
+	// Flat plane, the car starts in the center of a 2 x 4 x 1 meter box.
+	{
+		PerformanceTesting perftest(dynamics);
+		perftest.AddPlane();
+		for (GuiOption::List::const_iterator i = carlist.begin(); i != carlist.end(); ++i)
+		{
+			const size_t n = i->first.find("/");
+			const std::string cardir = pathmanager.GetCarsDir() + "/" + i->first.substr(0, n);
+			const std::string carname = i->first.substr(n + 1);
+
+			PerformanceTesting::BenchmarkResult result;
+			if (!perftest.Benchmark(
+				cardir, carname,
+				btVector3(0.0, -2.0, 0.5), btQuaternion::getIdentity(),
+				duration, content, result, error_output))
+				continue;
+
+			result.car = i->first;
+			result.surface = "plane";
+			results.push_back(result);
+		}
+	}
+
+	// Real track, the car starts at the first start position.
+	bool success = track.DeferredLoad(
+		content, dynamics, jobs,
+		info_output, error_output,
+		pathmanager.GetTracksPath(trackname),
+		pathmanager.GetTracksDir()+"/"+trackname,
+		pathmanager.GetEffectsTextureDir(),
+		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetTrackCachePath()+"/"+trackname+".vtc",
+		0, false, false, false);
+	while (success && !track.Loaded())
+		success = track.ContinueDeferredLoad();
+
+	if (success)
+	{
+		const btVector3 position = ToBulletVector(track.GetStart(0).first);
+		const btQuaternion rotation = ToBulletQuaternion(track.GetStart(0).second);
+
+		PerformanceTesting perftest(dynamics);
+		for (GuiOption::List::const_iterator i = carlist.begin(); i != carlist.end(); ++i)
+		{
+			const size_t n = i->first.find("/");
+			const std::string cardir = pathmanager.GetCarsDir() + "/" + i->first.substr(0, n);
+			const std::string carname = i->first.substr(n + 1);
+
+			PerformanceTesting::BenchmarkResult result;
+			if (!perftest.Benchmark(
+				cardir, carname,
+				position, rotation,
+				duration, content, result, error_output))
+				continue;
+
+			result.car = i->first;
+			result.surface = trackname;
+			results.push_back(result);
+		}
+
+		const int raycast_cars[] = {4, 20, 50};
+		for (int i = 0; i < 3; ++i)
+		{
+			PerformanceTesting::RaycastResult result;
+			perftest.BenchmarkRaycast(raycast_cars[i], position, rotation, duration, result);
+			info_output << result.cars << " cars wheel raycast on " << trackname << ": "
+				<< result.ray_us << " us/car per ray, "
+				<< result.batch_us << " us/car batched, "
+				<< result.cached_us << " us/car cached, "
+				<< result.mismatches << " mismatches" << std::endl;
+		}
+	}
+	else
+	{
+		error_output << "Error loading track: " << trackname << std::endl;
+	}
+	track.Clear();
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const PerformanceTesting::BenchmarkResult & r = results[i];
+		info_output << r.car << " on " << r.surface << ": "
+			<< r.update_us << " us/tick, "
+			<< r.ticks_per_second << " ticks/s";
+		if (r.allocs_per_tick >= 0)
+			info_output << ", " << r.allocs_per_tick << " allocs/tick";
+		info_output << std::endl;
+	}
+
+	if (PerformanceTesting::WriteResults(filename, results, error_output))
+		info_output << "Car benchmark results written to " << filename << std::endl;
+}
+
+void Game::BenchmarkCarScaling()
+{
+	const unsigned int car_counts[] = {1, 4, 16};
+	const unsigned int processors = NUMPROCESSORS::GetNumProcessors();
+	const unsigned int workers = processors > 1 ? processors - 1 : 0;
+	const CarInfo player = car_info[0];
+
+	// the car zone covers UpdateCars
+	FrameProfiler::Enable(true);
+	FrameProfiler::EnableSamples(true);
+	std::vector<float> samples;
+	for (int n = 0; n < 3; ++n)
+	{
+		// same simulation twice, without and with worker threads
+		float car_us[2] = {0, 0};
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			jobs.Deinit();
+			jobs.Init(pass ? workers : 0);
+
+			car_info.assign(car_counts[n], player);
+			if (!NewGame(false, car_counts[n] > 1, settings.GetNumberOfLaps()))
+			{
+				error_output << "Error loading headless simulation" << std::endl;
+				return;
+			}
+
+			FrameProfiler::Clear();
+			local_inputs = carcontrols_local.second.GetInputs();
+			for (unsigned int i = 0; i < headless_frames; ++i)
+			{
+				frame++;
+				AdvanceGameLogic();
+			}
+
+			FrameProfiler::GetSamples("car", samples);
+			for (size_t i = 0; i < samples.size(); ++i)
+				car_us[pass] += samples[i];
+			if (!samples.empty())
+				car_us[pass] /= samples.size();
+		}
+
+		info_output << car_counts[n] << " ai cars, car update 1 / " << workers + 1 << " threads: "
+			<< car_us[0] << " / " << car_us[1] << " us/tick, speedup "
+			<< (car_us[1] > 0 ? car_us[0] / car_us[1] : 0) << std::endl;
+	}
+	FrameProfiler::Clear();
+	FrameProfiler::EnableSamples(false);
+	FrameProfiler::Enable(profilingmode);
+}
+
+void Game::WriteBenchmarkResults(const std::string & filename)
+{
+	// the tick and its stages, the frame and its draw list assembly
+	const char * zones[] = {"tick", "ai", "physics", "car", "particles", "sound", "frame", "scenegraph"};
+	const unsigned zones_num = sizeof(zones) / sizeof(zones[0]);
+
+	std::ofstream out(filename.c_str());
+	if (!out)
+	{
+		error_output << "Unable to write benchmark results to " << filename << std::endl;
+		return;
+	}
+
+	out << "zone,calls,p50_us,p95_us,p99_us\n";
+	info_output << "Benchmark timings (p50 / p95 / p99 us):\n";
+
+	std::vector<float> samples;
+	for (unsigned i = 0; i < zones_num; ++i)
+	{
+		FrameProfiler::GetSamples(zones[i], samples);
+		if (samples.empty())
+			continue;
+
+		const float p50 = FrameProfiler::GetPercentile(samples, 0.50);
+		const float p95 = FrameProfiler::GetPercentile(samples, 0.95);
+		const float p99 = FrameProfiler::GetPercentile(samples, 0.99);
+		out << zones[i] << "," << samples.size() << "," << p50 << "," << p95 << "," << p99 << "\n";
+		info_output << zones[i] << ": " << p50 << " / " << p95 << " / " << p99 << "\n";
+	}
+	info_output << "Benchmark results written to " << filename << std::endl;
+}
+
 void Game::Test()
 {
 	QT_SET_OUTPUT(&info_output);
@@ -683,81 +1071,83 @@ void Game::Test()
 
 void Game::Draw(float dt)
 {
-	PROFILER.beginBlock("scenegraph");
+	PROFILE_ZONE("draw");
 
-	std::vector<SceneNode*> nodes;
-	nodes.reserve(5);
+	{
+		PROFILE_ZONE("scenegraph");
 
-	nodes.push_back(&dynamicsdraw.getNode());
-	nodes.push_back(&trackmap.GetNode());
-	nodes.push_back(&tire_smoke.GetNode());
+		std::vector<SceneNode*> nodes;
+		nodes.reserve(5);
 
-	if (gui.GetNodes().first)
-		nodes.push_back(gui.GetNodes().first);
+		nodes.push_back(&dynamicsdraw.getNode());
+		nodes.push_back(&trackmap.GetNode());
+		nodes.push_back(&tire_smoke.GetNode());
 
-	if (gui.GetNodes().second)
-		nodes.push_back(gui.GetNodes().second);
+		if (gui.GetNodes().first)
+			nodes.push_back(gui.GetNodes().first);
 
-	graphics->BindDynamicVertexData(nodes);
+		if (gui.GetNodes().second)
+			nodes.push_back(gui.GetNodes().second);
 
-	graphics->ClearDynamicDrawables();
-	graphics->AddDynamicNode(dynamicsdraw.getNode());
-	graphics->AddDynamicNode(track.GetBodyNode());
-	graphics->AddDynamicNode(track.GetRacinglineNode());
-	graphics->AddDynamicNode(trackmap.GetNode());
-	graphics->AddDynamicNode(tire_smoke.GetNode());
+		graphics->BindDynamicVertexData(nodes);
 
-	for (std::vector<CarGraphics>::iterator it = car_graphics.begin(); it != car_graphics.end(); ++it)
-		graphics->AddDynamicNode(it->GetNode());
+		graphics->ClearDynamicDrawables();
+		graphics->AddDynamicNode(dynamicsdraw.getNode());
+		graphics->AddDynamicNode(track.GetBodyNode());
+		graphics->AddDynamicNode(track.GetRacinglineNode());
+		graphics->AddDynamicNode(trackmap.GetNode());
+		graphics->AddDynamicNode(tire_smoke.GetNode());
 
-	if (gui.GetNodes().first)
-		graphics->AddDynamicNode(*gui.GetNodes().first);
+		for (std::vector<CarGraphics>::iterator it = car_graphics.begin(); it != car_graphics.end(); ++it)
+			graphics->AddDynamicNode(it->GetNode());
 
-	if (gui.GetNodes().second)
-		graphics->AddDynamicNode(*gui.GetNodes().second);
+		if (gui.GetNodes().first)
+			graphics->AddDynamicNode(*gui.GetNodes().first);
 
-	PROFILER.endBlock("scenegraph");
+		if (gui.GetNodes().second)
+			graphics->AddDynamicNode(*gui.GetNodes().second);
+	}
 
 	// Send scene information to the graphics subsystem.
-	PROFILER.beginBlock("render setup");
-	graphics->SetContrast(settings.GetContrast());
-	if (active_camera)
-	{
-		float fov = active_camera->GetFOV() > 0 ? active_camera->GetFOV() : settings.GetFOV();
-
-		Vec3 reflection_location = active_camera->GetPosition();
-		if (carcontrols_local.first)
-			reflection_location = ToMathVector<float>(carcontrols_local.first->GetCenterOfMass());
-
-		Quat camlook;
-		camlook.Rotate(M_PI_2, 1, 0, 0);
-		Quat cam_orientation = -(active_camera->GetOrientation() * camlook);
-
-		graphics->SetupScene(
-			fov, settings.GetViewDistance(),
-			active_camera->GetPosition(),
-			cam_orientation,
-			reflection_location,
-			error_output);
-	}
-	else
 	{
-		graphics->SetupScene(
-			settings.GetFOV(), settings.GetViewDistance(),
-			Vec3(), Quat(), Vec3(),
-			error_output);
+		PROFILE_ZONE("render setup");
+		graphics->SetContrast(settings.GetContrast());
+		const FrameSnapshot & snapshot = snapshots.getLast();
+		if (snapshot.camera)
+		{
+			float fov = snapshot.camera_fov > 0 ? snapshot.camera_fov : settings.GetFOV();
+
+			Quat camlook;
+			camlook.Rotate(M_PI_2, 1, 0, 0);
+			Quat cam_orientation = -(snapshot.camera_orientation * camlook);
+
+			graphics->SetupScene(
+				fov, settings.GetViewDistance(),
+				snapshot.camera_position,
+				cam_orientation,
+				snapshot.reflection_position,
+				error_output);
+		}
+		else
+		{
+			graphics->SetupScene(
+				settings.GetFOV(), settings.GetViewDistance(),
+				Vec3(), Quat(), Vec3(),
+				error_output);
+		}
+		graphics->UpdateScene(dt);
 	}
-	graphics->UpdateScene(dt);
-	PROFILER.endBlock("render setup");
 
 	// Sync CPU and GPU (flip the page).
-	PROFILER.beginBlock("render sync");
-	window.SwapBuffers();
-	PROFILER.endBlock("render sync");
+	{
+		PROFILE_ZONE("render sync");
+		window.SwapBuffers();
+	}
 
-	PROFILER.beginBlock("render draw");
-	graphics->DrawScene(error_output);
-	PROFILER.endBlock("render draw");
+	{
+		PROFILE_ZONE("render draw");
+		graphics->DrawScene(error_output);
+	}
 }
 
 /* The main game loop... */
@@ -765,25 +1155,46 @@ void Game::MainLoop()
 {
 	while (!eventsystem.GetQuit() && (!benchmode || replay.GetPlaying()))
 	{
+		PROFILE_ZONE("frame");
+
 		CalculateFPS();
 
 		clocktime += eventsystem.Get_dt();
 
 		eventsystem.BeginFrame();
 
-		// Do CPU intensive stuff in parallel with the GPU...
+		// Process inputs and start simulating the next frame...
 		Tick(eventsystem.Get_dt());
 
+		// ...while the last simulated frame is drawn.
 		Draw(eventsystem.Get_dt());
 
-		eventsystem.EndFrame();
+		{
+			PROFILE_ZONE("wait simulation");
+			jobs.Wait(frame_tasks);
+		}
 
-		PROFILER.endCycle();
+		eventsystem.EndFrame();
 
 		displayframe++;
 	}
 }
 
+/* Run the simulation without frame pacing, rendering or input... */
+void Game::HeadlessLoop()
+{
+	quickprof::Clock clock;
+	local_inputs = carcontrols_local.second.GetInputs();
+	const bool capped = !benchmode || headless_frames;
+	while ((!capped || frame < headless_frames) && (!benchmode || replay.GetPlaying()))
+	{
+		frame++;
+
+		AdvanceGameLogic();
+	}
+	clocktime = clock.getTimeMicroseconds() * 1E-6;
+}
+
 /* Deltat is in seconds... */
 void Game::Tick(float deltat)
 {
@@ -793,7 +1204,6 @@ void Game::Tick(float deltat)
 	const unsigned int maxticks = (int) (1.0f / (minfps * timestep));
 	// Slow the game down if we can't process fast enough.
 	const float maxtime = 1.0 / minfps;
-	unsigned int curticks = 0;
 
 	// Throw away wall clock time if necessary to keep the framerate above the minimum.
 	if (deltat > maxtime)
@@ -803,37 +1213,63 @@ void Game::Tick(float deltat)
 
 	http.Tick();
 
-	// Increment game logic by however many tick periods have passed since the last GAME::Tick...
-	while (target_time - timestep * frame > timestep && curticks < maxticks)
-	{
-		frame++;
-
-		AdvanceGameLogic();
+	content.update();
 
-		curticks++;
+	// Benchmarks simulate one tick per frame, independent of the wall clock,
+	// so the same replay does the same work on every machine.
+	unsigned int ticks = 1;
+	if (!benchmode)
+	{
+		ticks = 0;
+		while (target_time - timestep * (frame + ticks) > timestep && ticks < maxticks)
+			ticks++;
 	}
 
-	// Debug draw dynamics
-	if (dynamics_drawmode && track.Loaded())
+	// Process the inputs of every tick up front, the ticks are
+	// simulated by the job system while the last frame is drawn.
+	for (tick_count = 0; tick_count < ticks; ++tick_count)
 	{
-		dynamicsdraw.clear();
-		dynamics.debugDrawWorld();
+		ProcessInputs();
+
+		if (tick_inputs.size() <= tick_count)
+			tick_inputs.resize(tick_count + 1);
+		tick_inputs[tick_count] = carcontrols_local.second.GetInputs();
 	}
 
-	if (dumpfps && curticks > 0 && frame % 100 == 0)
+	if (dumpfps && tick_count > 0 && (frame + tick_count) % 100 == 0)
 	{
 		info_output << "Current FPS: " << eventsystem.GetFPS() << std::endl;
 	}
 
-	UpdateParticleGraphics();
+	// Debug drawing is not thread safe, simulate and draw in turn.
+	// Otherwise hand over the last frame to the renderer and simulate the next one.
+	const bool pipelined = !dynamics_drawmode;
+	if (pipelined)
+		ApplySnapshot();
+
+	jobs.Submit(frame_tasks);
+
+	if (!pipelined)
+	{
+		jobs.Wait(frame_tasks);
+
+		// Debug draw dynamics
+		if (dynamics_drawmode && track.Loaded())
+		{
+			dynamicsdraw.clear();
+			dynamics.debugDrawWorld();
+		}
+
+		ApplySnapshot();
+	}
 
 	gui.Update(eventsystem.Get_dt());
 }
 
-/* Increment game logic by one frame... */
-void Game::AdvanceGameLogic()
+/* Process window events, local controls and gui inputs... */
+void Game::ProcessInputs()
 {
-	//PROFILER.beginBlock("input-processing");
+	PROFILE_ZONE("input");
 
 	eventsystem.ProcessEvents();
 
@@ -856,43 +1292,69 @@ void Game::AdvanceGameLogic()
 	ProcessGUIInputs();
 
 	ProcessGameInputs();
+}
 
-	//PROFILER.endBlock("input-processing");
+/* Simulate the ticks of a frame and hand the result over to the renderer... */
+void Game::SimulateFrame()
+{
+	PROFILE_ZONE("simulate");
 
-	if (!pause)
+	FrameSnapshot & snapshot = snapshots.getFirst();
+	snapshot.hud.valid = false;
+	snapshot.interior_car = -1;
+
+	for (unsigned int i = 0; i < tick_count; ++i)
 	{
-		PROFILER.beginBlock("ai");
-		ai.Visualize();
-		ai.Update(timestep, &car_dynamics[0], car_dynamics.size());
-		PROFILER.endBlock("ai");
+		frame++;
 
-		PROFILER.beginBlock("physics");
-		dynamics.update(timestep);
-		PROFILER.endBlock("physics");
+		local_inputs.swap(tick_inputs[i]);
 
-		PROFILER.beginBlock("car");
-		UpdateCars(timestep);
-		PROFILER.endBlock("car");
+		AdvanceGameLogic();
+	}
 
-		// Update dynamic track objects.
-		track.Update();
+	PublishSnapshot();
+}
 
-		//PROFILER.beginBlock("timer");
-		UpdateTimer();
-		//PROFILER.endBlock("timer");
+/* Increment game logic by one frame... */
+void Game::AdvanceGameLogic()
+{
+	PROFILE_ZONE("tick");
 
-		//PROFILER.beginBlock("particles");
-		UpdateParticles(timestep);
-		//PROFILER.endBlock("particles");
+	if (!pause)
+	{
+		{
+			PROFILE_ZONE("ai");
+			ai.Visualize();
+			ai.Update(timestep, &car_dynamics[0], car_dynamics.size(), jobs);
+		}
+		{
+			PROFILE_ZONE("physics");
+			UpdateCarDetail();
+			dynamics.update(timestep);
+		}
+		{
+			PROFILE_ZONE("car");
+			UpdateCars(timestep);
+		}
 
-		//PROFILER.beginBlock("trackmap-update");
-		UpdateTrackMap();
-		//PROFILER.endBlock("trackmap-update");
+		// Timer and particles only read car state and can be updated in parallel.
+		TaskGraph tasks;
+		tasks.Add([this]()
+		{
+			PROFILE_ZONE("timer");
+			UpdateTimer();
+		});
+		tasks.Add([this]()
+		{
+			PROFILE_ZONE("particles");
+			UpdateParticles(timestep);
+		});
+		jobs.Run(tasks);
 	}
 
 	if (sound.Enabled())
 	{
-		PROFILER.beginBlock("sound");
+		PROFILE_ZONE("sound");
 		Vec3 pos;
 		Quat rot;
 		if (active_camera)
@@ -903,12 +1365,13 @@ void Game::AdvanceGameLogic()
 		sound.SetListenerPosition(pos[0], pos[1], pos[2]);
 		sound.SetListenerRotation(rot[0], rot[1], rot[2], rot[3]);
 		sound.Update(pause);
-		PROFILER.endBlock("sound");
 	}
 
-	//PROFILER.beginBlock("force-feedback");
-	UpdateForceFeedback(timestep);
-	//PROFILER.endBlock("force-feedback");
+	if (!headless)
+	{
+		PROFILE_ZONE("force feedback");
+		UpdateForceFeedback(timestep);
+	}
 }
 
 /* Process inputs used only for higher level game functions... */
@@ -1039,20 +1502,6 @@ void Game::UpdateTimer()
 	//timer.DebugPrint(info_output);
 }
 
-void Game::UpdateTrackMap()
-{
-	std::list <std::pair<Vec3, bool> > carpositions;
-	for (int i = 0; i != car_dynamics.size(); ++i)
-	{
-		const CarDynamics & car = car_dynamics[i];
-		bool player = (carcontrols_local.first == &car);
-		Vec3 carpos = ToMathVector<float>(car.GetCenterOfMass());
-		carpositions.push_back(std::make_pair(carpos, player));
-	}
-
-	trackmap.Update(settings.GetTrackmap(), carpositions);
-}
-
 void Game::ProcessGUIInputs()
 {
 	gui.ProcessInput(
@@ -1216,19 +1665,60 @@ void Game::UpdateCarInfo()
 	gui.SetOptionValue("game.ai_level", cast(info.ailevel));
 }
 
+void Game::UpdateCarDetail()
+{
+	// distance is measured from the local car instead of the camera,
+	// the physics must not depend on the view to keep replays in sync
+	const btScalar detail_distance = 150;
+	const CarDynamics * local = carcontrols_local.first;
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
+		CarDynamics & car = car_dynamics[i];
+		bool reduced = false;
+		if (local && local != &car)
+		{
+			const btVector3 d = car.GetCenterOfMass() - local->GetCenterOfMass();
+			reduced = d.length2() > detail_distance * detail_distance;
+		}
+		car.SetReducedDetail(reduced);
+	}
+}
+
 void Game::UpdateCars(float dt)
 {
+	// inputs touch replay, hud and camera state, process them in car order
 	for (int i = 0; i < car_dynamics.size(); ++i)
 	{
 		UpdateCarInputs(i);
+	}
+
+	// the remaining stages only write per car state or per car buffers
+	car_updates.resize(car_dynamics.size());
+	jobs.ParallelFor(0, car_dynamics.size(), 1, [this, dt](int i)
+	{
+		PROFILE_ZONE("car update");
 
-		car_graphics[i].Update(car_dynamics[i]);
+		CarUpdate & update = car_updates[i];
 
+		update.smoke.clear();
+		AddTireSmokeParticles(car_dynamics[i], dt, update.smoke);
+
+		UpdateDriftScore(i, dt, update.drift);
+	});
+
+	// merge in car order to keep particles and scores deterministic
+	// sound updates queue commands on the shared sound system, keep them serial
+	for (int i = 0; i < car_dynamics.size(); ++i)
+	{
 		car_sounds[i].Update(car_dynamics[i], dt);
 
-		AddTireSmokeParticles(car_dynamics[i], dt);
+		const CarUpdate & update = car_updates[i];
+		for (size_t n = 0; n < update.smoke.size(); ++n)
+		{
+			tire_smoke.AddParticle(update.smoke[n], 0.5);
+		}
 
-		UpdateDriftScore(i, dt);
+		ApplyDriftScore(i, update.drift);
 	}
 }
 
@@ -1240,7 +1730,8 @@ void Game::UpdateCarInputs(const int carid)
 	CarSound & car_snd = car_sounds[carid];
 
 	std::vector <float> carinputs(CarInput::INVALID, 0.0f);
-	if (replay.GetPlaying())
+	const bool playing = replay.GetPlaying();
+	if (playing)
 	{
 		const std::vector<float> inputs = replay.PlayFrame(carid, car);
 		assert(inputs.size() <= carinputs.size());
@@ -1251,7 +1742,7 @@ void Game::UpdateCarInputs(const int carid)
 	}
 	else if (carcontrols_local.first == &car)
 	{
-		carinputs = carcontrols_local.second.GetInputs();
+		carinputs = local_inputs;
 #ifdef VISUALIZE_AI_DEBUG
 		// It allows to activate the AI on the player car with F9 button.
 		// AI will override player inputs.
@@ -1304,37 +1795,39 @@ void Game::UpdateCarInputs(const int carid)
 	car.Update(carinputs);
 	car_gfx.Update(carinputs);
 
-	// Record car state.
+	// Record car state, or verify the played back state.
 	if (replay.GetRecording())
 		replay.RecordFrame(carid, carinputs, car);
+	else if (playing && !replay.CheckFrame(carid, car))
+		error_output << "Replay car " << carid << " diverged at frame " << replay.GetDivergedFrame(carid) << std::endl;
 
 	// Local player input processing starts here.
 	if (carcontrols_local.first != &car)
 		return;
 
 	// Update player HUD
-	if (settings.GetHUD() != "NoHud")
-		UpdateHUD(carid, carinputs);
+	if (!headless && settings.GetHUD() != "NoHud")
+		UpdateHUD(carid, carinputs, snapshots.getFirst().hud);
 
 	// Handle camera mode change inputs.
 	Camera * old_camera = active_camera;
-	CarControlMap & carcontrol = carcontrols_local.second;
+	const std::vector<float> & carcontrol = local_inputs;
 	unsigned int camera_id = settings.GetCamera();
-	if (carcontrol.GetInput(GameInput::VIEW_HOOD))
+	if (carcontrol[GameInput::VIEW_HOOD])
 		camera_id = 0;
-	else if (carcontrol.GetInput(GameInput::VIEW_INCAR))
+	else if (carcontrol[GameInput::VIEW_INCAR])
 		camera_id = 1;
-	else if (carcontrol.GetInput(GameInput::VIEW_CHASERIGID))
+	else if (carcontrol[GameInput::VIEW_CHASERIGID])
 		camera_id = 2;
-	else if (carcontrol.GetInput(GameInput::VIEW_CHASE))
+	else if (carcontrol[GameInput::VIEW_CHASE])
 		camera_id = 3;
-	else if (carcontrol.GetInput(GameInput::VIEW_ORBIT))
+	else if (carcontrol[GameInput::VIEW_ORBIT])
 		camera_id = 4;
-	else if (carcontrol.GetInput(GameInput::VIEW_FREE))
+	else if (carcontrol[GameInput::VIEW_FREE])
 		camera_id = 5;
-	else if (carcontrol.GetInput(GameInput::VIEW_NEXT))
+	else if (carcontrol[GameInput::VIEW_NEXT])
 		camera_id++;
-	else if (carcontrol.GetInput(GameInput::VIEW_PREV))
+	else if (carcontrol[GameInput::VIEW_PREV])
 		camera_id--;
 
 	// wrap around
@@ -1351,7 +1844,7 @@ void Game::UpdateCarInputs(const int carid)
 	// handle rear view
 	Vec3 pos = ToMathVector<float>(car.GetPosition());
 	Quat rot = ToQuaternion<float>(car.GetOrientation());
-	if (carcontrol.GetInput(GameInput::VIEW_REAR))
+	if (carcontrol[GameInput::VIEW_REAR])
 		rot.Rotate(M_PI, 0, 0, 1);
 
 	// reset camera on change
@@ -1361,51 +1854,41 @@ void Game::UpdateCarInputs(const int carid)
 		active_camera->Update(pos, rot, timestep);
 
 	// Handle camera inputs.
-	float left = timestep * (carcontrol.GetInput(GameInput::PAN_LEFT) - carcontrol.GetInput(GameInput::PAN_RIGHT));
-	float up = timestep * (carcontrol.GetInput(GameInput::PAN_UP) - carcontrol.GetInput(GameInput::PAN_DOWN));
-	float dy = timestep * (carcontrol.GetInput(GameInput::ZOOM_IN) - carcontrol.GetInput(GameInput::ZOOM_OUT));
+	float left = timestep * (carcontrol[GameInput::PAN_LEFT] - carcontrol[GameInput::PAN_RIGHT]);
+	float up = timestep * (carcontrol[GameInput::PAN_UP] - carcontrol[GameInput::PAN_DOWN]);
+	float dy = timestep * (carcontrol[GameInput::ZOOM_IN] - carcontrol[GameInput::ZOOM_OUT]);
 	Vec3 zoom(Direction::Forward * 4 * dy);
 	active_camera->Rotate(up, left);
 	active_camera->Move(zoom[0], zoom[1], zoom[2]);
 
-	// Hide glass if we're inside the car, adjust sounds.
+	// Adjust sounds if we're inside the car.
 	bool incar = (camera_id == 0 || camera_id == 1);
-	car_gfx.EnableInteriorView(incar);
 	car_snd.EnableInteriorSound(incar);
 
-	// Move up the close shadow distance if we're in the cockpit.
-	graphics->SetCloseShadow(incar ? 1.0 : 5.0);
+	// Glass and shadows are render state, updated by ApplySnapshot.
+	FrameSnapshot & snapshot = snapshots.getFirst();
+	snapshot.interior_car = carid;
+	snapshot.interior_view = incar;
 }
 
-void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
+void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs, HudState & hud)
 {
 	assert(carid >= 0 && carid < car_dynamics.size());
 	const CarDynamics & car = car_dynamics[carid];
 	const GuiLanguage & lang = gui.GetLanguageDict();
 
-	if (settings.GetDebugInfo())
-	{
-		if (!profilingmode)
-		{
-			std::ostringstream debug_info[4];
-			car.DebugPrint(debug_info[0], true, false, false, false);
-			car.DebugPrint(debug_info[1], false, true, false, false);
-			car.DebugPrint(debug_info[2], false, false, true, false);
-			car.DebugPrint(debug_info[3], false, false, false, true);
+	hud.valid = true;
 
-			signal_debug_info[0](debug_info[0].str());
-			signal_debug_info[1](debug_info[1].str());
-			signal_debug_info[2](debug_info[2].str());
-			signal_debug_info[3](debug_info[3].str());
-		}
-		else if (frame % 10 == 0)
-		{
-			std::ostringstream gpu_profile;
-			graphics->printProfilingInfo(gpu_profile);
+	if (settings.GetDebugInfo() && !profilingmode)
+	{
+		std::ostringstream debug_info[4];
+		car.DebugPrint(debug_info[0], true, false, false, false);
+		car.DebugPrint(debug_info[1], false, true, false, false);
+		car.DebugPrint(debug_info[2], false, false, true, false);
+		car.DebugPrint(debug_info[3], false, false, false, true);
 
-			signal_debug_info[0](PROFILER.getAvgSummary(quickprof::MICROSECONDS));
-			signal_debug_info[1](gpu_profile.str());
-		}
+		for (int i = 0; i < 4; ++i)
+			hud.debug_info[i] = debug_info[i].str();
 	}
 
 	if (settings.GetInputGraph())
@@ -1415,9 +1898,9 @@ void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
 		throttlestr << carinputs[CarInput::THROTTLE];
 		brakestr << carinputs[CarInput::BRAKE];
 
-		signal_steering(steeringstr.str());
-		signal_throttle(throttlestr.str());
-		signal_brake(brakestr.str());
+		hud.steering = steeringstr.str();
+		hud.throttle = throttlestr.str();
+		hud.brake = brakestr.str();
 	}
 
 	std::pair <int, int> curplace = timer.GetPlayerPlace();
@@ -1486,30 +1969,87 @@ void Game::UpdateHUD(const int carid, const std::vector<float> & carinputs)
 	gasstr << (car.GetFuelAmount() ? 0.3 : 1.0);
 	nosstr << ((car.GetNosAmount() && carinputs[CarInput::NOS]) ? 1.0 : 0.3);
 
-	signal_lap_time[0](GetTimeString(timer.GetPlayerTime()));
-	signal_lap_time[1](GetTimeString(timer.GetLastLap()));
-	signal_lap_time[2](GetTimeString(timer.GetBestLap()));
+	hud.lap_time[0] = GetTimeString(timer.GetPlayerTime());
+	hud.lap_time[1] = GetTimeString(timer.GetLastLap());
+	hud.lap_time[2] = GetTimeString(timer.GetBestLap());
+
+	hud.pos = placestr.str();
+	hud.lap = lapstr.str();
+	hud.score = scorestr.str();
+	hud.message = msgstr.str();
+
+	hud.gear = gearstr.str();
+	hud.shift = shiftstr.str();
 
-	signal_pos(placestr.str());
-	signal_lap(lapstr.str());
-	signal_score(scorestr.str());
-	signal_message(msgstr.str());
+	hud.speedometer = speedostr.str();
+	hud.speed_norm = speednstr.str();
+	hud.speed = speedstr.str();
 
-	signal_gear(gearstr.str());
-	signal_shift(shiftstr.str());
+	hud.tachometer = tachostr.str();
+	hud.rpm_norm = rpmnstr.str();
+	hud.rpm = rpmstr.str();
 
-	signal_speedometer(speedostr.str());
-	signal_speed_norm(speednstr.str());
-	signal_speed(speedstr.str());
+	hud.abs = absstr.str();
+	hud.tcs = tcsstr.str();
+	hud.gas = gasstr.str();
+	hud.nos = nosstr.str();
+}
+
+void Game::ApplyHUD(const HudState & hud)
+{
+	if (settings.GetDebugInfo())
+	{
+		if (!profilingmode)
+		{
+			signal_debug_info[0](hud.debug_info[0]);
+			signal_debug_info[1](hud.debug_info[1]);
+			signal_debug_info[2](hud.debug_info[2]);
+			signal_debug_info[3](hud.debug_info[3]);
+		}
+		else if (frame % 10 == 0)
+		{
+			std::ostringstream gpu_profile;
+			graphics->printProfilingInfo(gpu_profile);
+
+			std::ostringstream cpu_profile;
+			FrameProfiler::GetSummary(cpu_profile);
+
+			signal_debug_info[0](cpu_profile.str());
+			signal_debug_info[1](gpu_profile.str());
+		}
+	}
+
+	if (settings.GetInputGraph())
+	{
+		signal_steering(hud.steering);
+		signal_throttle(hud.throttle);
+		signal_brake(hud.brake);
+	}
+
+	signal_lap_time[0](hud.lap_time[0]);
+	signal_lap_time[1](hud.lap_time[1]);
+	signal_lap_time[2](hud.lap_time[2]);
+
+	signal_pos(hud.pos);
+	signal_lap(hud.lap);
+	signal_score(hud.score);
+	signal_message(hud.message);
+
+	signal_gear(hud.gear);
+	signal_shift(hud.shift);
+
+	signal_speedometer(hud.speedometer);
+	signal_speed_norm(hud.speed_norm);
+	signal_speed(hud.speed);
 
-	signal_tachometer(tachostr.str());
-	signal_rpm_norm(rpmnstr.str());
-	signal_rpm(rpmstr.str());
+	signal_tachometer(hud.tachometer);
+	signal_rpm_norm(hud.rpm_norm);
+	signal_rpm(hud.rpm);
 
-	signal_abs(absstr.str());
-	signal_tcs(tcsstr.str());
-	signal_gas(gasstr.str());
-	signal_nos(nosstr.str());
+	signal_abs(hud.abs);
+	signal_tcs(hud.tcs);
+	signal_gas(hud.gas);
+	signal_nos(hud.nos);
 }
 
 bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
@@ -1529,12 +2069,17 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 	// Set track, car config file.
 	std::string trackname = settings.GetTrack();
 
+	// Physics mode of the command line, replays may override it.
+	dynamics.setJobSystem(parallelphysics ? &jobs : 0);
+
 	if (playreplay)
 	{
 		// Load replay.
 		std::string replayfilename = pathmanager.GetReplayPath();
-		if (benchmode)
-			replayfilename += "/benchmark.vdr";
+		if (benchmode && pathmanager.FileExists(benchmark_replay))
+			replayfilename = benchmark_replay;
+		else if (benchmode)
+			replayfilename += "/" + benchmark_replay;
 		else
 			replayfilename += "/" + settings.GetSelectedReplay();
 
@@ -1546,6 +2091,12 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 		trackname = replay.GetTrack();
 		car_info = replay.GetCarInfo();
 		cars_num = car_info.size();
+
+		// Replay in the physics mode it was recorded in.
+		dynamics.setJobSystem(replay.GetParallelPhysics() ? &jobs : 0);
+		if (replay.GetParallelPhysics() != dynamics.isParallel())
+			error_output << "Replay was recorded with " << (replay.GetParallelPhysics() ? "parallel" : "serial")
+				<< " physics, which is not available, playback may diverge." << std::endl;
 	}
 
 	// Load track.
@@ -1556,6 +2107,7 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 	}
 
 	// Load cars.
+	dynamics.setDebrisLimits(settings.GetDebrisMax(), settings.GetDebrisLifetime());
 	car_dynamics.reserve(cars_num);
 	car_graphics.reserve(cars_num);
 	car_sounds.reserve(cars_num);
@@ -1623,7 +2175,8 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 			}
 		}
 
-		replay.StartRecording(car_info, settings.GetTrack(), error_output);
+		replay.StartRecording(car_info, settings.GetTrack(), deterministic,
+			dynamics.isParallel(), settings.GetTireTableError(), error_output);
 	}
 
 	// Clean up asset cache.
@@ -1631,7 +2184,8 @@ bool Game::NewGame(bool playreplay, bool addopponents, int num_laps)
 
 	// Set up GUI.
 	gui.SetInGame(true);
-	gui.ActivatePage("Hud", 0.25, error_output);
+	if (!headless)
+		gui.ActivatePage("Hud", 0.25, error_output);
 
 	// not strictly needed, is expected to be called by Hud page onfocus event
 	ContinueGame();
@@ -1711,6 +2265,17 @@ bool Game::LoadCar(
 
 	car_dynamics.push_back(CarDynamics());
 	CarDynamics & car = car_dynamics[car_dynamics.size() - 1];
+	// replays are played back with the tire model they have been recorded with
+	const float tire_table_error = replay.GetPlaying() ?
+		replay.GetTireTableError() : settings.GetTireTableError();
+	if (tire_table_error > 0)
+	{
+		// cache tire tables in the writeable copy of the car directory
+		const std::string cachedir = pathmanager.GetWriteableCarsPath() + "/" + info.name.substr(0, n0);
+		PathManager::MakeDir(pathmanager.GetWriteableCarsPath());
+		PathManager::MakeDir(cachedir);
+		car.SetTireTables(cachedir, tire_table_error);
+	}
 	if (!car.Load(
 		*carconf, cardir, info.tire,
 		ToBulletVector(position),
@@ -1743,15 +2308,19 @@ bool Game::LoadCar(
 
 bool Game::LoadTrack(const std::string & trackname)
 {
-	gui.ActivatePage("Loading", 0.5, error_output);
+	PROFILE_ZONE("load track");
+
+	if (!headless)
+		gui.ActivatePage("Loading", 0.5, error_output);
 
 	if (!track.DeferredLoad(
-		content, dynamics,
+		content, dynamics, jobs,
 		info_output, error_output,
 		pathmanager.GetTracksPath(trackname),
 		pathmanager.GetTracksDir()+"/"+trackname,
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		pathmanager.GetTrackCachePath()+"/"+trackname+(settings.GetTrackReverse() ? "-reverse.vtc" : ".vtc"),
 		settings.GetAnisotropy(),
 		settings.GetTrackReverse(),
 		settings.GetTrackDynamic(),
@@ -1767,8 +2336,8 @@ bool Game::LoadTrack(const std::string & trackname)
 	int displayevery = count_max / 50;
 	while (!track.Loaded() && success)
 	{
-		if (displayevery == 0 || count % displayevery == 0)
-			ShowLoadingScreen(count, count_max, "");
+		if (!headless && (displayevery == 0 || count % displayevery == 0))
+			ShowLoadingScreen(track.ObjectsNumLoaded(), count_max, "");
 
 		success = track.ContinueDeferredLoad();
 		count++;
@@ -1784,7 +2353,7 @@ bool Game::LoadTrack(const std::string & trackname)
 	track.SetRacingLineVisibility(settings.GetRacingline());
 
 	// Generate the track map.
-	if (!trackmap.BuildMap(
+	if (!headless && !trackmap.BuildMap(
 			window.GetW(),
 			window.GetH(),
 			track.GetRoadList(),
@@ -1828,12 +2397,13 @@ void Game::LoadGarage()
 	bool track_reverse = false;
 	bool track_dynamic = false;
 	if (!track.DeferredLoad(
-		content, dynamics,
+		content, dynamics, jobs,
 		info_output, error_output,
 		pathmanager.GetSkinsPath() + "/" + settings.GetSkin(),
 		pathmanager.GetSkinsDir() + "/" + settings.GetSkin(),
 		pathmanager.GetEffectsTextureDir(),
 		pathmanager.GetTrackPartsPath(),
+		"",
 		settings.GetAnisotropy(),
 		track_reverse, track_dynamic,
 		graphics->GetShadows()))
@@ -1849,7 +2419,7 @@ void Game::LoadGarage()
 	while (!track.Loaded() && success)
 	{
 		if (displayevery == 0 || count % displayevery == 0)
-			ShowLoadingScreen(count, count_max, "");
+			ShowLoadingScreen(track.ObjectsNumLoaded(), count_max, "");
 
 		success = track.ContinueDeferredLoad();
 		count++;
@@ -1879,6 +2449,7 @@ void Game::SetGarageCar()
 		return;
 
 	// clear previous car
+	ClearSnapshots();
 	carcontrols_local.first = NULL;
 	car_dynamics.clear();
 	car_graphics.clear();
@@ -2434,7 +3005,7 @@ void Game::UpdateForceFeedback(float dt)
 	}
 }
 
-void Game::AddTireSmokeParticles(const CarDynamics & car, float dt)
+void Game::AddTireSmokeParticles(const CarDynamics & car, float dt, std::vector<Vec3> & particles)
 {
 	// Only spawn particles every so often...
 	unsigned int interval = 0.2 / dt;
@@ -2446,7 +3017,7 @@ void Game::AddTireSmokeParticles(const CarDynamics & car, float dt)
 			if (squeal > 0)
 			{
 				btVector3 p = car.GetWheelContact(WheelPosition(i)).GetPosition();
-				tire_smoke.AddParticle(ToMathVector<float>(p), 0.5);
+				particles.push_back(ToMathVector<float>(p));
 			}
 		}
 	}
@@ -2458,21 +3029,111 @@ void Game::UpdateParticles(float dt)
 	particle_timer = (particle_timer + 1) % (unsigned int)((1.0 / timestep));
 }
 
-void Game::UpdateParticleGraphics()
+void Game::UpdateParticleGraphics(FrameSnapshot & snapshot)
 {
-	if (track.Loaded() && active_camera)
+	if (track.Loaded() && snapshot.camera)
 	{
 		Quat camlook;
 		camlook.Rotate(M_PI_2, 1, 0, 0);
-		Quat camorient = -(active_camera->GetOrientation() * camlook);
-		Vec3 campos = active_camera->GetPosition();
+		Quat camorient = -(snapshot.camera_orientation * camlook);
+		Vec3 campos = snapshot.camera_position;
 		float znear = 0.1f; // hardcoded in graphics
 		float zfar = settings.GetViewDistance();
-		tire_smoke.UpdateGraphics(camorient, campos, znear, zfar);
+		tire_smoke.UpdateGraphics(snapshot.particles, camorient, campos, znear, zfar);
+	}
+}
+
+void Game::PublishSnapshot()
+{
+	FrameSnapshot & snapshot = snapshots.getFirst();
+
+	snapshot.cars.resize(car_dynamics.size());
+	jobs.ParallelFor(0, car_dynamics.size(), 0, [this, &snapshot](int i)
+	{
+		car_graphics[i].GetState(car_dynamics[i], snapshot.cars[i]);
+	});
+
+	track.GetBodyTransforms(snapshot.track_bodies);
+
+	snapshot.map_cars.clear();
+	for (int i = 0; i != car_dynamics.size(); ++i)
+	{
+		const CarDynamics & car = car_dynamics[i];
+		bool player = (carcontrols_local.first == &car);
+		Vec3 carpos = ToMathVector<float>(car.GetCenterOfMass());
+		snapshot.map_cars.push_back(std::make_pair(carpos, player));
+	}
+
+	snapshot.particles = tire_smoke.GetParticles();
+
+	snapshot.camera = (active_camera != 0);
+	if (active_camera)
+	{
+		snapshot.camera_position = active_camera->GetPosition();
+		snapshot.camera_orientation = active_camera->GetOrientation();
+		snapshot.camera_fov = active_camera->GetFOV();
+
+		snapshot.reflection_position = snapshot.camera_position;
+		if (carcontrols_local.first)
+			snapshot.reflection_position = ToMathVector<float>(carcontrols_local.first->GetCenterOfMass());
 	}
+
+	SDL_AtomicLock(&snapshot_lock);
+	snapshots.swapFirst();
+	snapshot_ready = true;
+	SDL_AtomicUnlock(&snapshot_lock);
 }
 
-void Game::UpdateDriftScore(const int carid, const float dt)
+void Game::ApplySnapshot()
+{
+	PROFILE_ZONE("apply snapshot");
+
+	SDL_AtomicLock(&snapshot_lock);
+	if (snapshot_ready)
+	{
+		snapshots.swapLast();
+		snapshot_ready = false;
+	}
+	SDL_AtomicUnlock(&snapshot_lock);
+
+	FrameSnapshot & snapshot = snapshots.getLast();
+
+	if (snapshot.cars.size() == car_graphics.size())
+	{
+		for (size_t i = 0; i < car_graphics.size(); ++i)
+		{
+			car_graphics[i].Update(snapshot.cars[i]);
+		}
+	}
+
+	if (snapshot.interior_car >= 0 && snapshot.interior_car < (int)car_graphics.size())
+	{
+		// Hide glass and move up the close shadow distance if we're in the cockpit.
+		car_graphics[snapshot.interior_car].EnableInteriorView(snapshot.interior_view);
+		graphics->SetCloseShadow(snapshot.interior_view ? 1.0 : 5.0);
+	}
+
+	track.Update(snapshot.track_bodies);
+
+	if (!pause && track.Loaded())
+		trackmap.Update(settings.GetTrackmap(), snapshot.map_cars);
+
+	if (snapshot.hud.valid)
+		ApplyHUD(snapshot.hud);
+
+	UpdateParticleGraphics(snapshot);
+}
+
+/* Drop snapshots of cars that are about to change, the simulation must be idle... */
+void Game::ClearSnapshots()
+{
+	snapshots.getFirst() = FrameSnapshot();
+	snapshots.getSecond() = FrameSnapshot();
+	snapshots.getLast() = FrameSnapshot();
+	snapshot_ready = false;
+}
+
+void Game::UpdateDriftScore(const int carid, const float dt, DriftState & drift) const
 {
 	assert(carid >= 0 && carid < car_dynamics.size());
 	const CarDynamics & car = car_dynamics[carid];
@@ -2485,10 +3146,13 @@ void Game::UpdateDriftScore(const int carid, const float dt)
 			wheel_count++;
 	}
 
-	bool on_track = (wheel_count > 1);
-	bool is_drifting = false;
-	bool spin_out = false;
-	if (on_track)
+	drift.on_track = (wheel_count > 1);
+	drift.is_drifting = false;
+	drift.spin_out = false;
+	drift.score = 0;
+	drift.angle = 0;
+	drift.speed = 0;
+	if (drift.on_track)
 	{
 		// Car's velocity on the horizontal plane (should use surface plane here).
 		btVector3 car_velocity = car.GetVelocity();
@@ -2514,22 +3178,28 @@ void Game::UpdateDriftScore(const int carid, const float dt)
 			float angle_threshold(0.2);
 			if (timer.GetIsDrifting(carid)) angle_threshold = 0.1;
 
-			is_drifting = (car_angle > angle_threshold && car_angle <= M_PI / 2.0);
-			spin_out = (car_angle > M_PI / 2.0);
-
-			// Calculate score.
-			if (is_drifting)
-			{
-				// Base score is the drift distance.
-				timer.IncrementThisDriftScore(carid, dt * car_speed);
+			drift.is_drifting = (car_angle > angle_threshold && car_angle <= M_PI / 2.0);
+			drift.spin_out = (car_angle > M_PI / 2.0);
 
-				// Bonus score calculation is now done in TIMER.
-				timer.UpdateMaxDriftAngleSpeed(carid, car_angle, car_speed);
-			}
+			// Base score is the drift distance.
+			drift.score = dt * car_speed;
+			drift.angle = car_angle;
+			drift.speed = car_speed;
 		}
 	}
+}
+
+void Game::ApplyDriftScore(const int carid, const DriftState & drift)
+{
+	if (drift.is_drifting)
+	{
+		timer.IncrementThisDriftScore(carid, drift.score);
+
+		// Bonus score calculation is now done in TIMER.
+		timer.UpdateMaxDriftAngleSpeed(carid, drift.angle, drift.speed);
+	}
 
-	timer.SetIsDrifting(carid, is_drifting, on_track && !spin_out);
+	timer.SetIsDrifting(carid, drift.is_drifting, drift.on_track && !drift.spin_out);
 }
 
 void Game::BeginStartingUp()
@@ -2569,9 +3239,12 @@ void Game::LeaveGame()
 		info_output << "Saving replay to " << replayname << std::endl;
 		replay.StopRecording(replayname);
 
-		GuiOption::List replaylist;
-		PopulateReplayList(replaylist);
-		gui.SetOptionValues("game.selected_replay", "", replaylist, error_output);
+		if (!headless)
+		{
+			GuiOption::List replaylist;
+			PopulateReplayList(replaylist);
+			gui.SetOptionValues("game.selected_replay", "", replaylist, error_output);
+		}
 	}
 
 	if (replay.GetPlaying())
@@ -2579,6 +3252,7 @@ void Game::LeaveGame()
 
 	graphics->ClearStaticDrawables();
 
+	ClearSnapshots();
 	tire_smoke.Clear();
 	track.Clear();
 	car_dynamics.clear();
@@ -2604,22 +3278,28 @@ void Game::StartRace()
 
 void Game::PauseGame()
 {
+	pause = true;
+
+	if (headless)
+		return;
+
 	if (settings.GetMouseGrab())
 		window.ShowMouseCursor(true);
 
 	gui.ActivatePage("Main", 0.25, error_output);
-
-	pause = true;
 }
 
 void Game::ContinueGame()
 {
+	pause = false;
+
+	if (headless)
+		return;
+
 	if (settings.GetMouseGrab())
 		window.ShowMouseCursor(false);
 
 	gui.ActivatePage(settings.GetHUD(), 0.25, error_output);
-
-	pause = false;
 }
 
 void Game::RestartGame()
@@ -52,6 +52,8 @@
 #include "content/contentmanager.h"
 #include "updatemanager.h"
 #include "game_downloader.h"
+#include "job_system.h"
+#include "tripplebuffer.h"
 
 #include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
 #include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
@@ -79,10 +81,15 @@ private:
 
 	void MainLoop();
 
+	/// Advance game logic at a fixed timestep as fast as possible, no rendering.
+	void HeadlessLoop();
+
 	bool ParseArguments(std::list <std::string> & args);
 
 	bool InitCoreSubsystems();
 
+	bool InitGraphics(int texture_size);
+
 	void InitThreading();
 
 	void InitPlayerCar();
@@ -93,17 +100,34 @@ private:
 
 	void Test();
 
+	void BenchmarkCars(const std::string & filename, float duration, const std::string & trackname);
+
+	// car update time with 1, 4 and 16 ai cars, serial and on all job threads
+	void BenchmarkCarScaling();
+
+	void WriteBenchmarkResults(const std::string & filename);
+
 	void Tick(float dt);
 
 	void Draw();
 
+	void ProcessInputs();
+
 	void AdvanceGameLogic();
 
+	void SimulateFrame();
+
+	void UpdateCarDetail();
+
 	void UpdateCars(float dt);
 
 	void UpdateCarInputs(const int carid);
 
-	void UpdateHUD(const int carid, const std::vector<float> & carinputs);
+	struct HudState;
+
+	void UpdateHUD(const int carid, const std::vector<float> & carinputs, HudState & hud);
+
+	void ApplyHUD(const HudState & hud);
 
 	void UpdateTimer();
 
@@ -164,8 +188,6 @@ private:
 
 	void PopulateAntialiasList(GuiOption::List & antialiaslist);
 
-	void UpdateTrackMap();
-
 	void ShowLoadingScreen(float progress, float progress_max, const std::string & optional_text);
 
 	void ProcessNewSettings();
@@ -179,13 +201,25 @@ private:
 
 	void UpdateForceFeedback(float dt);
 
-	void AddTireSmokeParticles(const CarDynamics & car, float dt);
+	void AddTireSmokeParticles(const CarDynamics & car, float dt, std::vector<Vec3> & particles);
 
 	void UpdateParticles(float dt);
 
-	void UpdateParticleGraphics();
+	struct FrameSnapshot;
+
+	void UpdateParticleGraphics(FrameSnapshot & snapshot);
+
+	void PublishSnapshot();
+
+	void ApplySnapshot();
+
+	void ClearSnapshots();
 
-	void UpdateDriftScore(const int carid, const float dt);
+	struct DriftState;
+
+	void UpdateDriftScore(const int carid, const float dt, DriftState & drift) const;
+
+	void ApplyDriftScore(const int carid, const DriftState & drift);
 
 	std::string GetReplayRecordingFilename();
 
@@ -307,6 +341,7 @@ private:
 	Graphics * graphics;
 	StringIdMap stringMap;
 	EventSystem eventsystem;
+	JobSystem jobs;
 	ContentManager content;
 	Sound sound;
 	AutoUpdate autoupdate;
@@ -321,10 +356,22 @@ private:
 	float fps_max;
 
 	bool multithreaded;
+	bool parallelphysics;
+	bool deterministic;
 	bool profilingmode;
 	bool benchmode;
 	bool dumpfps;
 	bool pause;
+	bool headless;
+	bool carscaling; ///< run BenchmarkCarScaling in headless mode
+	unsigned int headless_frames; ///< physics frames to simulate in headless mode, benchmarks: 0 for the whole replay
+	unsigned int headless_aicars; ///< number of ai opponents in headless mode
+	std::string trace_file; ///< chrome trace written on shutdown
+	std::string benchmark_replay; ///< replay played back in benchmark mode
+	std::string benchmark_file; ///< benchmark timing percentiles output
+	std::string carbench_file; ///< car benchmark results, -carbench runs if set
+	std::string carbench_track; ///< car benchmark track, the settings track if empty
+	float carbench_duration; ///< simulated time per car and surface
 
 	std::vector <EventSystem::Joystick> controlgrab_joystick_state;
 	std::pair <int,int> controlgrab_mouse_coords;
@@ -342,6 +389,25 @@ private:
 	std::vector <CarGraphics> car_graphics;
 	std::vector <CarSound> car_sounds;
 	std::vector <CarInfo> car_info;
+
+	/// drift score changes of a car, computed in parallel, applied to timer in car order
+	struct DriftState
+	{
+		bool on_track;
+		bool is_drifting;
+		bool spin_out;
+		float score;
+		float angle;
+		float speed;
+	};
+
+	/// per car output of the parallel update stage, merged in car order
+	struct CarUpdate
+	{
+		std::vector<Vec3> smoke;
+		DriftState drift;
+	};
+	std::vector <CarUpdate> car_updates;
 	size_t player_car_id;
 	size_t car_edit_id;
 	int race_laps;
@@ -366,6 +432,51 @@ private:
 	Ai ai;
 	Http http;
 
+	/// player hud text, one string per hud signal
+	struct HudState
+	{
+		std::string debug_info[4];
+		std::string steering, throttle, brake;
+		std::string lap_time[3];
+		std::string pos, lap, score, message;
+		std::string gear, shift;
+		std::string speedometer, speed_norm, speed;
+		std::string tachometer, rpm_norm, rpm;
+		std::string abs, tcs, gas, nos;
+		bool valid;
+	};
+
+	/// simulation state needed to render a frame, the renderer only reads
+	/// snapshots so the next frame can be simulated while this one is drawn
+	struct FrameSnapshot
+	{
+		std::vector<CarGraphics::State> cars;
+		std::vector<Transform> track_bodies;
+		std::list<std::pair<Vec3, bool> > map_cars;
+		ParticleSystem::Particles particles;
+		HudState hud;
+		Vec3 camera_position;
+		Quat camera_orientation;
+		Vec3 reflection_position;
+		float camera_fov;
+		bool camera;
+		int interior_car; ///< car which changed interior view, -1 if none
+		bool interior_view;
+
+		FrameSnapshot();
+	};
+
+	/// simulation writes first, renderer reads last, second is the handoff
+	TrippleBuffer<FrameSnapshot> snapshots;
+	SDL_SpinLock snapshot_lock;
+	bool snapshot_ready;
+
+	/// frame simulation, runs on the job system while the previous frame is drawn
+	TaskGraph frame_tasks;
+	std::vector<std::vector<float> > tick_inputs; ///< local inputs for each tick of the frame
+	unsigned int tick_count; ///< ticks to simulate this frame
+	std::vector<float> local_inputs; ///< local inputs of the current tick
+
 	std::auto_ptr <ForceFeedback> forcefeedback;
 	double ff_update_time;
 };
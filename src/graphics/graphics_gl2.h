@@ -33,6 +33,7 @@
 #include "vertexbuffer.h"
 
 #include <memory>
+#include <map>
 
 struct GraphicsCamera;
 class Shader;
@@ -0,0 +1,89 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _GRAPHICS_NULL_H
+#define _GRAPHICS_NULL_H
+
+#include "graphics.h"
+
+#include <vector>
+
+/// graphics implementation that draws nothing and never touches OpenGL
+/// used by headless simulation runs where no window/context exists
+class GraphicsNull : public Graphics
+{
+public:
+	virtual bool Init(
+		const std::string & /*shaderpath*/,
+		unsigned /*resx*/, unsigned /*resy*/,
+		unsigned /*antialiasing*/,
+		bool /*enableshadows*/, int /*shadow_distance*/,
+		int /*shadow_quality*/, int /*reflection_type*/,
+		const std::string & /*static_reflectionmap_file*/,
+		const std::string & /*static_ambientmap_file*/,
+		int /*anisotropy*/, int /*texturesize*/,
+		int /*lighting_quality*/, bool /*newbloom*/,
+		bool /*newnormalmaps*/, bool /*dynamicsky*/,
+		const std::string & /*renderconfig*/,
+		std::ostream & /*info_output*/,
+		std::ostream & /*error_output*/)
+	{
+		return true;
+	}
+
+	virtual void Deinit() {}
+
+	virtual void BindDynamicVertexData(std::vector<SceneNode*> /*nodes*/) {}
+
+	virtual void BindStaticVertexData(std::vector<SceneNode*> /*nodes*/) {}
+
+	virtual void AddDynamicNode(SceneNode & /*node*/) {}
+
+	virtual void AddStaticNode(SceneNode & /*node*/) {}
+
+	virtual void ClearDynamicDrawables() {}
+
+	virtual void ClearStaticDrawables() {}
+
+	virtual void SetupScene(
+		float /*fov*/, float /*new_view_distance*/,
+		const Vec3 /*cam_position*/, const Quat & /*cam_rotation*/,
+		const Vec3 & /*dynamic_reflection_sample_pos*/,
+		std::ostream & /*error_output*/) {}
+
+	virtual void DrawScene(std::ostream & /*error_output*/) {}
+
+	virtual int GetMaxAnisotropy() const { return 0; }
+
+	virtual bool AntialiasingSupported() const { return false; }
+
+	virtual bool ReloadShaders(std::ostream & /*info_output*/, std::ostream & /*error_output*/) { return true; }
+
+	virtual void SetCloseShadow(float /*value*/) {}
+
+	virtual bool GetShadows() const { return false; }
+
+	virtual void SetFixedSkybox(bool /*enable*/) {}
+
+	virtual void SetSunDirection(const Vec3 & /*value*/) {}
+
+	virtual void SetContrast(float /*value*/) {}
+};
+
+#endif // _GRAPHICS_NULL_H
@@ -24,8 +24,11 @@
 
 #include <unordered_map>
 #include <functional>
+#include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 
 using std::vector;
 
@@ -145,17 +148,28 @@ static void CorrectEndian(std::vector<JoeTexCoord> & p)
 	}
 }
 
-static int BinaryRead ( void * buffer, unsigned int size, unsigned int count, FILE * f, const JoePack * pack )
+// reads from a file or from an entry mapped by a pack, the latter can be read by several threads
+struct JoeReader
+{
+	FILE * file;
+	const char * data;
+	unsigned size;
+	unsigned pos;
+};
+
+static int BinaryRead ( void * buffer, unsigned int size, unsigned int count, JoeReader & reader )
 {
 	unsigned int bytesread = 0;
 
-	if ( pack == NULL )
+	if ( reader.file )
 	{
-		bytesread = fread ( buffer, size, count, f );
+		bytesread = fread ( buffer, size, count, reader.file );
 	}
 	else
 	{
-		bytesread = pack->fread ( buffer, size, count );
+		bytesread = std::min ( count, ( reader.size - reader.pos ) / size );
+		memcpy ( buffer, reader.data + reader.pos, bytesread * size );
+		reader.pos += bytesread * size;
 	}
 
 	assert(bytesread == count);
@@ -208,13 +222,13 @@ bool ModelJoe03::Load ( const std::string & filename, std::ostream & err_output,
 {
 	Clear();
 
-	FILE * m_FilePointer = NULL;
+	JoeReader reader = {NULL, NULL, 0, 0};
 
 	//open file
 	if ( pack == NULL )
 	{
-		m_FilePointer = fopen(filename.c_str(), "rb");
-		if (!m_FilePointer)
+		reader.file = fopen(filename.c_str(), "rb");
+		if (!reader.file)
 		{
 			err_output << "MODEL_JOE03: Failed to open file " << filename << std::endl;
 			return false;
@@ -222,20 +236,20 @@ bool ModelJoe03::Load ( const std::string & filename, std::ostream & err_output,
 	}
 	else
 	{
-		if (!pack->fopen(filename))
+		const void * data = NULL;
+		if (!pack->GetFile(filename, data, reader.size))
 		{
 			err_output << "MODEL_JOE03: Failed to open file " << filename << " in " << pack->GetPath() << std::endl;
 			return false;
 		}
+		reader.data = (const char *)data;
 	}
 
-	bool loaded = LoadFromHandle ( m_FilePointer, pack, err_output );
+	bool loaded = LoadFromHandle ( reader, err_output );
 
 	// Clean up after everything
-	if ( pack == NULL )
-		fclose ( m_FilePointer );
-	else
-		pack->fclose();
+	if ( reader.file )
+		fclose ( reader.file );
 
 	if (!loaded)
 		err_output << "in " << filename << std::endl;
@@ -243,12 +257,12 @@ bool ModelJoe03::Load ( const std::string & filename, std::ostream & err_output,
 	return loaded;
 }
 
-bool ModelJoe03::LoadFromHandle ( FILE * m_FilePointer, const JoePack * pack, std::ostream & err_output )
+bool ModelJoe03::LoadFromHandle ( JoeReader & reader, std::ostream & err_output )
 {
 	JoeObject object;
 
 	// Read the header data and store it in our variable
-	BinaryRead ( &object.info, sizeof ( JoeHeader ), 1, m_FilePointer, pack );
+	BinaryRead ( &object.info, sizeof ( JoeHeader ), 1, reader );
 
 	object.info.magic = ENDIAN_SWAP_32 ( object.info.magic );
 	object.info.version = ENDIAN_SWAP_32 ( object.info.version );
@@ -270,7 +284,7 @@ bool ModelJoe03::LoadFromHandle ( FILE * m_FilePointer, const JoePack * pack, st
 	}
 
 	// Read in the model data
-	ReadData ( m_FilePointer, pack, object );
+	ReadData ( reader, object );
 
 	//generate metrics such as bounding box, etc
 	GenMeshMetrics();
@@ -279,7 +293,7 @@ bool ModelJoe03::LoadFromHandle ( FILE * m_FilePointer, const JoePack * pack, st
 	return true;
 }
 
-void ModelJoe03::ReadData ( FILE * m_FilePointer, const JoePack * pack, JoeObject & object )
+void ModelJoe03::ReadData ( JoeReader & reader, JoeObject & object )
 {
 	unsigned int num_frames = object.info.num_frames;
 	unsigned int num_faces = object.info.num_faces;
@@ -292,25 +306,25 @@ void ModelJoe03::ReadData ( FILE * m_FilePointer, const JoePack * pack, JoeObjec
 
 		frame.faces.resize(num_faces);
 
-		BinaryRead ( &frame.faces[0], sizeof ( JoeFace ), num_faces, m_FilePointer, pack );
+		BinaryRead ( &frame.faces[0], sizeof ( JoeFace ), num_faces, reader );
 		CorrectEndian ( frame.faces );
 
-		BinaryRead ( &frame.num_verts, sizeof ( unsigned int ), 1, m_FilePointer, pack );
+		BinaryRead ( &frame.num_verts, sizeof ( unsigned int ), 1, reader );
 		frame.num_verts = ENDIAN_SWAP_32 ( frame.num_verts );
-		BinaryRead ( &frame.num_texcoords, sizeof ( unsigned int ), 1, m_FilePointer, pack );
+		BinaryRead ( &frame.num_texcoords, sizeof ( unsigned int ), 1, reader );
 		frame.num_texcoords = ENDIAN_SWAP_32 ( frame.num_texcoords );
-		BinaryRead ( &frame.num_normals, sizeof ( unsigned int ), 1, m_FilePointer, pack );
+		BinaryRead ( &frame.num_normals, sizeof ( unsigned int ), 1, reader );
 		frame.num_normals = ENDIAN_SWAP_32 ( frame.num_normals );
 
 		frame.verts.resize(frame.num_verts);
 		frame.normals.resize(frame.num_normals);
 		frame.texcoords.resize(frame.num_texcoords);
 
-		BinaryRead ( &frame.verts[0], sizeof ( JoeVertex ), frame.num_verts, m_FilePointer, pack );
+		BinaryRead ( &frame.verts[0], sizeof ( JoeVertex ), frame.num_verts, reader );
 		CorrectEndian ( frame.verts );
-		BinaryRead ( &frame.normals[0], sizeof ( JoeVertex ), frame.num_normals, m_FilePointer, pack );
+		BinaryRead ( &frame.normals[0], sizeof ( JoeVertex ), frame.num_normals, reader );
 		CorrectEndian ( frame.normals );
-		BinaryRead ( &frame.texcoords[0], sizeof ( JoeTexCoord ), frame.num_texcoords, m_FilePointer, pack );
+		BinaryRead ( &frame.texcoords[0], sizeof ( JoeTexCoord ), frame.num_texcoords, reader );
 		CorrectEndian ( frame.texcoords );
 
 		// there seem to be models without texcoords like ct/glass.joe, why???
@@ -27,6 +27,7 @@
 
 class JoePack;
 struct JoeObject;
+struct JoeReader;
 
 // This class handles all of the loading code
 class ModelJoe03 : public Model
@@ -54,9 +55,9 @@ public:
 
 private:
 	// This reads in the data from the MD2 file and stores it in the member variable
-	void ReadData(FILE * m_FilePointer, const JoePack * pack, JoeObject & Object);
+	void ReadData(JoeReader & reader, JoeObject & Object);
 
-	bool LoadFromHandle(FILE * f, const JoePack * pack, std::ostream & error_output);
+	bool LoadFromHandle(JoeReader & reader, std::ostream & error_output);
 };
 
 #endif
@@ -28,6 +28,7 @@
 #include <SDL2/SDL_image.h>
 #endif
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -251,18 +252,22 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 	SDL_Surface * surface = 0;
 	if (info.data)
 	{
-		Uint32 rmask, gmask, bmask, amask;
+		// rgba masks, other pixel sizes are uploaded as they were decoded
+		Uint32 rmask = 0, gmask = 0, bmask = 0, amask = 0;
+		if (info.bytespp == 4)
+		{
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-		rmask = 0xff000000;
-		gmask = 0x00ff0000;
-		bmask = 0x0000ff00;
-		amask = 0x000000ff;
+			rmask = 0xff000000;
+			gmask = 0x00ff0000;
+			bmask = 0x0000ff00;
+			amask = 0x000000ff;
 #else
-		rmask = 0x000000ff;
-		gmask = 0x0000ff00;
-		bmask = 0x00ff0000;
-		amask = 0xff000000;
+			rmask = 0x000000ff;
+			gmask = 0x0000ff00;
+			bmask = 0x00ff0000;
+			amask = 0xff000000;
 #endif
+		}
 		surface = SDL_CreateRGBSurfaceFrom(
 			info.data, info.width, info.height,
 			info.bytespp * 8, info.width * info.bytespp,
@@ -356,6 +361,49 @@ bool Texture::Load(const std::string & path, const TextureInfo & info, std::ostr
 	return true;
 }
 
+bool Texture::Decode(const std::string & path, TextureInfo & info, std::vector<unsigned char> & pixels, std::ostream & error)
+{
+	if (info.data || info.cube)
+	{
+		return false;
+	}
+
+	std::ifstream file(path.c_str(), std::ifstream::in | std::ifstream::binary);
+	char magic[4];
+	if (!file.read(magic, 4) || IsDDS(magic, 4))
+	{
+		return false;
+	}
+	file.close();
+
+	SDL_Surface * surface = IMG_Load(path.c_str());
+	if (!surface)
+	{
+		error << "Error decoding texture file: " << path << std::endl;
+		error << IMG_GetError() << std::endl;
+		return false;
+	}
+
+	// pack rows, Load expects a pitch of width * bytespp
+	const unsigned bytespp = surface->format->BytesPerPixel;
+	const unsigned rowsize = surface->w * bytespp;
+	pixels.resize(rowsize * surface->h);
+	for (int y = 0; y < surface->h; ++y)
+	{
+		const unsigned char * row = (const unsigned char *)surface->pixels + y * surface->pitch;
+		std::copy(row, row + rowsize, pixels.begin() + y * rowsize);
+	}
+
+	info.data = pixels.empty() ? 0 : &pixels[0];
+	info.width = surface->w;
+	info.height = surface->h;
+	info.bytespp = bytespp;
+
+	SDL_FreeSurface(surface);
+
+	return info.data != 0;
+}
+
 void Texture::Unload()
 {
 	if (texid)
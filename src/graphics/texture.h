@@ -25,6 +25,7 @@
 
 #include <iosfwd>
 #include <string>
+#include <vector>
 
 class Texture : public TextureInterface
 {
@@ -35,6 +36,11 @@ public:
 
 	bool Load(const std::string & path, const TextureInfo & info, std::ostream & error);
 
+	/// Decode an image file into pixels without touching GL, safe to call from any thread.
+	/// On success info.data points into pixels, Load then only uploads them.
+	/// Cube maps and dds files are not decoded, they are left to Load.
+	static bool Decode(const std::string & path, TextureInfo & info, std::vector<unsigned char> & pixels, std::ostream & error);
+
 	void Unload();
 
 private:
@@ -0,0 +1,385 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "job_system.h"
+#include "frame_profiler.h"
+#include "unittest.h"
+
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_timer.h>
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define JOB_SYSTEM_SSE
+#endif
+
+// Jobs run on any thread, the simulation has to get the same results on every
+// one of them: round to nearest, denormals flushed to zero.
+static void SetFloatMode()
+{
+#ifdef JOB_SYSTEM_SSE
+	const unsigned int rounding = 0x6000; // MXCSR rounding control
+	const unsigned int ftz = 0x8000; // flush to zero
+	const unsigned int daz = 0x0040; // denormals are zero
+	_mm_setcsr((_mm_getcsr() & ~rounding) | ftz | daz);
+#endif
+}
+
+TaskGraph::TaskGraph()
+{
+	SDL_AtomicSet(&remaining, 0);
+}
+
+int TaskGraph::Add(const Function & function)
+{
+	tasks.push_back(Task());
+	Task & task = tasks.back();
+	task.function = function;
+	task.dependencies = 0;
+	SDL_AtomicSet(&task.pending, 0);
+	return tasks.size() - 1;
+}
+
+void TaskGraph::AddDependency(int before, int after)
+{
+	assert(before >= 0 && before < (int)tasks.size());
+	assert(after >= 0 && after < (int)tasks.size());
+	assert(before != after);
+	tasks[before].successors.push_back(after);
+	tasks[after].dependencies++;
+}
+
+void TaskGraph::Clear()
+{
+	assert(SDL_AtomicGet(&remaining) == 0);
+	tasks.clear();
+}
+
+JobSystem::JobSystem() :
+	work_available(0)
+{
+	SDL_AtomicSet(&quit, 0);
+}
+
+JobSystem::~JobSystem()
+{
+	Deinit();
+}
+
+void JobSystem::Init(unsigned worker_count)
+{
+	assert(workers.empty());
+
+	SDL_AtomicSet(&quit, 0);
+	work_available = SDL_CreateSemaphore(0);
+	SetFloatMode();
+
+	// worker 0 is the calling thread
+	workers.resize(worker_count + 1);
+	for (unsigned i = 0; i < workers.size(); ++i)
+	{
+		Worker * w = new Worker();
+		w->lock = 0;
+		w->thread = 0;
+		w->id = SDL_ThreadID();
+		w->system = this;
+		w->index = i;
+		workers[i] = w;
+	}
+
+	for (unsigned i = 1; i < workers.size(); ++i)
+	{
+		Worker * w = workers[i];
+		w->thread = SDL_CreateThread(WorkerThread, "JobSystemWorker", w);
+		w->id = SDL_GetThreadID(w->thread);
+	}
+}
+
+void JobSystem::Deinit()
+{
+	if (workers.empty())
+		return;
+
+	SDL_AtomicSet(&quit, 1);
+	for (unsigned i = 1; i < workers.size(); ++i)
+		SDL_SemPost(work_available);
+
+	for (unsigned i = 1; i < workers.size(); ++i)
+		SDL_WaitThread(workers[i]->thread, NULL);
+
+	for (unsigned i = 0; i < workers.size(); ++i)
+	{
+		assert(workers[i]->jobs.empty());
+		delete workers[i];
+	}
+	workers.clear();
+
+	SDL_DestroySemaphore(work_available);
+	work_available = 0;
+}
+
+void JobSystem::Run(TaskGraph & graph)
+{
+	Submit(graph);
+	Wait(graph);
+}
+
+void JobSystem::Submit(TaskGraph & graph)
+{
+	const int count = graph.tasks.size();
+	if (count == 0)
+		return;
+
+	// serial fallback if the pool has not been started
+	if (workers.empty())
+	{
+		std::vector<int> pending(count);
+		std::vector<int> ready;
+		for (int i = 0; i < count; ++i)
+		{
+			pending[i] = graph.tasks[i].dependencies;
+			if (pending[i] == 0)
+				ready.push_back(i);
+		}
+		while (!ready.empty())
+		{
+			TaskGraph::Task & task = graph.tasks[ready.back()];
+			ready.pop_back();
+			task.function();
+			for (size_t i = 0; i < task.successors.size(); ++i)
+			{
+				if (--pending[task.successors[i]] == 0)
+					ready.push_back(task.successors[i]);
+			}
+		}
+		return;
+	}
+
+	assert(SDL_AtomicGet(&graph.remaining) == 0);
+	SDL_AtomicSet(&graph.remaining, count);
+	for (int i = 0; i < count; ++i)
+		SDL_AtomicSet(&graph.tasks[i].pending, graph.tasks[i].dependencies);
+
+	const unsigned worker = GetWorkerIndex();
+	for (int i = 0; i < count; ++i)
+	{
+		if (graph.tasks[i].dependencies == 0)
+		{
+			Job job = {&graph, i};
+			Push(worker, job);
+		}
+	}
+}
+
+void JobSystem::Wait(TaskGraph & graph)
+{
+	if (SDL_AtomicGet(&graph.remaining) == 0)
+		return;
+
+	// help out until the graph has been processed
+	const unsigned worker = GetWorkerIndex();
+	Job job;
+	while (SDL_AtomicGet(&graph.remaining) > 0)
+	{
+		if (Pop(worker, job) || Steal(worker, job))
+			Execute(worker, job);
+		else
+			SDL_Delay(0);
+	}
+}
+
+void JobSystem::ParallelFor(int begin, int end, int grain, const std::function<void(int)> & function)
+{
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+
+	if (grain <= 0)
+		grain = std::max(1, count / int(4 * GetThreadCount()));
+
+	if (workers.size() < 2 || count <= grain)
+	{
+		for (int i = begin; i < end; ++i)
+			function(i);
+		return;
+	}
+
+	TaskGraph graph;
+	for (int i = begin; i < end; i += grain)
+	{
+		const int chunk_end = std::min(i + grain, end);
+		graph.Add([&function, i, chunk_end]()
+		{
+			for (int j = i; j < chunk_end; ++j)
+				function(j);
+		});
+	}
+	Run(graph);
+}
+
+int JobSystem::WorkerThread(void * data)
+{
+	Worker & self = *(Worker *)data;
+	JobSystem & system = *self.system;
+
+	std::ostringstream name;
+	name << "worker " << self.index;
+	FrameProfiler::SetThreadName(name.str());
+	SetFloatMode();
+
+	Job job;
+	while (true)
+	{
+		SDL_SemWait(system.work_available);
+		if (SDL_AtomicGet(&system.quit))
+			break;
+
+		while (system.Pop(self.index, job) || system.Steal(self.index, job))
+			system.Execute(self.index, job);
+	}
+	return 0;
+}
+
+unsigned JobSystem::GetWorkerIndex() const
+{
+	const SDL_threadID id = SDL_ThreadID();
+	for (unsigned i = 1; i < workers.size(); ++i)
+	{
+		if (workers[i]->id == id)
+			return i;
+	}
+	return 0;
+}
+
+void JobSystem::Push(unsigned worker, const Job & job)
+{
+	Worker & w = *workers[worker];
+	SDL_AtomicLock(&w.lock);
+	w.jobs.push_back(job);
+	SDL_AtomicUnlock(&w.lock);
+
+	// every job is announced once, so a sleeping worker never misses one
+	if (workers.size() > 1)
+		SDL_SemPost(work_available);
+}
+
+bool JobSystem::Pop(unsigned worker, Job & job)
+{
+	Worker & w = *workers[worker];
+	bool found = false;
+	SDL_AtomicLock(&w.lock);
+	if (!w.jobs.empty())
+	{
+		job = w.jobs.back();
+		w.jobs.pop_back();
+		found = true;
+	}
+	SDL_AtomicUnlock(&w.lock);
+	return found;
+}
+
+bool JobSystem::Steal(unsigned worker, Job & job)
+{
+	const unsigned count = workers.size();
+	for (unsigned n = 1; n < count; ++n)
+	{
+		Worker & w = *workers[(worker + n) % count];
+		bool found = false;
+		SDL_AtomicLock(&w.lock);
+		if (!w.jobs.empty())
+		{
+			job = w.jobs.front();
+			w.jobs.pop_front();
+			found = true;
+		}
+		SDL_AtomicUnlock(&w.lock);
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+void JobSystem::Execute(unsigned worker, const Job & job)
+{
+	TaskGraph & graph = *job.graph;
+	TaskGraph::Task & task = graph.tasks[job.task];
+	task.function();
+
+	// release successors before signaling completion so Run can't return early
+	for (size_t i = 0; i < task.successors.size(); ++i)
+	{
+		TaskGraph::Task & next = graph.tasks[task.successors[i]];
+		if (SDL_AtomicAdd(&next.pending, -1) == 1)
+		{
+			Job next_job = {&graph, task.successors[i]};
+			Push(worker, next_job);
+		}
+	}
+	SDL_AtomicAdd(&graph.remaining, -1);
+}
+
+QT_TEST(job_system_test)
+{
+	for (unsigned workers = 0; workers < 4; workers += 3)
+	{
+		JobSystem jobs;
+		jobs.Init(workers);
+
+		std::vector<int> values(1000, 0);
+		jobs.ParallelFor(0, values.size(), 0, [&values](int i) { values[i] = i; });
+		int sum = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+			sum += values[i];
+		QT_CHECK_EQUAL(sum, 999 * 1000 / 2);
+
+		// chain a -> (b, c) -> d, d must see the results of b and c
+		int a = 0, b = 0, c = 0, d = 0;
+		TaskGraph graph;
+		int ta = graph.Add([&]() { a = 1; });
+		int tb = graph.Add([&]() { b = a + 1; });
+		int tc = graph.Add([&]() { c = a + 2; });
+		int td = graph.Add([&]() { d = b + c; });
+		graph.AddDependency(ta, tb);
+		graph.AddDependency(ta, tc);
+		graph.AddDependency(tb, td);
+		graph.AddDependency(tc, td);
+		for (int run = 0; run < 10; ++run)
+		{
+			d = 0;
+			jobs.Run(graph);
+			QT_CHECK_EQUAL(d, 5);
+		}
+
+		// the calling thread is free to do other work until Wait
+		d = 0;
+		jobs.Submit(graph);
+		sum = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+			sum += values[i];
+		jobs.Wait(graph);
+		QT_CHECK_EQUAL(d, 5);
+		QT_CHECK_EQUAL(sum, 999 * 1000 / 2);
+
+		jobs.Deinit();
+	}
+}
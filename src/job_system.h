@@ -0,0 +1,134 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _JOB_SYSTEM_H
+#define _JOB_SYSTEM_H
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_thread.h>
+
+#include <functional>
+#include <vector>
+#include <deque>
+
+struct SDL_semaphore;
+
+/// A set of tasks and their dependencies, executed by JobSystem::Run.
+/// A graph can be run repeatedly, it is not modified by the execution.
+class TaskGraph
+{
+public:
+	typedef std::function<void()> Function;
+
+	TaskGraph();
+
+	/// Add a task, returns the task id.
+	int Add(const Function & function);
+
+	/// Task after will not start before task before has completed.
+	void AddDependency(int before, int after);
+
+	void Clear();
+
+	int Size() const { return tasks.size(); }
+
+private:
+	friend class JobSystem;
+
+	struct Task
+	{
+		Function function;
+		std::vector<int> successors;
+		int dependencies;
+		SDL_atomic_t pending;
+	};
+	std::vector<Task> tasks;
+	SDL_atomic_t remaining;
+};
+
+/// Work stealing thread pool. Every thread owns a job deque, jobs spawned
+/// by a thread are pushed to and popped from the back of its own deque,
+/// idle threads steal from the front of the other deques.
+/// The thread calling Init is treated as a worker too, it executes jobs
+/// while waiting in Run, so zero worker threads means serial execution.
+class JobSystem
+{
+public:
+	JobSystem();
+
+	~JobSystem();
+
+	/// Start worker_count worker threads in addition to the calling thread.
+	void Init(unsigned worker_count);
+
+	void Deinit();
+
+	/// Number of threads executing jobs, including the main thread.
+	unsigned GetThreadCount() const { return workers.size() ? workers.size() : 1; }
+
+	/// Execute all graph tasks in dependency order, returns once all are done.
+	void Run(TaskGraph & graph);
+
+	/// Start executing graph tasks and return immediately.
+	/// Every Submit has to be matched by a Wait on the same graph.
+	/// Without worker threads tasks are executed by Submit or Wait.
+	void Submit(TaskGraph & graph);
+
+	/// Help executing jobs until all graph tasks are done.
+	void Wait(TaskGraph & graph);
+
+	/// Call function(i) for every i in [begin, end), in chunks of grain indices.
+	/// A grain of zero picks a chunk size from the thread count.
+	void ParallelFor(int begin, int end, int grain, const std::function<void(int)> & function);
+
+private:
+	struct Job
+	{
+		TaskGraph * graph;
+		int task;
+	};
+
+	struct Worker
+	{
+		std::deque<Job> jobs;
+		SDL_SpinLock lock;
+		SDL_Thread * thread;
+		SDL_threadID id;
+		JobSystem * system;
+		unsigned index;
+	};
+
+	std::vector<Worker *> workers;
+	SDL_semaphore * work_available;
+	SDL_atomic_t quit;
+
+	static int WorkerThread(void * data);
+
+	unsigned GetWorkerIndex() const;
+
+	void Push(unsigned worker, const Job & job);
+
+	bool Pop(unsigned worker, Job & job);
+
+	bool Steal(unsigned worker, Job & job);
+
+	void Execute(unsigned worker, const Job & job);
+};
+
+#endif // _JOB_SYSTEM_H
@@ -17,158 +17,190 @@
 /*                                                                      */
 /************************************************************************/
 
+
 #include "joepack.h"
 #include "endian_utility.h"
 #include "unittest.h"
 
-#include <map>
-#include <fstream>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using std::string;
-using std::map;
-using std::ios_base;
 
 struct JoePack::Impl
 {
 	struct FatEntry
 	{
 		FatEntry() : offset(0), length(0) { }
+		string name;
 		unsigned offset;
 		unsigned length;
+		bool operator<(const FatEntry & other) const {return name < other.name;}
 	};
 	const std::string versionstr;
-	std::map <std::string, FatEntry> fat;
-	std::map <std::string, FatEntry>::iterator curfa;
-	std::ifstream f;
+	std::vector<FatEntry> fat; ///< sorted by name
+	const char * data;
+	size_t size;
+#ifdef _WIN32
+	std::vector<char> buffer;
+#endif
 
 	Impl();
+	~Impl();
 	bool Load(const string & fn);
+	bool Map(const string & fn);
 	void Close();
-	void fclose();
-	bool fopen(const string & fn);
-	int fread(void * buffer, const unsigned size, const unsigned count);
+	bool GetFile(const string & fn, const void *& data, unsigned & size) const;
 };
 
-JoePack::Impl::Impl() : versionstr("JPK01.00")
+static unsigned ReadUnsigned(const char * data)
 {
-	curfa = fat.end();
+	unsigned int value;
+	std::memcpy(&value, data, sizeof(value));
+	return ENDIAN_SWAP_32(value);
 }
 
-bool JoePack::Impl::Load(const string & fn)
+JoePack::Impl::Impl() : versionstr("JPK01.00"), data(0), size(0)
 {
-	Close();
-	f.clear();
-	f.open(fn.c_str(), ios_base::binary);
-	if (f)
-	{
-		//load header
-		char * versioncstr = new char[versionstr.length() + 1];
-		f.read(versioncstr, versionstr.length());
-		versioncstr[versionstr.length()] = '\0';
-		string fversionstr = versioncstr;
-		delete [] versioncstr;
-		if (fversionstr != versionstr)
-		{
-			//write out an error?
-			return false;
-		}
-
-		unsigned int numobjs = 0;
-		assert(sizeof(unsigned int) == 4);
-		f.read((char*)(&numobjs), sizeof(unsigned int));
-		numobjs = ENDIAN_SWAP_32(numobjs);
-
-		//DPRINT(numobjs << " objects");
+	// ctor
+}
 
-		unsigned int maxstrlen = 0;
-		f.read((char*)(&maxstrlen), sizeof(unsigned int));
-		maxstrlen = ENDIAN_SWAP_32(maxstrlen);
+JoePack::Impl::~Impl()
+{
+	Close();
+}
 
-		//DPRINT(maxstrlen << " max string length");
+bool JoePack::Impl::Map(const string & fn)
+{
+#ifdef _WIN32
+	std::ifstream f(fn.c_str(), std::ios_base::binary);
+	if (!f)
+		return false;
 
-		char * fnch = new char[maxstrlen+1];
+	f.seekg(0, std::ios_base::end);
+	buffer.resize(f.tellg());
+	f.seekg(0, std::ios_base::beg);
+	if (!buffer.empty() && !f.read(&buffer[0], buffer.size()))
+		return false;
 
-		//load FAT
-		for (unsigned int i = 0; i < numobjs; i++)
-		{
-			FatEntry fa;
-			f.read((char*)(&(fa.offset)), sizeof(unsigned int));
-			fa.offset = ENDIAN_SWAP_32(fa.offset);
-			f.read((char*)(&(fa.length)), sizeof(unsigned int));
-			fa.length = ENDIAN_SWAP_32(fa.length);
-			f.read(fnch, maxstrlen);
-			fnch[maxstrlen] = '\0';
-			string filename = fnch;
-			fat[filename] = fa;
-
-			//DPRINT(filename << ": offest " << fa.offset << " length " << fa.length);
-		}
+	data = buffer.empty() ? 0 : &buffer[0];
+	size = buffer.size();
+	return true;
+#else
+	int fd = open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
 
-		delete [] fnch;
-		return true;
-	}
-	else
-	{
-		//write an error?
+	struct stat st;
+	void * map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
 		return false;
-	}
-}
 
-void JoePack::Impl::Close()
-{
-	if (f.is_open()) f.close();
-	fat.clear();
-	curfa = fat.end();
+	data = (const char *)map;
+	size = st.st_size;
+	return true;
+#endif
 }
 
-void JoePack::Impl::fclose()
+bool JoePack::Impl::Load(const string & fn)
 {
-	curfa = fat.end();
-}
+	Close();
+	if (!Map(fn))
+		return false;
 
-bool JoePack::Impl::fopen(const string & fn)
-{
-	curfa = fat.find(fn);
-	if (curfa == fat.end())
+	//load header
+	const size_t header_size = versionstr.length() + 2 * sizeof(unsigned int);
+	if (size < header_size || versionstr.compare(0, versionstr.length(), data, versionstr.length()) != 0)
 	{
+		Close();
 		return false;
 	}
-	else
+
+	assert(sizeof(unsigned int) == 4);
+	const char * p = data + versionstr.length();
+	unsigned int numobjs = ReadUnsigned(p);
+	unsigned int maxstrlen = ReadUnsigned(p + 4);
+	p += 8;
+
+	//load FAT
+	const size_t entry_size = 2 * sizeof(unsigned int) + maxstrlen;
+	if ((size - header_size) / entry_size < numobjs)
 	{
-		f.seekg(curfa->second.offset);
-		return true;
+		Close();
+		return false;
 	}
-}
 
-int JoePack::Impl::fread(void * buffer, const unsigned size, const unsigned count)
-{
-	if (curfa != fat.end())
+	fat.resize(numobjs);
+	for (unsigned int i = 0; i < numobjs; i++)
 	{
-		unsigned int abspos = f.tellg();
-		assert(abspos >= curfa->second.offset);
-		unsigned int relpos = abspos - curfa->second.offset;
-		assert(curfa->second.length >= relpos);
-		unsigned int fileleft = curfa->second.length - relpos;
-		unsigned int requestedread = size*count;
-
-		assert(size != 0);
+		FatEntry & fa = fat[i];
+		fa.offset = ReadUnsigned(p);
+		fa.length = ReadUnsigned(p + 4);
+		const char * name = p + 8;
+		fa.name.assign(name, std::find(name, name + maxstrlen, '\0'));
+		p += entry_size;
 
-		if (requestedread > fileleft)
+		if (fa.offset > size || fa.length > size - fa.offset)
 		{
-			//overflow
-			requestedread = fileleft/size;
+			Close();
+			return false;
 		}
-
-		//DPRINT("JOEPACK fread: " << abspos << "," << relpos << "," << fileleft << "," << requestedread);
-		f.read((char *)buffer, requestedread);
-		return f.gcount()/size;
 	}
-	else
+
+	// later duplicates used to replace earlier ones, keep the last
+	std::stable_sort(fat.begin(), fat.end());
+	std::vector<FatEntry>::iterator last = fat.begin();
+	for (std::vector<FatEntry>::iterator i = fat.begin(); i != fat.end(); ++i)
 	{
-		//write error?
-		return 0;
+		if (last->name != i->name)
+			++last;
+		if (last != i)
+			*last = *i;
 	}
+	if (!fat.empty())
+		fat.erase(last + 1, fat.end());
+
+	return true;
+}
+
+void JoePack::Impl::Close()
+{
+#ifdef _WIN32
+	std::vector<char>().swap(buffer);
+#else
+	if (data)
+		munmap((void *)data, size);
+#endif
+	data = 0;
+	size = 0;
+	fat.clear();
+}
+
+bool JoePack::Impl::GetFile(const string & fn, const void *& file_data, unsigned & file_size) const
+{
+	FatEntry key;
+	key.name = fn;
+	std::vector<FatEntry>::const_iterator i = std::lower_bound(fat.begin(), fat.end(), key);
+	if (i == fat.end() || i->name != fn)
+		return false;
+
+	file_data = data + i->offset;
+	file_size = i->length;
+	return true;
 }
 
 JoePack::JoePack()
@@ -194,12 +226,7 @@ void JoePack::Close()
 	impl->Close();
 }
 
-void JoePack::fclose() const
-{
-	impl->fclose();
-}
-
-bool JoePack::fopen(const string & fn) const
+bool JoePack::GetFile(const string & fn, const void *& data, unsigned & size) const
 {
 	string newfn;
 	if (fn.find(packpath, 0) < fn.length())
@@ -210,24 +237,62 @@ bool JoePack::fopen(const string & fn) const
 	{
 		newfn = fn;
 	}
-	return impl->fopen(newfn);
-}
-
-int JoePack::fread(void * buffer, const unsigned size, const unsigned count) const
-{
-	return impl->fread(buffer, size, count);
+	return impl->GetFile(newfn, data, size);
 }
 
 QT_TEST(joepack_test)
 {
 	JoePack p;
 	QT_CHECK(p.Load("data/test/test1.jpk"));
-	QT_CHECK(p.fopen("testlist.txt"));
-	char buf[1000];
-	unsigned int chars = p.fread(buf, 1, 999);
-	QT_CHECK_EQUAL(chars, 16);
-	buf[chars] = '\0';
+	const void * data = 0;
+	unsigned size = 0;
+	QT_CHECK(p.GetFile("testlist.txt", data, size));
+	QT_CHECK_EQUAL(size, 16);
 	string comparisonstr = "This is\na test.\n";
-	string filestr = buf;
-	QT_CHECK_EQUAL(buf,comparisonstr);
+	string filestr((const char *)data, size);
+	QT_CHECK_EQUAL(filestr, comparisonstr);
+}
+
+QT_TEST(joepack_lookup_test)
+{
+	// write a pack with entries out of order
+	const char * names[] = {"b.txt", "a.txt", "c/d.txt"};
+	const char * contents[] = {"bb", "a", "ddd"};
+	const unsigned count = 3, maxstrlen = 8;
+	std::string pack("JPK01.00");
+	unsigned header[] = {ENDIAN_SWAP_32(count), ENDIAN_SWAP_32(maxstrlen)};
+	pack.append((const char *)header, sizeof(header));
+	unsigned offset = pack.size() + count * (8 + maxstrlen);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned entry[] = {ENDIAN_SWAP_32(offset), ENDIAN_SWAP_32(unsigned(std::strlen(contents[i])))};
+		pack.append((const char *)entry, sizeof(entry));
+		std::string name(names[i]);
+		name.resize(maxstrlen, '\0');
+		pack.append(name);
+		offset += std::strlen(contents[i]);
+	}
+	for (unsigned i = 0; i < count; ++i)
+		pack.append(contents[i]);
+
+	const std::string path = "joepack_lookup_test.jpk";
+	std::ofstream(path.c_str(), std::ios_base::binary) << pack;
+
+	JoePack p;
+	QT_CHECK(p.Load(path));
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const void * data = 0;
+		unsigned size = 0;
+		QT_CHECK(p.GetFile(names[i], data, size));
+		QT_CHECK_EQUAL(std::string((const char *)data, size), contents[i]);
+		QT_CHECK(p.GetFile(path + "/" + names[i], data, size));
+		QT_CHECK_EQUAL(size, std::strlen(contents[i]));
+	}
+	const void * data = 0;
+	unsigned size = 0;
+	QT_CHECK(!p.GetFile("c.txt", data, size));
+	p.Close();
+
+	std::remove(path.c_str());
 }
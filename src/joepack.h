@@ -22,6 +22,9 @@
 
 #include <string>
 
+/// Read only view of a JPK01.00 archive. The archive is mapped into memory,
+/// entries are handed out as pointers into the mapping without copying.
+/// A loaded pack can be read from several threads at once.
 class JoePack
 {
 public:
@@ -35,11 +38,9 @@ public:
 
 	void Close();
 
-	bool fopen(const std::string & fn) const;
-
-	void fclose() const;
-
-	int fread(void * buffer, const unsigned size, const unsigned count) const;
+	/// Get the contents of entry fn, fn may be prefixed with the pack path.
+	/// The data stays valid until the pack is closed, false if there is no such entry.
+	bool GetFile(const std::string & fn, const void *& data, unsigned & size) const;
 
 private:
 	std::string packpath;
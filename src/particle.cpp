@@ -87,6 +87,18 @@ void ParticleSystem::Update(float dt)
 }
 
 void ParticleSystem::UpdateGraphics(
+	const Quat & camdir,
+	const Vec3 & campos,
+	float znear,
+	float zfar,
+	float fovy,
+	float fovz)
+{
+	UpdateGraphics(particles, camdir, campos, znear, zfar, fovy, fovz);
+}
+
+void ParticleSystem::UpdateGraphics(
+	Particles & state,
 	const Quat & camdir,
 	const Vec3 & campos,
 	float znear,
@@ -102,9 +114,9 @@ void ParticleSystem::UpdateGraphics(
 
 	// get particle position in camera space
 	distance_from_cam.clear();
-	for (unsigned i = 0; i < particles.size(); ++i)
+	for (unsigned i = 0; i < state.size(); ++i)
 	{
-		Particle & p = particles[i];
+		Particle & p = state[i];
 		Vec3 pos = p.start_position;
 		pos = pos + p.direction * p.time * p.speed - campos;
 		camdir.RotateVector(pos);
@@ -120,14 +132,14 @@ void ParticleSystem::UpdateGraphics(
 
 	// update vertex data
 	varray.Clear();
-	for (size_t i = 0; i < particles.size(); ++i)
+	for (size_t i = 0; i < state.size(); ++i)
 	{
 		// cull particles outside of [znear, zfar]
 		// todo: cull particles outside of view frustum
 		if (distance_from_cam[i] < znear || distance_from_cam[i] > zfar)
 			continue;
 
-		Particle & p = particles[i];
+		Particle & p = state[i];
 		Vec3 pos = p.position;
 
 		float trans = p.transparency * std::pow((1.0f - p.time / p.longevity), 4);
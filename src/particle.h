@@ -36,6 +36,20 @@ class Texture;
 class ParticleSystem
 {
 public:
+	struct Particle
+	{
+		Vec3 start_position; ///< start position in world space
+		Vec3 direction;		///< direction in world space
+		Vec3 position;		///< position in camera space
+		float transparency; ///< transparency factor
+		float speed;		///< initial velocity along direction
+		float size;			///< initial size
+		float longevity;	///< particle age limit
+		float time;			///< particle age, time since the particle was created
+		int tid;			///< particle texture atlas tile id 0-8
+	};
+	typedef std::vector<Particle> Particles;
+
 	ParticleSystem();
 
 	/// Load texture atlas and setup drawable.
@@ -61,6 +75,15 @@ public:
 		float znear, float zfar,
 		float fovy = 0, float fovz = 0);
 
+	/// Particles graphics update based on a copy of the physics state.
+	/// Allows the graphics update to run while the physics state advances.
+	void UpdateGraphics(
+		Particles & state,
+		const Quat & camdir,
+		const Vec3 & campos,
+		float znear, float zfar,
+		float fovy = 0, float fovz = 0);
+
 	void Clear();
 
 	void SetParameters(
@@ -77,22 +100,12 @@ public:
 
 	unsigned NumParticles() { return particles.size(); }
 
+	const Particles & GetParticles() const { return particles; }
+
 	SceneNode & GetNode() { return node; }
 
 private:
-	struct Particle
-	{
-		Vec3 start_position; ///< start position in world space
-		Vec3 direction;		///< direction in world space
-		Vec3 position;		///< position in camera space
-		float transparency; ///< transparency factor
-		float speed;		///< initial velocity along direction
-		float size;			///< initial size
-		float longevity;	///< particle age limit
-		float time;			///< particle age, time since the particle was created
-		int tid;			///< particle texture atlas tile id 0-8
-	};
-	std::vector<Particle> particles;
+	Particles particles;
 	std::vector<float> distance_from_cam;
 	unsigned max_particles;
 	unsigned texture_tiles;
@@ -97,6 +97,7 @@ void PathManager::Init(std::ostream & info_output, std::ostream & error_output)
 
 	MakeDir(settings_path);
 	MakeDir(GetTrackRecordsPath());
+	MakeDir(GetTrackCachePath());
 	MakeDir(GetReplayPath());
 	MakeDir(GetScreenshotPath());
 	MakeDir(GetTemporaryFolder());
@@ -253,6 +254,11 @@ std::string PathManager::GetTrackRecordsPath() const
 	return settings_path+"/records"+profile_suffix;
 }
 
+std::string PathManager::GetTrackCachePath() const
+{
+	return settings_path+"/trackcache";
+}
+
 std::string PathManager::GetSettingsFile() const
 {
 	return settings_path+"/VDrift.config"+profile_suffix;
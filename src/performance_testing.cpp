@@ -18,19 +18,128 @@
 /************************************************************************/
 
 #include "performance_testing.h"
+#include "bezier.h"
+#include "replay.h"
 #include "physics/carinput.h"
 #include "physics/dynamicsworld.h"
 #include "physics/tracksurface.h"
 #include "content/contentmanager.h"
 #include "cfg/ptree.h"
+#include "quickprof.h"
 
 #include "BulletCollision/CollisionDispatch/btCollisionObject.h"
 #include "BulletCollision/CollisionShapes/btStaticPlaneShape.h"
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <cstdlib>
+#include <cmath>
 #include <ctime>
+#include <new>
+
+#ifdef ENABLE_ALLOCATION_COUNT
+// Heap allocation counter used by the benchmark, replaces the global
+// operator new, so it is only built with the alloc_count build option.
+// Only a thread that has enabled counting with AllocationCounter counts,
+// into its own counter, all other threads pay a thread local pointer test.
+static thread_local unsigned long * allocation_counter = 0;
+
+/// Counts the heap allocations of the calling thread while in scope.
+struct AllocationCounter
+{
+	unsigned long count;
+
+	AllocationCounter() : count(0)
+	{
+		allocation_counter = &count;
+	}
+
+	~AllocationCounter()
+	{
+		allocation_counter = 0;
+	}
+};
+
+void * operator new(std::size_t size)
+{
+	if (allocation_counter)
+		++*allocation_counter;
+
+	void * p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void * p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+	std::free(p);
+}
+#endif
+
+/// Forwards to the car action and measures the time spent in it.
+struct TimedAction : public btActionInterface
+{
+	CarDynamics & car;
+	quickprof::Clock clock;
+	unsigned long long time_us;
+
+	TimedAction(CarDynamics & car) : car(car), time_us(0) {}
+
+	void updateAction(btCollisionWorld * collisionWorld, btScalar dt)
+	{
+		unsigned long long start = clock.getTimeMicroseconds();
+		car.updateAction(collisionWorld, dt);
+		time_us += clock.getTimeMicroseconds() - start;
+	}
+
+	void debugDraw(btIDebugDraw * debugDrawer)
+	{
+		car.debugDraw(debugDrawer);
+	}
+};
+
+/// Repeating 10 second script: accelerate weaving, brake hard, half throttle turn.
+static void GetScriptedInput(float t, std::vector<float> & input)
+{
+	const float phase = std::fmod(t, 10.0f);
+	float steer = 0;
+	if (phase < 6)
+	{
+		input[CarInput::THROTTLE] = 1;
+		input[CarInput::BRAKE] = 0;
+		steer = 0.3 * std::sin(t);
+	}
+	else if (phase < 8)
+	{
+		input[CarInput::THROTTLE] = 0;
+		input[CarInput::BRAKE] = 1;
+	}
+	else
+	{
+		input[CarInput::THROTTLE] = 0.5;
+		input[CarInput::BRAKE] = 0;
+		steer = 1;
+	}
+	input[CarInput::STEER_RIGHT] = steer > 0 ? steer : 0;
+	input[CarInput::STEER_LEFT] = steer < 0 ? -steer : 0;
+}
+
+// tire table error bound used by TestTireTables
+static const float tire_table_error = 1E-2;
 
 static inline float ConvertToMPH(float ms)
 {
@@ -76,18 +185,7 @@ void PerformanceTesting::Test(
 {
 	info_output << "Beginning car performance test on " << carname << std::endl;
 
-	// init track
-	assert(!track);
-	assert(!plane);
-	btVector3 planeNormal(0, 0, 1);
-	btScalar planeConstant = 0;
-	plane = new btStaticPlaneShape(planeNormal, planeConstant);
-	plane->setUserPointer(static_cast<void*>(&surface));
-	track = new btCollisionObject();
-	track->setCollisionShape(plane);
-	track->setActivationState(DISABLE_SIMULATION);
-	track->setUserPointer(static_cast<void*>(&surface));
-	world.addCollisionObject(track);
+	AddPlane();
 
 	//load the car dynamics
 	std::shared_ptr<PTree> cfg;
@@ -102,10 +200,12 @@ void PerformanceTesting::Test(
 	btQuaternion rot = btQuaternion::getIdentity();
 	const std::string tire = "";
 	const bool damage = false;
+	car.SetTireTables("", tire_table_error);
 	if (!car.Load(*cfg, cardir, tire, pos, rot, damage, world, content, error_output))
 	{
 		return;
 	}
+	car.EnableTireTables(false);
 
 	btVector3 cm = -car.GetCenterOfMassOffset();
 	info_output << "Car dynamics loaded" << std::endl;
@@ -126,10 +226,330 @@ void PerformanceTesting::Test(
 	TestMaxSpeed(info_output, error_output);
 	TestStoppingDistance(false, info_output, error_output);
 	TestStoppingDistance(true, info_output, error_output);
+	TestSubsteps(info_output, error_output);
+	TestTireTables(info_output, error_output);
+	TestReplay(info_output, error_output);
+	TestRollback(info_output, error_output);
 
 	info_output << "Car performance test complete." << std::endl;
 }
 
+void PerformanceTesting::AddPlane()
+{
+	assert(!track);
+	assert(!plane);
+	btVector3 planeNormal(0, 0, 1);
+	btScalar planeConstant = 0;
+	plane = new btStaticPlaneShape(planeNormal, planeConstant);
+	plane->setUserPointer(static_cast<void*>(&surface));
+	track = new btCollisionObject();
+	track->setCollisionShape(plane);
+	track->setActivationState(DISABLE_SIMULATION);
+	track->setUserPointer(static_cast<void*>(&surface));
+	world.addCollisionObject(track);
+}
+
+bool PerformanceTesting::Benchmark(
+	const std::string & cardir,
+	const std::string & carname,
+	const btVector3 & position,
+	const btQuaternion & rotation,
+	float duration,
+	ContentManager & content,
+	BenchmarkResult & result,
+	std::ostream & error_output)
+{
+	std::shared_ptr<PTree> cfg;
+	content.load(cfg, cardir, carname + ".car");
+	if (!cfg->size())
+	{
+		error_output << "Failed to load car config: " << carname << std::endl;
+		return false;
+	}
+
+	CarDynamics testcar;
+	const std::string tire = "";
+	const bool damage = false;
+	if (!testcar.Load(*cfg, cardir, tire, position, rotation, damage, world, content, error_output))
+	{
+		return false;
+	}
+	testcar.SetAutoShift(true);
+	testcar.SetAutoClutch(true);
+	testcar.SetTCS(true);
+	testcar.SetABS(true);
+
+	// swap the car action for the timed one
+	TimedAction action(testcar);
+	world.removeAction(&testcar);
+	world.addAction(&action);
+
+	const float dt = 1 / 90.0;
+	const unsigned int ticks = duration / dt;
+	std::vector<float> input(CarInput::INVALID, 0.0f);
+
+#ifdef ENABLE_ALLOCATION_COUNT
+	// allocations on job threads are not counted
+	unsigned long allocation_count = 0;
+#endif
+	quickprof::Clock clock;
+	for (unsigned int i = 0; i < ticks; ++i)
+	{
+		GetScriptedInput(i * dt, input);
+
+#ifdef ENABLE_ALLOCATION_COUNT
+		AllocationCounter counter;
+		testcar.Update(input);
+		world.update(dt);
+		allocation_count += counter.count;
+#else
+		testcar.Update(input);
+		world.update(dt);
+#endif
+	}
+	const unsigned long long total_us = clock.getTimeMicroseconds();
+
+	world.removeAction(&action);
+	world.addAction(&testcar);
+
+	result.ticks = ticks;
+	result.update_us = ticks ? double(action.time_us) / ticks : 0;
+	result.ticks_per_second = total_us ? ticks * 1E6 / total_us : 0;
+#ifdef ENABLE_ALLOCATION_COUNT
+	result.allocs_per_tick = ticks ? double(allocation_count) / ticks : 0;
+#else
+	result.allocs_per_tick = -1;
+#endif
+	return true;
+}
+
+void PerformanceTesting::BenchmarkRaycast(
+	int cars,
+	const btVector3 & position,
+	const btQuaternion & rotation,
+	float duration,
+	RaycastResult & result)
+{
+	// two cars per row, 4 x 8 meters apart, wheels at the corners of a 1.6 x 2.6 meter box
+	const btVector3 wheels[4] = {
+		btVector3(-0.8, 1.3, 0), btVector3(0.8, 1.3, 0),
+		btVector3(-0.8, -1.3, 0), btVector3(0.8, -1.3, 0)};
+	const btVector3 raydir = quatRotate(rotation, btVector3(0, 0, -1));
+	const btScalar raylen = 4;
+
+	std::vector<DynamicsWorld::Ray> rays(cars * 4);
+	std::vector<CollisionContact> contacts[3];
+	contacts[0].resize(rays.size());
+	contacts[1].resize(rays.size());
+	contacts[2].resize(rays.size());
+	std::vector<DynamicsWorld::RayCache> caches(rays.size());
+	for (int i = 0; i < cars; ++i)
+	{
+		btVector3 offset(i % 2 ? 2 : -2, -8 * (i / 2), 1);
+		for (int j = 0; j < 4; ++j)
+		{
+			DynamicsWorld::Ray & ray = rays[i * 4 + j];
+			ray.origin = position + quatRotate(rotation, offset + wheels[j]);
+			ray.direction = raydir;
+			ray.length = raylen;
+			ray.caster = 0;
+			ray.contact = &contacts[1][i * 4 + j];
+			ray.cache = 0;
+			ray.hit = false;
+		}
+	}
+
+	const float dt = 1 / 90.0;
+	const unsigned int ticks = duration / dt;
+	quickprof::Clock clock;
+
+	unsigned long long start = clock.getTimeMicroseconds();
+	for (unsigned int i = 0; i < ticks; ++i)
+	{
+		for (size_t j = 0; j < rays.size(); ++j)
+			world.castRay(rays[j].origin, rays[j].direction, rays[j].length, rays[j].caster, contacts[0][j]);
+	}
+	const unsigned long long ray_us = clock.getTimeMicroseconds() - start;
+
+	start = clock.getTimeMicroseconds();
+	for (unsigned int i = 0; i < ticks; ++i)
+	{
+		world.castRays(&rays[0], rays.size());
+	}
+	const unsigned long long batch_us = clock.getTimeMicroseconds() - start;
+
+	for (size_t j = 0; j < rays.size(); ++j)
+	{
+		rays[j].contact = &contacts[2][j];
+		rays[j].cache = &caches[j];
+	}
+	start = clock.getTimeMicroseconds();
+	for (unsigned int i = 0; i < ticks; ++i)
+	{
+		world.castRays(&rays[0], rays.size());
+	}
+	const unsigned long long cached_us = clock.getTimeMicroseconds() - start;
+
+	result.cars = cars;
+	result.ray_us = ticks ? double(ray_us) / (ticks * cars) : 0;
+	result.batch_us = ticks ? double(batch_us) / (ticks * cars) : 0;
+	result.cached_us = ticks ? double(cached_us) / (ticks * cars) : 0;
+	result.mismatches = 0;
+	for (size_t j = 0; j < rays.size(); ++j)
+	{
+		const CollisionContact & a = contacts[0][j];
+		for (int k = 1; k < 3; ++k)
+		{
+			const CollisionContact & b = contacts[k][j];
+			if (a.GetPosition() != b.GetPosition() || a.GetNormal() != b.GetNormal() ||
+				a.GetDepth() != b.GetDepth() || a.GetPatchId() != b.GetPatchId() ||
+				a.GetPatch() != b.GetPatch() || &a.GetSurface() != &b.GetSurface() ||
+				a.GetObject() != b.GetObject())
+				result.mismatches++;
+		}
+	}
+}
+
+void PerformanceTesting::BenchmarkPatches(std::ostream & info_output)
+{
+	// curved patches spread over a track sized area, rays hitting in and around them
+	const int patch_count = 256;
+	const int rays_per_patch = 16;
+	const int repeats = 100;
+	std::srand(1);
+
+	std::vector<Bezier> patches(patch_count);
+	std::vector<BezierPowerForm> forms(patch_count);
+	for (int i = 0; i < patch_count; ++i)
+	{
+		const float x0 = 2000.0f * std::rand() / RAND_MAX - 1000;
+		const float y0 = 2000.0f * std::rand() / RAND_MAX - 1000;
+		std::stringstream stream;
+		for (int x = 0; x < 4; ++x)
+			for (int y = 0; y < 4; ++y)
+				stream << x0 + x * 4 << " " << y0 + y * 3.3 << " "
+					<< 1.5f * std::rand() / RAND_MAX + 0.3 * x * y << " ";
+		patches[i].ReadFrom(stream);
+		forms[i].Set(patches[i]);
+	}
+
+	const int ray_count = patch_count * rays_per_patch;
+	std::vector<const BezierPowerForm *> ray_forms(ray_count);
+	std::vector<Vec3> origins(ray_count), directions(ray_count);
+	std::vector<Vec3> points[3], normals[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		points[k].resize(ray_count);
+		normals[k].resize(ray_count);
+	}
+	for (int i = 0; i < ray_count; ++i)
+	{
+		const Bezier & patch = patches[i / rays_per_patch];
+		const float u = 1.2f * std::rand() / RAND_MAX - 0.1f;
+		const float v = 1.2f * std::rand() / RAND_MAX - 0.1f;
+		ray_forms[i] = &forms[i / rays_per_patch];
+		directions[i] = Vec3(0.2f * std::rand() / RAND_MAX - 0.1f, 0.2f * std::rand() / RAND_MAX - 0.1f, -1).Normalize();
+		origins[i] = patch.SurfCoord(u, v) - directions[i] * 2;
+	}
+
+	std::vector<char> hits[3];
+	for (int k = 0; k < 3; ++k)
+		hits[k].resize(ray_count);
+
+	quickprof::Clock clock;
+	unsigned long long time_us[3];
+	unsigned long long start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeats; ++r)
+		for (int i = 0; i < ray_count; ++i)
+			hits[0][i] = patches[i / rays_per_patch].CollideSubDivQuadSimpleNorm(origins[i], directions[i], points[0][i], normals[0][i]);
+	time_us[0] = clock.getTimeMicroseconds() - start;
+
+	start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeats; ++r)
+		for (int i = 0; i < ray_count; ++i)
+			hits[1][i] = ray_forms[i]->Collide(origins[i], directions[i], points[1][i], normals[1][i]);
+	time_us[1] = clock.getTimeMicroseconds() - start;
+
+	start = clock.getTimeMicroseconds();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (int i = 0; i < ray_count; i += 32)
+		{
+			const unsigned mask = BezierPowerForm::Collide(
+				&ray_forms[i], &origins[i], &directions[i], 32, &points[2][i], &normals[2][i]);
+			for (int j = 0; j < 32; ++j)
+				hits[2][i + j] = (mask >> j) & 1;
+		}
+	}
+	time_us[2] = clock.getTimeMicroseconds() - start;
+
+	int mismatches = 0;
+	float max_error = 0;
+	for (int i = 0; i < ray_count; ++i)
+	{
+		for (int k = 1; k < 3; ++k)
+		{
+			if (hits[k][i] != hits[0][i])
+				mismatches++;
+			else if (hits[0][i])
+				max_error = std::max(max_error, (points[k][i] - points[0][i]).Magnitude());
+		}
+	}
+
+	const double tests = double(ray_count) * repeats;
+	info_output << "Road patch ray test reference / power form / batched: "
+		<< time_us[0] * 1E3 / tests << " / "
+		<< time_us[1] * 1E3 / tests << " / "
+		<< time_us[2] * 1E3 / tests << " ns, "
+		<< mismatches << " hit mismatches, "
+		<< max_error << " m maximum point error" << std::endl;
+}
+
+bool PerformanceTesting::WriteResults(
+	const std::string & filename,
+	const std::vector<BenchmarkResult> & results,
+	std::ostream & error_output)
+{
+	std::ofstream out(filename.c_str());
+	if (!out)
+	{
+		error_output << "Unable to write benchmark results to " << filename << std::endl;
+		return false;
+	}
+
+	const std::string ext = ".json";
+	const bool json = filename.size() >= ext.size() &&
+		filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+	if (json)
+	{
+		out << "[\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const BenchmarkResult & r = results[i];
+			out << "\t{\"car\": \"" << r.car << "\", "
+				<< "\"surface\": \"" << r.surface << "\", "
+				<< "\"ticks\": " << r.ticks << ", "
+				<< "\"update_us\": " << r.update_us << ", "
+				<< "\"ticks_per_second\": " << r.ticks_per_second << ", "
+				<< "\"allocs_per_tick\": " << r.allocs_per_tick << "}"
+				<< (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "]\n";
+	}
+	else
+	{
+		out << "car,surface,ticks,update_us,ticks_per_second,allocs_per_tick\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const BenchmarkResult & r = results[i];
+			out << r.car << "," << r.surface << "," << r.ticks << ","
+				<< r.update_us << "," << r.ticks_per_second << ","
+				<< r.allocs_per_tick << "\n";
+		}
+	}
+	return true;
+}
+
 void PerformanceTesting::ResetCar()
 {
 	std::istringstream statestream(carstate);
@@ -312,3 +732,311 @@ void PerformanceTesting::TestStoppingDistance(bool abs, std::ostream & info_outp
 		info_output << "(no ABS)";
 	info_output << ": " << ConvertToFeet((stopend-stopstart).length()) << " ft" << std::endl;
 }
+
+void PerformanceTesting::TestSubsteps(std::ostream & info_output, std::ostream & /*error_output*/)
+{
+	info_output << "Testing adaptive against fixed substeps" << std::endl;
+
+	const float maxtime = 30.0;
+	const float dt = 1/90.0;
+	const int ticks = maxtime / dt;
+
+	// adaptive first, then the fixed default
+	std::vector<btVector3> path[2];
+	btScalar speed[2];
+	float cputime[2];
+	float substeps[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		ResetCar();
+		if (pass == 0)
+			car.SetSubsteps(2, 10);
+		else
+			car.SetSubsteps(10, 10);
+
+		std::fill(carinput.begin(), carinput.end(), 0.0f);
+		path[pass].reserve(ticks);
+		long substeps_total = 0;
+
+		clock_t cpu_timer_start = clock();
+		for (int i = 0; i < ticks; ++i)
+		{
+			GetScriptedInput(i * dt, carinput);
+
+			car.Update(carinput);
+
+			world.update(dt);
+
+			substeps_total += car.GetSubsteps();
+			path[pass].push_back(car.GetCenterOfMass());
+		}
+		clock_t cpu_timer_stop = clock();
+
+		speed[pass] = car.GetSpeed();
+		cputime[pass] = float(cpu_timer_stop - cpu_timer_start) / CLOCKS_PER_SEC;
+		substeps[pass] = float(substeps_total) / ticks;
+	}
+
+	btScalar distance = 0;
+	btScalar deviation = 0;
+	for (int i = 1; i < ticks; ++i)
+	{
+		distance += (path[1][i] - path[1][i - 1]).length();
+		deviation = btMax(deviation, (path[0][i] - path[1][i]).length());
+	}
+
+	info_output << "Average substeps adaptive / fixed: " << substeps[0] << " / " << substeps[1] << "\n"
+		<< "CPU time adaptive / fixed: " << cputime[0] << " / " << cputime[1] << " s\n"
+		<< "Final speed adaptive / fixed: " << ConvertToMPH(speed[0]) << " / " << ConvertToMPH(speed[1]) << " MPH\n"
+		<< "Maximum path deviation: " << ConvertToFeet(deviation) << " ft over "
+		<< ConvertToFeet(distance) << " ft driven" << std::endl;
+}
+
+void PerformanceTesting::TestTireTables(std::ostream & info_output, std::ostream & /*error_output*/)
+{
+	info_output << "Testing tire tables against tire formulas" << std::endl;
+
+	const float maxtime = 30.0;
+	const float dt = 1/90.0;
+	const int ticks = maxtime / dt;
+
+	// fixed substeps, so both passes do the same number of tire evaluations
+	std::vector<btVector3> path[2];
+	float cputime[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		ResetCar();
+		car.SetSubsteps(10, 10);
+		car.EnableTireTables(pass == 1);
+
+		std::fill(carinput.begin(), carinput.end(), 0.0f);
+		path[pass].reserve(ticks);
+
+		clock_t cpu_timer_start = clock();
+		for (int i = 0; i < ticks; ++i)
+		{
+			GetScriptedInput(i * dt, carinput);
+
+			car.Update(carinput);
+
+			world.update(dt);
+
+			path[pass].push_back(car.GetCenterOfMass());
+		}
+		clock_t cpu_timer_stop = clock();
+
+		cputime[pass] = float(cpu_timer_stop - cpu_timer_start) / CLOCKS_PER_SEC;
+	}
+	car.EnableTireTables(false);
+
+	btScalar distance = 0;
+	btScalar deviation = 0;
+	for (int i = 1; i < ticks; ++i)
+	{
+		distance += (path[0][i] - path[0][i - 1]).length();
+		deviation = btMax(deviation, (path[0][i] - path[1][i]).length());
+	}
+
+	info_output << "Tire table error bound: " << tire_table_error << "\n"
+		<< "Time per tick formula / table: " << cputime[0] * 1E6 / ticks << " / "
+		<< cputime[1] * 1E6 / ticks << " us\n"
+		<< "Maximum path deviation: " << ConvertToFeet(deviation) << " ft over "
+		<< ConvertToFeet(distance) << " ft driven" << std::endl;
+
+#ifndef VDRIFTN
+	// isolated tire evaluations, formula and batch without tables
+	const int sample_count = 256;
+	const int repeats = 100;
+	CarTire tires[WHEEL_POSITION_SIZE];
+	std::shared_ptr<const CarTireTable> tables[WHEEL_POSITION_SIZE];
+	car.EnableTireTables(true);
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		tires[i] = car.GetTire(WheelPosition(i));
+		tables[i] = tires[i].getTable();
+		tires[i].setTable(std::shared_ptr<const CarTireTable>());
+	}
+	car.EnableTireTables(false);
+
+	std::srand(0);
+	std::vector<btScalar> inputs(sample_count * WHEEL_POSITION_SIZE * 6);
+	for (int i = 0; i < sample_count * WHEEL_POSITION_SIZE; ++i)
+	{
+		btScalar * in = &inputs[i * 6];
+		const btScalar r = btScalar(std::rand()) / RAND_MAX;
+		const btScalar s = btScalar(std::rand()) / RAND_MAX;
+		const btScalar t = btScalar(std::rand()) / RAND_MAX;
+		in[0] = 1000 + 5000 * r;	// normal force
+		in[1] = 0.9 + 0.1 * s;		// friction coefficient
+		in[2] = 4 * t - 2;			// inclination
+		in[3] = 20 + 10 * r;		// rotational velocity
+		in[4] = 20 + 10 * s;		// longitudinal velocity
+		in[5] = 6 * t - 3;			// lateral velocity
+	}
+
+	// structure of arrays copy for the batch
+	std::vector<btScalar> batch(inputs.size());
+	for (int n = 0; n < sample_count; ++n)
+		for (int k = 0; k < 6; ++k)
+			for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+				batch[(n * 6 + k) * WHEEL_POSITION_SIZE + i] = inputs[(n * WHEEL_POSITION_SIZE + i) * 6 + k];
+
+	btVector3 force[WHEEL_POSITION_SIZE];
+	btScalar checksum[3] = {0, 0, 0};
+	unsigned long long time_us[3];
+	quickprof::Clock clock;
+	for (int pass = 0; pass < 3; ++pass)
+	{
+		if (pass == 2)
+		{
+			for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+				tires[i].setTable(tables[i]);
+		}
+
+		unsigned long long start = clock.getTimeMicroseconds();
+		for (int r = 0; r < repeats; ++r)
+		{
+			for (int n = 0; n < sample_count; ++n)
+			{
+				if (pass == 1)
+				{
+					const btScalar * in = &batch[n * 6 * WHEEL_POSITION_SIZE];
+					CarTire::getForces(tires, WHEEL_POSITION_SIZE,
+						in, in + 4, in + 8, in + 12, in + 16, in + 20, force);
+				}
+				else
+				{
+					for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+					{
+						const btScalar * in = &inputs[(n * WHEEL_POSITION_SIZE + i) * 6];
+						force[i] = tires[i].getForce(in[0], in[1], in[2], in[3], in[4], in[5]);
+					}
+				}
+				for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+					checksum[pass] += force[i][0] + force[i][1];
+			}
+		}
+		time_us[pass] = clock.getTimeMicroseconds() - start;
+	}
+
+	const double evaluations = double(sample_count) * repeats;
+	info_output << "Four tire evaluations formula / batch / table: "
+		<< time_us[0] * 1E3 / evaluations << " / "
+		<< time_us[1] * 1E3 / evaluations << " / "
+		<< time_us[2] * 1E3 / evaluations << " ns, force sums "
+		<< checksum[0] << " / " << checksum[1] << " / " << checksum[2] << std::endl;
+#endif
+}
+
+void PerformanceTesting::TestReplay(std::ostream & info_output, std::ostream & error_output)
+{
+	info_output << "Testing deterministic replay" << std::endl;
+
+	const float maxtime = 10.0;
+	const float dt = 1/90.0;
+	const int ticks = maxtime / dt;
+
+	// both runs start from the full car state, not only the serialized part
+	ResetCar();
+	CarDynamics::State start;
+	car.SaveState(start);
+
+	Replay replay(dt);
+	replay.StartRecording(std::vector<CarInfo>(1), "", true, world.isParallel(), 0, error_output);
+	for (int i = 0; i < ticks; ++i)
+	{
+		GetScriptedInput(i * dt, carinput);
+
+		car.Update(carinput);
+		replay.RecordFrame(0, carinput, car);
+
+		world.update(dt);
+	}
+
+	std::stringstream replaystream;
+	replay.StopRecording(replaystream);
+	if (!replay.StartPlaying(replaystream, error_output))
+	{
+		error_output << "Failed to load the recorded replay" << std::endl;
+		return;
+	}
+
+	car.RestoreState(start);
+	int mismatches = 0;
+	for (int i = 0; i < ticks && replay.GetPlaying(); ++i)
+	{
+		const std::vector<float> inputs = replay.PlayFrame(0, car);
+
+		car.Update(inputs);
+		mismatches += !replay.CheckFrame(0, car);
+
+		world.update(dt);
+	}
+
+	info_output << "Replay state hash mismatches: " << mismatches << std::endl;
+	if (mismatches)
+	{
+		error_output << "Replay diverged at frame " << replay.GetDivergedFrame(0) << std::endl;
+	}
+}
+
+void PerformanceTesting::TestRollback(std::ostream & info_output, std::ostream & error_output)
+{
+	info_output << "Testing state rollback" << std::endl;
+
+	const float dt = 1/90.0;
+	const int ticks = 2 / dt;
+
+	// start from a moving car, wheels spinning and suspension compressed
+	ResetCar();
+	for (int i = 0; i < ticks; ++i)
+	{
+		GetScriptedInput(i * dt, carinput);
+		car.Update(carinput);
+		world.update(dt);
+	}
+
+	CarDynamics::State saved;
+	car.SaveState(saved);
+	std::ostringstream saved_stream;
+	joeserialize::BinaryOutputSerializer saved_output(saved_stream);
+	car.Serialize(saved_output);
+	btVector3 wheel_position[WHEEL_POSITION_SIZE];
+	btQuaternion wheel_orientation[WHEEL_POSITION_SIZE];
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		wheel_position[i] = car.GetWheelPosition(WheelPosition(i));
+		wheel_orientation[i] = car.GetWheelOrientation(WheelPosition(i));
+	}
+
+	for (int i = ticks; i < 2 * ticks; ++i)
+	{
+		GetScriptedInput(i * dt, carinput);
+		car.Update(carinput);
+		world.update(dt);
+	}
+
+	car.RestoreState(saved);
+	std::ostringstream restored_stream;
+	joeserialize::BinaryOutputSerializer restored_output(restored_stream);
+	car.Serialize(restored_output);
+
+	int mismatches = 0;
+	if (restored_stream.str() != saved_stream.str())
+	{
+		error_output << "Restored car state differs from the saved state" << std::endl;
+		mismatches++;
+	}
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		const btScalar position_error = car.GetWheelPosition(WheelPosition(i)).distance(wheel_position[i]);
+		const btScalar orientation_error = btFabs(btFabs(car.GetWheelOrientation(WheelPosition(i)).dot(wheel_orientation[i])) - 1);
+		if (position_error > 1E-5 || orientation_error > 1E-5)
+		{
+			error_output << "Restored wheel " << i << " motion state differs by "
+				<< position_error << " m" << std::endl;
+			mismatches++;
+		}
+	}
+	info_output << "Rollback state mismatches: " << mismatches << std::endl;
+}
@@ -22,11 +22,35 @@
 
 #include "physics/cardynamics.h"
 
+#include <string>
+#include <vector>
+
 class ContentManager;
 
 class PerformanceTesting
 {
 public:
+	/// Physics cost of a car driving scripted inputs.
+	struct BenchmarkResult
+	{
+		std::string car;
+		std::string surface;
+		unsigned int ticks;
+		double update_us; ///< average CarDynamics::updateAction time per tick
+		double ticks_per_second; ///< simulation ticks per wall clock second
+		double allocs_per_tick; ///< heap allocations per tick, -1 if built without alloc_count
+	};
+
+	/// Wheel raycast cost of a grid of cars, per ray against batched and cached.
+	struct RaycastResult
+	{
+		int cars;
+		double ray_us; ///< DynamicsWorld::castRay time per car wheel set
+		double batch_us; ///< DynamicsWorld::castRays time per car wheel set
+		double cached_us; ///< DynamicsWorld::castRays time per car wheel set with ray caches
+		int mismatches; ///< batch contacts differing from the per ray contacts
+	};
+
 	PerformanceTesting(DynamicsWorld & world);
 	~PerformanceTesting();
 
@@ -37,6 +61,40 @@ public:
 		std::ostream & info_output,
 		std::ostream & error_output);
 
+	/// Add a flat plane test track to the world.
+	void AddPlane();
+
+	/// Drive car with scripted inputs for duration seconds on whatever
+	/// geometry the world contains. Fills result timings, not the names.
+	bool Benchmark(
+		const std::string & cardir,
+		const std::string & carname,
+		const btVector3 & position,
+		const btQuaternion & rotation,
+		float duration,
+		ContentManager & content,
+		BenchmarkResult & result,
+		std::ostream & error_output);
+
+	/// Cast the wheel rays of cars placed on a grid behind position on whatever
+	/// geometry the world contains, one iteration per tick for duration seconds.
+	void BenchmarkRaycast(
+		int cars,
+		const btVector3 & position,
+		const btQuaternion & rotation,
+		float duration,
+		RaycastResult & result);
+
+	/// Time the road patch ray intersection, reference subdivision against the
+	/// precomputed power form one ray at a time and batched, report differences.
+	static void BenchmarkPatches(std::ostream & info_output);
+
+	/// Write results as json if filename ends with .json, as csv otherwise.
+	static bool WriteResults(
+		const std::string & filename,
+		const std::vector<BenchmarkResult> & results,
+		std::ostream & error_output);
+
 private:
 	DynamicsWorld & world;
 	TrackSurface surface;
@@ -54,6 +112,20 @@ private:
 	void TestMaxSpeed(std::ostream & info_output, std::ostream & error_output);
 
 	void TestStoppingDistance(bool abs, std::ostream & info_output, std::ostream & error_output);
+
+	/// Compare the adaptive substep integrator with fixed substeps on the benchmark inputs.
+	void TestSubsteps(std::ostream & info_output, std::ostream & error_output);
+
+	/// Compare tire table lookups with the tire formulas on the benchmark inputs.
+	void TestTireTables(std::ostream & info_output, std::ostream & error_output);
+
+	/// Record the benchmark inputs in a deterministic replay, play it back
+	/// from the same start state and check the recorded state hashes.
+	void TestReplay(std::ostream & info_output, std::ostream & error_output);
+
+	/// Save the car state, drive on, restore it and compare the serialized
+	/// state and the wheel motion states with the saved ones.
+	void TestRollback(std::ostream & info_output, std::ostream & error_output);
 };
 
 #endif
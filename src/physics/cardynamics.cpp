@@ -18,15 +18,18 @@
 /************************************************************************/
 
 #include "cardynamics.h"
+#include "cartiretable.h"
 #include "carinput.h"
 #include "tracksurface.h"
 #include "dynamicsworld.h"
 #include "fracturebody.h"
 #include "loadcollisionshape.h"
 #include "coordinatesystem.h"
+#include "ssemath.h"
 #include "content/contentmanager.h"
 #include "cfg/ptree.h"
 #include "macros.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionShapes/btCompoundShape.h"
 #include "BulletCollision/CollisionShapes/btCylinderShape.h"
@@ -45,6 +48,94 @@ static inline std::istream & operator >> (std::istream & lhs, btVector3 & rhs)
 	return lhs;
 }
 
+// bump height of the surface at the contact position x, z
+// the second wave sin(phase * pi / 2) is also the phase shift of the first
+static inline btScalar BumpOffset(btScalar x, btScalar z, btScalar wavelength, btScalar amplitude)
+{
+	btScalar phase = 2 * M_PI * (x + z) / wavelength;
+	btScalar wave = sin(phase * M_PI_2);
+	return 0.25 * amplitude * (sin(phase + 2 * wave) + wave - 2.0);
+}
+
+// bump heights of count contacts, four at a time with one lane per contact
+static void BumpOffsets(
+	int count,
+	const btScalar x[],
+	const btScalar z[],
+	const btScalar wavelength[],
+	const btScalar amplitude[],
+	btScalar offset[])
+{
+	int i = 0;
+#ifdef PHYSICS_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		using namespace SseMath;
+		const __m128 phase = _mm_div_ps(
+			_mm_mul_ps(_mm_set1_ps(2 * M_PI), _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(z + i))),
+			_mm_loadu_ps(wavelength + i));
+		const __m128 wave = Sin(_mm_mul_ps(phase, _mm_set1_ps(M_PI_2)));
+		const __m128 bump = _mm_add_ps(Sin(_mm_add_ps(phase, _mm_add_ps(wave, wave))), wave);
+		const __m128 scale = _mm_mul_ps(_mm_set1_ps(0.25f), _mm_loadu_ps(amplitude + i));
+		_mm_storeu_ps(offset + i, _mm_mul_ps(scale, _mm_sub_ps(bump, _mm_set1_ps(2))));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		offset[i] = BumpOffset(x[i], z[i], wavelength[i], amplitude[i]);
+	}
+}
+
+// wheel torques of count wheels, four at a time with one lane per wheel
+// friction: tire friction torque, lock: torque stopping the wheel within dt,
+// brake_max: brake torque magnitude, rolling: rolling resistance torque
+// brake: applied brake torque, reaction: friction torque limited to the applied torque
+static void WheelTorques(
+	int count,
+	const btScalar drive[],
+	const btScalar friction[],
+	const btScalar lock[],
+	const btScalar brake_max[],
+	const btScalar rolling[],
+	btScalar brake[],
+	btScalar reaction[],
+	btScalar total[])
+{
+	int i = 0;
+#ifdef PHYSICS_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		using namespace SseMath;
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 d = _mm_loadu_ps(drive + i);
+		const __m128 f = _mm_loadu_ps(friction + i);
+		const __m128 m = _mm_loadu_ps(brake_max + i);
+		__m128 b = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(lock + i), d), f);
+		b = _mm_max_ps(_mm_min_ps(b, m), _mm_sub_ps(zero, m));
+		const __m128 applied = _mm_add_ps(d, b);
+		const __m128 limit = _mm_or_ps(
+			_mm_and_ps(_mm_cmpgt_ps(applied, zero), _mm_cmpgt_ps(f, applied)),
+			_mm_and_ps(_mm_cmplt_ps(applied, zero), _mm_cmplt_ps(f, applied)));
+		_mm_storeu_ps(brake + i, b);
+		_mm_storeu_ps(reaction + i, Select(limit, applied, f));
+		_mm_storeu_ps(total + i, _mm_add_ps(_mm_add_ps(d, b), _mm_sub_ps(_mm_loadu_ps(rolling + i), f)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		btScalar b = lock[i] - drive[i] + friction[i];
+		if (b > brake_max[i])
+			b = brake_max[i];
+		else if (b < -brake_max[i])
+			b = -brake_max[i];
+		const btScalar applied = drive[i] + b;
+		const bool limit = (applied > 0 && friction[i] > applied) || (applied < 0 && friction[i] < applied);
+		brake[i] = b;
+		reaction[i] = limit ? applied : friction[i];
+		total[i] = drive[i] + b + (rolling[i] - friction[i]);
+	}
+}
+
 static bool LoadClutch(
 	const PTree & cfg,
 	CarClutch & clutch,
@@ -258,6 +349,39 @@ static bool LoadTire(const PTree & cfg_wheel, const PTree & cfg, CarTire & tire,
 
 	return true;
 }
+
+static std::shared_ptr<const CarTireTable> LoadTireTable(
+	const CarTire & tire,
+	const std::string & name,
+	const std::string & cache_dir,
+	btScalar max_error,
+	std::ostream & error_output)
+{
+	max_error = CarTireTable::clampError(max_error);
+
+	// the file name hash changes with the tire coefficients, stale tables are never loaded
+	std::string filename;
+	if (!cache_dir.empty())
+	{
+		std::ostringstream s;
+		s << cache_dir << "/" << name.substr(name.rfind('/') + 1) << "-"
+			<< std::hex << CarTireTable::getHash(tire, max_error) << ".tiretable";
+		filename = s.str();
+	}
+
+	std::shared_ptr<CarTireTable> table(new CarTireTable());
+	if (!filename.empty() && table->load(filename, tire, max_error))
+		return table;
+
+	btScalar table_error = table->build(tire, max_error);
+	if (table_error > max_error)
+		error_output << "Tire table " << name << " error " << table_error << " exceeds " << max_error << std::endl;
+
+	if (!filename.empty() && !table->save(filename))
+		error_output << "Failed to save tire table " << filename << std::endl;
+
+	return table;
+}
 #endif // VDRIFTN
 
 static bool LoadWheel(const PTree & cfg, CarWheel & wheel, std::ostream & error_output)
@@ -537,6 +661,22 @@ bool CarDynamics::Load(
 		content.load(cfg_tire, cardir, tirestr);
 		if (!LoadTire(cfg_wheel, *cfg_tire, tire[i], error)) return false;
 
+		#ifndef VDRIFTN
+		if (tire_table_error > 0)
+		{
+			// wheels with the same tire share a table
+			unsigned int hash = CarTireTable::getHash(tire[i], tire_table_error);
+			for (int j = 0; j < i && !tire_table[i]; ++j)
+			{
+				if (tire_table[j] && tire_table[j]->getHash() == hash)
+					tire_table[i] = tire_table[j];
+			}
+			if (!tire_table[i])
+				tire_table[i] = LoadTireTable(tire[i], tirestr, tire_table_dir, tire_table_error, error);
+			tire[i].setTable(tire_table[i]);
+		}
+		#endif
+
 		const PTree * cfg_brake;
 		if (!cfg_wheel.get("brake", cfg_brake, error)) return false;
 		if (!LoadBrake(*cfg_brake, brake[i], error)) return false;
@@ -575,6 +715,7 @@ bool CarDynamics::Load(
 	body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
 	world.addRigidBody(body);
 	world.addAction(this);
+	world.addRayCaster(this);
 	this->world = &world;
 
 	// position is the center of a 2 x 4 x 1 meter box on track surface
@@ -630,6 +771,8 @@ bool CarDynamics::Load(
 
 void CarDynamics::SetPosition(const btVector3 & position)
 {
+	Wake();
+
 	body->translate(position - body->getCenterOfMassPosition());
 
 	transform.setOrigin(position);
@@ -687,10 +830,43 @@ void CarDynamics::SetTCS(bool value)
 	tcs = value;
 }
 
+void CarDynamics::SetTireTables(const std::string & cache_dir, btScalar max_error)
+{
+	tire_table_dir = cache_dir;
+	tire_table_error = max_error;
+}
+
+void CarDynamics::EnableTireTables(bool value)
+{
+#ifndef VDRIFTN
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		tire[i].setTable(value ? tire_table[i] : std::shared_ptr<const CarTireTable>());
+	}
+#endif
+}
+
+void CarDynamics::SetSubsteps(int min, int max)
+{
+	assert(min > 0 && min <= max);
+	substeps_min = min;
+	substeps_max = max;
+	substeps = max;
+}
+
 void CarDynamics::Update(const std::vector<float> & inputs)
 {
 	assert(inputs.size() >= CarInput::INVALID);
 
+	bool changed = false;
+	for (int i = 0; i < CarInput::INVALID; ++i)
+	{
+		changed = changed || inputs[i] != last_inputs[i];
+		last_inputs[i] = inputs[i];
+	}
+	if (changed)
+		Wake();
+
 	SetBrake(inputs[CarInput::BRAKE]);
 
 	SetHandBrake(inputs[CarInput::HANDBRAKE]);
@@ -1112,6 +1288,19 @@ bool CarDynamics::Serialize ( joeserialize::Serializer & s )
 	_SERIALIZE_(s, shift_gear);
 	_SERIALIZE_(s, shifted);
 	_SERIALIZE_(s, autoshift);
+	_SERIALIZE_(s, substeps);
+	_SERIALIZE_(s, wheel_contacts);
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		_SERIALIZE_(s, last_slide[i]);
+		_SERIALIZE_(s, last_slip[i]);
+	}
+	_SERIALIZE_(s, sleeping);
+	_SERIALIZE_(s, sleep_time);
+	for (int i = 0; i < CarInput::INVALID; ++i)
+	{
+		_SERIALIZE_(s, last_inputs[i]);
+	}
 	if (!serialize(s, *body)) return false;
 	if (!serialize(s, transform)) return false;
 	if (!serialize(s, linear_velocity)) return false;
@@ -1129,6 +1318,110 @@ bool CarDynamics::Serialize ( joeserialize::Serializer & s )
 	return true;
 }
 
+void CarDynamics::SaveState(State & state) const
+{
+	DynamicsWorld::getBodyState(*body, state.body);
+	state.transform = transform;
+	state.linear_velocity = linear_velocity;
+	state.angular_velocity = angular_velocity;
+	engine.GetState(state.engine);
+	state.fuel_tank = fuel_tank;
+	state.clutch = clutch;
+	transmission.GetState(state.transmission);
+	state.differential_front = differential_front;
+	state.differential_rear = differential_rear;
+	state.differential_center = differential_center;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		state.brake[i] = brake[i];
+		state.wheel[i] = wheel[i];
+		tire[i].getState(state.tire[i]);
+		suspension[i]->GetState(state.suspension[i]);
+		state.wheel_contact[i] = wheel_contact[i];
+		state.suspension_force[i] = suspension_force[i];
+		state.wheel_velocity[i] = wheel_velocity[i];
+		state.wheel_position[i] = wheel_position[i];
+		state.wheel_orientation[i] = wheel_orientation[i];
+		state.last_slide[i] = last_slide[i];
+		state.last_slip[i] = last_slip[i];
+		state.abs_active[i] = abs_active[i];
+		state.tcs_active[i] = tcs_active[i];
+	}
+	state.driveshaft_rpm = driveshaft_rpm;
+	state.tacho_rpm = tacho_rpm;
+	state.remaining_shift_time = remaining_shift_time;
+	state.clutch_value = clutch_value;
+	state.brake_value = brake_value;
+	state.feedback = feedback;
+	state.shift_gear = shift_gear;
+	state.substeps = substeps;
+	state.wheel_contacts = wheel_contacts;
+	for (int i = 0; i < CarInput::INVALID; ++i)
+		state.last_inputs[i] = last_inputs[i];
+	state.sleep_time = sleep_time;
+	state.sleeping = sleeping;
+	state.autoclutch = autoclutch;
+	state.autoshift = autoshift;
+	state.shifted = shifted;
+	state.abs = abs;
+	state.tcs = tcs;
+}
+
+void CarDynamics::RestoreState(const State & state)
+{
+	DynamicsWorld::setBodyState(state.body, *body);
+	world->updateSingleAabb(body);
+	transform = state.transform;
+	linear_velocity = state.linear_velocity;
+	angular_velocity = state.angular_velocity;
+	engine.SetState(state.engine);
+	fuel_tank = state.fuel_tank;
+	clutch = state.clutch;
+	transmission.SetState(state.transmission);
+	differential_front = state.differential_front;
+	differential_rear = state.differential_rear;
+	differential_center = state.differential_center;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		brake[i] = state.brake[i];
+		wheel[i] = state.wheel[i];
+		tire[i].setState(state.tire[i]);
+		suspension[i]->SetState(state.suspension[i]);
+		wheel_contact[i] = state.wheel_contact[i];
+		suspension_force[i] = state.suspension_force[i];
+		wheel_velocity[i] = state.wheel_velocity[i];
+		wheel_position[i] = state.wheel_position[i];
+		wheel_orientation[i] = state.wheel_orientation[i];
+		last_slide[i] = state.last_slide[i];
+		last_slip[i] = state.last_slip[i];
+		abs_active[i] = state.abs_active[i];
+		tcs_active[i] = state.tcs_active[i];
+	}
+	driveshaft_rpm = state.driveshaft_rpm;
+	tacho_rpm = state.tacho_rpm;
+	remaining_shift_time = state.remaining_shift_time;
+	clutch_value = state.clutch_value;
+	brake_value = state.brake_value;
+	feedback = state.feedback;
+	shift_gear = state.shift_gear;
+	substeps = state.substeps;
+	wheel_contacts = state.wheel_contacts;
+	for (int i = 0; i < CarInput::INVALID; ++i)
+		last_inputs[i] = state.last_inputs[i];
+	sleep_time = state.sleep_time;
+	sleeping = state.sleeping;
+	autoclutch = state.autoclutch;
+	autoshift = state.autoshift;
+	shifted = state.shifted;
+	abs = state.abs;
+	tcs = state.tcs;
+
+	// wheel shapes follow the restored suspension and wheel rotation,
+	// the body motion state passes them on to the wheel motion states
+	UpdateWheelTransform();
+	body->getMotionState()->setWorldTransform(body->getWorldTransform());
+}
+
 btVector3 CarDynamics::GetDownVector() const
 {
 	return -body->getCenterOfMassTransform().getBasis().getColumn(2);
@@ -1200,81 +1493,86 @@ void CarDynamics::ApplyAerodynamicsToBody ( btVector3 & force, btVector3 & torqu
 }
 
 ///do traction control system (wheelspin prevention) calculations and modify the throttle position if necessary
-void CarDynamics::DoTCS ( int i, btScalar /*suspension_force*/ )
+void CarDynamics::DoTCS()
 {
 	btScalar sense = 1.0;
 	if ( transmission.GetGear() < 0 )
 		sense = -1.0;
 
-	btScalar gas = engine.GetThrottle();
+	//the largest spin difference of a wheel is to the slowest or the fastest one
+	btScalar minspeed = wheel[0].GetAngularVelocity();
+	btScalar maxspeed = minspeed;
+	for ( int i = 1; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		minspeed = btMin ( minspeed, wheel[i].GetAngularVelocity() );
+		maxspeed = btMax ( maxspeed, wheel[i].GetAngularVelocity() );
+	}
 
-	//only active if throttle commanded past threshold
-	btScalar gasthresh = 0.1;
-	if ( gas > gasthresh )
+	//the throttle is shared, each wheel sees the reduction of the previous ones
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
 	{
-		//see if we're spinning faster than the rest of the wheels
-		btScalar maxspindiff = 0;
-		btScalar myrotationalspeed = wheel[i].GetAngularVelocity();
-		for ( int i2 = 0; i2 < WHEEL_POSITION_SIZE; i2++ )
-		{
-			btScalar spindiff = myrotationalspeed - wheel[WheelPosition ( i2 ) ].GetAngularVelocity();
-			if ( spindiff < 0 )
-				spindiff = -spindiff;
-			if ( spindiff > maxspindiff )
-				maxspindiff = spindiff;
-		}
+		btScalar gas = engine.GetThrottle();
 
-		//don't engage if all wheels are moving at the same rate
-		if ( maxspindiff > 1.0 )
+		//only active if throttle commanded past threshold
+		btScalar gasthresh = 0.1;
+		if ( gas > gasthresh )
 		{
-			btScalar sp = tire[i].getIdealSlip();
-			btScalar error = tire[i].getSlip() * sense - sp;
-			btScalar thresholdeng = 0.0;
-			btScalar thresholddis = -sp/2.0;
+			//see if we're spinning faster than the rest of the wheels
+			btScalar myrotationalspeed = wheel[i].GetAngularVelocity();
+			btScalar maxspindiff = btMax ( myrotationalspeed - minspeed, maxspeed - myrotationalspeed );
 
-			if ( error > thresholdeng && ! tcs_active[i] )
-				tcs_active[i] = true;
-
-			if ( error < thresholddis && tcs_active[i] )
-				tcs_active[i] = false;
-
-			if ( tcs_active[i] )
+			//don't engage if all wheels are moving at the same rate
+			if ( maxspindiff > 1.0 )
 			{
-				btScalar curclutch = clutch.GetPosition();
-				if ( curclutch > 1 ) curclutch = 1;
-				if ( curclutch < 0 ) curclutch = 0;
-
-				gas = gas - error*10.0*curclutch;
-				if ( gas < 0 ) gas = 0;
-				if ( gas > 1 ) gas = 1;
-				engine.SetThrottle ( gas );
+				btScalar sp = tire[i].getIdealSlip();
+				btScalar error = tire[i].getSlip() * sense - sp;
+				btScalar thresholdeng = 0.0;
+				btScalar thresholddis = -sp/2.0;
+
+				if ( error > thresholdeng && ! tcs_active[i] )
+					tcs_active[i] = true;
+
+				if ( error < thresholddis && tcs_active[i] )
+					tcs_active[i] = false;
+
+				if ( tcs_active[i] )
+				{
+					btScalar curclutch = clutch.GetPosition();
+					if ( curclutch > 1 ) curclutch = 1;
+					if ( curclutch < 0 ) curclutch = 0;
+
+					gas = gas - error*10.0*curclutch;
+					if ( gas < 0 ) gas = 0;
+					if ( gas > 1 ) gas = 1;
+					engine.SetThrottle ( gas );
+				}
 			}
+			else
+				tcs_active[i] = false;
 		}
 		else
 			tcs_active[i] = false;
 	}
-	else
-		tcs_active[i] = false;
 }
 
 ///do anti-lock brake system calculations and modify the brake force if necessary
-void CarDynamics::DoABS ( int i, btScalar /*suspension_force*/ )
+void CarDynamics::DoABS()
 {
 	//an ideal ABS algorithm
 
-	//only active if brakes commanded past threshold
-	btScalar brakesetting = brake[i].GetBrakeFactor();
-	if ( brakesetting > 0.1 )
+	btScalar maxspeed = 0;
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
 	{
-		btScalar maxspeed = 0;
-		for ( int i2 = 0; i2 < WHEEL_POSITION_SIZE; i2++ )
-		{
-			if ( wheel[WheelPosition ( i2 ) ].GetAngularVelocity() > maxspeed )
-				maxspeed = wheel[WheelPosition ( i2 ) ].GetAngularVelocity();
-		}
+		if ( wheel[i].GetAngularVelocity() > maxspeed )
+			maxspeed = wheel[i].GetAngularVelocity();
+	}
 
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		//only active if brakes commanded past threshold
 		//don't engage ABS if all wheels are moving slowly
-		if ( maxspeed > 6.0 )
+		btScalar brakesetting = brake[i].GetBrakeFactor();
+		if ( brakesetting > 0.1 && maxspeed > 6.0 )
 		{
 			btScalar sp = tire[i].getIdealSlip();
 			btScalar error = - tire[i].getSlip() - sp;
@@ -1289,169 +1587,177 @@ void CarDynamics::DoABS ( int i, btScalar /*suspension_force*/ )
 		}
 		else
 			abs_active[i] = false;
+
+		if ( abs_active[i] )
+			brake[i].SetBrakeFactor ( 0.0 );
 	}
-	else
-		abs_active[i] = false;
-
-	if ( abs_active[i] )
-		brake[i].SetBrakeFactor ( 0.0 );
-}
-
-void CarDynamics::ComputeSuspensionDisplacement ( int i, btScalar /*dt*/ )
-{
-	//compute bump effect
-	const TrackSurface & surface = wheel_contact[i].GetSurface();
-	btScalar posx = wheel_contact[i].GetPosition()[0];
-	btScalar posz = wheel_contact[i].GetPosition()[2];
-	btScalar phase = 2 * M_PI * ( posx + posz ) / surface.bumpWaveLength;
-	btScalar shift = 2 * sin ( phase * M_PI_2 );
-	btScalar amplitude = 0.25 * surface.bumpAmplitude;
-	btScalar bumpoffset = amplitude * ( sin ( phase + shift ) + sin ( M_PI_2*phase ) - 2.0 );
-
-	btScalar relative_displacement = wheel_contact[i].GetDepth() - 2 * wheel[i].GetRadius() - bumpoffset;
-	assert ( !std::isnan ( relative_displacement ) );
-	suspension[i]->SetDisplacement ( suspension[i]->GetDisplacement()-relative_displacement );
-	assert ( !std::isnan ( suspension[i]->GetDisplacement() ) );
-}
-
-///returns the suspension force (so it can be applied to the tires)
-btVector3 CarDynamics::ApplySuspensionForceToBody ( int i, btScalar dt, btVector3 & force, btVector3 & torque )
-{
-	//compute suspension force
-	btScalar springdampforce = suspension[i]->GetForce ( dt );
-	assert ( !std::isnan ( springdampforce ) );
-
-	//do anti-roll
-	int otheri = i;
-	if ( i == 0 || i == 2 ) otheri++;
-	else otheri--;
-	btScalar antirollforce = suspension[i]->GetAntiRoll() *
-		( suspension[i]->GetDisplacement() - suspension[WheelPosition ( otheri ) ]->GetDisplacement() );
-	assert ( !std::isnan ( antirollforce ) );
-
-	//find the vector direction to apply the suspension force
-#ifdef SUSPENSION_FORCE_DIRECTION
-	const btVector3 & wheelext = wheel[i].GetExtendedPosition();
-	const btVector3 & hinge = suspension[i].GetHinge();
-	btVector3 relwheelext = wheelext - hinge;
-	btVector3 up ( 0,0,1 );
-	btVector3 rotaxis = up.cross ( relwheelext.Normalize() );
-	btVector3 forcedirection = relwheelext.Normalize().cross ( rotaxis );
-	//std::cout << i << ". " << forcedirection << std::endl;
-#else
-	btVector3 forcedirection(Direction::up);
-#endif
-	forcedirection = body->getCenterOfMassTransform().getBasis() * forcedirection;
+}
+
+void CarDynamics::ComputeSuspensionDisplacements()
+{
+	//compute bump effect of all wheels in one batch
+	btScalar posx[WHEEL_POSITION_SIZE];
+	btScalar posz[WHEEL_POSITION_SIZE];
+	btScalar wavelength[WHEEL_POSITION_SIZE];
+	btScalar amplitude[WHEEL_POSITION_SIZE];
+	btScalar bumpoffset[WHEEL_POSITION_SIZE];
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		const TrackSurface & surface = wheel_contact[i].GetSurface();
+		posx[i] = wheel_contact[i].GetPosition()[0];
+		posz[i] = wheel_contact[i].GetPosition()[2];
+		wavelength[i] = surface.bumpWaveLength;
+		amplitude[i] = surface.bumpAmplitude;
+	}
+	BumpOffsets(WHEEL_POSITION_SIZE, posx, posz, wavelength, amplitude, bumpoffset);
 
-	btVector3 suspension_force = forcedirection * ( antirollforce + springdampforce );
-	btVector3 suspension_force_application_point = wheel_position[i] - body->getCenterOfMassPosition();
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		btScalar relative_displacement = wheel_contact[i].GetDepth() - 2 * wheel[i].GetRadius() - bumpoffset[i];
+		assert ( !std::isnan ( relative_displacement ) );
+		suspension[i]->SetDisplacement ( suspension[i]->GetDisplacement()-relative_displacement );
+		assert ( !std::isnan ( suspension[i]->GetDisplacement() ) );
+	}
+}
 
-	btScalar overtravel = suspension[i]->GetOvertravel();
-	if (overtravel > 0)
+///apply the suspension forces of all wheels, their magnitude is the tire load
+void CarDynamics::ApplySuspensionForces ( btScalar dt, btScalar normal_force[], btVector3 & force, btVector3 & torque )
+{
+	//spring and damper forces first, anti-roll needs the displacements of both wheels of an axle
+	btScalar springdampforce[WHEEL_POSITION_SIZE];
+	btScalar displacement[WHEEL_POSITION_SIZE];
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
 	{
-		btScalar correction_factor = 0.0;
-		btScalar dv = body->getVelocityInLocalPoint(suspension_force_application_point).dot(forcedirection);
-		dv -= correction_factor * overtravel / dt;
-		btScalar effectiveMass = 1.0 / body->computeImpulseDenominator(wheel_position[i], forcedirection);
-		btScalar correction = -effectiveMass * dv / dt;
-		if (correction > 0 && correction > antirollforce + springdampforce)
+		springdampforce[i] = suspension[i]->GetForce ( dt );
+		displacement[i] = suspension[i]->GetDisplacement();
+		assert ( !std::isnan ( springdampforce[i] ) );
+	}
+
+	//the suspension forces act along the car up axis
+	const btVector3 forcedirection = body->getCenterOfMassTransform().getBasis() * Direction::up;
+
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		//do anti-roll, wheel pairs are front left/right and rear left/right
+		const int otheri = i ^ 1;
+		btScalar antirollforce = suspension[i]->GetAntiRoll() * ( displacement[i] - displacement[otheri] );
+		assert ( !std::isnan ( antirollforce ) );
+
+		btVector3 wheel_force = forcedirection * ( antirollforce + springdampforce[i] );
+		btVector3 suspension_force_application_point = wheel_position[i] - body->getCenterOfMassPosition();
+
+		btScalar overtravel = suspension[i]->GetOvertravel();
+		if (overtravel > 0)
 		{
-			suspension_force = forcedirection * correction;
+			btScalar correction_factor = 0.0;
+			btScalar dv = body->getVelocityInLocalPoint(suspension_force_application_point).dot(forcedirection);
+			dv -= correction_factor * overtravel / dt;
+			btScalar effectiveMass = 1.0 / body->computeImpulseDenominator(wheel_position[i], forcedirection);
+			btScalar correction = -effectiveMass * dv / dt;
+			if (correction > 0 && correction > antirollforce + springdampforce[i])
+			{
+				wheel_force = forcedirection * correction;
+			}
 		}
-	}
 
-	force = force + suspension_force;
-	torque = torque + suspension_force_application_point.cross(suspension_force);
+		force = force + wheel_force;
+		torque = torque + suspension_force_application_point.cross(wheel_force);
+
+		suspension_force[i] = wheel_force;
+		normal_force[i] = wheel_force.length();
+	}
 
 	for ( int n = 0; n < 3; ++n ) assert ( !std::isnan ( force[n] ) );
 	for ( int n = 0; n < 3; ++n ) assert ( !std::isnan ( torque[n] ) );
-
-	return suspension_force;
 }
 
-btVector3 CarDynamics::ComputeTireFrictionForce (
-	int i, btScalar /*dt*/, btScalar normal_force,
-	btScalar rotvel, const btVector3 & linvel,
-	const btQuaternion & wheel_orientation)
+void CarDynamics::ComputeTireFrictionForces ( const btScalar normal_force[], btVector3 friction_force[] )
 {
-	btMatrix3x3 wheel_mat(wheel_orientation);
-	btVector3 xw = wheel_mat.getColumn(0);
-	btVector3 yw = wheel_mat.getColumn(1);
-	btVector3 z = wheel_contact[i].GetNormal();
-
-	btScalar coszxw = z.dot(xw);
-	btScalar coszyw = z.dot(yw);
-	btVector3 x = (xw - z * coszxw).normalized();
-	btVector3 y = (yw - z * coszyw).normalized();
+	// gather the tire inputs of all wheels to evaluate them in one batch
+	btScalar friction_coeff[WHEEL_POSITION_SIZE];
+	btScalar camber[WHEEL_POSITION_SIZE];
+	btScalar rotvel[WHEEL_POSITION_SIZE];
+	btScalar lonvel[WHEEL_POSITION_SIZE];
+	btScalar latvel[WHEEL_POSITION_SIZE];
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		btMatrix3x3 wheel_mat(wheel_orientation[i]);
+		btVector3 xw = wheel_mat.getColumn(0);
+		btVector3 yw = wheel_mat.getColumn(1);
+		btVector3 z = wheel_contact[i].GetNormal();
 
-	btScalar camber = M_PI_2 - btAcos(coszxw);
-	btScalar lonvel = y.dot(linvel);
-	btScalar latvel = -x.dot(linvel);
+		btScalar coszxw = z.dot(xw);
+		btScalar coszyw = z.dot(yw);
+		btVector3 x = (xw - z * coszxw).normalized();
+		btVector3 y = (yw - z * coszyw).normalized();
 
-	btScalar friction_coeff =
-		tire[i].getTread() * wheel_contact[i].GetSurface().frictionTread +
-		(1.0 - tire[i].getTread()) * wheel_contact[i].GetSurface().frictionNonTread;
+		camber[i] = M_PI_2 - btAcos(coszxw);
+		rotvel[i] = wheel[i].GetAngularVelocity() * wheel[i].GetRadius();
+		lonvel[i] = y.dot(wheel_velocity[i]);
+		latvel[i] = -x.dot(wheel_velocity[i]);
 
-	btVector3 friction_force = tire[i].getForce(
-		normal_force, friction_coeff, camber, rotvel, lonvel, latvel);
+		friction_coeff[i] =
+			tire[i].getTread() * wheel_contact[i].GetSurface().frictionTread +
+			(1.0 - tire[i].getTread()) * wheel_contact[i].GetSurface().frictionNonTread;
+	}
 
-	for (int n = 0; n < 3; ++n) assert(!std::isnan(friction_force[n]));
+	CarTire::getForces(
+		&tire[0], WHEEL_POSITION_SIZE,
+		normal_force, friction_coeff, camber,
+		rotvel, lonvel, latvel, friction_force);
 
-	return friction_force;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+		for (int n = 0; n < 3; ++n) assert(!std::isnan(friction_force[i][n]));
 }
 
-void CarDynamics::ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & suspension_force, btVector3 & force, btVector3 & torque )
+void CarDynamics::ApplyWheelForces ( btScalar dt, const btScalar wheel_drive_torque[], const btVector3 friction_force[], btVector3 & force, btVector3 & torque )
 {
-	btScalar normal_force = suspension_force.length();
-	btScalar rotvel = wheel[i].GetAngularVelocity() * wheel[i].GetRadius();
-	btVector3 friction_force = ComputeTireFrictionForce ( i, dt, normal_force, rotvel, wheel_velocity[i], wheel_orientation[i] );
-
-	//calculate friction torque
-	btVector3 tire_force = Direction::forward * friction_force[0] - Direction::right * friction_force[1];
-	btScalar tire_friction_torque = friction_force[0] * wheel[i].GetRadius();
-	assert ( !std::isnan ( tire_friction_torque ) );
-
-	//calculate brake torque
-	btScalar wheel_lock_torque = -wheel[i].GetAngularVelocity() / dt * wheel[i].GetInertia();
-	btScalar wheel_brake_torque = wheel_lock_torque - wheel_drive_torque + tire_friction_torque;
-	if (wheel_brake_torque > 0 && wheel_brake_torque > brake[i].GetTorque())
-	{
-		wheel_brake_torque = brake[i].GetTorque();
-	}
-	else if (wheel_brake_torque < 0 && wheel_brake_torque < -brake[i].GetTorque())
+	//gather the torque inputs of all wheels to resolve them in one batch
+	btScalar tire_friction_torque[WHEEL_POSITION_SIZE];
+	btScalar wheel_lock_torque[WHEEL_POSITION_SIZE];
+	btScalar brake_torque[WHEEL_POSITION_SIZE];
+	btScalar rolling_resistance_torque[WHEEL_POSITION_SIZE];
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
 	{
-		wheel_brake_torque = -brake[i].GetTorque();
+		const btScalar radius = wheel[i].GetRadius();
+		const btScalar angvel = wheel[i].GetAngularVelocity();
+		tire_friction_torque[i] = friction_force[i][0] * radius;
+		wheel_lock_torque[i] = -angvel / dt * wheel[i].GetInertia();
+		brake_torque[i] = brake[i].GetTorque();
+		rolling_resistance_torque[i] = -tire[i].getRollingResistance(angvel, wheel_contact[i].GetSurface().rollResistanceCoefficient) * radius;
+		assert ( !std::isnan ( tire_friction_torque[i] ) );
 	}
-	assert ( !std::isnan ( wheel_brake_torque ) );
 
-	//limit the reaction torque to the applied drive and braking torque
-	btScalar reaction_torque = tire_friction_torque;
-	btScalar applied_torque = wheel_drive_torque + wheel_brake_torque;
-	if ( ( applied_torque > 0 && reaction_torque > applied_torque ) ||
-			( applied_torque < 0 && reaction_torque < applied_torque ) )
-		reaction_torque = applied_torque;
-	btVector3 tire_torque = Direction::right * reaction_torque;// - direction::up * friction_force[2];
+	//brake torque limited to the lock torque, reaction torque limited to the applied drive and braking torque
+	btScalar wheel_brake_torque[WHEEL_POSITION_SIZE];
+	btScalar reaction_torque[WHEEL_POSITION_SIZE];
+	btScalar wheel_torque[WHEEL_POSITION_SIZE];
+	WheelTorques(WHEEL_POSITION_SIZE, wheel_drive_torque, tire_friction_torque, wheel_lock_torque,
+		brake_torque, rolling_resistance_torque, wheel_brake_torque, reaction_torque, wheel_torque);
+
+	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	{
+		assert ( !std::isnan ( wheel_brake_torque[i] ) );
 
-	//set wheel torque due to tire rolling resistance
-	btScalar rolling_resistance = -tire[i].getRollingResistance(wheel[i].GetAngularVelocity(), wheel_contact[i].GetSurface().rollResistanceCoefficient);
-	btScalar rolling_resistance_torque = rolling_resistance * wheel[i].GetRadius() - tire_friction_torque;
-	btScalar wheel_torque = wheel_drive_torque + wheel_brake_torque + rolling_resistance_torque;
+		//have the wheels internally apply forces, or just forcibly set the wheel speed if the brakes are locked
+		wheel[i].SetTorque ( wheel_torque[i], dt );
+		wheel[i].Integrate ( dt );
 
-	//have the wheels internally apply forces, or just forcibly set the wheel speed if the brakes are locked
-	wheel[i].SetTorque ( wheel_torque, dt );
-	wheel[i].Integrate ( dt );
+		btVector3 tire_force = Direction::forward * friction_force[i][0] - Direction::right * friction_force[i][1];
+		btVector3 tire_torque = Direction::right * reaction_torque[i];
 
-	//viscous tire contact drag (hack)
-	btVector3 wheel_drag = -wheel_velocity[i] * wheel_contact[i].GetSurface().rollingDrag;
+		//viscous tire contact drag (hack)
+		btVector3 wheel_drag = -wheel_velocity[i] * wheel_contact[i].GetSurface().rollingDrag;
 
-	//apply forces to body
-	btVector3 tire_pos = wheel_position[i] - body->getCenterOfMassPosition();
-	btVector3 world_tire_force = quatRotate ( wheel_orientation[i], tire_force );
-	btVector3 world_tire_torque = quatRotate ( wheel_orientation[i],  tire_torque);
-	world_tire_force += wheel_drag;
-	world_tire_torque += tire_pos.cross(world_tire_force);
-	force = force + world_tire_force;
-	torque = torque + world_tire_torque;
+		//apply forces to body
+		btVector3 tire_pos = wheel_position[i] - body->getCenterOfMassPosition();
+		btVector3 world_tire_force = quatRotate ( wheel_orientation[i], tire_force );
+		btVector3 world_tire_torque = quatRotate ( wheel_orientation[i],  tire_torque);
+		world_tire_force += wheel_drag;
+		world_tire_torque += tire_pos.cross(world_tire_force);
+		force = force + world_tire_force;
+		torque = torque + world_tire_torque;
+	}
 }
 
 ///the core function of the car dynamics simulation:  find and apply all forces on the car and components.
@@ -1469,10 +1775,7 @@ void CarDynamics::ApplyForces ( btScalar dt, const btVector3 & ext_force, const
 	//do TCS first thing
 	if ( tcs )
 	{
-		for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
-		{
-			DoTCS ( i, suspension_force[i].length() );
-		}
+		DoTCS();
 	}
 
 	//compute wheel torques
@@ -1486,31 +1789,24 @@ void CarDynamics::ApplyForces ( btScalar dt, const btVector3 & ext_force, const
 	ApplyAerodynamicsToBody ( force, torque );
 
 	//compute suspension displacements
-	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
-	{
-		ComputeSuspensionDisplacement ( i, dt );
-	}
+	ComputeSuspensionDisplacements();
 
-	//compute suspension forces
-	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
-	{
-		suspension_force[i] = ApplySuspensionForceToBody ( i, dt, force, torque );
-	}
+	//compute suspension forces, their magnitude is the tire load
+	btScalar normal_force[WHEEL_POSITION_SIZE];
+	ApplySuspensionForces ( dt, normal_force, force, torque );
 
 	//do abs
 	if ( abs )
 	{
-		for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
-		{
-			DoABS ( i, suspension_force[i].length() );
-		}
+		DoABS();
 	}
 
+	//compute tire forces
+	btVector3 friction_force[WHEEL_POSITION_SIZE];
+	ComputeTireFrictionForces ( normal_force, friction_force );
+
 	//compute wheel forces
-	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
-	{
-		ApplyWheelForces ( dt, wheel_drive_torque[i], i, suspension_force[i], force, torque );
-	}
+	ApplyWheelForces ( dt, wheel_drive_torque, friction_force, force, torque );
 
 	for ( int n = 0; n < 3; ++n ) assert ( !std::isnan ( force[n] ) );
 	for ( int n = 0; n < 3; ++n ) assert ( !std::isnan ( torque[n] ) );
@@ -1545,17 +1841,22 @@ void CarDynamics::updateAction(btCollisionWorld * /*collisionWorld*/, btScalar d
 	btVector3 torque = body->getInvInertiaTensorWorld().inverse() * dw / dt;
 	body->setLinearVelocity(linear_velocity);
 	body->setAngularVelocity(angular_velocity);
-	UpdateWheelContacts();
+
+	// still asleep, getRays has not woken the car up
+	if (sleeping)
+		return;
+
+	// wheel contacts have been updated by the world ray batch, see getRays
+	UpdateSubsteps(dt);
 
 	feedback = 0;
-	int repeats = 10;
-	for (int i = 0; i < repeats; ++i)
+	for (int i = 0; i < substeps; ++i)
 	{
-		Tick(dt / repeats, force, torque);
+		Tick(dt / substeps, force, torque);
 
 		feedback += tire[FRONT_LEFT].getMz() + tire[FRONT_RIGHT].getMz();
 	}
-	feedback /= repeats;
+	feedback /= substeps;
 	feedback *= feedback_scale;
 
 	//update fuel tank
@@ -1568,6 +1869,116 @@ void CarDynamics::updateAction(btCollisionWorld * /*collisionWorld*/, btScalar d
 
 	linear_velocity = body->getLinearVelocity();
 	angular_velocity = body->getAngularVelocity();
+
+	UpdateSleep(dt);
+}
+
+void CarDynamics::SetSleepEnabled(bool value)
+{
+	sleep_enabled = value;
+	if (!sleep_enabled)
+		Wake();
+}
+
+void CarDynamics::Wake()
+{
+	sleeping = false;
+	sleep_time = 0;
+}
+
+void CarDynamics::UpdateSleep(btScalar dt)
+{
+	const btScalar sleep_velocity = 0.05; // m/s, rad/s
+	const btScalar sleep_delay = 2; // s
+
+	bool rest = sleep_enabled && engine.GetThrottle() == 0 &&
+		linear_velocity.length2() < sleep_velocity * sleep_velocity &&
+		angular_velocity.length2() < sleep_velocity * sleep_velocity;
+	for (int i = 0; i < WHEEL_POSITION_SIZE && rest; ++i)
+	{
+		rest = btFabs(wheel[i].GetAngularVelocity()) < sleep_velocity;
+	}
+
+	sleep_time = rest ? sleep_time + dt : 0;
+	if (sleep_time < sleep_delay)
+		return;
+
+	// freeze the car where it is, the driveline keeps its idle state
+	sleeping = true;
+	feedback = 0;
+	linear_velocity.setZero();
+	angular_velocity.setZero();
+	body->setLinearVelocity(linear_velocity);
+	body->setAngularVelocity(angular_velocity);
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		wheel[i].SetAngularVelocity(0);
+		wheel_velocity[i].setZero();
+	}
+}
+
+// The stiffest part of the car is the tire spinning the wheel, the slip ratio
+// feedback rate is dFx/dslip * r^2 / (I * v). Explicit integration of it needs
+// substeps well below the inverse rate. Fast cars in benign states get few
+// substeps, slow or sliding cars, bumps, gear shifts and contact changes the most.
+void CarDynamics::UpdateSubsteps(btScalar dt)
+{
+	const btScalar min_velocity = 1; // keep the rate finite at standstill
+	const btScalar rate_substeps = 2; // substeps per unit dt * rate
+	const btScalar slip_change = 0.25; // slip change per step relative to peak slip
+	const btScalar suspension_velocity = 1; // m/s
+	const int reduced_substeps_min = 2;
+
+	// a fixed count at full detail needs none of the estimates below
+	if (substeps_min == substeps_max && !reduced_detail)
+	{
+		substeps = substeps_max;
+		return;
+	}
+
+	// reduced detail may drop below a fixed count
+	const int n_min = reduced_detail ? btMin(reduced_substeps_min, substeps_min) : substeps_min;
+	int n = n_min;
+	int contacts = 0;
+	bool limit = remaining_shift_time > 0 || (clutch_value > 0 && clutch_value < 1);
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		const btScalar slide = tire[i].getSlip();
+		const btScalar slip = tire[i].getSlipAngle();
+		const btScalar ideal_slide = btMax(tire[i].getIdealSlip(), btScalar(1E-3));
+		const btScalar ideal_slip = btMax(tire[i].getIdealSlipAngle(), btScalar(1E-3));
+		const btScalar slide_change = btFabs(slide - last_slide[i]) / ideal_slide;
+		const btScalar slip_angle_change = btFabs(slip - last_slip[i]) / ideal_slip;
+		last_slide[i] = slide;
+		last_slip[i] = slip;
+
+		if (suspension[i]->GetDisplacement() > 0)
+			contacts |= 1 << i;
+
+		// sliding beyond the peak, fast changing slip, abs/tcs or impacts
+		limit = limit || btFabs(slide) > ideal_slide || btFabs(slip) > ideal_slip ||
+			slide_change > slip_change || slip_angle_change > slip_change ||
+			btFabs(suspension[i]->GetVelocity()) > suspension_velocity ||
+			abs_active[i] || tcs_active[i];
+
+		const btScalar load = suspension_force[i].length();
+		const TrackSurface & surface = wheel_contact[i].GetSurface();
+		const btScalar friction = tire[i].getTread() * surface.frictionTread +
+			(1 - tire[i].getTread()) * surface.frictionNonTread;
+		const btScalar stiffness = friction * tire[i].getMaxFx(load) / ideal_slide;
+		const btScalar radius = wheel[i].GetRadius();
+		const btScalar velocity = btMax(wheel_velocity[i].length(), min_velocity);
+		const btScalar rate = stiffness * radius * radius / (wheel[i].GetInertia() * velocity);
+		n = btMax(n, int(std::ceil(btMin(rate_substeps * dt * rate, btScalar(substeps_max)))));
+	}
+	// reduced detail only keeps the stability bound above
+	if ((limit || contacts != wheel_contacts) && !reduced_detail)
+		n = substeps_max;
+	wheel_contacts = contacts;
+
+	// step up at once, step down gradually to avoid oscillating between counts
+	n = btMax(n, substeps - 1);
+	substeps = btMin(btMax(n, n_min), substeps_max);
 }
 
 void CarDynamics::UpdateWheelContacts()
@@ -1589,6 +2000,49 @@ void CarDynamics::UpdateWheelContacts()
 	}
 }
 
+void CarDynamics::getRays(btScalar dt, btAlignedObjectArray<DynamicsWorld::Ray> & rays)
+{
+	// a sleeping car keeps its contacts, the wake test runs here, before the
+	// actions, so the rays of a woken car join the world ray batch
+	if (sleeping)
+	{
+		// stay asleep unless pushed by another body, gravity is held by the suspension
+		const btScalar wake_velocity = 0.1;
+		const btVector3 dv = body->getLinearVelocity() - linear_velocity;
+		const btVector3 dw = body->getAngularVelocity() - angular_velocity;
+		const btVector3 push = dv - body->getGravity() * dt;
+		if (push.length2() < wake_velocity * wake_velocity &&
+			dw.length2() < wake_velocity * wake_velocity)
+			return;
+
+		Wake();
+	}
+
+	// body has been moved by bullet, updateAction resets it to transform
+	btVector3 raydir = -transform.getBasis().getColumn(2);
+	btScalar raylen = 4;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		btVector3 raystart = wheel_position[i] - raydir * wheel[i].GetRadius();
+		if (body->getChildBody(i)->isInWorld())
+		{
+			// wheel separated
+			wheel_contact[i] = CollisionContact(raystart, raydir, raylen, -1, 0, TrackSurface::None(), 0);
+		}
+		else
+		{
+			DynamicsWorld::Ray ray;
+			ray.origin = raystart;
+			ray.direction = raydir;
+			ray.length = raylen;
+			ray.caster = body;
+			ray.contact = &wheel_contact[i];
+			ray.cache = &wheel_ray_cache[i];
+			rays.push_back(ray);
+		}
+	}
+}
+
 void CarDynamics::InterpolateWheelContacts()
 {
 	btVector3 raydir = GetDownVector();
@@ -1956,6 +2410,7 @@ void CarDynamics::Clear()
 		}
 		delete child;
 	}
+	world->removeRayCaster(this);
 	world->removeAction(this);
 	world->removeRigidBody(body);
 	world = 0;
@@ -2008,18 +2463,33 @@ void CarDynamics::Init()
 	maxspeed = 0;
 	feedback_scale = 0;
 	feedback = 0;
+	substeps_min = 10;
+	substeps_max = 10;
+	substeps = substeps_max;
+	wheel_contacts = 0;
+	reduced_detail = false;
+	sleep_enabled = true;
+	sleeping = false;
+	sleep_time = 0;
+	for (int i = 0; i < CarInput::INVALID; ++i)
+		last_inputs[i] = 0;
+	tire_table_error = 0;
 
 	suspension.resize(WHEEL_POSITION_SIZE, 0);
 	wheel.resize(WHEEL_POSITION_SIZE);
 	tire.resize(WHEEL_POSITION_SIZE);
+	tire_table.resize(WHEEL_POSITION_SIZE);
 	brake.resize(WHEEL_POSITION_SIZE);
-	suspension_force.resize(WHEEL_POSITION_SIZE);
-	wheel_velocity.resize(WHEEL_POSITION_SIZE);
-	wheel_position.resize(WHEEL_POSITION_SIZE);
-	wheel_orientation.resize(WHEEL_POSITION_SIZE);
+	suspension_force.resize(WHEEL_POSITION_SIZE, btVector3(0, 0, 0));
+	wheel_velocity.resize(WHEEL_POSITION_SIZE, btVector3(0, 0, 0));
+	wheel_position.resize(WHEEL_POSITION_SIZE, btVector3(0, 0, 0));
+	wheel_orientation.resize(WHEEL_POSITION_SIZE, btQuaternion::getIdentity());
 	wheel_contact.resize(WHEEL_POSITION_SIZE);
+	wheel_ray_cache.resize(WHEEL_POSITION_SIZE);
 	abs_active.resize(WHEEL_POSITION_SIZE, false);
 	tcs_active.resize(WHEEL_POSITION_SIZE, false);
+	last_slide.resize(WHEEL_POSITION_SIZE, 0);
+	last_slip.resize(WHEEL_POSITION_SIZE, 0);
 }
 
 bool CarDynamics::WheelContactCallback(
@@ -2057,3 +2527,49 @@ const btCollisionObject & CarDynamics::getCollisionObject() const
 {
 	return *static_cast<btCollisionObject*>(body);
 }
+
+QT_TEST(cardynamics_bump_test)
+{
+	// six contacts to cover a full and a partial batch
+	const int count = 6;
+	const btScalar x[count] = {0, 1.3, -250.7, 1000.2, 3.5, -0.1};
+	const btScalar z[count] = {0, 2.1, 80.4, -420.9, 0.25, 7.7};
+	const btScalar wavelength[count] = {1, 10, 2.5, 40, 1, 6};
+	const btScalar amplitude[count] = {0, 0.05, 0.1, 0.2, 0.01, 0.3};
+	btScalar offset[count];
+	BumpOffsets(count, x, z, wavelength, amplitude, offset);
+	for (int i = 0; i < count; ++i)
+	{
+		const btScalar ref = BumpOffset(x[i], z[i], wavelength[i], amplitude[i]);
+		QT_CHECK_CLOSE(offset[i], ref, amplitude[i] * 1E-3 + 1E-6);
+	}
+}
+
+QT_TEST(cardynamics_wheel_torque_test)
+{
+	// six wheels to cover a full and a partial batch, brake clamps and reaction limits
+	const int count = 6;
+	const btScalar drive[count] = {0, 300, -150, 50, 0, 800};
+	const btScalar friction[count] = {120, 450, -400, -30, 0, 200};
+	const btScalar lock[count] = {-5000, 20, 3000, 100, 0, -900};
+	const btScalar brake_max[count] = {1000, 0, 2500, 10, 0, 50};
+	const btScalar rolling[count] = {-2, -5, 3, -1, 0, -7};
+	btScalar brake[count], reaction[count], total[count];
+	WheelTorques(count, drive, friction, lock, brake_max, rolling, brake, reaction, total);
+	for (int i = 0; i < count; ++i)
+	{
+		btScalar brake_ref = lock[i] - drive[i] + friction[i];
+		if (brake_ref > 0 && brake_ref > brake_max[i])
+			brake_ref = brake_max[i];
+		else if (brake_ref < 0 && brake_ref < -brake_max[i])
+			brake_ref = -brake_max[i];
+		btScalar reaction_ref = friction[i];
+		btScalar applied = drive[i] + brake_ref;
+		if ((applied > 0 && reaction_ref > applied) || (applied < 0 && reaction_ref < applied))
+			reaction_ref = applied;
+		btScalar total_ref = drive[i] + brake_ref + (rolling[i] - friction[i]);
+		QT_CHECK_CLOSE(brake[i], brake_ref, 1E-3);
+		QT_CHECK_CLOSE(reaction[i], reaction_ref, 1E-3);
+		QT_CHECK_CLOSE(total[i], total_ref, 1E-3);
+	}
+}
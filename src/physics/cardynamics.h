@@ -30,23 +30,27 @@
 #include "cartire.h"
 #include "carbrake.h"
 #include "carwheelposition.h"
+#include "carinput.h"
 #include "aerodevice.h"
 #include "collision_contact.h"
 #include "motionstate.h"
+#include "dynamicsworld.h"
 #include "joeserialize.h"
 
 #include "BulletDynamics/Dynamics/btActionInterface.h"
 
+#include <memory>
+
 struct btCollisionObjectWrapper;
 class btCollisionWorld;
 class btManifoldPoint;
 class btIDebugDraw;
-class DynamicsWorld;
 class FractureBody;
 class ContentManager;
+class CarTireTable;
 class PTree;
 
-class CarDynamics : public btActionInterface
+class CarDynamics : public btActionInterface, public RayCaster
 {
 friend class joeserialize::Serializer;
 
@@ -59,6 +63,10 @@ public:
 
 	~CarDynamics();
 
+	// look up the tire curves in tables with relative error max_error, zero disables,
+	// tables are cached in cache_dir if it is not empty, call before Load
+	void SetTireTables(const std::string & cache_dir, btScalar max_error);
+
 	// tirealt is optional tire config, overrides default tire type
 	bool Load(
 		const PTree & cfg,
@@ -83,6 +91,26 @@ public:
 	void SetABS(bool value);
 	void SetTCS(bool value);
 
+	// substep count range of the adaptive integrator, min == max is a fixed count
+	// default is a fixed count of 10, the adaptive range 2 to 10 is opt in
+	void SetSubsteps(int min, int max);
+
+	// substeps used by the last update
+	int GetSubsteps() const {return substeps;}
+
+	// reduced detail keeps only the substeps needed for a stable tire integration,
+	// switching back is seamless as both use the same model
+	void SetReducedDetail(bool value) {reduced_detail = value;}
+	bool GetReducedDetail() const {return reduced_detail;}
+
+	// a car at rest with constant inputs falls asleep and skips its update,
+	// input changes, moving it and pushes by other bodies wake it up
+	void SetSleepEnabled(bool value);
+	bool GetSleeping() const {return sleeping;}
+
+	// switch between the tire tables built by Load and the tire formulas
+	void EnableTireTables(bool value);
+
 	// update dynamics from car input vector
 	void Update(const std::vector<float> & inputs);
 
@@ -90,6 +118,9 @@ public:
 	void updateAction(btCollisionWorld * collisionWorld, btScalar dt);
 	void debugDraw(btIDebugDraw * debugDrawer);
 
+	// ray caster interface, wheel contact rays
+	void getRays(btScalar dt, btAlignedObjectArray<DynamicsWorld::Ray> & rays);
+
 	// graphics interpolated
 	btVector3 GetEnginePosition() const;
 	const btVector3 & GetPosition() const;
@@ -166,6 +197,58 @@ public:
 
 	bool Serialize(joeserialize::Serializer & s);
 
+	/// plain copy of the simulation state of the car, for rollback and replay seeking
+	struct State
+	{
+		DynamicsWorld::BodyState body;
+		btTransform transform;
+		btVector3 linear_velocity;
+		btVector3 angular_velocity;
+		CarEngine::State engine;
+		CarFuelTank fuel_tank;
+		CarClutch clutch;
+		CarTransmission::State transmission;
+		CarDifferential differential_front;
+		CarDifferential differential_rear;
+		CarDifferential differential_center;
+		CarBrake brake[WHEEL_POSITION_SIZE];
+		CarWheel wheel[WHEEL_POSITION_SIZE];
+		CarTire::State tire[WHEEL_POSITION_SIZE];
+		CarSuspension::State suspension[WHEEL_POSITION_SIZE];
+		CollisionContact wheel_contact[WHEEL_POSITION_SIZE];
+		btVector3 suspension_force[WHEEL_POSITION_SIZE];
+		btVector3 wheel_velocity[WHEEL_POSITION_SIZE];
+		btVector3 wheel_position[WHEEL_POSITION_SIZE];
+		btQuaternion wheel_orientation[WHEEL_POSITION_SIZE];
+		btScalar last_slide[WHEEL_POSITION_SIZE];
+		btScalar last_slip[WHEEL_POSITION_SIZE];
+		int abs_active[WHEEL_POSITION_SIZE];
+		int tcs_active[WHEEL_POSITION_SIZE];
+		btScalar driveshaft_rpm;
+		btScalar tacho_rpm;
+		btScalar remaining_shift_time;
+		btScalar clutch_value;
+		btScalar brake_value;
+		btScalar feedback;
+		int shift_gear;
+		int substeps;
+		int wheel_contacts;
+		float last_inputs[CarInput::INVALID];
+		btScalar sleep_time;
+		bool sleeping;
+		bool autoclutch;
+		bool autoshift;
+		bool shifted;
+		bool abs;
+		bool tcs;
+	};
+
+	/// copy the car state without allocating, separated parts are not part of it
+	void SaveState(State & state) const;
+
+	/// set the car state saved by SaveState of this car
+	void RestoreState(const State & state);
+
 	static bool WheelContactCallback(
 		btManifoldPoint& cp,
 		const btCollisionObjectWrapper* col0,
@@ -196,11 +279,15 @@ protected:
 	btAlignedObjectArray<CarBrake> brake;
 	btAlignedObjectArray<CarWheel> wheel;
 	btAlignedObjectArray<CarTire> tire;
+	std::vector<std::shared_ptr<const CarTireTable> > tire_table;
+	std::string tire_table_dir;
+	btScalar tire_table_error;
 	btAlignedObjectArray<CarSuspension*> suspension;
 	btAlignedObjectArray<AeroDevice> aerodevice;
 
 	// wheel contact state
 	btAlignedObjectArray<CollisionContact> wheel_contact;
+	btAlignedObjectArray<DynamicsWorld::RayCache> wheel_ray_cache;
 	btAlignedObjectArray<btVector3> suspension_force;
 	btAlignedObjectArray<btVector3> wheel_velocity;
 	btAlignedObjectArray<btVector3> wheel_position;
@@ -229,6 +316,25 @@ protected:
 	btScalar feedback_scale;
 	btScalar feedback;
 
+	// adaptive substep state
+	int substeps_min;
+	int substeps_max;
+	int substeps;
+	int wheel_contacts; ///< bit per wheel, set if the suspension is loaded
+	btAlignedObjectArray<btScalar> last_slide;
+	btAlignedObjectArray<btScalar> last_slip;
+
+	// level of detail state
+	bool reduced_detail;
+	bool sleep_enabled;
+	bool sleeping;
+	btScalar sleep_time; ///< time at rest with constant inputs
+	float last_inputs[CarInput::INVALID];
+
+	void Wake();
+
+	void UpdateSleep(btScalar dt);
+
 	btVector3 GetDownVector() const;
 
 	btQuaternion LocalToWorld(const btQuaternion & local) const;
@@ -241,23 +347,32 @@ protected:
 
 	void ApplyAerodynamicsToBody ( btVector3 & force, btVector3 & torque );
 
-	void ComputeSuspensionDisplacement ( int i, btScalar dt );
+	// the wheel passes below work on all four wheels of the car at once,
+	// gathering the wheel, suspension and brake state into per wheel arrays
+
+	// bump offsets of the four wheels in one SIMD batch
+	void ComputeSuspensionDisplacements();
 
-	void DoTCS ( int i, btScalar suspension_force );
+	void DoTCS();
 
-	void DoABS ( int i, btScalar suspension_force );
+	void DoABS();
 
-	btVector3 ApplySuspensionForceToBody ( int i, btScalar dt, btVector3 & force, btVector3 & torque );
+	// suspension forces of all wheels, normal_force is their magnitude
+	void ApplySuspensionForces ( btScalar dt, btScalar normal_force[], btVector3 & force, btVector3 & torque );
 
-	btVector3 ComputeTireFrictionForce ( int i, btScalar dt, btScalar normal_force,
-        btScalar rotvel, const btVector3 & linvel, const btQuaternion & wheel_orientation );
+	// tire friction forces of all wheels from their normal forces
+	void ComputeTireFrictionForces ( const btScalar normal_force[], btVector3 friction_force[] );
 
-	void ApplyWheelForces ( btScalar dt, btScalar wheel_drive_torque, int i, const btVector3 & suspension_force, btVector3 & force, btVector3 & torque );
+	// brake, reaction and wheel torques of all wheels in one SIMD batch
+	void ApplyWheelForces ( btScalar dt, const btScalar wheel_drive_torque[], const btVector3 friction_force[], btVector3 & force, btVector3 & torque );
 
 	void ApplyForces ( btScalar dt, const btVector3 & force, const btVector3 & torque);
 
 	void Tick ( btScalar dt, const btVector3 & force, const btVector3 & torque);
 
+	// pick the substep count of the next update from the current state
+	void UpdateSubsteps(btScalar dt);
+
 	void UpdateWheelContacts();
 
 	void InterpolateWheelContacts();
@@ -239,3 +239,31 @@ bool CarEngine::Serialize(joeserialize::Serializer & s)
 	_SERIALIZE_(s, rev_limit_exceeded);
 	return true;
 }
+
+void CarEngine::GetState(State & state) const
+{
+	state.shaft = shaft;
+	state.combustion_torque = combustion_torque;
+	state.friction_torque = friction_torque;
+	state.clutch_torque = clutch_torque;
+	state.throttle_position = throttle_position;
+	state.nos_boost_factor = nos_boost_factor;
+	state.nos_mass = nos_mass;
+	state.rev_limit_exceeded = rev_limit_exceeded;
+	state.out_of_gas = out_of_gas;
+	state.stalled = stalled;
+}
+
+void CarEngine::SetState(const State & state)
+{
+	shaft = state.shaft;
+	combustion_torque = state.combustion_torque;
+	friction_torque = state.friction_torque;
+	clutch_torque = state.clutch_torque;
+	throttle_position = state.throttle_position;
+	nos_boost_factor = state.nos_boost_factor;
+	nos_mass = state.nos_mass;
+	rev_limit_exceeded = state.rev_limit_exceeded;
+	out_of_gas = state.out_of_gas;
+	stalled = state.stalled;
+}
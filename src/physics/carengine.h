@@ -189,6 +189,25 @@ public:
 
 	bool Serialize(joeserialize::Serializer & s);
 
+	/// plain copy of the engine variables, for snapshots
+	struct State
+	{
+		DriveShaft shaft;
+		btScalar combustion_torque;
+		btScalar friction_torque;
+		btScalar clutch_torque;
+		btScalar throttle_position;
+		btScalar nos_boost_factor;
+		btScalar nos_mass;
+		bool rev_limit_exceeded;
+		bool out_of_gas;
+		bool stalled;
+	};
+
+	void GetState(State & state) const;
+
+	void SetState(const State & state);
+
 private:
 	CarEngineInfo info;
 
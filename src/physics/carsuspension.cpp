@@ -145,6 +145,40 @@ void CarSuspension::DebugPrint(std::ostream & out) const
 	out << "Steering angle: " << steering_angle * 180 / M_PI << "\n";
 }
 
+void CarSuspension::GetState(State & state) const
+{
+	state.orientation_ext = orientation_ext;
+	state.steering_axis = steering_axis;
+	state.orientation = orientation;
+	state.position = position;
+	state.steering_angle = steering_angle;
+	state.spring_force = spring_force;
+	state.damp_force = damp_force;
+	state.force = force;
+	state.overtravel = overtravel;
+	state.displacement = displacement;
+	state.last_displacement = last_displacement;
+	state.wheel_velocity = wheel_velocity;
+	state.wheel_force = wheel_force;
+}
+
+void CarSuspension::SetState(const State & state)
+{
+	orientation_ext = state.orientation_ext;
+	steering_axis = state.steering_axis;
+	orientation = state.orientation;
+	position = state.position;
+	steering_angle = state.steering_angle;
+	spring_force = state.spring_force;
+	damp_force = state.damp_force;
+	force = state.force;
+	overtravel = state.overtravel;
+	displacement = state.displacement;
+	last_displacement = state.last_displacement;
+	wheel_velocity = state.wheel_velocity;
+	wheel_force = state.wheel_force;
+}
+
 class BasicSuspension : public CarSuspension
 {
 public:
@@ -108,6 +108,28 @@ public:
 		return true;
 	}
 
+	/// plain copy of the suspension variables, for snapshots
+	struct State
+	{
+		btQuaternion orientation_ext;
+		btVector3 steering_axis;
+		btQuaternion orientation;
+		btVector3 position;
+		btScalar steering_angle;
+		btScalar spring_force;
+		btScalar damp_force;
+		btScalar force;
+		btScalar overtravel;
+		btScalar displacement;
+		btScalar last_displacement;
+		btScalar wheel_velocity;
+		btScalar wheel_force;
+	};
+
+	void GetState(State & state) const;
+
+	void SetState(const State & state);
+
 	static bool Load(
 		const PTree & cfg_wheel,
 		CarSuspension *& suspension,
@@ -18,11 +18,80 @@
 /************************************************************************/
 
 #include "cartire.h"
+#include "cartiretable.h"
+#include "cartiretestinfo.h"
+#include "ssemath.h"
 #include "cfg/ptree.h"
+#include "unittest.h"
+#include <algorithm>
 #include <cassert>
 
 #ifndef VDRIFTN
 
+#ifdef PHYSICS_SSE
+namespace
+{
+	using namespace SseMath;
+
+	/// D * sin(C * atan(B * S - E * (B * S - atan(B * S))))
+	inline __m128 MagicFormula(__m128 B, __m128 C, __m128 D, __m128 E, __m128 S)
+	{
+		const __m128 BS = _mm_mul_ps(B, S);
+		const __m128 t = _mm_sub_ps(BS, _mm_mul_ps(E, _mm_sub_ps(BS, Atan(BS))));
+		return _mm_mul_ps(D, Sin(_mm_mul_ps(C, Atan(t))));
+	}
+
+	/// CarTire::PacejkaFx without max_Fx
+	inline __m128 PacejkaFx4(const __m128 b[], __m128 sigma, __m128 Fz, __m128 friction_coeff)
+	{
+		const __m128 C = b[0];
+		const __m128 D = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(b[1], Fz), b[2]), Fz);
+		const __m128 BCD = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(b[3], Fz), b[4]), Fz),
+			Exp(_mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), b[5]), Fz)));
+		const __m128 B = _mm_div_ps(BCD, _mm_mul_ps(C, D));
+		const __m128 E = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(b[6], Fz), b[7]), Fz), b[8]);
+		const __m128 S = _mm_mul_ps(_mm_set1_ps(100), sigma);
+		return _mm_mul_ps(MagicFormula(B, C, D, E, S), friction_coeff);
+	}
+
+	/// CarTire::PacejkaFy without max_Fy
+	inline __m128 PacejkaFy4(const __m128 a[], __m128 alpha, __m128 Fz, __m128 gamma, __m128 friction_coeff)
+	{
+		const __m128 one = _mm_set1_ps(1);
+		const __m128 C = a[0];
+		const __m128 D = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(a[1], Fz), a[2]), Fz);
+		const __m128 BCD = _mm_mul_ps(_mm_mul_ps(a[3], Sin(_mm_mul_ps(_mm_set1_ps(2), Atan(_mm_div_ps(Fz, a[4]))))),
+			_mm_sub_ps(one, _mm_mul_ps(a[5], Abs(gamma))));
+		const __m128 B = _mm_div_ps(BCD, _mm_mul_ps(C, D));
+		const __m128 E = _mm_add_ps(_mm_mul_ps(a[6], Fz), a[7]);
+		const __m128 Sv = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(
+			_mm_add_ps(_mm_mul_ps(a[11], Fz), a[12]), gamma), a[13]), Fz), a[14]);
+		return _mm_mul_ps(_mm_add_ps(MagicFormula(B, C, D, E, alpha), Sv), friction_coeff);
+	}
+
+	/// CarTire::PacejkaMz without max_Mz
+	inline __m128 PacejkaMz4(const __m128 c[], __m128 alpha, __m128 Fz, __m128 gamma, __m128 friction_coeff)
+	{
+		const __m128 one = _mm_set1_ps(1);
+		const __m128 abs_gamma = Abs(gamma);
+		const __m128 Fz2 = _mm_mul_ps(Fz, Fz);
+		const __m128 C = c[0];
+		const __m128 D = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(c[1], Fz), c[2]), Fz);
+		const __m128 BCD = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c[3], Fz), c[4]), Fz),
+			_mm_sub_ps(one, _mm_mul_ps(c[6], abs_gamma))),
+			Exp(_mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), c[5]), Fz)));
+		const __m128 B = _mm_div_ps(BCD, _mm_mul_ps(C, D));
+		const __m128 E = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[7], Fz2), _mm_mul_ps(c[8], Fz)), c[9]),
+			_mm_sub_ps(one, _mm_mul_ps(c[10], abs_gamma)));
+		const __m128 Sh = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[11], gamma), _mm_mul_ps(c[12], Fz)), c[13]);
+		const __m128 S = _mm_add_ps(alpha, Sh);
+		const __m128 Sv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c[14], Fz2),
+			_mm_mul_ps(c[15], Fz)), gamma), _mm_mul_ps(c[16], Fz)), c[17]);
+		return _mm_mul_ps(_mm_add_ps(MagicFormula(B, C, D, E, S), Sv), friction_coeff);
+	}
+}
+#endif // PHYSICS_SSE
+
 CarTireInfo::CarTireInfo() :
 	longitudinal(11),
 	lateral(15),
@@ -52,6 +121,17 @@ void CarTire::init(const CarTireInfo & info)
 {
 	CarTireInfo::operator=(info);
 	initSigmaHatAlphaHat();
+	table.reset();
+}
+
+void CarTire::setTable(const std::shared_ptr<const CarTireTable> & value)
+{
+	table = value;
+}
+
+const std::shared_ptr<const CarTireTable> & CarTire::getTable() const
+{
+	return table;
 }
 
 btVector3 CarTire::getForce(
@@ -98,9 +178,19 @@ btVector3 CarTire::getForce(
 	btScalar ap = rho * alpha_hat * alpha_sign;
 	btScalar gx = s / rho * sigma_sign;
 	btScalar gy = a / rho * alpha_sign;
-	btScalar Fx = gx * PacejkaFx(sp, Fz, friction_coeff, max_Fx);
-	btScalar Fy = gy * PacejkaFy(ap, Fz, gamma, friction_coeff, max_Fy);
-	btScalar Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+	btScalar Fx, Fy, Mz;
+	if (table && table->lookup(sp, ap, alpha, Fz, gamma, Fx, Fy, Mz))
+	{
+		Fx = gx * (Fx * friction_coeff);
+		Fy = gy * (Fy * friction_coeff);
+		Mz = Mz * friction_coeff;
+	}
+	else
+	{
+		Fx = gx * PacejkaFx(sp, Fz, friction_coeff, max_Fx);
+		Fy = gy * PacejkaFy(ap, Fz, gamma, friction_coeff, max_Fy);
+		Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+	}
 
 	camber = inclination;
 	slide = sigma;
@@ -116,6 +206,157 @@ btVector3 CarTire::getForce(
 	return btVector3(Fx, Fy, Mz);
 }
 
+void CarTire::getForces(
+	CarTire tire[],
+	int count,
+	const btScalar normal_force[],
+	const btScalar friction_coeff[],
+	const btScalar inclination[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[])
+{
+	int i = 0;
+#ifdef PHYSICS_SSE
+	// table lookups are cheaper than the vectorized formula
+	bool tabulated = false;
+	for (int n = 0; n < count; ++n)
+		tabulated = tabulated || tire[n].table;
+
+	if (!tabulated)
+	{
+		for (; i < count; i += 4)
+		{
+			getForces4(
+				tire + i, std::min(count - i, 4),
+				normal_force + i, friction_coeff + i, inclination + i,
+				rot_velocity + i, lon_velocity + i, lat_velocity + i,
+				force + i);
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		force[i] = tire[i].getForce(
+			normal_force[i], friction_coeff[i], inclination[i],
+			rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+	}
+}
+
+void CarTire::getForces4(
+	CarTire tire[],
+	int count,
+	const btScalar normal_force[],
+	const btScalar friction_coeff[],
+	const btScalar inclination[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[])
+{
+#ifdef PHYSICS_SSE
+	// gather the inputs and coefficients one lane per tire,
+	// unused lanes repeat the first tire and are discarded
+	float fz[4], incl[4], friction[4], sigma_hat[4], alpha_hat[4], rot[4], lon[4], lat[4];
+	float b[9][4], a[15][4], c[18][4];
+	bool active[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		const int k = i < count ? i : 0;
+		const CarTire & t = tire[k];
+		active[i] = i < count && normal_force[k] * friction_coeff[k] >= 1E-6;
+
+		fz[i] = btMin(normal_force[k] * btScalar(0.001), btScalar(30));
+		incl[i] = inclination[k];
+		btClamp(incl[i], btScalar(-0.1 * M_PI), btScalar(0.1 * M_PI));
+		friction[i] = friction_coeff[k];
+		rot[i] = rot_velocity[k];
+		lon[i] = lon_velocity[k];
+		lat[i] = lat_velocity[k];
+		t.getSigmaHatAlphaHat(normal_force[k], sigma_hat[i], alpha_hat[i]);
+
+		for (int n = 0; n < 9; ++n)
+			b[n][i] = t.longitudinal[n];
+		for (int n = 0; n < 15; ++n)
+			a[n][i] = t.lateral[n];
+		for (int n = 0; n < 18; ++n)
+			c[n][i] = t.aligning[n];
+	}
+
+	__m128 B[9], A[15], C[18];
+	for (int n = 0; n < 9; ++n)
+		B[n] = _mm_loadu_ps(b[n]);
+	for (int n = 0; n < 15; ++n)
+		A[n] = _mm_loadu_ps(a[n]);
+	for (int n = 0; n < 18; ++n)
+		C[n] = _mm_loadu_ps(c[n]);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 Fz = _mm_loadu_ps(fz);
+	const __m128 gamma = _mm_mul_ps(_mm_loadu_ps(incl), _mm_set1_ps(SIMD_DEGS_PER_RAD));
+	const __m128 friction_coeff4 = _mm_loadu_ps(friction);
+	const __m128 sh = _mm_loadu_ps(sigma_hat);
+	const __m128 ah = _mm_loadu_ps(alpha_hat);
+	const __m128 lon_vel = _mm_loadu_ps(lon);
+
+	// same slip and combined slip math as getForce
+	const __m128 denom = _mm_max_ps(Abs(lon_vel), _mm_set1_ps(1E-3f));
+	const __m128 sigma = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(rot), lon_vel), denom);
+	const __m128 alpha = _mm_sub_ps(zero, _mm_mul_ps(
+		Atan(_mm_div_ps(_mm_loadu_ps(lat), denom)), _mm_set1_ps(SIMD_DEGS_PER_RAD)));
+
+	const __m128 sigma_sign = Select(_mm_cmplt_ps(sigma, zero), _mm_set1_ps(-1), one);
+	const __m128 alpha_sign = Select(_mm_cmplt_ps(alpha, zero), _mm_set1_ps(-1), one);
+	const __m128 s = _mm_div_ps(sigma, sh);
+	const __m128 a4 = _mm_div_ps(alpha, ah);
+	const __m128 rho = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(a4, a4))), _mm_set1_ps(1E-4f));
+	const __m128 sp = _mm_mul_ps(_mm_mul_ps(rho, sh), sigma_sign);
+	const __m128 ap = _mm_mul_ps(_mm_mul_ps(rho, ah), alpha_sign);
+	const __m128 gx = _mm_mul_ps(_mm_div_ps(s, rho), sigma_sign);
+	const __m128 gy = _mm_mul_ps(_mm_div_ps(a4, rho), alpha_sign);
+	const __m128 Fx = _mm_mul_ps(gx, PacejkaFx4(B, sp, Fz, friction_coeff4));
+	const __m128 Fy = _mm_mul_ps(gy, PacejkaFy4(A, ap, Fz, gamma, friction_coeff4));
+	const __m128 Mz = PacejkaMz4(C, alpha, Fz, gamma, friction_coeff4);
+
+	float fx[4], fy[4], mz[4], slide[4], slip[4];
+	_mm_storeu_ps(fx, Fx);
+	_mm_storeu_ps(fy, Fy);
+	_mm_storeu_ps(mz, Mz);
+	_mm_storeu_ps(slide, sigma);
+	_mm_storeu_ps(slip, alpha);
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (!active[i])
+		{
+			force[i] = btVector3(0, 0, 0);
+			continue;
+		}
+
+		CarTire & t = tire[i];
+		t.camber = incl[i];
+		t.slide = slide[i];
+		t.slip = slip[i] * SIMD_RADS_PER_DEG;
+		t.ideal_slide = sigma_hat[i];
+		t.ideal_slip = alpha_hat[i] * SIMD_RADS_PER_DEG;
+		t.fx = fx[i];
+		t.fy = fy[i];
+		t.fz = fz[i];
+		t.mz = mz[i];
+		force[i] = btVector3(fx[i], fy[i], mz[i]);
+	}
+#else
+	for (int i = 0; i < count; ++i)
+	{
+		force[i] = tire[i].getForce(
+			normal_force[i], friction_coeff[i], inclination[i],
+			rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+	}
+#endif
+}
+
 btScalar CarTire::getRollingResistance(const btScalar velocity, const btScalar resistance_factor) const
 {
 	// surface influence on rolling resistance
@@ -344,4 +585,39 @@ void CarTire::initSigmaHatAlphaHat(int tablesize)
 	}
 }
 
+QT_TEST(cartire_test)
+{
+	const CarTireInfo info = GetTestTireInfo();
+
+	// five tires to cover a full and a partial batch, the last one unloaded
+	const int count = 5;
+	CarTire tire[count], tire_ref[count];
+	const btScalar normal_force[count] = {3000, 4500, 1200, 6000, 0};
+	const btScalar friction_coeff[count] = {1.0, 0.9, 1.0, 0.7, 1.0};
+	const btScalar inclination[count] = {0.02, -0.05, 0.5, 0, 0};
+	const btScalar rot_velocity[count] = {20, 31, 5, -10, 10};
+	const btScalar lon_velocity[count] = {20, 30, 6, -12, 10};
+	const btScalar lat_velocity[count] = {0, 1.5, -2, 0.5, 1};
+	for (int i = 0; i < count; ++i)
+	{
+		tire[i].init(info);
+		tire_ref[i].init(info);
+	}
+
+	btVector3 force[count];
+	CarTire::getForces(tire, count, normal_force, friction_coeff, inclination,
+		rot_velocity, lon_velocity, lat_velocity, force);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const btVector3 ref = tire_ref[i].getForce(normal_force[i], friction_coeff[i],
+			inclination[i], rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+		for (int n = 0; n < 3; ++n)
+			QT_CHECK_CLOSE(force[i][n], ref[n], btFabs(ref[n]) * 1E-4 + 1E-3);
+		QT_CHECK_CLOSE(tire[i].getSlip(), tire_ref[i].getSlip(), 1E-5);
+		QT_CHECK_CLOSE(tire[i].getSlipAngle(), tire_ref[i].getSlipAngle(), 1E-5);
+	}
+	QT_CHECK_EQUAL(force[count - 1].length2(), 0);
+}
+
 #endif
@@ -32,8 +32,11 @@ typedef TireInfo CarTireInfo;
 #include "joeserialize.h"
 #include "macros.h"
 
+#include <memory>
 #include <vector>
 
+class CarTireTable;
+
 struct CarTireInfo
 {
 	std::vector<btScalar> longitudinal; ///< the parameters of the longitudinal pacejka equation.  this is series b
@@ -50,11 +53,17 @@ struct CarTireInfo
 class CarTire : private CarTireInfo
 {
 friend class joeserialize::Serializer;
+friend class CarTireTable;
 public:
 	CarTire();
 
 	void init(const CarTireInfo & info);
 
+	/// use table to look up the tire curves, null to evaluate them
+	void setTable(const std::shared_ptr<const CarTireTable> & table);
+
+	const std::shared_ptr<const CarTireTable> & getTable() const;
+
 	/// get tire tread fraction
 	btScalar getTread() const;
 
@@ -72,6 +81,22 @@ public:
 		btScalar lon_velocty,
 		btScalar lat_velocity);
 
+	/// getForce of count tires, the inputs are structure of arrays with one
+	/// entry per tire. Evaluates four tires at once with SSE where available,
+	/// force differences to getForce are within float rounding of the
+	/// transcendental approximations. Without SSE or with tables in use it
+	/// calls getForce per tire.
+	static void getForces(
+		CarTire tire[],
+		int count,
+		const btScalar normal_force[],
+		const btScalar friction_coeff[],
+		const btScalar inclination[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[]);
+
 	btScalar getRollingResistance(
 		const btScalar velocity,
 		const btScalar resistance_factor) const;
@@ -95,6 +120,21 @@ public:
 
 	bool Serialize(joeserialize::Serializer & s);
 
+	/// plain copy of the tire variables, for snapshots
+	struct State
+	{
+		btScalar camber;
+		btScalar slide;
+		btScalar slip;
+		btScalar ideal_slide;
+		btScalar ideal_slip;
+		btScalar fx, fy, fz, mz;
+	};
+
+	void getState(State & state) const;
+
+	void setState(const State & state);
+
 private:
 	btScalar camber; ///< tire camber relative to track surface
 	btScalar slide; ///< ratio of tire contact patch speed to road speed, minus one
@@ -102,6 +142,7 @@ private:
 	btScalar ideal_slide; ///< ideal slide ratio
 	btScalar ideal_slip; ///< ideal slip angle
 	btScalar fx, fy, fz, mz;
+	std::shared_ptr<const CarTireTable> table;
 
 	/// pacejka magic formula function, longitudinal
 	btScalar PacejkaFx(btScalar sigma, btScalar Fz, btScalar friction_coeff, btScalar & max_Fx) const;
@@ -121,6 +162,18 @@ private:
 		int iterations=400);
 
 	void initSigmaHatAlphaHat(int tablesize = 20);
+
+	/// getForces of up to four tires
+	static void getForces4(
+		CarTire tire[],
+		int count,
+		const btScalar normal_force[],
+		const btScalar friction_coeff[],
+		const btScalar inclination[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[]);
 };
 
 // implementation
@@ -171,6 +224,32 @@ inline bool CarTire::Serialize(joeserialize::Serializer & /*s*/)
 	return true;
 }
 
+inline void CarTire::getState(State & state) const
+{
+	state.camber = camber;
+	state.slide = slide;
+	state.slip = slip;
+	state.ideal_slide = ideal_slide;
+	state.ideal_slip = ideal_slip;
+	state.fx = fx;
+	state.fy = fy;
+	state.fz = fz;
+	state.mz = mz;
+}
+
+inline void CarTire::setState(const State & state)
+{
+	camber = state.camber;
+	slide = state.slide;
+	slip = state.slip;
+	ideal_slide = state.ideal_slide;
+	ideal_slip = state.ideal_slip;
+	fx = state.fx;
+	fy = state.fy;
+	fz = state.fz;
+	mz = state.mz;
+}
+
 #endif
 
 #endif
@@ -0,0 +1,453 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "cartiretable.h"
+#include "cartire.h"
+#include "cartiretestinfo.h"
+#include "unittest.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#ifndef VDRIFTN
+
+static const char table_magic[4] = {'V', 'T', 'T', '1'};
+static const int max_level = 5;
+
+// table size limit, 4 MB of float samples, refinement stops there
+static const unsigned int max_samples = 1 << 20;
+
+// smaller error bounds would only run into the size limit
+static const btScalar min_error = 1E-3;
+
+// slip ratio, slip angle in degrees, load in kN, camber in degrees
+// the ranges cover normal driving, inputs outside fall back to the formula
+static const btScalar sigma_range = 1;
+static const btScalar alpha_range = 30;
+static const btScalar load_range = 12;
+static const btScalar camber_range = btScalar(0.1 * M_PI) * SIMD_DEGS_PER_RAD;
+
+// the curves have no finite limit at zero load, sample slightly above
+static const btScalar min_load = 1E-3;
+
+// axis node counts of the refinement levels
+// odd camber node count to sample the |gamma| kink at zero
+static int GetSlipNodes(int level) { return (32 << level) + 1; }
+static int GetLoadNodes(int level) { return (4 << level) + 1; }
+static int GetCamberNodes(int level) { return (2 << level) + 1; }
+
+static unsigned int GetSampleCount(int slip_level, int load_level, int camber_level)
+{
+	const unsigned int ns = GetSlipNodes(slip_level);
+	const unsigned int nl = GetLoadNodes(load_level);
+	const unsigned int nc = GetCamberNodes(camber_level);
+	return ns * nl + 2 * ns * nl * nc;
+}
+
+template <typename T>
+static void Hash(unsigned int & hash, const T * data, size_t count)
+{
+	// fnv-1a
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < count * sizeof(T); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+}
+
+void CarTireTable::Axis::init(btScalar new_min, btScalar new_max, int new_size)
+{
+	assert(new_size > 1);
+	min = new_min;
+	max = new_max;
+	size = new_size;
+	inv_step = (size - 1) / (max - min);
+}
+
+btScalar CarTireTable::Axis::get(int i) const
+{
+	return min + i * (max - min) / (size - 1);
+}
+
+bool CarTireTable::Axis::locate(btScalar x, int & i, btScalar & t) const
+{
+	// tolerate rounding at the range bounds
+	btScalar u = (x - min) * inv_step;
+	if (!(u > btScalar(-1E-3) && u < size - 1 + btScalar(1E-3)))
+		return false;
+
+	i = btMin(btMax(int(u), 0), size - 2);
+	t = u - i;
+	return true;
+}
+
+static btScalar Interpolate(
+	const std::vector<btScalar> & data,
+	int size0, int i0, btScalar t0,
+	int i1, btScalar t1)
+{
+	const btScalar * d = &data[i1 * size0 + i0];
+	btScalar a = d[0] + (d[1] - d[0]) * t0;
+	btScalar b = d[size0] + (d[size0 + 1] - d[size0]) * t0;
+	return a + (b - a) * t1;
+}
+
+static btScalar Interpolate(
+	const std::vector<btScalar> & data,
+	int size0, int size1, int i0, btScalar t0,
+	int i1, btScalar t1, int i2, btScalar t2)
+{
+	const int stride = size0 * size1;
+	const int n = i2 * stride + i1 * size0 + i0;
+	const btScalar * d = &data[n];
+	btScalar a = d[0] + (d[1] - d[0]) * t0;
+	btScalar b = d[size0] + (d[size0 + 1] - d[size0]) * t0;
+	btScalar ab = a + (b - a) * t1;
+	d += stride;
+	btScalar c = d[0] + (d[1] - d[0]) * t0;
+	btScalar e = d[size0] + (d[size0 + 1] - d[size0]) * t0;
+	btScalar ce = c + (e - c) * t1;
+	return ab + (ce - ab) * t2;
+}
+
+CarTireTable::CarTireTable() :
+	hash(0),
+	slip_level(0),
+	load_level(0),
+	camber_level(0)
+{
+	// ctor
+}
+
+btScalar CarTireTable::clampError(btScalar max_error)
+{
+	return btMax(max_error, min_error);
+}
+
+btScalar CarTireTable::build(const CarTire & tire, btScalar max_error)
+{
+	assert(max_error > 0);
+	max_error = clampError(max_error);
+	hash = getHash(tire, max_error);
+
+	// the axis errors add up, refine the worst axis until the sum is in bounds
+	init(0, 0, 0);
+	while (true)
+	{
+		sample(tire);
+
+		btScalar error[3];
+		getErrors(tire, error[0], error[1], error[2]);
+		int * level[3] = {&slip_level, &load_level, &camber_level};
+		int worst = -1;
+		for (int i = 0; i < 3; ++i)
+		{
+			int next[3] = {slip_level, load_level, camber_level};
+			next[i]++;
+			if (*level[i] < max_level &&
+				GetSampleCount(next[0], next[1], next[2]) <= max_samples &&
+				(worst < 0 || error[i] > error[worst]))
+				worst = i;
+		}
+		if (worst < 0 || error[0] + error[1] + error[2] <= max_error)
+			return error[0] + error[1] + error[2];
+
+		(*level[worst])++;
+		init(slip_level, load_level, camber_level);
+	}
+}
+
+bool CarTireTable::load(const std::string & filename, const CarTire & tire, btScalar max_error)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	char magic[4];
+	unsigned int file_hash;
+	int levels[3];
+	file.read(magic, sizeof(magic));
+	file.read((char *)&file_hash, sizeof(file_hash));
+	file.read((char *)levels, sizeof(levels));
+	if (!file || std::memcmp(magic, table_magic, sizeof(magic)) ||
+		file_hash != getHash(tire, max_error))
+		return false;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		if (levels[i] < 0 || levels[i] > max_level)
+			return false;
+	}
+	if (GetSampleCount(levels[0], levels[1], levels[2]) > max_samples)
+		return false;
+
+	init(levels[0], levels[1], levels[2]);
+	file.read((char *)&fx[0], fx.size() * sizeof(btScalar));
+	file.read((char *)&fy[0], fy.size() * sizeof(btScalar));
+	file.read((char *)&mz[0], mz.size() * sizeof(btScalar));
+	if (!file)
+	{
+		init(0, 0, 0);
+		return false;
+	}
+
+	hash = file_hash;
+	return true;
+}
+
+bool CarTireTable::save(const std::string & filename) const
+{
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	const int levels[3] = {slip_level, load_level, camber_level};
+	file.write(table_magic, sizeof(table_magic));
+	file.write((const char *)&hash, sizeof(hash));
+	file.write((const char *)levels, sizeof(levels));
+	file.write((const char *)&fx[0], fx.size() * sizeof(btScalar));
+	file.write((const char *)&fy[0], fy.size() * sizeof(btScalar));
+	file.write((const char *)&mz[0], mz.size() * sizeof(btScalar));
+	return file.good();
+}
+
+bool CarTireTable::lookup(
+	btScalar sigma,
+	btScalar alpha_combined,
+	btScalar alpha,
+	btScalar Fz,
+	btScalar gamma,
+	btScalar & Fx,
+	btScalar & Fy,
+	btScalar & Mz) const
+{
+	int is, ia, im, il, ic;
+	btScalar ts, ta, tm, tl, tc;
+	if (!sigma_axis.locate(sigma, is, ts) ||
+		!alpha_axis.locate(alpha_combined, ia, ta) ||
+		!alpha_axis.locate(alpha, im, tm) ||
+		!load_axis.locate(Fz, il, tl) ||
+		!camber_axis.locate(gamma, ic, tc))
+		return false;
+
+	const int ns = sigma_axis.size;
+	const int na = alpha_axis.size;
+	const int nl = load_axis.size;
+	Fx = Interpolate(fx, ns, is, ts, il, tl);
+	Fy = Interpolate(fy, na, nl, ia, ta, il, tl, ic, tc);
+	Mz = Interpolate(mz, na, nl, im, tm, il, tl, ic, tc);
+	return true;
+}
+
+unsigned int CarTireTable::getHash(const CarTire & tire, btScalar max_error)
+{
+	max_error = clampError(max_error);
+	const int version = 1;
+	const int scalar_size = sizeof(btScalar);
+	unsigned int hash = 2166136261u;
+	Hash(hash, &version, 1);
+	Hash(hash, &scalar_size, 1);
+	Hash(hash, &max_error, 1);
+	Hash(hash, &tire.longitudinal[0], tire.longitudinal.size());
+	Hash(hash, &tire.lateral[0], tire.lateral.size());
+	Hash(hash, &tire.aligning[0], tire.aligning.size());
+	return hash;
+}
+
+void CarTireTable::init(int new_slip_level, int new_load_level, int new_camber_level)
+{
+	slip_level = new_slip_level;
+	load_level = new_load_level;
+	camber_level = new_camber_level;
+
+	sigma_axis.init(-sigma_range, sigma_range, GetSlipNodes(slip_level));
+	alpha_axis.init(-alpha_range, alpha_range, GetSlipNodes(slip_level));
+	load_axis.init(0, load_range, GetLoadNodes(load_level));
+	camber_axis.init(-camber_range, camber_range, GetCamberNodes(camber_level));
+
+	fx.resize(sigma_axis.size * load_axis.size);
+	fy.resize(alpha_axis.size * load_axis.size * camber_axis.size);
+	mz.resize(fy.size());
+}
+
+void CarTireTable::sample(const CarTire & tire)
+{
+	btScalar max;
+	for (int l = 0; l < load_axis.size; ++l)
+	{
+		const btScalar Fz = btMax(load_axis.get(l), min_load);
+		for (int s = 0; s < sigma_axis.size; ++s)
+		{
+			fx[l * sigma_axis.size + s] = tire.PacejkaFx(sigma_axis.get(s), Fz, 1, max);
+		}
+		for (int c = 0; c < camber_axis.size; ++c)
+		{
+			const btScalar gamma = camber_axis.get(c);
+			const int n = (c * load_axis.size + l) * alpha_axis.size;
+			for (int a = 0; a < alpha_axis.size; ++a)
+			{
+				const btScalar alpha = alpha_axis.get(a);
+				fy[n + a] = tire.PacejkaFy(alpha, Fz, gamma, 1, max);
+				mz[n + a] = tire.PacejkaMz(alpha, Fz, gamma, 1, max);
+			}
+		}
+	}
+}
+
+void CarTireTable::getErrors(
+	const CarTire & tire,
+	btScalar & slip_error,
+	btScalar & load_error,
+	btScalar & camber_error) const
+{
+	btScalar fx_peak(1E-6), fy_peak(1E-6), mz_peak(1E-6);
+	for (size_t i = 0; i < fx.size(); ++i)
+		fx_peak = btMax(fx_peak, btFabs(fx[i]));
+	for (size_t i = 0; i < fy.size(); ++i)
+		fy_peak = btMax(fy_peak, btFabs(fy[i]));
+	for (size_t i = 0; i < mz.size(); ++i)
+		mz_peak = btMax(mz_peak, btFabs(mz[i]));
+
+	// linear interpolation error peaks halfway between nodes,
+	// probe every axis at its cell centers and the other axes at nodes
+	btScalar error[3] = {0, 0, 0};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const btScalar h[3] = {
+			btScalar(axis == 0 ? 0.5 : 0),
+			btScalar(axis == 1 ? 0.5 : 0),
+			btScalar(axis == 2 ? 0.5 : 0)};
+		const int nl = load_axis.size - (axis == 1);
+		const int nc = camber_axis.size - (axis == 2);
+		const int na = alpha_axis.size - (axis == 0);
+		const int ns = sigma_axis.size - (axis == 0);
+		for (int l = 0; l < nl; ++l)
+		{
+			const btScalar Fz = btMax(load_axis.get(l) + h[1] / load_axis.inv_step, min_load);
+			// camber has no influence on Fx
+			for (int s = 0; s < ns && axis != 2; ++s)
+			{
+				btScalar sigma = sigma_axis.get(s) + h[0] / sigma_axis.inv_step;
+				btScalar max, Fx, Fy, Mz;
+				btScalar Fx_ref = tire.PacejkaFx(sigma, Fz, 1, max);
+				lookup(sigma, 0, 0, Fz, 0, Fx, Fy, Mz);
+				error[axis] = btMax(error[axis], btFabs(Fx - Fx_ref) / fx_peak);
+			}
+			for (int c = 0; c < nc; ++c)
+			{
+				const btScalar gamma = camber_axis.get(c) + h[2] / camber_axis.inv_step;
+				for (int a = 0; a < na; ++a)
+				{
+					btScalar alpha = alpha_axis.get(a) + h[0] / alpha_axis.inv_step;
+					btScalar max, Fx, Fy, Mz;
+					btScalar Fy_ref = tire.PacejkaFy(alpha, Fz, gamma, 1, max);
+					btScalar Mz_ref = tire.PacejkaMz(alpha, Fz, gamma, 1, max);
+					lookup(0, alpha, alpha, Fz, gamma, Fx, Fy, Mz);
+					error[axis] = btMax(error[axis], btFabs(Fy - Fy_ref) / fy_peak);
+					error[axis] = btMax(error[axis], btFabs(Mz - Mz_ref) / mz_peak);
+				}
+			}
+		}
+	}
+	slip_error = error[0];
+	load_error = error[1];
+	camber_error = error[2];
+}
+
+QT_TEST(cartiretable_test)
+{
+	const CarTireInfo info = GetTestTireInfo();
+
+	CarTire tire, tire_ref;
+	tire.init(info);
+	tire_ref.init(info);
+
+	const btScalar max_error = 1E-2;
+	std::shared_ptr<CarTireTable> table(new CarTireTable());
+	table->build(tire, max_error);
+	tire.setTable(table);
+
+	// compare against the analytic model, errors are relative to the peak force or moment of the table
+	btScalar max_Fx = tire.getMaxFx(12000);
+	btScalar max_Fy = tire.getMaxFy(12000, 0);
+	btScalar max_Mz = btFabs(tire.getMaxMz(12000, 0));
+	for (int i = 0; i < 200; ++i)
+	{
+		btScalar load = 500 + 40 * i;
+		btScalar inclination = -0.2 + 0.002 * i;
+		btScalar lon_velocity = 20;
+		btScalar rot_velocity = lon_velocity * (1 + 0.002 * (i - 100));
+		btScalar lat_velocity = 0.03 * (i - 100);
+		btVector3 f = tire.getForce(load, 1, inclination, rot_velocity, lon_velocity, lat_velocity);
+		btVector3 f_ref = tire_ref.getForce(load, 1, inclination, rot_velocity, lon_velocity, lat_velocity);
+		QT_CHECK_CLOSE(f[0], f_ref[0], max_error * max_Fx);
+		QT_CHECK_CLOSE(f[1], f_ref[1], max_error * max_Fy);
+		QT_CHECK_CLOSE(f[2], f_ref[2], max_error * max_Mz);
+	}
+
+	// unchanged tire coefficients and bound reuse the table
+	QT_CHECK_EQUAL(CarTireTable::getHash(tire_ref, max_error), table->getHash());
+	QT_CHECK(CarTireTable::getHash(tire_ref, max_error * 2) != table->getHash());
+
+	// tiny bounds are clamped, the table stays within its size limit
+	QT_CHECK_EQUAL(CarTireTable::getHash(tire_ref, 1E-9), CarTireTable::getHash(tire_ref, 1E-3));
+	CarTireTable fine;
+	fine.build(tire_ref, 1E-9);
+	QT_CHECK(fine.getSize() <= 1u << 20);
+
+	// cache file round trip
+	const std::string filename = "cartiretable_test.tiretable";
+	QT_CHECK(table->save(filename));
+	CarTireTable loaded;
+	QT_CHECK(loaded.load(filename, tire_ref, max_error));
+	QT_CHECK_EQUAL(loaded.getHash(), table->getHash());
+	QT_CHECK_EQUAL(loaded.getSize(), table->getSize());
+	for (int i = 0; i < 100; ++i)
+	{
+		const btScalar sigma = -0.9 + 0.018 * i;
+		const btScalar alpha = -25 + 0.5 * i;
+		const btScalar load = 0.5 + 0.1 * i;
+		const btScalar gamma = -9 + 0.18 * i;
+		btScalar f[3], f_ref[3];
+		QT_CHECK(table->lookup(sigma, alpha, alpha, load, gamma, f_ref[0], f_ref[1], f_ref[2]));
+		QT_CHECK(loaded.lookup(sigma, alpha, alpha, load, gamma, f[0], f[1], f[2]));
+		QT_CHECK_EQUAL(f[0], f_ref[0]);
+		QT_CHECK_EQUAL(f[1], f_ref[1]);
+		QT_CHECK_EQUAL(f[2], f_ref[2]);
+	}
+
+	// tables of another bound and truncated files are rejected
+	CarTireTable rejected;
+	QT_CHECK(!rejected.load(filename, tire_ref, max_error * 2));
+	std::string data;
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	std::ofstream(filename.c_str(), std::ios::binary).write(data.data(), data.size() / 2);
+	QT_CHECK(!rejected.load(filename, tire_ref, max_error));
+	std::remove(filename.c_str());
+}
+
+#endif // VDRIFTN
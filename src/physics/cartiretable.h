@@ -0,0 +1,108 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _CARTIRETABLE_H
+#define _CARTIRETABLE_H
+
+#ifndef VDRIFTN
+
+#include "LinearMath/btScalar.h"
+
+#include <string>
+#include <vector>
+
+class CarTire;
+
+/// Pacejka curves of a tire compound sampled on regular grids at unit friction:
+/// Fx(sigma, Fz), Fy(alpha, Fz, gamma) and Mz(alpha, Fz, gamma).
+/// The grids are refined until the multilinear interpolation error is below
+/// max_error times the peak value of each curve or the resolution limit is hit.
+/// Tables are limited to 2^20 samples, max_error to 1E-3 and above.
+class CarTireTable
+{
+public:
+	CarTireTable();
+
+	/// Error bound actually used for max_error.
+	static btScalar clampError(btScalar max_error);
+
+	/// Sample the curves of tire, returns the estimated relative error.
+	btScalar build(const CarTire & tire, btScalar max_error);
+
+	/// Load a table built for tire with max_error, fails if the file is missing or stale.
+	bool load(const std::string & filename, const CarTire & tire, btScalar max_error);
+
+	bool save(const std::string & filename) const;
+
+	/// Interpolate the curves at unit friction, same units as CarTire::getForce.
+	/// Returns false if an argument is outside of the tabulated range.
+	bool lookup(
+		btScalar sigma,
+		btScalar alpha_combined,
+		btScalar alpha,
+		btScalar Fz,
+		btScalar gamma,
+		btScalar & Fx,
+		btScalar & Fy,
+		btScalar & Mz) const;
+
+	/// Hash of the tire coefficients and max_error, identifies the table.
+	static unsigned int getHash(const CarTire & tire, btScalar max_error);
+
+	unsigned int getHash() const { return hash; }
+
+	/// Total number of samples.
+	unsigned int getSize() const { return fx.size() + fy.size() + mz.size(); }
+
+private:
+	struct Axis
+	{
+		btScalar min;
+		btScalar max;
+		btScalar inv_step;
+		int size;
+
+		void init(btScalar min, btScalar max, int size);
+
+		btScalar get(int i) const;
+
+		/// Cell index i and weight t of x, false if x is out of range.
+		bool locate(btScalar x, int & i, btScalar & t) const;
+	};
+
+	Axis sigma_axis, alpha_axis, load_axis, camber_axis;
+	std::vector<btScalar> fx;
+	std::vector<btScalar> fy;
+	std::vector<btScalar> mz;
+	unsigned int hash;
+	int slip_level;
+	int load_level;
+	int camber_level;
+
+	void init(int slip_level, int load_level, int camber_level);
+
+	void sample(const CarTire & tire);
+
+	/// Relative interpolation error along the slip, load and camber axes.
+	void getErrors(const CarTire & tire, btScalar & slip_error, btScalar & load_error, btScalar & camber_error) const;
+};
+
+#endif // VDRIFTN
+
+#endif // _CARTIRETABLE_H
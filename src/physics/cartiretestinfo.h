@@ -17,10 +17,26 @@
 /*                                                                      */
 /************************************************************************/
 
-#include "parallel_task.h"
+#ifndef _CARTIRETESTINFO_H
+#define _CARTIRETESTINFO_H
 
-int Parallel::Dispatch(void * data)
+#ifndef VDRIFTN
+
+#include "cartire.h"
+
+/// Pacejka coefficients of a generic road tire, shared by the tire unit tests.
+inline CarTireInfo GetTestTireInfo()
 {
-	((Task *) data)->Run();
-	return 0;
+	CarTireInfo info;
+	const btScalar b[] = {1.65, 0, 1650, 0, 300, 0, 0, 0, -10, 0, 0};
+	const btScalar a[] = {1.6, -50, 1450, 1800, 8, 0.01, -0.03, -0.4, 0, 0, 0, 0, 0, 0, 0};
+	const btScalar c[] = {2.3, -3.8, -3.14, -1.16, -7.2, 0, 0, 0.044, -0.58, 0.18, 0, 0, 0, 0, 0.14, -1.029, 0, 0};
+	info.longitudinal.assign(b, b + 11);
+	info.lateral.assign(a, a + 15);
+	info.aligning.assign(c, c + 18);
+	return info;
 }
+
+#endif // VDRIFTN
+
+#endif // _CARTIRETESTINFO_H
@@ -146,6 +146,28 @@ public:
 		return true;
 	}
 
+	/// plain copy of the transmission variables, for snapshots
+	struct State
+	{
+		int gear;
+		btScalar driveshaft_rpm;
+		btScalar crankshaft_rpm;
+	};
+
+	void GetState(State & state) const
+	{
+		state.gear = gear;
+		state.driveshaft_rpm = driveshaft_rpm;
+		state.crankshaft_rpm = crankshaft_rpm;
+	}
+
+	void SetState(const State & state)
+	{
+		gear = state.gear;
+		driveshaft_rpm = state.driveshaft_rpm;
+		crankshaft_rpm = state.crankshaft_rpm;
+	}
+
 private:
 	//constants (not actually declared as const because they can be changed after object creation)
 	std::map <int, btScalar> gear_ratios; ///< gear number and ratio.  reverse gears are negative integers. neutral is zero.
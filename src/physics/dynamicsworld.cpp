@@ -22,11 +22,64 @@
 #include "collision_contact.h"
 #include "tobullet.h"
 #include "track.h"
+#include "job_system.h"
+#include "frame_profiler.h"
+#include "unittest.h"
 
+#include "BulletCollision/BroadphaseCollision/btDbvt.h"
+#include "BulletCollision/BroadphaseCollision/btDbvtBroadphase.h"
+#include "BulletCollision/CollisionDispatch/btDefaultCollisionConfiguration.h"
+#include "BulletCollision/CollisionShapes/btBoxShape.h"
+#include "BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h"
 #include "BulletCollision/CollisionShapes/btCollisionShape.h"
+#include "BulletCollision/CollisionShapes/btCompoundShape.h"
+#include "BulletCollision/CollisionShapes/btConcaveShape.h"
+#include "BulletCollision/CollisionShapes/btTriangleCallback.h"
+#include "BulletCollision/CollisionShapes/btTriangleMesh.h"
+#include "BulletCollision/NarrowPhaseCollision/btRaycastCallback.h"
+#include "BulletCollision/BroadphaseCollision/btBroadphaseInterface.h"
+#include "BulletCollision/CollisionDispatch/btSimulationIslandManager.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolver.h"
+#include "LinearMath/btAabbUtil2.h"
+#include "LinearMath/btQuickprof.h"
 
 #define EXTBULLET
 
+// bullet profiling is not thread safe, the world steps in parallel only
+// if profiling is compiled out or can be disabled while the jobs run
+#if defined(BT_NO_PROFILE) || (BT_BULLET_VERSION >= 287)
+#define PARALLEL_STEP
+#endif
+
+#if !defined(BT_NO_PROFILE) && (BT_BULLET_VERSION >= 287)
+static void EnterProfileZoneNone(const char * /*name*/) {}
+
+static void LeaveProfileZoneNone() {}
+
+// disables bullet profiling for its lifetime
+struct ProfileLock
+{
+	btEnterProfileZoneFunc * enter;
+	btLeaveProfileZoneFunc * leave;
+
+	ProfileLock() :
+		enter(btGetCurrentEnterProfileZoneFunc()),
+		leave(btGetCurrentLeaveProfileZoneFunc())
+	{
+		btSetCustomEnterProfileZoneFunc(&EnterProfileZoneNone);
+		btSetCustomLeaveProfileZoneFunc(&LeaveProfileZoneNone);
+	}
+
+	~ProfileLock()
+	{
+		btSetCustomEnterProfileZoneFunc(enter);
+		btSetCustomLeaveProfileZoneFunc(leave);
+	}
+};
+#else
+struct ProfileLock {};
+#endif
+
 struct MyRayResultCallback : public btCollisionWorld::RayResultCallback
 {
 	MyRayResultCallback(
@@ -87,6 +140,199 @@ struct MyRayResultCallback : public btCollisionWorld::RayResultCallback
 	}
 };
 
+// collects the broadphase proxies overlapping a ray packet
+struct PacketCallback : public btBroadphaseAabbCallback
+{
+	btAlignedObjectArray<btBroadphaseProxy*> & proxies;
+
+	PacketCallback(btAlignedObjectArray<btBroadphaseProxy*> & proxies) :
+		proxies(proxies)
+	{
+		// ctor
+	}
+
+	virtual bool process(const btBroadphaseProxy* proxy)
+	{
+		proxies.push_back(const_cast<btBroadphaseProxy*>(proxy));
+		return true;
+	}
+};
+
+// collects the triangles of a concave shape overlapping a ray cache region
+struct CacheTriangleCallback : public btTriangleCallback
+{
+	btAlignedObjectArray<DynamicsWorld::RayCache::Triangle> & triangles;
+
+	CacheTriangleCallback(btAlignedObjectArray<DynamicsWorld::RayCache::Triangle> & triangles) :
+		triangles(triangles)
+	{
+		// ctor
+	}
+
+	virtual void processTriangle(btVector3* triangle, int partId, int triangleIndex)
+	{
+		DynamicsWorld::RayCache::Triangle t;
+		t.vertices[0] = triangle[0];
+		t.vertices[1] = triangle[1];
+		t.vertices[2] = triangle[2];
+		t.part = partId;
+		t.index = triangleIndex;
+		triangles.push_back(t);
+	}
+};
+
+// collects the compound children overlapping a ray cache region
+struct CompoundChildCallback : public btDbvt::ICollide
+{
+	btAlignedObjectArray<int> & children;
+
+	CompoundChildCallback(btAlignedObjectArray<int> & children) :
+		children(children)
+	{
+		// ctor
+	}
+
+	void Process(const btDbvtNode * leaf)
+	{
+		children.push_back(leaf->dataAsInt);
+	}
+};
+
+// add shape to the ray cache if it overlaps the cache region
+// compound children are added recursively with their world transforms
+static void CacheShape(
+	DynamicsWorld::RayCache & cache,
+	btCollisionObject * object,
+	const btCollisionShape * shape,
+	const btTransform & transform)
+{
+	if (shape->isCompound())
+	{
+		const btCompoundShape * compound = static_cast<const btCompoundShape*>(shape);
+		const btTransform inverse = transform.inverse();
+		btVector3 min, max;
+		btTransformAabb(cache.min, cache.max, 0, inverse, min, max);
+
+		btAlignedObjectArray<int> children;
+		if (const btDbvt * tree = compound->getDynamicAabbTree())
+		{
+			CompoundChildCallback callback(children);
+			tree->collideTV(tree->m_root, btDbvtVolume::FromMM(min, max), callback);
+		}
+		else
+		{
+			for (int i = 0; i < compound->getNumChildShapes(); ++i)
+				children.push_back(i);
+		}
+
+		for (int i = 0; i < children.size(); ++i)
+		{
+			const int child = children[i];
+			CacheShape(cache, object, compound->getChildShape(child), transform * compound->getChildTransform(child));
+		}
+		return;
+	}
+
+	btVector3 shape_min, shape_max;
+	shape->getAabb(transform, shape_min, shape_max);
+	if (!TestAabbAgainstAabb2(cache.min, cache.max, shape_min, shape_max))
+		return;
+
+	DynamicsWorld::RayCache::Object entry;
+	entry.object = object;
+	entry.shape = shape;
+	entry.transform = transform;
+	entry.begin = -1;
+	entry.end = -1;
+	if (shape->isConcave())
+	{
+		const btTransform inverse = transform.inverse();
+		btVector3 min, max;
+		btTransformAabb(cache.min, cache.max, 0, inverse, min, max);
+
+		entry.begin = cache.triangles.size();
+		CacheTriangleCallback triangles(cache.triangles);
+		static_cast<const btConcaveShape*>(shape)->processAllTriangles(&triangles, min, max);
+		entry.end = cache.triangles.size();
+		if (entry.begin == entry.end)
+			return;
+	}
+	cache.objects.push_back(entry);
+}
+
+// reports cached triangle hits the way btCollisionWorld::rayTestSingle reports concave shape hits
+struct CacheRaycastCallback : public btTriangleRaycastCallback
+{
+	btCollisionWorld::RayResultCallback & m_resultCallback;
+	btCollisionObject * m_collisionObject;
+	const btTransform & m_colObjWorldTransform;
+
+	CacheRaycastCallback(
+		const btVector3 & from,
+		const btVector3 & to,
+		btCollisionWorld::RayResultCallback & resultCallback,
+		btCollisionObject * collisionObject,
+		const btTransform & colObjWorldTransform) :
+		btTriangleRaycastCallback(from, to, resultCallback.m_flags),
+		m_resultCallback(resultCallback),
+		m_collisionObject(collisionObject),
+		m_colObjWorldTransform(colObjWorldTransform)
+	{
+		m_hitFraction = resultCallback.m_closestHitFraction;
+	}
+
+	virtual btScalar reportHit(const btVector3& hitNormalLocal, btScalar hitFraction, int partId, int triangleIndex)
+	{
+		btCollisionWorld::LocalShapeInfo shapeInfo;
+		shapeInfo.m_shapePart = partId;
+		shapeInfo.m_triangleIndex = triangleIndex;
+		btVector3 hitNormalWorld = m_colObjWorldTransform.getBasis() * hitNormalLocal;
+		btCollisionWorld::LocalRayResult rayResult(m_collisionObject, &shapeInfo, hitNormalWorld, hitFraction);
+		return m_resultCallback.addSingleResult(rayResult, true);
+	}
+};
+
+// collects the islands of the world, bodies are copied as the island manager reuses its array
+struct IslandCallback : public btSimulationIslandManager::IslandCallback
+{
+	btAlignedObjectArray<DynamicsWorld::Island> & islands;
+	btAlignedObjectArray<btCollisionObject*> & bodies;
+
+	IslandCallback(
+		btAlignedObjectArray<DynamicsWorld::Island> & islands,
+		btAlignedObjectArray<btCollisionObject*> & bodies) :
+		islands(islands),
+		bodies(bodies)
+	{
+		// ctor
+	}
+
+	virtual void processIsland(
+		btCollisionObject** islandBodies, int numBodies,
+		btPersistentManifold** manifolds, int numManifolds,
+		int /*islandId*/)
+	{
+		DynamicsWorld::Island island;
+		island.bodies = bodies.size();
+		island.numBodies = numBodies;
+		island.manifolds = manifolds;
+		island.numManifolds = numManifolds;
+		island.solver = 0;
+		for (int i = 0; i < numBodies; ++i)
+			bodies.push_back(islandBodies[i]);
+		islands.push_back(island);
+	}
+};
+
+// largest islands first
+struct IslandSortPredicate
+{
+	bool operator()(const DynamicsWorld::Island & a, const DynamicsWorld::Island & b) const
+	{
+		return a.numBodies + a.numManifolds > b.numBodies + b.numManifolds;
+	}
+};
+
 DynamicsWorld::DynamicsWorld(
 	btDispatcher* dispatcher,
 	btBroadphaseInterface* broadphase,
@@ -95,6 +341,10 @@ DynamicsWorld::DynamicsWorld(
 	btScalar timeStep,
 	int maxSubSteps) :
 	btDiscreteDynamicsWorld(dispatcher, broadphase, constraintSolver, collisionConfig),
+	m_debrisMaxActive(32),
+	m_debrisLifetime(30),
+	m_jobs(0),
+	m_staticRevision(0),
 	track(0),
 	timeStep(timeStep),
 	maxSubSteps(maxSubSteps)
@@ -106,6 +356,10 @@ DynamicsWorld::DynamicsWorld(
 DynamicsWorld::~DynamicsWorld()
 {
 	reset();
+	for (int i = 0; i < m_islandSolvers.size(); ++i)
+	{
+		delete m_islandSolvers[i];
+	}
 }
 
 const Bezier* DynamicsWorld::GetSectorPatch(int i){
@@ -181,12 +435,343 @@ bool DynamicsWorld::castRay(
 	return false;
 }
 
+void DynamicsWorld::castRays(Ray rays[], int count) const
+{
+	// rays are merged into a packet while its bounds stay within packet_size,
+	// wheel rays of a car and of cars driving close to each other share one query
+	const btScalar packet_size = 16;
+
+	btAlignedObjectArray<btBroadphaseProxy*> proxies;
+	btAlignedObjectArray<btBroadphaseProxy*> bodies;
+	btAlignedObjectArray<Track::RoadRay> roadrays;
+	btAlignedObjectArray<int> roadray_ids;
+	btTransform from_trans = btTransform::getIdentity();
+	btTransform to_trans = btTransform::getIdentity();
+
+	int begin = 0;
+	while (begin < count)
+	{
+		btVector3 packet_min = rays[begin].origin;
+		btVector3 packet_max = rays[begin].origin;
+		packet_min.setMin(rays[begin].origin + rays[begin].direction * rays[begin].length);
+		packet_max.setMax(rays[begin].origin + rays[begin].direction * rays[begin].length);
+
+		int end = begin + 1;
+		for (; end < count; ++end)
+		{
+			const btVector3 to = rays[end].origin + rays[end].direction * rays[end].length;
+			btVector3 min = packet_min, max = packet_max;
+			min.setMin(rays[end].origin);
+			min.setMin(to);
+			max.setMax(rays[end].origin);
+			max.setMax(to);
+			const btVector3 extent = max - min;
+			if (extent[extent.maxAxis()] > packet_size)
+				break;
+			packet_min = min;
+			packet_max = max;
+		}
+
+		// static geometry of cached rays comes from their cache, their dynamic
+		// bodies from the packet, all other rays need the full broadphase query
+		bool uncached = false;
+		bool cached = false;
+		for (int i = begin; i < end; ++i)
+		{
+			uncached = uncached || !rays[i].cache;
+			cached = cached || rays[i].cache;
+		}
+
+		proxies.resize(0);
+		if (uncached)
+		{
+			PacketCallback packet(proxies);
+			m_broadphasePairCache->aabbTest(packet_min, packet_max, packet);
+		}
+
+		bodies.resize(0);
+		if (cached)
+		{
+			for (int k = 0; k < m_nonStaticRigidBodies.size(); ++k)
+			{
+				btBroadphaseProxy * proxy = m_nonStaticRigidBodies[k]->getBroadphaseHandle();
+				if (proxy && TestAabbAgainstAabb2(packet_min, packet_max, proxy->m_aabbMin, proxy->m_aabbMax))
+					bodies.push_back(proxy);
+			}
+		}
+
+		for (int i = begin; i < end; ++i)
+		{
+			Ray & r = rays[i];
+			const btVector3 to = r.origin + r.direction * r.length;
+			from_trans.setOrigin(r.origin);
+			to_trans.setOrigin(to);
+
+			btVector3 ray_min = r.origin, ray_max = r.origin;
+			ray_min.setMin(to);
+			ray_max.setMax(to);
+
+			MyRayResultCallback ray(r.origin, to, r.caster);
+			const btAlignedObjectArray<btBroadphaseProxy*> & candidates = r.cache ? bodies : proxies;
+			for (int k = 0; k < candidates.size(); ++k)
+			{
+				btBroadphaseProxy * proxy = candidates[k];
+				if (!ray.needsCollision(proxy) ||
+					!TestAabbAgainstAabb2(ray_min, ray_max, proxy->m_aabbMin, proxy->m_aabbMax))
+					continue;
+
+				btCollisionObject * object = static_cast<btCollisionObject*>(proxy->m_clientObject);
+				rayTestSingle(from_trans, to_trans, object, object->getCollisionShape(), object->getWorldTransform(), ray);
+			}
+
+			if (r.cache)
+			{
+				RayCache & cache = *r.cache;
+				updateRayCache(cache, ray_min, ray_max);
+				for (int k = 0; k < cache.objects.size(); ++k)
+				{
+					const RayCache::Object & entry = cache.objects[k];
+					if (!ray.needsCollision(entry.object->getBroadphaseHandle()))
+						continue;
+
+#ifndef EXTBULLET
+					const btScalar fraction = ray.m_closestHitFraction;
+#endif
+					if (entry.begin < 0)
+					{
+						rayTestSingle(from_trans, to_trans, entry.object, entry.shape, entry.transform, ray);
+					}
+					else
+					{
+						const btTransform inverse = entry.transform.inverse();
+						CacheRaycastCallback callback(inverse * r.origin, inverse * to, ray, entry.object, entry.transform);
+						for (int t = entry.begin; t < entry.end; ++t)
+						{
+							RayCache::Triangle & triangle = cache.triangles[t];
+							callback.processTriangle(triangle.vertices, triangle.part, triangle.index);
+						}
+					}
+#ifndef EXTBULLET
+					// compound child hit, as reported by rayTestSingle of the compound
+					if (ray.m_closestHitFraction < fraction && entry.shape != entry.object->getCollisionShape())
+						ray.m_shape = entry.shape;
+#endif
+				}
+			}
+
+			btVector3 p = to;
+			btVector3 n = -r.direction;
+			btScalar d = r.length;
+			int patch_id = -1;
+			const TrackSurface * s = TrackSurface::None();
+			const btCollisionObject * c = 0;
+			r.hit = ray.hasHit();
+			if (r.hit)
+			{
+				p = ray.m_hitPointWorld;
+				n = ray.m_hitNormalWorld;
+				d = ray.m_closestHitFraction * r.length;
+				c = ray.m_collisionObject;
+				if (c->isStaticObject())
+				{
+					TrackSurface * ts = static_cast<TrackSurface*>(c->getUserPointer());
+					if (c->getCollisionShape()->isCompound() && ray.m_shape)
+						ts = static_cast<TrackSurface*>(ray.m_shape->getUserPointer());
+
+					// verify surface pointer
+					if (track)
+					{
+						const std::vector<TrackSurface> & surfaces = track->GetSurfaces();
+						if (ts < &surfaces[0] || ts > &surfaces[surfaces.size() - 1])
+							ts = NULL;
+						assert(ts);
+					}
+
+					if (ts)
+						s = ts;
+				}
+
+				// bezier patches are tested after the broadphase for all hits at once
+				if (track)
+				{
+					Track::RoadRay roadray;
+					roadray.origin = ToMathVector<float>(r.origin);
+					roadray.direction = ToMathVector<float>(r.direction);
+					roadray.seglen = r.length;
+					roadray.patch_id = r.contact->GetPatchId();
+					roadrays.push_back(roadray);
+					roadray_ids.push_back(i);
+					patch_id = roadray.patch_id;
+				}
+			}
+			*r.contact = CollisionContact(p, n, d, patch_id, 0, s, c);
+		}
+
+		begin = end;
+	}
+
+	// track bezierpatch collision
+	if (roadrays.size())
+	{
+		track->CastRays(&roadrays[0], roadrays.size());
+		for (int i = 0; i < roadrays.size(); ++i)
+		{
+			const Track::RoadRay & roadray = roadrays[i];
+			CollisionContact & contact = *rays[roadray_ids[i]].contact;
+			btVector3 p = contact.GetPosition();
+			btVector3 n = contact.GetNormal();
+			btScalar d = contact.GetDepth();
+			const Bezier * b = 0;
+			if (roadray.hit)
+			{
+				p = ToBulletVector(roadray.point);
+				n = ToBulletVector(roadray.normal);
+				d = (roadray.point - roadray.origin).Magnitude();
+				b = roadray.patch;
+			}
+			contact = CollisionContact(p, n, d, roadray.patch_id, b, &contact.GetSurface(), contact.GetObject());
+		}
+	}
+}
+
+void DynamicsWorld::updateRayCache(RayCache & cache, const btVector3 & ray_min, const btVector3 & ray_max) const
+{
+	// a wheel moving up to margin meters per step keeps its cache for a step or more
+	const btScalar margin = 2;
+
+	if (cache.revision == m_staticRevision &&
+		cache.min.x() <= ray_min.x() && cache.min.y() <= ray_min.y() && cache.min.z() <= ray_min.z() &&
+		cache.max.x() >= ray_max.x() && cache.max.y() >= ray_max.y() && cache.max.z() >= ray_max.z())
+		return;
+
+	cache.min = ray_min - btVector3(margin, margin, margin);
+	cache.max = ray_max + btVector3(margin, margin, margin);
+	cache.revision = m_staticRevision;
+	cache.objects.resize(0);
+	cache.triangles.resize(0);
+
+	btAlignedObjectArray<btBroadphaseProxy*> proxies;
+	PacketCallback region(proxies);
+	m_broadphasePairCache->aabbTest(cache.min, cache.max, region);
+	for (int i = 0; i < proxies.size(); ++i)
+	{
+		btCollisionObject * object = static_cast<btCollisionObject*>(proxies[i]->m_clientObject);
+		if (object->isStaticObject())
+			CacheShape(cache, object, object->getCollisionShape(), object->getWorldTransform());
+	}
+}
+
+void DynamicsWorld::addRayCaster(RayCaster * caster)
+{
+	m_rayCasters.push_back(caster);
+}
+
+void DynamicsWorld::removeRayCaster(RayCaster * caster)
+{
+	m_rayCasters.remove(caster);
+}
+
+void DynamicsWorld::setJobSystem(JobSystem * jobs)
+{
+	m_jobs = jobs;
+}
+
+bool DynamicsWorld::isParallel() const
+{
+#ifdef PARALLEL_STEP
+	return m_jobs && m_jobs->GetThreadCount() > 1;
+#else
+	return false;
+#endif
+}
+
+void DynamicsWorld::updateActions(btScalar timeStep)
+{
+	m_rays.resize(0);
+	for (int i = 0; i < m_rayCasters.size(); ++i)
+	{
+		m_rayCasters[i]->getRays(timeStep, m_rays);
+	}
+	if (m_rays.size())
+	{
+		castRays(&m_rays[0], m_rays.size());
+	}
+
+	if (!isParallel() || m_actions.size() < 2)
+	{
+		btDiscreteDynamicsWorld::updateActions(timeStep);
+		return;
+	}
+
+	ProfileLock lock;
+	m_jobs->ParallelFor(0, m_actions.size(), 1, [this, timeStep](int i)
+	{
+		m_actions[i]->updateAction(this, timeStep);
+	});
+}
+
 void DynamicsWorld::update(btScalar dt)
 {
 	stepSimulation(dt, maxSubSteps, timeStep);
 	//CProfileManager::dumpAll();
 }
 
+void DynamicsWorld::getBodyState(const btRigidBody & body, BodyState & state)
+{
+	state.transform = body.getCenterOfMassTransform();
+	state.interpolation_transform = body.getInterpolationWorldTransform();
+	state.linear_velocity = body.getLinearVelocity();
+	state.angular_velocity = body.getAngularVelocity();
+	state.interpolation_linear_velocity = body.getInterpolationLinearVelocity();
+	state.interpolation_angular_velocity = body.getInterpolationAngularVelocity();
+	state.deactivation_time = body.getDeactivationTime();
+	state.activation_state = body.getActivationState();
+}
+
+void DynamicsWorld::setBodyState(const BodyState & state, btRigidBody & body)
+{
+	body.setCenterOfMassTransform(state.transform);
+	body.setInterpolationWorldTransform(state.interpolation_transform);
+	body.setLinearVelocity(state.linear_velocity);
+	body.setAngularVelocity(state.angular_velocity);
+	body.setInterpolationLinearVelocity(state.interpolation_linear_velocity);
+	body.setInterpolationAngularVelocity(state.interpolation_angular_velocity);
+	body.setDeactivationTime(state.deactivation_time);
+	body.forceActivationState(state.activation_state);
+	body.clearForces();
+}
+
+void DynamicsWorld::saveState(btAlignedObjectArray<BodyState> & state) const
+{
+	state.resize(m_nonStaticRigidBodies.size());
+	for (int i = 0; i < m_nonStaticRigidBodies.size(); ++i)
+	{
+		getBodyState(*m_nonStaticRigidBodies[i], state[i]);
+	}
+}
+
+bool DynamicsWorld::restoreState(const btAlignedObjectArray<BodyState> & state)
+{
+	if (state.size() != m_nonStaticRigidBodies.size())
+		return false;
+
+	for (int i = 0; i < m_nonStaticRigidBodies.size(); ++i)
+	{
+		btRigidBody * body = m_nonStaticRigidBodies[i];
+		setBodyState(state[i], *body);
+		updateSingleAabb(body);
+		if (body->getMotionState())
+			body->getMotionState()->setWorldTransform(state[i].interpolation_transform);
+	}
+
+	// the cached impulses belong to the future of the restored bodies
+	for (int i = 0; i < getDispatcher()->getNumManifolds(); ++i)
+	{
+		getDispatcher()->getManifoldByIndexInternal(i)->clearManifold();
+	}
+	return true;
+}
+
 void DynamicsWorld::debugPrint(std::ostream & out) const
 {
 	out << "Collision objects: " << getNumCollisionObjects() << std::endl;
@@ -200,8 +785,86 @@ void DynamicsWorld::solveConstraints(btContactSolverInfo& solverInfo)
 	//	1) revert all velocties
 	//	2) apply impulses for the fracture bodies at the contact locations
 	//	3) and run the constaint solver again
-	btDiscreteDynamicsWorld::solveConstraints(solverInfo);
-	fractureCallback();
+	{
+		PROFILE_ZONE("solve");
+		if (!solveIslands(solverInfo))
+			btDiscreteDynamicsWorld::solveConstraints(solverInfo);
+	}
+
+	// fracture sees the impulses of all islands, in dispatcher manifold order
+	{
+		PROFILE_ZONE("fracture");
+		fractureCallback();
+	}
+
+	PROFILE_ZONE("debris");
+	updateDebris(solverInfo.m_timeStep);
+}
+
+void DynamicsWorld::performDiscreteCollisionDetection()
+{
+	PROFILE_ZONE("collision");
+	btDiscreteDynamicsWorld::performDiscreteCollisionDetection();
+}
+
+bool DynamicsWorld::solveIslands(btContactSolverInfo& solverInfo)
+{
+	// typed constraints span islands, bullet sorts them into the islands while
+	// solving, worlds using them are solved serially
+	if (!isParallel() || getNumConstraints() || !m_islandManager->getSplitIsland())
+		return false;
+
+	// island bodies and manifolds stay valid until the next build
+	m_islands.resize(0);
+	m_islandBodies.resize(0);
+	IslandCallback callback(m_islands, m_islandBodies);
+	m_islandManager->buildAndProcessIslands(getDispatcher(), this, &callback);
+	if (!m_islands.size())
+		return true;
+
+	// one solver per job, islands are assigned to the least loaded solver,
+	// the assignment does not change results as every island is solved alone
+	const int solvers_num = btMin(int(m_jobs->GetThreadCount()), m_islands.size());
+	while (m_islandSolvers.size() < solvers_num)
+	{
+		m_islandSolvers.push_back(new btSequentialImpulseConstraintSolver());
+	}
+
+	btAlignedObjectArray<int> loads;
+	loads.resize(solvers_num, 0);
+	m_islands.quickSort(IslandSortPredicate());
+	for (int i = 0; i < m_islands.size(); ++i)
+	{
+		int solver = 0;
+		for (int k = 1; k < solvers_num; ++k)
+		{
+			if (loads[k] < loads[solver])
+				solver = k;
+		}
+		m_islands[i].solver = solver;
+		loads[solver] += m_islands[i].numBodies + m_islands[i].numManifolds;
+	}
+
+	ProfileLock lock;
+	m_jobs->ParallelFor(0, solvers_num, 1, [this, &solverInfo](int solver)
+	{
+		for (int i = 0; i < m_islands.size(); ++i)
+		{
+			const Island & island = m_islands[i];
+			if (island.solver != solver)
+				continue;
+
+			m_islandSolvers[solver]->solveGroup(
+				&m_islandBodies[island.bodies], island.numBodies,
+				island.manifolds, island.numManifolds,
+				0, 0, solverInfo, m_debugDrawer,
+#if (BT_BULLET_VERSION < 282)
+				m_stackAlloc,
+#endif
+				m_dispatcher1);
+		}
+	});
+	return true;
 }
 
 void DynamicsWorld::addCollisionObject(btCollisionObject* object)
@@ -214,9 +877,41 @@ void DynamicsWorld::addCollisionObject(btCollisionObject* object)
 		flags |= btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT;
 		object->setCollisionFlags(flags);
 	}
+	if (object->isStaticObject())
+		m_staticRevision++;
 	btDiscreteDynamicsWorld::addCollisionObject(object);
 }
 
+void DynamicsWorld::addRigidBody(btRigidBody* body)
+{
+	// the base class adds the body through its own addCollisionObject
+	if (body->isStaticObject())
+		m_staticRevision++;
+	btDiscreteDynamicsWorld::addRigidBody(body);
+}
+
+void DynamicsWorld::removeCollisionObject(btCollisionObject* object)
+{
+	if (object->isStaticObject())
+		m_staticRevision++;
+	btDiscreteDynamicsWorld::removeCollisionObject(object);
+}
+
+void DynamicsWorld::removeRigidBody(btRigidBody* body)
+{
+	for (int i = 0; i < m_debris.size(); ++i)
+	{
+		if (m_debris[i].body == body)
+		{
+			for (int j = i + 1; j < m_debris.size(); ++j)
+				m_debris[j - 1] = m_debris[j];
+			m_debris.pop_back();
+			break;
+		}
+	}
+	btDiscreteDynamicsWorld::removeRigidBody(body);
+}
+
 void DynamicsWorld::reset(const Track & t)
 {
 	reset();
@@ -228,7 +923,16 @@ void DynamicsWorld::reset()
 	getBroadphase()->resetPool(getDispatcher());
 	m_nonStaticRigidBodies.resize(0);
 	m_collisionObjects.resize(0);
+	m_debris.resize(0);
+	m_staticRevision++;
 	track = 0;
+
+	// solver seeds carry over between worlds, a new world starts deterministically
+	m_constraintSolver->reset();
+	for (int i = 0; i < m_islandSolvers.size(); ++i)
+	{
+		m_islandSolvers[i]->reset();
+	}
 }
 
 void DynamicsWorld::setContactAddedCallback(ContactAddedCallback cb)
@@ -279,12 +983,289 @@ void DynamicsWorld::fractureCallback()
 	}
 
 	// Update active connections.
+	int detached = 0;
 	for (int i = 0; i < m_activeConnections.size(); ++i)
 	{
 		int con_id = m_activeConnections[i].id;
 		FractureBody* body = m_activeConnections[i].body;
 		btRigidBody* child = body->updateConnection(con_id);
-		if (child) addRigidBody(child);
+		if (child)
+		{
+			addDebris(child);
+			detached++;
+		}
 	}
+	PROFILE_COUNTER("debris detached", detached);
 #endif
 }
+
+void DynamicsWorld::setDebrisLimits(int maxActive, btScalar lifetime)
+{
+	m_debrisMaxActive = maxActive;
+	m_debrisLifetime = lifetime;
+}
+
+void DynamicsWorld::addDebris(btRigidBody* body)
+{
+	// child bodies and shapes are allocated with the fracture body,
+	// detaching only adds the broadphase proxy
+	addRigidBody(body);
+
+	Debris debris;
+	debris.body = body;
+	debris.age = 0;
+	m_debris.push_back(debris);
+}
+
+// strict weak order of body pointers for the binary search of debris bodies
+struct BodyPointerLess
+{
+	bool operator()(const btCollisionObject* a, const btCollisionObject* b) const
+	{
+		return a < b;
+	}
+};
+
+void DynamicsWorld::updateDebris(btScalar dt)
+{
+	if (m_debris.size() == 0)
+	{
+		PROFILE_COUNTER("debris active", 0);
+		PROFILE_COUNTER("debris contacts", 0);
+		return;
+	}
+
+	// contact points of the parts, their load on the narrowphase and the solver,
+	// parts with contacts are supported by something
+	m_debrisBodies.resize(0);
+	for (int i = 0; i < m_debris.size(); ++i)
+	{
+		m_debrisBodies.push_back(m_debris[i].body);
+	}
+	m_debrisBodies.quickSort(BodyPointerLess());
+	m_debrisContacts.resize(0);
+	m_debrisContacts.resize(m_debrisBodies.size(), 0);
+
+	int contacts = 0;
+	for (int i = 0; i < getDispatcher()->getNumManifolds(); ++i)
+	{
+		const btPersistentManifold* manifold = getDispatcher()->getManifoldByIndexInternal(i);
+		const int n = manifold->getNumContacts();
+		if (!n) continue;
+
+		const btCollisionObject* bodies[2] = {
+			static_cast<const btCollisionObject*>(manifold->getBody0()),
+			static_cast<const btCollisionObject*>(manifold->getBody1())};
+		for (int k = 0; k < 2; ++k)
+		{
+			int j = m_debrisBodies.findBinarySearch(bodies[k]);
+			if (j < m_debrisBodies.size())
+			{
+				m_debrisContacts[j] += n;
+				contacts += n;
+			}
+		}
+	}
+
+	// expired or over budget parts are retired once they rest or touch something,
+	// parts in flight stay active until they land
+	const btScalar rest_velocity2 = 0.01;
+	int n = 0;
+	for (int i = 0; i < m_debris.size(); ++i)
+	{
+		Debris & debris = m_debris[i];
+		debris.age += dt;
+		bool expired = m_debrisLifetime > 0 && debris.age > m_debrisLifetime;
+		bool over_budget = m_debrisMaxActive > 0 && m_debris.size() - i > m_debrisMaxActive;
+		bool at_rest = debris.body->getLinearVelocity().length2() < rest_velocity2 &&
+			debris.body->getAngularVelocity().length2() < rest_velocity2;
+		bool supported = m_debrisContacts[m_debrisBodies.findBinarySearch(debris.body)] > 0;
+		if ((expired || over_budget) && (at_rest || supported))
+			retireDebris(debris.body);
+		else
+			m_debris[n++] = debris;
+	}
+	m_debris.resize(n);
+	PROFILE_COUNTER("debris active", n);
+	PROFILE_COUNTER("debris contacts", contacts);
+}
+
+void DynamicsWorld::retireDebris(btRigidBody* body)
+{
+	// the part stays in the world and keeps colliding, but sleeps, so it drops out of
+	// the narrowphase and the solver until something hits it, its owner tells
+	// detached parts by isInWorld
+	body->setLinearVelocity(btVector3(0, 0, 0));
+	body->setAngularVelocity(btVector3(0, 0, 0));
+	body->setActivationState(ISLAND_SLEEPING);
+}
+
+QT_TEST(dynamicsworld_ray_cache_test)
+{
+	btDefaultCollisionConfiguration config;
+	btCollisionDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DynamicsWorld world(&dispatcher, &broadphase, &solver, &config);
+
+	// track like compound, two bumpy road meshes and a kerb box
+	const int n = 8;
+	btTriangleMesh mesh;
+	for (int y = 0; y < n; ++y)
+	{
+		for (int x = 0; x < n; ++x)
+		{
+			btVector3 v[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				const int vx = x + (i & 1), vy = y + (i >> 1);
+				v[i] = btVector3(vx, vy, 0.1f * ((vx * 7 + vy * 3) % 5));
+			}
+			mesh.addTriangle(v[0], v[1], v[3]);
+			mesh.addTriangle(v[0], v[3], v[2]);
+		}
+	}
+	btBvhTriangleMeshShape road0(&mesh, true);
+	btBvhTriangleMeshShape road1(&mesh, true);
+	btBoxShape kerb(btVector3(0.5, 4, 0.5));
+	TrackSurface surfaces[3];
+	road0.setUserPointer(&surfaces[0]);
+	road1.setUserPointer(&surfaces[1]);
+	kerb.setUserPointer(&surfaces[2]);
+
+	btCompoundShape compound(true);
+	btTransform child = btTransform::getIdentity();
+	compound.addChildShape(child, &road0);
+	child.setOrigin(btVector3(n, 0, 0.05));
+	compound.addChildShape(child, &road1);
+	child.setOrigin(btVector3(n, n / 2, 0.3));
+	child.setRotation(btQuaternion(btVector3(0, 0, 1), 0.3));
+	compound.addChildShape(child, &kerb);
+
+	const btTransform transform(btQuaternion(btVector3(0, 0, 1), 0.1), btVector3(-3, 2, 1));
+	btCollisionObject track;
+	track.setWorldTransform(transform);
+	track.setCollisionShape(&compound);
+	track.setUserPointer(&surfaces[0]);
+	world.addCollisionObject(&track);
+
+	// a ray moving along the track, cast with and without cache
+	DynamicsWorld::RayCache cache;
+	btVector3 origin;
+	for (int i = 0; i < 64; ++i)
+	{
+		DynamicsWorld::Ray rays[2];
+		CollisionContact contacts[2];
+		origin = transform * btVector3(0.37f + 0.25f * i, 0.61f + 0.11f * i, 2);
+		for (int k = 0; k < 2; ++k)
+		{
+			rays[k].origin = origin;
+			rays[k].direction = btVector3(0, 0, -1);
+			rays[k].length = 4;
+			rays[k].caster = 0;
+			rays[k].contact = &contacts[k];
+			rays[k].cache = k ? &cache : 0;
+			rays[k].hit = false;
+			world.castRays(&rays[k], 1);
+		}
+		QT_CHECK(rays[0].hit && rays[1].hit);
+		QT_CHECK_CLOSE(contacts[0].GetDepth(), contacts[1].GetDepth(), 1E-4);
+		QT_CHECK_CLOSE(contacts[0].GetNormal().dot(contacts[1].GetNormal()), 1, 1E-4);
+		QT_CHECK(contacts[0].GetObject() == contacts[1].GetObject());
+		QT_CHECK(&contacts[0].GetSurface() == &contacts[1].GetSurface());
+	}
+
+	// compound children are cached, road triangles instead of the road shapes
+	QT_CHECK(cache.triangles.size() > 0);
+	for (int i = 0; i < cache.objects.size(); ++i)
+	{
+		QT_CHECK(cache.objects[i].shape != &compound);
+		QT_CHECK(cache.objects[i].shape == &kerb || cache.objects[i].begin >= 0);
+	}
+
+	// a static rigid body invalidates the cache of the last ray
+	const int revision = cache.revision;
+	btRigidBody body(btRigidBody::btRigidBodyConstructionInfo(0, 0, &kerb));
+	world.addRigidBody(&body);
+	DynamicsWorld::Ray ray;
+	CollisionContact contact;
+	ray.origin = origin;
+	ray.direction = btVector3(0, 0, -1);
+	ray.length = 4;
+	ray.caster = 0;
+	ray.contact = &contact;
+	ray.cache = &cache;
+	world.castRays(&ray, 1);
+	QT_CHECK(cache.revision != revision);
+
+	world.removeRigidBody(&body);
+	world.removeCollisionObject(&track);
+}
+
+// exposes debris detaching to the test
+class DebrisTestWorld : public DynamicsWorld
+{
+public:
+	DebrisTestWorld(
+		btDispatcher* dispatcher,
+		btBroadphaseInterface* broadphase,
+		btConstraintSolver* constraintSolver,
+		btCollisionConfiguration* collisionConfig) :
+		DynamicsWorld(dispatcher, broadphase, constraintSolver, collisionConfig)
+	{
+		// nothing here
+	}
+
+	void detach(btRigidBody* body)
+	{
+		addDebris(body);
+	}
+};
+
+QT_TEST(dynamicsworld_debris_test)
+{
+	btDefaultCollisionConfiguration config;
+	btCollisionDispatcher dispatcher(&config);
+	btDbvtBroadphase broadphase;
+	btSequentialImpulseConstraintSolver solver;
+	DebrisTestWorld world(&dispatcher, &broadphase, &solver, &config);
+	world.setDebrisLimits(0, 0.05);
+
+	btBoxShape ground_shape(btVector3(10, 10, 0.5));
+	btRigidBody ground(btRigidBody::btRigidBodyConstructionInfo(0, 0, &ground_shape));
+	ground.setWorldTransform(btTransform(btQuaternion::getIdentity(), btVector3(0, 0, -0.5)));
+	world.addRigidBody(&ground);
+
+	// an expired part in flight stays active until it lands
+	btBoxShape part_shape(btVector3(0.2, 0.2, 0.2));
+	btVector3 part_inertia;
+	part_shape.calculateLocalInertia(1, part_inertia);
+	btRigidBody part(btRigidBody::btRigidBodyConstructionInfo(1, 0, &part_shape, part_inertia));
+	part.setWorldTransform(btTransform(btQuaternion::getIdentity(), btVector3(0, 0, 2)));
+	world.detach(&part);
+	for (int i = 0; i < 20; ++i)
+		world.stepSimulation(0.01, 1, 0.01);
+	QT_CHECK(part.getWorldTransform().getOrigin().z() > 0.5);
+	QT_CHECK_EQUAL(world.getNumActiveDebris(), 1);
+	QT_CHECK(part.isActive());
+
+	// landed part is retired, it sleeps on the ground
+	for (int i = 0; i < 200 && world.getNumActiveDebris(); ++i)
+		world.stepSimulation(0.01, 1, 0.01);
+	QT_CHECK_EQUAL(world.getNumActiveDebris(), 0);
+	QT_CHECK(!part.isActive());
+	QT_CHECK_CLOSE(part.getWorldTransform().getOrigin().z(), 0.2, 0.05);
+
+	// retired part still collides, a box dropped on it comes to rest on top
+	btRigidBody box(btRigidBody::btRigidBodyConstructionInfo(1, 0, &part_shape, part_inertia));
+	box.setWorldTransform(btTransform(btQuaternion::getIdentity(), btVector3(0, 0, 1.5)));
+	world.addRigidBody(&box);
+	for (int i = 0; i < 200; ++i)
+		world.stepSimulation(0.01, 1, 0.01);
+	QT_CHECK(box.getWorldTransform().getOrigin().z() > 0.5);
+	QT_CHECK(part.getWorldTransform().getOrigin().z() > 0.1);
+
+	world.removeRigidBody(&box);
+	world.removeRigidBody(&part);
+	world.removeRigidBody(&ground);
+}
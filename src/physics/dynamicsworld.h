@@ -28,10 +28,77 @@ class Track;
 class CollisionContact;
 class FractureBody;
 class Bezier;
+class RayCaster;
+class JobSystem;
+class btSequentialImpulseConstraintSolver;
 
 class DynamicsWorld  : public btDiscreteDynamicsWorld
 {
 public:
+	// static geometry around the last cast of a ray, while the ray stays inside
+	// the cached region castRays skips the broadphase and mesh tree walks
+	struct RayCache
+	{
+		struct Triangle
+		{
+			btVector3 vertices[3];
+			int part;
+			int index;
+		};
+
+		// static shape in the cached region, compound children are cached one by one
+		struct Object
+		{
+			btCollisionObject * object;
+			const btCollisionShape * shape;
+			btTransform transform; // world transform of shape
+			int begin, end; // cached triangles, begin < 0 to test the whole shape
+		};
+
+		btAlignedObjectArray<Object> objects;
+		btAlignedObjectArray<Triangle> triangles;
+		btVector3 min;
+		btVector3 max;
+		int revision;
+
+		RayCache() : revision(-1) {}
+	};
+
+	// ray batch entry, contact provides the patch id hint and receives the result
+	struct Ray
+	{
+		btVector3 origin;
+		btVector3 direction;
+		btScalar length;
+		const btCollisionObject * caster;
+		CollisionContact * contact;
+		RayCache * cache; // optional
+		bool hit;
+	};
+
+	// plain copy of the motion of a rigid body
+	struct BodyState
+	{
+		btTransform transform;
+		btTransform interpolation_transform;
+		btVector3 linear_velocity;
+		btVector3 angular_velocity;
+		btVector3 interpolation_linear_velocity;
+		btVector3 interpolation_angular_velocity;
+		btScalar deactivation_time;
+		int activation_state;
+	};
+
+	// simulation island of the parallel step
+	struct Island
+	{
+		int bodies; // first body in the island body array
+		int numBodies;
+		btPersistentManifold ** manifolds;
+		int numManifolds;
+		int solver;
+	};
+
 	DynamicsWorld(
 		btDispatcher* dispatcher,
 		btBroadphaseInterface* broadphase,
@@ -44,6 +111,12 @@ public:
 
 	void addCollisionObject(btCollisionObject* object);
 
+	void addRigidBody(btRigidBody* body);
+
+	void removeCollisionObject(btCollisionObject* object);
+
+	void removeRigidBody(btRigidBody* body);
+
 	// reset collision world (unloads previous track)
 	void reset(const Track & t);
 
@@ -60,8 +133,41 @@ public:
 		const btCollisionObject * caster,
 		CollisionContact & contact) const;
 
+	// cast a batch of rays, same results as castRay per ray
+	// spatially coherent rays share a broadphase query, road patches are tested for all rays at once
+	void castRays(Ray rays[], int count) const;
+
+	// ray casters cast their rays as one batch every step, before the actions are updated
+	void addRayCaster(RayCaster * caster);
+
+	void removeRayCaster(RayCaster * caster);
+
+	// solve simulation islands and update actions on the job threads, 0 steps serially
+	// islands are always solved one by one, results do not depend on the thread count,
+	// but they differ from the serial step, replays have to use the same mode
+	// actions are updated concurrently and may only modify their own bodies
+	void setJobSystem(JobSystem * jobs);
+
 	void update(btScalar dt);
 
+	// detached fracture parts beyond the active budget, oldest first, or older than
+	// lifetime are retired once they are at rest or in contact, they are put to sleep
+	// and still collide, a hit wakes them up, a limit of zero disables it
+	void setDebrisLimits(int maxActive, btScalar lifetime);
+
+	int getNumActiveDebris() const {return m_debris.size();}
+
+	static void getBodyState(const btRigidBody & body, BodyState & state);
+
+	static void setBodyState(const BodyState & state, btRigidBody & body);
+
+	// save the motion of all dynamic bodies, the state array keeps its capacity
+	void saveState(btAlignedObjectArray<BodyState> & state) const;
+
+	// restore the bodies, false if bodies have been added or removed since the save
+	// contact caches are cleared, contacts are warm started anew
+	bool restoreState(const btAlignedObjectArray<BodyState> & state);
+
 	void draw();
 
 	void debugPrint(std::ostream & out) const;
@@ -75,15 +181,63 @@ protected:
 		int id;
 	};
 	btAlignedObjectArray<ActiveCon> m_activeConnections;
+
+	// detached fracture parts in detach order
+	struct Debris
+	{
+		btRigidBody* body;
+		btScalar age;
+	};
+	btAlignedObjectArray<Debris> m_debris;
+	btAlignedObjectArray<const btCollisionObject*> m_debrisBodies; // sorted debris bodies
+	btAlignedObjectArray<int> m_debrisContacts; // contact points per sorted debris body
+	int m_debrisMaxActive;
+	btScalar m_debrisLifetime;
+	btAlignedObjectArray<RayCaster*> m_rayCasters;
+	btAlignedObjectArray<Ray> m_rays;
+
+	btAlignedObjectArray<Island> m_islands;
+	btAlignedObjectArray<btCollisionObject*> m_islandBodies;
+	btAlignedObjectArray<btSequentialImpulseConstraintSolver*> m_islandSolvers;
+	JobSystem * m_jobs;
+	int m_staticRevision; // changes with the static geometry, invalidates ray caches
 	const Track * track;
 	btScalar timeStep;
 	int maxSubSteps;
 
 	void reset();
 
+	// rebuild cache unless it is current and contains the ray bounds
+	void updateRayCache(RayCache & cache, const btVector3 & ray_min, const btVector3 & ray_max) const;
+
+	bool isParallel() const;
+
+	void updateActions(btScalar timeStep);
+
 	void solveConstraints(btContactSolverInfo& solverInfo);
 
+	void performDiscreteCollisionDetection();
+
+	// solve islands concurrently, returns false if the world has to be solved serially
+	bool solveIslands(btContactSolverInfo& solverInfo);
+
 	void fractureCallback();
+
+	void addDebris(btRigidBody* body);
+
+	void updateDebris(btScalar dt);
+
+	void retireDebris(btRigidBody* body);
+};
+
+class RayCaster
+{
+public:
+	virtual ~RayCaster() {}
+
+	// append the rays of this step, contacts have to stay valid until the actions are updated
+	// called serially before the actions, timeStep is the step of the actions
+	virtual void getRays(btScalar timeStep, btAlignedObjectArray<DynamicsWorld::Ray> & rays) = 0;
 };
 
 #endif // _DYNAMICSWORLD_H
@@ -0,0 +1,139 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _SSEMATH_H
+#define _SSEMATH_H
+
+#include "LinearMath/btScalar.h"
+
+#if !defined(BT_USE_DOUBLE_PRECISION) && \
+	(defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PHYSICS_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef PHYSICS_SSE
+// Four wide float approximations of the cephes single precision functions,
+// accurate to a few ulp for arguments of moderate magnitude.
+namespace SseMath
+{
+	inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline __m128 SignBit()
+	{
+		return _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	}
+
+	inline __m128 Abs(__m128 x)
+	{
+		return _mm_andnot_ps(SignBit(), x);
+	}
+
+	inline __m128 Atan(__m128 x)
+	{
+		const __m128 sign = _mm_and_ps(x, SignBit());
+		x = Abs(x);
+
+		// reduce to [-tan(pi/8), tan(pi/8)]
+		const __m128 one = _mm_set1_ps(1);
+		const __m128 big = _mm_cmpgt_ps(x, _mm_set1_ps(2.414213562373095f));
+		const __m128 mid = _mm_andnot_ps(big, _mm_cmpgt_ps(x, _mm_set1_ps(0.4142135623730950f)));
+		const __m128 xbig = _mm_div_ps(_mm_set1_ps(-1), x);
+		const __m128 xmid = _mm_div_ps(_mm_sub_ps(x, one), _mm_add_ps(x, one));
+		x = Select(big, xbig, Select(mid, xmid, x));
+		__m128 y = Select(big, _mm_set1_ps(1.570796326794897f),
+			_mm_and_ps(mid, _mm_set1_ps(0.7853981633974483f)));
+
+		const __m128 z = _mm_mul_ps(x, x);
+		__m128 p = _mm_set1_ps(8.05374449538e-2f);
+		p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.38776856032e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.99777106478e-1f));
+		p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.33329491539e-1f));
+		p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), x), x);
+		y = _mm_add_ps(y, p);
+
+		return _mm_xor_ps(y, sign);
+	}
+
+	inline __m128 Sin(__m128 x)
+	{
+		__m128 sign = _mm_and_ps(x, SignBit());
+		x = Abs(x);
+
+		// octant j, rounded up to even, x reduced to [-pi/4, pi/4]
+		__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+		j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+		const __m128 y = _mm_cvtepi32_ps(j);
+		const __m128 swap_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+		const __m128 sin_poly = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+		sign = _mm_xor_ps(sign, swap_sign);
+
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+		const __m128 z = _mm_mul_ps(x, x);
+
+		__m128 c = _mm_set1_ps(2.443315711809948e-5f);
+		c = _mm_sub_ps(_mm_mul_ps(c, z), _mm_set1_ps(1.388731625493765e-3f));
+		c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(4.166664568298827e-2f));
+		c = _mm_mul_ps(_mm_mul_ps(c, z), z);
+		c = _mm_sub_ps(c, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+		c = _mm_add_ps(c, _mm_set1_ps(1));
+
+		__m128 s = _mm_set1_ps(-1.9515295891e-4f);
+		s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(8.3321608736e-3f));
+		s = _mm_sub_ps(_mm_mul_ps(s, z), _mm_set1_ps(1.6666654611e-1f));
+		s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), x), x);
+
+		return _mm_xor_ps(Select(sin_poly, s, c), sign);
+	}
+
+	inline __m128 Exp(__m128 x)
+	{
+		x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+		x = _mm_max_ps(x, _mm_set1_ps(-88.3762626647949f));
+
+		// x = n * ln2 + r, n = floor(x / ln2 + 0.5)
+		__m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+		__m128 n = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+		n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, fx), _mm_set1_ps(1)));
+		x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+		const __m128 z = _mm_mul_ps(x, x);
+
+		__m128 y = _mm_set1_ps(1.9875691500e-4f);
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+		y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), _mm_set1_ps(1));
+
+		// scale by 2^n
+		__m128i e = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127));
+		e = _mm_slli_epi32(e, 23);
+		return _mm_mul_ps(y, _mm_castsi128_ps(e));
+	}
+}
+#endif // PHYSICS_SSE
+
+#endif // _SSEMATH_H
@@ -132,6 +132,25 @@ btVector3 Tire::getForce(
 	return btVector3(Fx, Fy, Mz0);
 }
 
+void Tire::getForces(
+	Tire tire[],
+	int count,
+	const btScalar normal_load[],
+	const btScalar friction_coeff[],
+	const btScalar camber[],
+	const btScalar rot_velocity[],
+	const btScalar lon_velocity[],
+	const btScalar lat_velocity[],
+	btVector3 force[])
+{
+	for (int i = 0; i < count; ++i)
+	{
+		force[i] = tire[i].getForce(
+			normal_load[i], friction_coeff[i], camber[i],
+			rot_velocity[i], lon_velocity[i], lat_velocity[i]);
+	}
+}
+
 btScalar Tire::getSqueal() const
 {
 	btScalar squeal = 0.0;
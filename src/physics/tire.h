@@ -100,6 +100,18 @@ public:
 		btScalar lon_velocty,
 		btScalar lat_velocity);
 
+	/// getForce of count tires, the inputs are structure of arrays with one entry per tire
+	static void getForces(
+		Tire tire[],
+		int count,
+		const btScalar normal_load[],
+		const btScalar friction_coeff[],
+		const btScalar camber[],
+		const btScalar rot_velocity[],
+		const btScalar lon_velocity[],
+		const btScalar lat_velocity[],
+		btVector3 force[]);
+
 	btScalar getRollingResistance(
 		const btScalar velocity,
 		const btScalar resistance_factor) const;
@@ -122,6 +134,22 @@ public:
 	/// load is the normal force in N, camber is in rad
 	btScalar getMaxFy(btScalar load, btScalar camber) const;
 
+	/// plain copy of the cached tire state, for snapshots
+	struct State
+	{
+		btScalar slip;
+		btScalar slip_angle;
+		btScalar ideal_slip;
+		btScalar ideal_slip_angle;
+		btScalar vx, vy;
+		btScalar fx, fy, fz;
+		btScalar mz;
+	};
+
+	void getState(State & state) const;
+
+	void setState(const State & state);
+
 private:
 	btScalar slip;				///< ratio of tire contact patch speed to road speed, minus one
 	btScalar slip_angle;		///< angle (in degrees) between the wheel heading and the wheel velocity
@@ -237,6 +265,34 @@ inline btScalar Tire::getMz() const
 	return mz;
 }
 
+inline void Tire::getState(State & state) const
+{
+	state.slip = slip;
+	state.slip_angle = slip_angle;
+	state.ideal_slip = ideal_slip;
+	state.ideal_slip_angle = ideal_slip_angle;
+	state.vx = vx;
+	state.vy = vy;
+	state.fx = fx;
+	state.fy = fy;
+	state.fz = fz;
+	state.mz = mz;
+}
+
+inline void Tire::setState(const State & state)
+{
+	slip = state.slip;
+	slip_angle = state.slip_angle;
+	ideal_slip = state.ideal_slip;
+	ideal_slip_angle = state.ideal_slip_angle;
+	vx = state.vx;
+	vy = state.vy;
+	fx = state.fx;
+	fy = state.fy;
+	fz = state.fz;
+	mz = state.mz;
+}
+
 inline btScalar Tire::getRollingResistance(
 	const btScalar velocity,
 	const btScalar resistance_factor) const
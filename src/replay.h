@@ -39,20 +39,35 @@ public:
 		const std::string & replayfilename,
 		std::ostream & error_output);
 
+	/// play a replay read from the stream, true on success
+	bool StartPlaying(
+		std::istream & replaystream,
+		std::ostream & error_output);
+
 	/// stops playing/recording, clears state
 	void Reset();
 
 	/// true if the replay system is currently playing
 	bool GetPlaying() const;
 
+	/// a deterministic replay records inputs and state hashes only,
+	/// the simulation is expected to reproduce the recorded states exactly
+	/// parallel physics steps differ from serial ones, the mode is recorded
+	/// tire table lookups differ from the tire formulas, the table error is recorded
 	void StartRecording(
 		const std::vector<CarInfo> & carinfo,
 		const std::string & trackname,
+		bool deterministic,
+		bool parallel_physics,
+		float tire_table_error,
 		std::ostream & error_log);
 
 	/// if replayfilename is empty, do not save the data
 	void StopRecording(const std::string & replayfilename);
 
+	/// save the data to the stream
+	void StopRecording(std::ostream & replaystream);
+
 	/// true if the replay system is currently recording
 	bool GetRecording() const;
 
@@ -62,12 +77,25 @@ public:
 	/// record car inputs and state
 	void RecordFrame(unsigned carid, const std::vector <float> & inputs, CarDynamics & car);
 
+	/// compare car state with the recorded state hash, call after the car inputs have been set
+	/// false once, on the first frame the playback diverges from the recording
+	bool CheckFrame(unsigned carid, CarDynamics & car);
+
+	/// frame the car playback diverged, -1 if it did not
+	int GetDivergedFrame(unsigned carid) const;
+
 	bool Serialize(joeserialize::Serializer & s);
 
 	const std::vector<CarInfo> & GetCarInfo() const;
 
 	const std::string & GetTrack() const;
 
+	/// physics mode the replay has been recorded in
+	bool GetParallelPhysics() const;
+
+	/// tire table error the replay has been recorded with, zero for the tire formulas
+	float GetTireTableError() const;
+
 private:
 	friend class joeserialize::Serializer;
 
@@ -147,12 +175,15 @@ private:
 		/// serialized
 		std::vector<InputFrame> inputframes;
 		std::vector<StateFrame> stateframes;
+		std::vector< std::pair<unsigned, unsigned> > statehashes; // frame, hash
 
 		/// not serialized
 		std::vector<float> inputbuffer; // buffer for input delta frame decoding
 		unsigned cur_inputframe;
 		unsigned cur_stateframe;
+		unsigned cur_statehash;
 		unsigned frame;
+		int diverged_frame;
 
 		/// true if we have zero recorded frames
 		bool Empty() const;
@@ -167,7 +198,10 @@ private:
 		bool PlayFrame(CarDynamics & car);
 
 		/// get car state, save input delta frame
-		void RecordFrame(const std::vector<float> & inputs, CarDynamics & car);
+		void RecordFrame(const std::vector<float> & inputs, CarDynamics & car, bool deterministic);
+
+		/// false if the car state does not match the recorded hash
+		bool CheckFrame(CarDynamics & car);
 
 		void ProcessPlayInputFrame(const InputFrame & frame);
 
@@ -178,6 +212,9 @@ private:
 	Version version_info;
 	std::string track;
 	std::vector<CarInfo> carinfo;
+	bool deterministic;
+	bool parallel_physics;
+	float tire_table_error;
 	std::vector<CarState> carstate;
 
 	/// not serialized
@@ -212,4 +249,14 @@ inline const std::string & Replay::GetTrack() const
 	return track;
 }
 
+inline bool Replay::GetParallelPhysics() const
+{
+	return parallel_physics;
+}
+
+inline float Replay::GetTireTableError() const
+{
+	return tire_table_error;
+}
+
 #endif
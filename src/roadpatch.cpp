@@ -19,14 +19,32 @@
 
 #include "roadpatch.h"
 
+#include <iostream>
+
 bool RoadPatch::Collide(
 	const Vec3 & origin,
 	const Vec3 & direction,
 	float seglen, Vec3 & outtri,
 	Vec3 & normal) const
 {
-	bool col = patch.CollideSubDivQuadSimpleNorm(origin, direction, outtri, normal);
+	bool col = form.Collide(origin, direction, outtri, normal);
 	float len = (outtri - origin).Magnitude();
 	return col && len <= seglen;
 }
 
+void RoadPatch::ReadBinary(std::istream & openfile)
+{
+	patch.ReadBinary(openfile);
+	openfile.read((char *)&track_curvature, sizeof(track_curvature));
+	for (int i = 0; i < 3; i++)
+		openfile.read((char *)&racing_line[i], sizeof(float));
+}
+
+void RoadPatch::WriteBinary(std::ostream & openfile) const
+{
+	patch.WriteBinary(openfile);
+	openfile.write((const char *)&track_curvature, sizeof(track_curvature));
+	for (int i = 0; i < 3; i++)
+		openfile.write((const char *)&racing_line[i], sizeof(float));
+}
+
@@ -31,6 +31,12 @@ public:
 
 	Bezier & GetPatch() {return patch;}
 
+	///precomputed form of the patch used by Collide
+	const BezierPowerForm & GetPowerForm() const {return form;}
+
+	///update the precomputed form, call after modifying the patch
+	void UpdatePowerForm() {form.Set(patch);}
+
 	///return true if the ray starting at the given origin going in the given direction intersects this patch.
 	/// output the contact point and normal to the given outtri and normal variables.
 	bool Collide(
@@ -55,6 +61,10 @@ public:
 		track_curvature = value;
 	}
 
+	///read/write the patch and its racing line in native binary format
+	void ReadBinary(std::istream & openfile);
+	void WriteBinary(std::ostream & openfile) const;
+
 	void SetRacingLine ( const MathVector< float, 3 >& value )
 	{
 		racing_line = value;
@@ -64,6 +74,7 @@ public:
 
 private:
 	Bezier patch;
+	BezierPowerForm form;
 	float track_curvature;
 	Vec3 racing_line;
 };
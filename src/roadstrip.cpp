@@ -18,7 +18,11 @@
 /************************************************************************/
 
 #include "roadstrip.h"
+#include "unittest.h"
+
 #include <algorithm>
+#include <iostream>
+#include <sstream>
 
 RoadStrip::RoadStrip() :
 	closed(false)
@@ -92,11 +96,90 @@ bool RoadStrip::ReadFrom(
 	return true;
 }
 
+// size of a patch record as written by RoadPatch::WriteBinary
+static std::streamoff GetPatchRecordSize()
+{
+	static std::streamoff size = 0;
+	if (!size)
+	{
+		std::ostringstream s;
+		RoadPatch().WriteBinary(s);
+		size = s.str().size();
+	}
+	return size;
+}
+
+// bytes left in a seekable stream, -1 if unknown
+static std::streamoff GetRemainingSize(std::istream & s)
+{
+	const std::streampos pos = s.tellg();
+	if (pos < 0)
+		return -1;
+	s.seekg(0, std::ios::end);
+	const std::streampos end = s.tellg();
+	s.seekg(pos);
+	if (end < 0 || !s)
+		return -1;
+	return end - pos;
+}
+
+bool RoadStrip::ReadBinary(std::istream & openfile)
+{
+	unsigned num = 0;
+	openfile.read((char *)&num, sizeof(num));
+	openfile.read((char *)&closed, sizeof(closed));
+	if (!openfile)
+		return false;
+
+	// a damaged count must not turn into a huge allocation
+	const std::streamoff remaining = GetRemainingSize(openfile);
+	if (remaining < 0 || std::streamoff(num) > remaining / GetPatchRecordSize())
+		return false;
+
+	patches.clear();
+	patches.resize(num);
+	for (unsigned i = 0; i < num && openfile; ++i)
+	{
+		patches[i].ReadBinary(openfile);
+	}
+	if (!openfile)
+	{
+		patches.clear();
+		return false;
+	}
+
+	// Restore patch links.
+	for (unsigned i = 0; i + 1 < num; ++i)
+	{
+		patches[i].GetPatch().next_patch = &patches[i + 1].GetPatch();
+	}
+	if (closed && num > 0)
+	{
+		patches.back().GetPatch().next_patch = &patches.front().GetPatch();
+	}
+
+	GenerateSpacePartitioning();
+
+	return true;
+}
+
+void RoadStrip::WriteBinary(std::ostream & openfile) const
+{
+	unsigned num = patches.size();
+	openfile.write((const char *)&num, sizeof(num));
+	openfile.write((const char *)&closed, sizeof(closed));
+	for (unsigned i = 0; i < num; ++i)
+	{
+		patches[i].WriteBinary(openfile);
+	}
+}
+
 void RoadStrip::GenerateSpacePartitioning()
 {
 	aabb_part.Clear();
 	for (unsigned i = 0; i < patches.size(); ++i)
 	{
+		patches[i].UpdatePowerForm();
 		aabb_part.Add(i, patches[i].GetPatch().GetAABB());
 	}
 	aabb_part.Optimize();
@@ -110,6 +193,20 @@ bool RoadStrip::Collide(
 	Vec3 & outtri,
 	const Bezier * & colpatch,
 	Vec3 & normal) const
+{
+	std::vector<int> candidates;
+	return Collide(origin, direction, seglen, patch_id, outtri, colpatch, normal, candidates);
+}
+
+bool RoadStrip::Collide(
+	const Vec3 & origin,
+	const Vec3 & direction,
+	const float seglen,
+	int & patch_id,
+	Vec3 & outtri,
+	const Bezier * & colpatch,
+	Vec3 & normal,
+	std::vector<int> & candidates) const
 {
 	if (patch_id >= 0 && patch_id < (int)patches.size())
 	{
@@ -124,23 +221,105 @@ bool RoadStrip::Collide(
 	}
 
 	bool col = false;
-	std::vector<int> candidates;
+	candidates.clear();
 	aabb_part.Query(Aabb<float>::Ray(origin, direction, seglen), candidates);
-	for (std::vector<int>::iterator i = candidates.begin(); i != candidates.end(); ++i)
+
+	// intersect the candidates in batches, the kernel tests four at once
+	const int batch_size = 32;
+	const BezierPowerForm * forms[batch_size];
+	Vec3 origins[batch_size];
+	Vec3 directions[batch_size];
+	Vec3 coltris[batch_size];
+	Vec3 colnorms[batch_size];
+	for (size_t begin = 0; begin < candidates.size(); begin += batch_size)
 	{
-		Vec3 coltri, colnorm;
-		if (patches[*i].Collide(origin, direction, seglen, coltri, colnorm))
+		const int count = std::min(candidates.size() - begin, size_t(batch_size));
+		for (int i = 0; i < count; ++i)
+		{
+			forms[i] = &patches[candidates[begin + i]].GetPowerForm();
+			origins[i] = origin;
+			directions[i] = direction;
+		}
+
+		const unsigned hits = BezierPowerForm::Collide(forms, origins, directions, count, coltris, colnorms);
+		for (int i = 0; i < count; ++i)
 		{
-			if (!col || (coltri-origin).MagnitudeSquared() < (outtri-origin).MagnitudeSquared())
+			const Vec3 & coltri = coltris[i];
+			if ((hits & (1u << i)) && (coltri - origin).Magnitude() <= seglen)
 			{
-				outtri = coltri;
-				normal = colnorm;
-				colpatch = &patches[*i].GetPatch();
-				patch_id = *i;
+				if (!col || (coltri-origin).MagnitudeSquared() < (outtri-origin).MagnitudeSquared())
+				{
+					outtri = coltri;
+					normal = colnorms[i];
+					colpatch = &patches[candidates[begin + i]].GetPatch();
+					patch_id = candidates[begin + i];
+				}
+				col = true;
 			}
-			col = true;
 		}
 	}
 
 	return col;
 }
+
+QT_TEST(roadstrip_binary_test)
+{
+	// three flat patches in a row, read in the ascii YZX format
+	std::stringstream text;
+	text << 3 << std::endl;
+	for (int k = 0; k < 3; ++k)
+		for (int x = 0; x < 4; ++x)
+			for (int y = 0; y < 4; ++y)
+				text << y - 1.5 << " " << 0.1 * x << " " << (k + 1) * 3 - x << std::endl;
+
+	std::ostringstream error;
+	RoadStrip strip;
+	QT_CHECK(strip.ReadFrom(text, false, error));
+	QT_CHECK_EQUAL(strip.GetPatches().size(), 3);
+	strip.GetPatches()[1].SetRacingLine(Vec3(4, 0.5, 0.1));
+
+	std::stringstream binary;
+	strip.WriteBinary(binary);
+
+	RoadStrip cached;
+	QT_CHECK(cached.ReadBinary(binary));
+	QT_CHECK_EQUAL(cached.GetClosed(), strip.GetClosed());
+	QT_CHECK_EQUAL(cached.GetPatches().size(), strip.GetPatches().size());
+	for (size_t i = 0; i < cached.GetPatches().size(); ++i)
+	{
+		const Bezier & a = strip.GetPatches()[i].GetPatch();
+		const Bezier & b = cached.GetPatches()[i].GetPatch();
+		for (int n = 0; n < 16; ++n)
+			QT_CHECK_EQUAL(a[n], b[n]);
+		QT_CHECK_EQUAL(a.GetDistFromStart(), b.GetDistFromStart());
+		QT_CHECK_EQUAL(a.GetTrackRadius(), b.GetTrackRadius());
+		QT_CHECK_EQUAL(a.HasRacingline(), b.HasRacingline());
+		QT_CHECK_EQUAL(a.GetRacingLine(), b.GetRacingLine());
+		QT_CHECK_EQUAL(a.GetNextPatch() != 0, b.GetNextPatch() != 0);
+	}
+	QT_CHECK(cached.GetPatches()[0].GetPatch().GetNextPatch() == &cached.GetPatches()[1].GetPatch());
+
+	// same collision result on the rebuilt partitioning
+	Vec3 origin(4.5, 0.2, 1), direction(0, 0, -1), p0, p1, n0, n1;
+	const Bezier * b0 = 0, * b1 = 0;
+	int id0 = -1, id1 = -1;
+	QT_CHECK(strip.Collide(origin, direction, 2, id0, p0, b0, n0));
+	QT_CHECK(cached.Collide(origin, direction, 2, id1, p1, b1, n1));
+	QT_CHECK_EQUAL(id0, id1);
+	QT_CHECK_EQUAL(p0, p1);
+
+	// truncated data is rejected
+	std::string data = binary.str();
+	std::stringstream truncated(data.substr(0, data.size() / 2));
+	RoadStrip broken;
+	QT_CHECK(!broken.ReadBinary(truncated));
+	QT_CHECK(broken.GetPatches().empty());
+
+	// a damaged patch count is rejected before allocating
+	std::string damaged = data;
+	const unsigned huge = 0x7fffffff;
+	damaged.replace(0, sizeof(huge), (const char *)&huge, sizeof(huge));
+	std::stringstream damaged_stream(damaged);
+	QT_CHECK(!broken.ReadBinary(damaged_stream));
+	QT_CHECK(broken.GetPatches().empty());
+}
@@ -36,6 +36,13 @@ public:
 		bool reverse,
 		std::ostream & error_output);
 
+	/// read/write the processed strip in native binary format
+	/// patches are stored as loaded, reversed and connected
+	/// the stream has to be seekable, the patch count is checked against its size
+	bool ReadBinary(std::istream & openfile);
+
+	void WriteBinary(std::ostream & openfile) const;
+
 	bool Collide(
 		const Vec3 & origin,
 		const Vec3 & direction,
@@ -45,6 +52,17 @@ public:
 		const Bezier * & colpatch,
 		Vec3 & normal) const;
 
+	// candidates is scratch space, reused over calls to avoid allocations
+	bool Collide(
+		const Vec3 & origin,
+		const Vec3 & direction,
+		const float seglen,
+		int & patch_id,
+		Vec3 & outtri,
+		const Bezier * & colpatch,
+		Vec3 & normal,
+		std::vector<int> & candidates) const;
+
 	const std::vector<RoadPatch> & GetPatches() const
 	{
 		return patches;
@@ -104,6 +104,9 @@ Settings::Settings() :
 	hgateshifter(false),
 	ai_level(1.0),
 	vehicle_damage(false),
+	tire_table_error(0),
+	debris_max(32),
+	debris_lifetime(30),
 	particles(512),
 	sky_dynamic(false),
 	sky_time(17),
@@ -131,6 +134,9 @@ void Settings::Serialize(bool write, Config & config)
 
 	config.get("game", section);
 	Param(config, write, section, "vehicle_damage", vehicle_damage);
+	Param(config, write, section, "tire_table_error", tire_table_error);
+	Param(config, write, section, "debris_max", debris_max);
+	Param(config, write, section, "debris_lifetime", debris_lifetime);
 	Param(config, write, section, "ai_level", ai_level);
 	Param(config, write, section, "track", track);
 	Param(config, write, section, "antilock", abs);
@@ -377,6 +377,21 @@ public:
 		return vehicle_damage;
 	}
 
+	float GetTireTableError() const
+	{
+		return tire_table_error;
+	}
+
+	int GetDebrisMax() const
+	{
+		return debris_max;
+	}
+
+	float GetDebrisLifetime() const
+	{
+		return debris_lifetime;
+	}
+
 	void SetResolution(unsigned w, unsigned h)
 	{
 		resolution[0] = w;
@@ -465,6 +480,9 @@ private:
 	bool hgateshifter;
 	float ai_level;
 	bool vehicle_damage;
+	float tire_table_error;
+	int debris_max;
+	float debris_lifetime;
 	int particles;
 	bool sky_dynamic;
 	int sky_time;
@@ -25,6 +25,7 @@
 
 #include "BulletCollision/CollisionShapes/btCollisionShape.h"
 #include "BulletCollision/CollisionShapes/btStridingMeshInterface.h"
+#include "BulletCollision/CollisionShapes/btOptimizedBvh.h"
 
 Track::Track() : racingline_visible(false)
 {
@@ -39,12 +40,14 @@ Track::~Track()
 bool Track::DeferredLoad(
 	ContentManager & content,
 	DynamicsWorld & world,
+	JobSystem & jobs,
 	std::ostream & info_output,
 	std::ostream & error_output,
 	const std::string & trackpath,
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachepath,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamicobjects,
@@ -57,10 +60,11 @@ bool Track::DeferredLoad(
 
 	loader.reset(
 		new Loader(
-			content, world, data,
+			content, world, jobs, data,
 			info_output, error_output,
 			trackpath, trackdir,
 			texturedir,	sharedobjectpath,
+			cachepath,
 			anisotropy, reverse,
 			dynamicobjects,
 			dynamicshadows));
@@ -106,6 +110,13 @@ void Track::Clear()
 	}
 	data.shapes.clear();
 
+	for (int i = 0, n = data.bvhs.size(); i < n; ++i)
+	{
+		data.bvhs[i]->~btOptimizedBvh();
+		btAlignedFree(data.bvhs[i]);
+	}
+	data.bvhs.clear();
+
 	for (int i = 0, n = data.meshes.size(); i < n; ++i)
 	{
 		delete data.meshes[i];
@@ -153,16 +164,54 @@ bool Track::CastRay(
 	return col;
 }
 
-void Track::Update()
+void Track::CastRays(RoadRay rays[], int count) const
+{
+	for (int n = 0; n < count; ++n)
+		rays[n].hit = false;
+
+	std::vector<int> candidates;
+	for (std::list <RoadStrip>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	{
+		for (int n = 0; n < count; ++n)
+		{
+			RoadRay & r = rays[n];
+			Vec3 coltri, colnorm;
+			const Bezier * colbez = NULL;
+			if (i->Collide(r.origin, r.direction, r.seglen, r.patch_id, coltri, colbez, colnorm, candidates))
+			{
+				if (!r.hit || (coltri - r.origin).MagnitudeSquared() < (r.point - r.origin).MagnitudeSquared())
+				{
+					r.point = coltri;
+					r.normal = colnorm;
+					r.patch = colbez;
+				}
+				r.hit = true;
+			}
+		}
+	}
+}
+
+void Track::GetBodyTransforms(std::vector<Transform> & transforms) const
 {
+	transforms.clear();
 	if (!data.loaded) return;
 
+	transforms.resize(data.body_transforms.size());
 	std::list<MotionState>::const_iterator t = data.body_transforms.begin();
-	for (int i = 0, e = data.body_nodes.size(); i < e; ++i, ++t)
+	for (int i = 0, e = transforms.size(); i < e; ++i, ++t)
+	{
+		transforms[i].SetRotation(ToQuaternion<float>(t->rotation));
+		transforms[i].SetTranslation(ToMathVector<float>(t->position));
+	}
+}
+
+void Track::Update(const std::vector<Transform> & transforms)
+{
+	if (!data.loaded || transforms.size() != data.body_nodes.size()) return;
+
+	for (int i = 0, e = data.body_nodes.size(); i < e; ++i)
 	{
-		Transform & vt = data.dynamic_node.GetNode(data.body_nodes[i]).GetTransform();
-		vt.SetRotation(ToQuaternion<float>(t->rotation));
-		vt.SetTranslation(ToMathVector<float>(t->position));
+		data.dynamic_node.GetNode(data.body_nodes[i]).GetTransform() = transforms[i];
 	}
 }
 
@@ -39,9 +39,11 @@ class Texture;
 class RoadStrip;
 class DynamicsWorld;
 class ContentManager;
+class JobSystem;
 class btStridingMeshInterface;
 class btCollisionShape;
 class btCollisionObject;
+class btOptimizedBvh;
 
 class Track
 {
@@ -56,12 +58,14 @@ public:
 	bool DeferredLoad(
 		ContentManager & content,
 		DynamicsWorld & world,
+		JobSystem & jobs,
 		std::ostream & info_output,
 		std::ostream & error_output,
 		const std::string & trackpath,
 		const std::string & trackdir,
 		const std::string & effects_texturepath,
 		const std::string & sharedobjectpath,
+		const std::string & cachepath,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamicobjects,
@@ -92,8 +96,27 @@ public:
 		const Bezier * & colpatch,
 		Vec3 & normal) const;
 
-	/// Synchronize graphics and physics.
-	void Update();
+	/// Road ray batch entry, patch_id is the hint and result like in CastRay.
+	struct RoadRay
+	{
+		Vec3 origin;
+		Vec3 direction;
+		float seglen;
+		int patch_id;
+		Vec3 point;
+		Vec3 normal;
+		const Bezier * patch;
+		bool hit;
+	};
+
+	/// Same as CastRay for each ray, the road strips are walked once for all rays.
+	void CastRays(RoadRay rays[], int count) const;
+
+	/// Copy dynamic object transforms from physics.
+	void GetBodyTransforms(std::vector<Transform> & transforms) const;
+
+	/// Synchronize graphics with transforms captured by GetBodyTransforms.
+	void Update(const std::vector<Transform> & transforms);
 
 	std::pair <Vec3, Quat > GetStart(unsigned int index) const;
 
@@ -170,6 +193,7 @@ private:
 		std::vector<TrackSurface> surfaces;
 		std::vector<btStridingMeshInterface*> meshes;
 		std::vector<btCollisionShape*> shapes;
+		std::vector<btOptimizedBvh*> bvhs; // deserialized in place, not owned by shapes
 		std::vector<btCollisionObject*> objects;
 
 		// dynamic track objects
@@ -23,16 +23,27 @@
 #include "coordinatesystem.h"
 #include "tobullet.h"
 #include "k1999.h"
+#include "job_system.h"
+#include "frame_profiler.h"
 #include "content/contentmanager.h"
 #include "graphics/texture.h"
-#include "graphics/model.h"
+#include "graphics/model_joe03.h"
+#include "unittest.h"
 
 #include "BulletCollision/CollisionShapes/btBoxShape.h"
 #include "BulletCollision/CollisionShapes/btBvhTriangleMeshShape.h"
 #include "BulletCollision/CollisionShapes/btCompoundShape.h"
+#include "BulletCollision/CollisionShapes/btOptimizedBvh.h"
 #include "BulletCollision/CollisionShapes/btTriangleIndexVertexArray.h"
 #include "BulletDynamics/Dynamics/btRigidBody.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
 #define EXTBULLET
 
 static inline std::istream & operator >> (std::istream & lhs, btVector3 & rhs)
@@ -81,23 +92,147 @@ static btIndexedMesh GetIndexedMesh(const Model & model)
 	return mesh;
 }
 
-struct Track::Loader::Object
+// FNV-1a hash of a byte range
+static unsigned HashBytes(const void * data, size_t size, unsigned hash)
 {
-	std::shared_ptr<Model> model;
-	std::string texture;
-	int transparent_blend;
-	int clamptexture;
-	int surface;
-	bool mipmap;
-	bool nolighting;
-	bool skybox;
-	bool collideable;
-	bool cached;
-};
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+// hash of the collision mesh data, keys the bvh cache with the mesh size
+static unsigned HashMesh(const btIndexedMesh & mesh)
+{
+	unsigned hash = 2166136261u;
+	hash = HashBytes(mesh.m_vertexBase, mesh.m_numVertices * mesh.m_vertexStride, hash);
+	hash = HashBytes(mesh.m_triangleIndexBase, mesh.m_numTriangles * mesh.m_triangleIndexStride, hash);
+	return hash;
+}
+
+// check a deserialized bvh against the mesh it is used with,
+// every triangle of the single mesh part in exactly one leaf, root bounds matching the mesh
+static bool IsValidBvh(btOptimizedBvh & bvh, btStridingMeshInterface & mesh, int triangles)
+{
+	QuantizedNodeArray & nodes = bvh.getQuantizedNodeArray();
+	if (!bvh.isQuantized() || triangles <= 0 || nodes.size() <= 0)
+		return false;
+
+	std::vector<bool> leaves(triangles, false);
+	for (int i = 0, n = nodes.size(); i < n; ++i)
+	{
+		const btQuantizedBvhNode & node = nodes[i];
+		if (node.isLeafNode())
+		{
+			const int triangle = node.getTriangleIndex();
+			if (node.getPartId() != 0 || triangle < 0 || triangle >= triangles || leaves[triangle])
+				return false;
+			leaves[triangle] = true;
+		}
+		else if (node.getEscapeIndex() <= 0 || node.getEscapeIndex() > n - i)
+		{
+			return false;
+		}
+	}
+	if (std::find(leaves.begin(), leaves.end(), false) != leaves.end())
+		return false;
+
+	// quantization rounds by a small fraction of the extent
+	btVector3 mesh_min, mesh_max;
+	mesh.calculateAabbBruteForce(mesh_min, mesh_max);
+	const btVector3 root_min = bvh.unQuantize(nodes[0].m_quantizedAabbMin);
+	const btVector3 root_max = bvh.unQuantize(nodes[0].m_quantizedAabbMax);
+	const btVector3 tolerance = (mesh_max - mesh_min + btVector3(2, 2, 2)) * btScalar(1E-3);
+	for (int i = 0; i < 3; ++i)
+	{
+		if (btFabs(root_min[i] - mesh_min[i]) > tolerance[i] ||
+			btFabs(root_max[i] - mesh_max[i]) > tolerance[i])
+			return false;
+	}
+	return true;
+}
+
+static bool SerializeBvh(const btOptimizedBvh & bvh, std::string & bytes)
+{
+	const unsigned size = bvh.calculateSerializeBufferSize();
+	void * buffer = btAlignedAlloc(size, 16);
+	const bool serialized = bvh.serializeInPlace(buffer, size, false);
+	if (serialized)
+	{
+		bytes.assign((const char *)buffer, size);
+	}
+	btAlignedFree(buffer);
+	return serialized;
+}
+
+// deserialized bvh lives in an aligned copy of bytes, null if it does not fit the mesh
+static btOptimizedBvh * DeserializeBvh(const std::string & bytes, btStridingMeshInterface & mesh, int triangles)
+{
+	// deSerializeInPlace reads the header before checking the size
+	if (bytes.size() < sizeof(btOptimizedBvh))
+	{
+		return 0;
+	}
+
+	void * buffer = btAlignedAlloc(bytes.size(), 16);
+	std::memcpy(buffer, bytes.data(), bytes.size());
+	btOptimizedBvh * bvh = btOptimizedBvh::deSerializeInPlace(buffer, bytes.size(), false);
+	if (bvh && IsValidBvh(*bvh, mesh, triangles))
+	{
+		return bvh;
+	}
+	if (bvh)
+	{
+		bvh->~btOptimizedBvh();
+	}
+	btAlignedFree(buffer);
+	return 0;
+}
+
+// set relative path for models and textures, ugly hack
+// need to identify body references
+static std::string GetBodyName(
+	const PTree & cfg,
+	std::string & model_name,
+	std::vector<std::string> & texture_names)
+{
+	std::string name;
+	if (cfg.value() == "body" && cfg.parent())
+	{
+		name = cfg.parent()->value();
+	}
+	else
+	{
+		name = cfg.value();
+		size_t npos = name.rfind("/");
+		if (npos < name.length())
+		{
+			std::string rel_path = name.substr(0, npos+1);
+			model_name = rel_path + model_name;
+			texture_names[0] = rel_path + texture_names[0];
+			if (!texture_names[1].empty())
+				texture_names[1] = rel_path + texture_names[1];
+			if (!texture_names[2].empty())
+				texture_names[2] = rel_path + texture_names[2];
+		}
+	}
+	return name;
+}
+
+static TextureInfo GetTextureInfo(bool mipmap, int clampuv, int anisotropy)
+{
+	TextureInfo texinfo;
+	texinfo.mipmap = mipmap || anisotropy; //always mipmap if anisotropy is on
+	texinfo.anisotropy = anisotropy;
+	texinfo.repeatu = clampuv != 1 && clampuv != 2;
+	texinfo.repeatv = clampuv != 1 && clampuv != 3;
+	return texinfo;
+}
 
 Track::Loader::Loader(
 	ContentManager & content,
 	DynamicsWorld & world,
+	JobSystem & jobs,
 	Track::Data & data,
 	std::ostream & info_output,
 	std::ostream & error_output,
@@ -105,12 +240,14 @@ Track::Loader::Loader(
 	const std::string & trackdir,
 	const std::string & texturedir,
 	const std::string & sharedobjectpath,
+	const std::string & cachepath,
 	const int anisotropy,
 	const bool reverse,
 	const bool dynamic_objects,
 	const bool dynamic_shadows) :
 	content(content),
 	world(world),
+	jobs(jobs),
 	data(data),
 	info_output(info_output),
 	error_output(error_output),
@@ -118,6 +255,7 @@ Track::Loader::Loader(
 	trackdir(trackdir),
 	texturedir(texturedir),
 	sharedobjectpath(sharedobjectpath),
+	cachepath(cachepath),
 	anisotropy(anisotropy),
 	dynamic_objects(dynamic_objects),
 	dynamic_shadows(dynamic_shadows),
@@ -129,6 +267,8 @@ Track::Loader::Loader(
 	min_params(14),
 	error(false),
 	list(false),
+	bvh_dirty(false),
+	prefetch_count(64),
 	track_shape(0)
 {
 	objectpath = trackpath + "/objects";
@@ -143,6 +283,21 @@ Track::Loader::~Loader()
 
 void Track::Loader::Clear()
 {
+	for (std::map<const Model *, Shape>::iterator i = prefetched_shapes.begin(); i != prefetched_shapes.end(); ++i)
+	{
+		delete i->second.shape;
+		delete i->second.mesh;
+		if (i->second.bvh)
+		{
+			i->second.bvh->~btOptimizedBvh();
+			btAlignedFree(i->second.bvh);
+		}
+	}
+	prefetched_shapes.clear();
+	bvh_cache.clear();
+	bvh_used.clear();
+	bvh_dirty = false;
+	objects.clear();
 	bodies.clear();
 	objectfile.close();
 	pack.Close();
@@ -150,19 +305,30 @@ void Track::Loader::Clear()
 
 bool Track::Loader::BeginLoad()
 {
+	PROFILE_ZONE("track begin load");
+
 	Clear();
 
 	info_output << "Loading track from path: " << trackpath << std::endl;
 
-	if (!LoadSurfaces())
+	// surfaces, roads and racing lines from the cache if it is up to date
+	const unsigned hash = HashSources();
+	if (!LoadCache(hash))
 	{
-		info_output << "No Surfaces File. Continuing with standard surfaces" << std::endl;
-	}
+		if (!LoadSurfaces())
+		{
+			info_output << "No Surfaces File. Continuing with standard surfaces" << std::endl;
+		}
 
-	if (!LoadRoads())
-	{
-		error_output << "Error during road loading; continuing with an unsmoothed track" << std::endl;
-		data.roads.clear();
+		if (!LoadRoads())
+		{
+			error_output << "Error during road loading; continuing with an unsmoothed track" << std::endl;
+			data.roads.clear();
+		}
+
+		OptimizeRacingLines();
+
+		WriteCache(hash);
 	}
 
 	if (!CreateRacingLines())
@@ -205,6 +371,8 @@ bool Track::Loader::BeginLoad()
 
 bool Track::Loader::ContinueLoad()
 {
+	PROFILE_ZONE("track load objects");
+
 	if (data.loaded)
 	{
 		return true;
@@ -227,6 +395,7 @@ bool Track::Loader::ContinueLoad()
 		data.shapes.push_back(track_shape);
 		track_shape = 0;
 #endif
+		WriteBvhCache();
 		data.loaded = true;
 		Clear();
 	}
@@ -244,6 +413,8 @@ bool Track::Loader::BeginObjectLoad()
 	list = true;
 	packload = pack.Load(objectpath + "/objects.jpk");
 
+	LoadBvhCache();
+
 	std::string objectlist = objectpath + "/list.txt";
 	objectfile.open(objectlist.c_str());
 	if (objectfile.good())
@@ -284,6 +455,7 @@ bool Track::Loader::Begin()
 		if (track_config->get("object", nodes))
 		{
 			node_it = nodes->begin();
+			prefetch_it = node_it;
 			numobjects = nodes->size();
 			data.meshes.reserve(numobjects);
 			return true;
@@ -299,25 +471,214 @@ std::pair<bool, bool> Track::Loader::Continue()
 		return std::make_pair(false, false);
 	}
 
+	if (node_it == prefetch_it)
+	{
+		PrefetchNodes();
+	}
+
 	if (!LoadNode(node_it->second))
 	{
 		return std::make_pair(true, false);
 	}
 
 	node_it++;
+	numloaded++;
 
 	return std::make_pair(false, true);
 }
 
+void Track::Loader::Prefetch(
+	const std::vector<std::pair<std::string, bool> > & models,
+	const std::vector<std::pair<std::string, TextureInfo> > & textures)
+{
+	PROFILE_ZONE("track prefetch");
+
+	// texture files are read and decoded by the content loader threads
+	// meanwhile, the serial load picks them up and uploads them
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		content.loadAsync<Texture>(objectdir, textures[i].first, textures[i].second);
+	}
+
+	// models not in cache yet
+	std::map<std::string, std::shared_ptr<Model> > batch;
+	std::vector<std::string> names;
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		const std::string & name = models[i].first;
+		if (batch.find(name) != batch.end())
+			continue;
+
+		std::shared_ptr<Model> model;
+		content.get(model, objectdir, name);
+		batch[name] = model;
+		if (!model)
+			names.push_back(name);
+	}
+
+	// decode models, the pack entries are read only views
+	// failures are reported by the serial load later on
+	std::vector<std::shared_ptr<Model> > decoded(names.size());
+	jobs.ParallelFor(0, names.size(), 1, [&](int i)
+	{
+		PROFILE_ZONE("track model");
+
+		std::ostringstream error;
+		std::shared_ptr<ModelJoe03> model(new ModelJoe03());
+		if ((packload && model->Load(names[i], error, &pack)) ||
+			model->Load(objectpath + "/" + names[i], error))
+		{
+			decoded[i] = model;
+		}
+	});
+
+	// content cache is not thread safe, fill it here
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (decoded[i])
+		{
+			content.set(decoded[i], objectdir, names[i]);
+			batch[names[i]] = decoded[i];
+		}
+	}
+
+	// static collision meshes, one per model
+	std::vector<Shape *> shapes;
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		const std::shared_ptr<Model> & model = batch[models[i].first];
+		if (!models[i].second || !model)
+			continue;
+
+		std::pair<std::map<const Model *, Shape>::iterator, bool> ins =
+			prefetched_shapes.insert(std::make_pair(model.get(), Shape()));
+		if (ins.second)
+		{
+			ins.first->second.model = model;
+			shapes.push_back(&ins.first->second);
+		}
+	}
+
+	jobs.ParallelFor(0, shapes.size(), 1, [&](int i)
+	{
+		PROFILE_ZONE("track shape");
+
+		Shape & shape = *shapes[i];
+		BuildStaticShape(*shape.model, shape);
+	});
+}
+
+void Track::Loader::PrefetchNodes()
+{
+	std::vector<std::pair<std::string, bool> > models;
+	std::vector<std::pair<std::string, TextureInfo> > textures;
+	for (int i = 0; i < prefetch_count && prefetch_it != nodes->end(); ++i, ++prefetch_it)
+	{
+		const PTree * cfg;
+		if (!prefetch_it->second.get("body", cfg))
+			continue;
+
+		bool isashadow = false;
+		cfg->get("isashadow", isashadow);
+		if (dynamic_shadows && isashadow)
+			continue;
+
+		std::string model_name;
+		std::string texture_str;
+		std::vector<std::string> texture_names(3);
+		cfg->get("model", model_name);
+		cfg->get("texture", texture_str);
+		std::istringstream s(texture_str);
+		s >> texture_names;
+		GetBodyName(*cfg, model_name, texture_names);
+
+		float mass = 0;
+		bool static_shape = cfg->get("mass", mass) && mass < 1E-3;
+		models.push_back(std::make_pair(model_name, static_shape));
+
+		int clampuv = 0;
+		bool mipmap = true;
+		cfg->get("clampuv", clampuv);
+		cfg->get("mipmap", mipmap);
+		TextureInfo texinfo = GetTextureInfo(mipmap, clampuv, anisotropy);
+		for (int n = 0; n < 3; ++n)
+		{
+			if (n == 2)
+				texinfo.compress = false;
+			if (!texture_names[n].empty())
+				textures.push_back(std::make_pair(texture_names[n], texinfo));
+		}
+	}
+	Prefetch(models, textures);
+}
+
+void Track::Loader::BuildStaticShape(const Model & model, Shape & shape) const
+{
+	const btIndexedMesh indexed_mesh = GetIndexedMesh(model);
+	shape.mesh = new btTriangleIndexVertexArray();
+	shape.mesh->addIndexedMesh(indexed_mesh);
+	shape.key.hash = HashMesh(indexed_mesh);
+	shape.key.vertices = indexed_mesh.m_numVertices;
+	shape.key.triangles = indexed_mesh.m_numTriangles;
+
+	// reuse the cached bvh of the same mesh data
+	std::map<BvhKey, std::string>::const_iterator i = bvh_cache.find(shape.key);
+	if (i != bvh_cache.end())
+	{
+		shape.bvh = DeserializeBvh(i->second, *shape.mesh, indexed_mesh.m_numTriangles);
+		if (shape.bvh)
+		{
+			shape.shape = new btBvhTriangleMeshShape(shape.mesh, true, false);
+			shape.shape->setOptimizedBvh(shape.bvh);
+			return;
+		}
+	}
+
+	shape.shape = new btBvhTriangleMeshShape(shape.mesh, true);
+
+	// serialize the new bvh for the next load, no cache without a cache path
+	if (!cachepath.empty())
+	{
+		SerializeBvh(*shape.shape->getOptimizedBvh(), shape.bvh_data);
+	}
+}
+
+btBvhTriangleMeshShape * Track::Loader::GetStaticShape(const Model & model, int surface)
+{
+	Shape built;
+	std::map<const Model *, Shape>::iterator i = prefetched_shapes.find(&model);
+	if (i != prefetched_shapes.end())
+	{
+		built = i->second;
+		prefetched_shapes.erase(i);
+	}
+	else
+	{
+		BuildStaticShape(model, built);
+	}
+
+	if (built.bvh)
+	{
+		data.bvhs.push_back(built.bvh);
+	}
+	if (!built.bvh_data.empty())
+	{
+		bvh_cache[built.key].swap(built.bvh_data);
+		bvh_dirty = true;
+	}
+	bvh_used.insert(built.key);
+
+	btBvhTriangleMeshShape * shape = built.shape;
+	shape->setUserPointer((void*)&data.surfaces[surface]);
+	data.meshes.push_back(built.mesh);
+	data.shapes.push_back(shape);
+	return shape;
+}
+
 bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & body)
 {
 	if (body.mass < 1E-3)
 	{
-		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
-		mesh->addIndexedMesh(GetIndexedMesh(model));
-		data.meshes.push_back(mesh);
-		body.mesh = mesh;
-
 		int surface = 0;
 		cfg.get("surface", surface);
 		if (surface >= (int)data.surfaces.size())
@@ -325,9 +686,8 @@ bool Track::Loader::LoadShape(const PTree & cfg, const Model & model, Body & bod
 			surface = 0;
 		}
 
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
-		shape->setUserPointer((void*)&data.surfaces[surface]);
-		data.shapes.push_back(shape);
+		btBvhTriangleMeshShape * shape = GetStaticShape(model, surface);
+		body.mesh = shape->getMeshInterface();
 		body.shape = shape;
 	}
 	else
@@ -387,28 +747,7 @@ Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
 	std::istringstream s(texture_str);
 	s >> texture_names;
 
-	// set relative path for models and textures, ugly hack
-	// need to identify body references
-	std::string name;
-	if (cfg.value() == "body" && cfg.parent())
-	{
-		name = cfg.parent()->value();
-	}
-	else
-	{
-		name = cfg.value();
-		size_t npos = name.rfind("/");
-		if (npos < name.length())
-		{
-			std::string rel_path = name.substr(0, npos+1);
-			model_name = rel_path + model_name;
-			texture_names[0] = rel_path + texture_names[0];
-			if (!texture_names[1].empty())
-				texture_names[1] = rel_path + texture_names[1];
-			if (!texture_names[2].empty())
-				texture_names[2] = rel_path + texture_names[2];
-		}
-	}
+	std::string name = GetBodyName(cfg, model_name, texture_names);
 
 	if (dynamic_shadows && isashadow)
 	{
@@ -435,11 +774,7 @@ Track::Loader::body_iterator Track::Loader::LoadBody(const PTree & cfg)
 
 	// load textures
 	std::shared_ptr<Texture> tex[3];
-	TextureInfo texinfo;
-	texinfo.mipmap = mipmap || anisotropy; //always mipmap if anisotropy is on
-	texinfo.anisotropy = anisotropy;
-	texinfo.repeatu = clampuv != 1 && clampuv != 2;
-	texinfo.repeatv = clampuv != 1 && clampuv != 3;
+	TextureInfo texinfo = GetTextureInfo(mipmap, clampuv, anisotropy);
 	content.load(tex[0], objectdir, texture_names[0], texinfo);
 	if (!texture_names[1].empty())
 	{
@@ -681,11 +1016,7 @@ bool Track::Loader::AddObject(const Object & object)
 {
 	data.models.insert(object.model);
 
-	TextureInfo texinfo;
-	texinfo.mipmap = object.mipmap || anisotropy; //always mipmap if anisotropy is on
-	texinfo.anisotropy = anisotropy;
-	texinfo.repeatu = object.clamptexture != 1 && object.clamptexture != 2;
-	texinfo.repeatv = object.clamptexture != 1 && object.clamptexture != 3;
+	TextureInfo texinfo = GetTextureInfo(object.mipmap, object.clamptexture, anisotropy);
 
 	std::shared_ptr<Texture> texture0, texture1, texture2;
 	{
@@ -751,14 +1082,8 @@ bool Track::Loader::AddObject(const Object & object)
 
 	if (object.collideable)
 	{
-		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
-		mesh->addIndexedMesh(GetIndexedMesh(*object.model));
-		data.meshes.push_back(mesh);
-
 		assert(object.surface >= 0 && object.surface < (int)data.surfaces.size());
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
-		shape->setUserPointer((void*)&data.surfaces[object.surface]);
-		data.shapes.push_back(shape);
+		btBvhTriangleMeshShape * shape = GetStaticShape(*object.model, object.surface);
 
 #ifndef EXTBULLET
 		btTransform transform = btTransform::getIdentity();
@@ -775,51 +1100,86 @@ bool Track::Loader::AddObject(const Object & object)
 	return true;
 }
 
-std::pair<bool, bool> Track::Loader::ContinueOld()
+bool Track::Loader::PrefetchOld()
 {
-	std::string model_name;
-	if (!get(objectfile, model_name))
+	std::vector<std::pair<std::string, bool> > models;
+	std::vector<std::pair<std::string, TextureInfo> > textures;
+	for (int n = 0; n < prefetch_count; ++n)
 	{
-		return std::make_pair(false, false);
+		Object object;
+		if (!get(objectfile, object.model_name))
+		{
+			break;
+		}
+
+		std::string junk;
+		get(objectfile, object.texture);
+		get(objectfile, object.mipmap);
+		get(objectfile, object.nolighting);
+		get(objectfile, object.skybox);
+		get(objectfile, object.transparent_blend);
+		get(objectfile, junk);//bump_wavelength);
+		get(objectfile, junk);//bump_amplitude);
+		get(objectfile, junk);//driveable);
+		get(objectfile, object.collideable);
+		get(objectfile, junk);//friction_notread);
+		get(objectfile, junk);//friction_tread);
+		get(objectfile, junk);//rolling_resistance);
+		get(objectfile, junk);//rolling_drag);
+		get(objectfile, object.isashadow);
+		get(objectfile, object.clamptexture);
+		get(objectfile, object.surface);
+		for (int i = 0; i < params_per_object - expected_params; i++)
+		{
+			get(objectfile, junk);
+		}
+
+		// skybox models are modified after load, build their shapes later
+		if (!(dynamic_shadows && object.isashadow))
+		{
+			models.push_back(std::make_pair(object.model_name, object.collideable && !object.skybox));
+
+			// same textures as AddObject
+			TextureInfo texinfo = GetTextureInfo(object.mipmap, object.clamptexture, anisotropy);
+			textures.push_back(std::make_pair(object.texture, texinfo));
+
+			const std::string texbase = object.texture.substr(0, std::max<int>(0, object.texture.length()-4));
+			if (std::ifstream((objectpath + "/" + texbase + "-misc1.png").c_str()))
+				textures.push_back(std::make_pair(texbase + "-misc1.png", texinfo));
+			texinfo.compress = false;
+			if (std::ifstream((objectpath + "/" + texbase + "-misc2.png").c_str()))
+				textures.push_back(std::make_pair(texbase + "-misc2.png", texinfo));
+		}
+		objects.push_back(object);
 	}
+	Prefetch(models, textures);
 
-	Object object;
-	bool isashadow;
-	std::string junk;
+	return !objects.empty();
+}
 
-	get(objectfile, object.texture);
-	get(objectfile, object.mipmap);
-	get(objectfile, object.nolighting);
-	get(objectfile, object.skybox);
-	get(objectfile, object.transparent_blend);
-	get(objectfile, junk);//bump_wavelength);
-	get(objectfile, junk);//bump_amplitude);
-	get(objectfile, junk);//driveable);
-	get(objectfile, object.collideable);
-	get(objectfile, junk);//friction_notread);
-	get(objectfile, junk);//friction_tread);
-	get(objectfile, junk);//rolling_resistance);
-	get(objectfile, junk);//rolling_drag);
-	get(objectfile, isashadow);
-	get(objectfile, object.clamptexture);
-	get(objectfile, object.surface);
-	for (int i = 0; i < params_per_object - expected_params; i++)
+std::pair<bool, bool> Track::Loader::ContinueOld()
+{
+	if (objects.empty() && !PrefetchOld())
 	{
-		get(objectfile, junk);
+		return std::make_pair(false, false);
 	}
 
-	if (dynamic_shadows && isashadow)
+	Object object = objects.front();
+	objects.pop_front();
+	numloaded++;
+
+	if (dynamic_shadows && object.isashadow)
 	{
 		return std::make_pair(false, true);
 	}
 
 	if (packload)
 	{
-		content.load(object.model, objectdir, model_name, pack);
+		content.load(object.model, objectdir, object.model_name, pack);
 	}
 	else
 	{
-		content.load(object.model, objectdir, model_name);
+		content.load(object.model, objectdir, object.model_name);
 	}
 
 	// fixme: ugly hack to make vertical tracking work
@@ -839,6 +1199,326 @@ std::pair<bool, bool> Track::Loader::ContinueOld()
 	return std::make_pair(false, true);
 }
 
+// track cache layout version, bump on layout changes
+static const unsigned cache_version = 2;
+
+struct CacheHeader
+{
+	char magic[4];
+	unsigned version;
+	unsigned hash;
+	unsigned surfaces;
+	unsigned roads;
+	unsigned payload; // size of the surfaces and roads data
+	unsigned checksum; // FNV-1a hash of the payload
+};
+
+// FNV-1a hash of a file, a missing file is treated as empty
+static unsigned HashFile(const std::string & path, unsigned hash)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	char buffer[4096];
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+	{
+		hash = HashBytes(buffer, file.gcount(), hash);
+	}
+	return hash;
+}
+
+unsigned Track::Loader::HashSources() const
+{
+	unsigned hash = 2166136261u;
+	hash = (hash ^ cache_version) * 16777619u;
+	hash = (hash ^ unsigned(data.reverse)) * 16777619u;
+	hash = HashFile(trackpath + "/roads.trk", hash);
+	hash = HashFile(trackpath + "/surfaces.txt", hash);
+	return hash;
+}
+
+bool Track::Loader::LoadCache(unsigned hash)
+{
+	if (cachepath.empty())
+	{
+		return false;
+	}
+
+	PROFILE_ZONE("track cache");
+
+	std::ifstream file(cachepath.c_str(), std::ios::binary | std::ios::ate);
+	const std::streamoff file_size = file.tellg();
+	file.seekg(0);
+	CacheHeader header;
+	if (!file.read((char *)&header, sizeof(header)) ||
+		std::string(header.magic, 4) != std::string("VTC", 4) ||
+		header.version != cache_version ||
+		header.hash != hash ||
+		std::streamoff(header.payload) != file_size - std::streamoff(sizeof(header)))
+	{
+		return false;
+	}
+
+	// counts are bounded by the payload size, so damaged ones fail before allocating
+	const size_t strip_size_min = sizeof(unsigned) + sizeof(bool);
+	if (header.surfaces > header.payload / sizeof(TrackSurface) ||
+		header.roads > (header.payload - header.surfaces * sizeof(TrackSurface)) / strip_size_min)
+	{
+		return false;
+	}
+
+	std::string payload(header.payload, 0);
+	if (!payload.empty() && !file.read(&payload[0], payload.size()))
+	{
+		return false;
+	}
+	if (HashBytes(payload.data(), payload.size(), 2166136261u) != header.checksum)
+	{
+		error_output << "Track cache checksum mismatch: " << cachepath << std::endl;
+		return false;
+	}
+
+	std::istringstream stream(payload);
+	std::vector<TrackSurface> surfaces(header.surfaces);
+	if (!surfaces.empty() && !stream.read((char *)&surfaces[0], surfaces.size() * sizeof(TrackSurface)))
+	{
+		return false;
+	}
+
+	// strips link their patches, read them in place
+	std::list<RoadStrip> roads;
+	for (unsigned i = 0; i < header.roads; ++i)
+	{
+		roads.push_back(RoadStrip());
+		if (!roads.back().ReadBinary(stream))
+		{
+			return false;
+		}
+	}
+
+	data.surfaces.swap(surfaces);
+	data.roads.swap(roads);
+
+	info_output << "Loaded track cache: " << cachepath << std::endl;
+	return true;
+}
+
+void Track::Loader::WriteCache(unsigned hash) const
+{
+	if (cachepath.empty())
+	{
+		return;
+	}
+
+	PROFILE_ZONE("track cache");
+
+	// write to a temporary file first, an interrupted write must not leave a valid header behind
+	const std::string temppath = cachepath + ".tmp";
+	std::ofstream file(temppath.c_str(), std::ios::binary);
+
+	std::ostringstream stream;
+	if (!data.surfaces.empty())
+	{
+		stream.write((const char *)&data.surfaces[0], data.surfaces.size() * sizeof(TrackSurface));
+	}
+
+	for (std::list<RoadStrip>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	{
+		i->WriteBinary(stream);
+	}
+	const std::string payload = stream.str();
+
+	CacheHeader header;
+	std::memcpy(header.magic, "VTC", 4);
+	header.version = cache_version;
+	header.hash = hash;
+	header.surfaces = data.surfaces.size();
+	header.roads = data.roads.size();
+	header.payload = payload.size();
+	header.checksum = HashBytes(payload.data(), payload.size(), 2166136261u);
+	file.write((const char *)&header, sizeof(header));
+	file.write(payload.data(), payload.size());
+
+	file.close();
+	if (!file)
+	{
+		error_output << "Failed to write track cache: " << temppath << std::endl;
+		std::remove(temppath.c_str());
+		return;
+	}
+
+	std::remove(cachepath.c_str());
+	std::rename(temppath.c_str(), cachepath.c_str());
+}
+
+// bvh cache layout version, bump on layout changes
+static const unsigned bvh_cache_version = 3;
+
+struct BvhCacheHeader
+{
+	char magic[4];
+	unsigned version;
+	unsigned bullet_version;
+	unsigned scalar_size;
+	unsigned entries;
+	unsigned payload; // size of the entries data
+	unsigned checksum; // FNV-1a hash of the payload
+};
+
+typedef std::map<Track::Loader::BvhKey, std::string> BvhCache;
+
+// bvh cache file next to the track cache file
+static std::string GetBvhCachePath(const std::string & cachepath)
+{
+	return cachepath.substr(0, cachepath.rfind('.')) + ".bvh";
+}
+
+// read the serialized bvhs of a cache file, false if it is missing, stale or damaged
+static bool ReadBvhCacheFile(const std::string & path, BvhCache & cache, std::ostream & error_output)
+{
+	cache.clear();
+
+	std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+	const std::streamoff file_size = file.tellg();
+	file.seekg(0);
+	BvhCacheHeader header;
+	if (!file.read((char *)&header, sizeof(header)) ||
+		std::string(header.magic, 4) != std::string("BVH", 4) ||
+		header.version != bvh_cache_version ||
+		header.bullet_version != BT_BULLET_VERSION ||
+		header.scalar_size != sizeof(btScalar) ||
+		std::streamoff(header.payload) != file_size - std::streamoff(sizeof(header)))
+	{
+		return false;
+	}
+
+	// entries are bounded by the payload size, so damaged counts fail before allocating
+	const size_t entry_size_min = 4 * sizeof(unsigned) + sizeof(btOptimizedBvh);
+	if (header.entries > header.payload / entry_size_min)
+	{
+		return false;
+	}
+
+	std::string payload(header.payload, 0);
+	if (!payload.empty() && !file.read(&payload[0], payload.size()))
+	{
+		return false;
+	}
+	if (HashBytes(payload.data(), payload.size(), 2166136261u) != header.checksum)
+	{
+		error_output << "Track bvh cache checksum mismatch: " << path << std::endl;
+		return false;
+	}
+
+	std::istringstream stream(payload);
+	for (unsigned n = 0; n < header.entries; ++n)
+	{
+		unsigned entry[4]; // hash, vertices, triangles, size
+		if (!stream.read((char *)entry, sizeof(entry)) ||
+			entry[3] < sizeof(btOptimizedBvh) ||
+			entry[3] > payload.size() - size_t(stream.tellg()))
+		{
+			cache.clear();
+			return false;
+		}
+
+		Track::Loader::BvhKey key;
+		key.hash = entry[0];
+		key.vertices = entry[1];
+		key.triangles = entry[2];
+		std::string & bytes = cache[key];
+		bytes.resize(entry[3]);
+		stream.read(&bytes[0], entry[3]);
+	}
+	return true;
+}
+
+static bool WriteBvhCacheFile(const std::string & path, const BvhCache & cache)
+{
+	std::ostringstream stream;
+	for (BvhCache::const_iterator i = cache.begin(); i != cache.end(); ++i)
+	{
+		const unsigned entry[4] = {i->first.hash, i->first.vertices, i->first.triangles, unsigned(i->second.size())};
+		stream.write((const char *)entry, sizeof(entry));
+		stream.write(i->second.data(), i->second.size());
+	}
+	const std::string payload = stream.str();
+
+	BvhCacheHeader header;
+	std::memcpy(header.magic, "BVH", 4);
+	header.version = bvh_cache_version;
+	header.bullet_version = BT_BULLET_VERSION;
+	header.scalar_size = sizeof(btScalar);
+	header.entries = cache.size();
+	header.payload = payload.size();
+	header.checksum = HashBytes(payload.data(), payload.size(), 2166136261u);
+
+	// write to a temporary file first, an interrupted write must not leave a valid header behind
+	const std::string temppath = path + ".tmp";
+	std::ofstream file(temppath.c_str(), std::ios::binary);
+	file.write((const char *)&header, sizeof(header));
+	file.write(payload.data(), payload.size());
+	file.close();
+	if (!file)
+	{
+		std::remove(temppath.c_str());
+		return false;
+	}
+
+	std::remove(path.c_str());
+	std::rename(temppath.c_str(), path.c_str());
+	return true;
+}
+
+void Track::Loader::LoadBvhCache()
+{
+	bvh_cache.clear();
+	bvh_used.clear();
+	bvh_dirty = false;
+
+	if (cachepath.empty())
+	{
+		return;
+	}
+
+	PROFILE_ZONE("track bvh cache");
+
+	const std::string path = GetBvhCachePath(cachepath);
+	if (ReadBvhCacheFile(path, bvh_cache, error_output))
+	{
+		info_output << "Loaded track bvh cache: " << path << ", " << bvh_cache.size() << " meshes" << std::endl;
+	}
+}
+
+void Track::Loader::WriteBvhCache()
+{
+	// drop bvhs of meshes no longer in the track
+	bool stale = false;
+	for (BvhCache::iterator i = bvh_cache.begin(); i != bvh_cache.end();)
+	{
+		if (bvh_used.find(i->first) == bvh_used.end())
+		{
+			bvh_cache.erase(i++);
+			stale = true;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	if (cachepath.empty() || !(bvh_dirty || stale))
+	{
+		return;
+	}
+
+	PROFILE_ZONE("track bvh cache");
+
+	const std::string path = GetBvhCachePath(cachepath);
+	if (!WriteBvhCacheFile(path, bvh_cache))
+	{
+		error_output << "Failed to write track bvh cache: " << path << std::endl;
+	}
+}
+
 bool Track::Loader::LoadSurfaces()
 {
 	std::string path = trackpath + "/surfaces.txt";
@@ -897,6 +1577,8 @@ bool Track::Loader::LoadSurfaces()
 
 bool Track::Loader::LoadRoads()
 {
+	PROFILE_ZONE("track roads");
+
 	data.roads.clear();
 
 	std::string roadpath = trackpath + "/roads.trk";
@@ -918,17 +1600,35 @@ bool Track::Loader::LoadRoads()
 	return true;
 }
 
-bool Track::Loader::CreateRacingLines()
+void Track::Loader::OptimizeRacingLines()
 {
-	K1999 k1999data;
+	std::vector<RoadStrip *> roads;
 	for (std::list <RoadStrip>::iterator i = data.roads.begin(); i != data.roads.end(); ++i)
 	{
-		if (k1999data.LoadData(*i))
+		roads.push_back(&*i);
+	}
+
+	// Racing line optimization is independent per road, run it in parallel.
+	jobs.ParallelFor(0, roads.size(), 1, [&](int i)
+	{
+		PROFILE_ZONE("racing line");
+
+		K1999 k1999data;
+		if (k1999data.LoadData(*roads[i]))
 		{
 			k1999data.CalcRaceLine();
-			k1999data.UpdateRoadStrip(*i);
-			CreateRacingLine(*i);
+			k1999data.UpdateRoadStrip(*roads[i]);
 		}
+	});
+}
+
+bool Track::Loader::CreateRacingLines()
+{
+	// Racing line geometry is shared, build it in road order.
+	for (std::list <RoadStrip>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	{
+		if (!i->GetPatches().empty() && i->GetPatches().front().GetPatch().HasRacingline())
+			CreateRacingLine(*i);
 	}
 	return true;
 }
@@ -1179,3 +1879,130 @@ bool Track::Loader::LoadLapSections(const PTree & info)
 	info_output << "Track timing sectors: " << lapmarkers << std::endl;
 	return true;
 }
+
+// collects the triangles visited by a bvh ray query
+struct BvhRayHits : public btTriangleCallback
+{
+	std::vector<int> triangles;
+
+	void processTriangle(btVector3 * /*triangle*/, int /*partId*/, int triangleIndex)
+	{
+		triangles.push_back(triangleIndex);
+	}
+};
+
+QT_TEST(trackloader_bvh_test)
+{
+	// bumpy grid, two triangles per cell
+	const int n = 8;
+	std::vector<float> vertices;
+	std::vector<unsigned> faces;
+	for (int y = 0; y <= n; ++y)
+	{
+		for (int x = 0; x <= n; ++x)
+		{
+			vertices.push_back(x);
+			vertices.push_back(y);
+			vertices.push_back(0.1f * ((x * 7 + y * 3) % 5));
+		}
+	}
+	for (int y = 0; y < n; ++y)
+	{
+		for (int x = 0; x < n; ++x)
+		{
+			const unsigned v = y * (n + 1) + x;
+			const unsigned f[] = {v, v + 1, v + n + 2, v, v + n + 2, v + n + 1};
+			faces.insert(faces.end(), f, f + 6);
+		}
+	}
+
+	btIndexedMesh indexed_mesh;
+	indexed_mesh.m_numTriangles = faces.size() / 3;
+	indexed_mesh.m_triangleIndexBase = (const unsigned char *)&faces[0];
+	indexed_mesh.m_triangleIndexStride = sizeof(unsigned) * 3;
+	indexed_mesh.m_numVertices = vertices.size() / 3;
+	indexed_mesh.m_vertexBase = (const unsigned char *)&vertices[0];
+	indexed_mesh.m_vertexStride = sizeof(float) * 3;
+	indexed_mesh.m_vertexType = PHY_FLOAT;
+	btTriangleIndexVertexArray mesh;
+	mesh.addIndexedMesh(indexed_mesh);
+
+	btBvhTriangleMeshShape built(&mesh, true);
+	std::string bytes;
+	QT_CHECK(SerializeBvh(*built.getOptimizedBvh(), bytes));
+
+	btOptimizedBvh * bvh = DeserializeBvh(bytes, mesh, indexed_mesh.m_numTriangles);
+	QT_CHECK(bvh);
+	if (!bvh)
+		return;
+
+	// same triangles along rays through the restored bvh
+	{
+		btBvhTriangleMeshShape restored(&mesh, true, false);
+		restored.setOptimizedBvh(bvh);
+		for (int i = 0; i < 24; ++i)
+		{
+			const btVector3 from(0.37f + 0.3f * i, 0.61f + 0.27f * i, 10);
+			const btVector3 to(from.x() + 0.5f, from.y(), -10);
+			BvhRayHits a, b;
+			built.performRaycast(&a, from, to);
+			restored.performRaycast(&b, from, to);
+			std::sort(a.triangles.begin(), a.triangles.end());
+			std::sort(b.triangles.begin(), b.triangles.end());
+			QT_CHECK(a.triangles == b.triangles);
+			QT_CHECK(i > n || !a.triangles.empty());
+		}
+	}
+	bvh->~btOptimizedBvh();
+	btAlignedFree(bvh);
+
+	// cache file round trip, damaged files are rejected before any bvh is deserialized
+	{
+		const std::string path = "trackloader_test.bvh";
+		std::ostringstream error;
+		BvhCache cache, loaded;
+		Track::Loader::BvhKey key;
+		key.hash = HashMesh(indexed_mesh);
+		key.vertices = indexed_mesh.m_numVertices;
+		key.triangles = indexed_mesh.m_numTriangles;
+		cache[key] = bytes;
+		QT_CHECK(WriteBvhCacheFile(path, cache));
+		QT_CHECK(ReadBvhCacheFile(path, loaded, error));
+		QT_CHECK(loaded == cache);
+
+		std::string file_data;
+		{
+			std::ifstream file(path.c_str(), std::ios::binary);
+			file_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+
+		// one flipped bit in the serialized bvh
+		std::string corrupted = file_data;
+		corrupted[corrupted.size() / 2] ^= 1;
+		std::ofstream(path.c_str(), std::ios::binary).write(corrupted.data(), corrupted.size());
+		QT_CHECK(!ReadBvhCacheFile(path, loaded, error));
+		QT_CHECK(loaded.empty());
+		QT_CHECK(!error.str().empty());
+
+		// truncated file
+		std::ofstream(path.c_str(), std::ios::binary).write(file_data.data(), file_data.size() - 1);
+		QT_CHECK(!ReadBvhCacheFile(path, loaded, error));
+
+		// entry too small to hold a bvh, with a valid checksum
+		cache[key] = bytes.substr(0, sizeof(btOptimizedBvh) - 1);
+		QT_CHECK(WriteBvhCacheFile(path, cache));
+		QT_CHECK(!ReadBvhCacheFile(path, loaded, error));
+		QT_CHECK(!DeserializeBvh(cache[key], mesh, indexed_mesh.m_numTriangles));
+		std::remove(path.c_str());
+	}
+
+	// the restored bvh has to fit the mesh it is used with
+	QT_CHECK(!DeserializeBvh(bytes, mesh, indexed_mesh.m_numTriangles - 2));
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		vertices[i] *= 2;
+	}
+	QT_CHECK(!DeserializeBvh(bytes, mesh, indexed_mesh.m_numTriangles));
+	bytes.resize(bytes.size() / 2);
+	QT_CHECK(!DeserializeBvh(bytes, mesh, indexed_mesh.m_numTriangles));
+}
@@ -23,6 +23,11 @@
 #include "track.h"
 #include "cfg/ptree.h"
 #include "joepack.h"
+#include "graphics/textureinfo.h"
+
+#include <deque>
+#include <map>
+#include <set>
 
 /*
 [object.foo]
@@ -47,7 +52,11 @@ model = body.joe
 
 class DynamicsWorld;
 class ContentManager;
+class JobSystem;
 class btStridingMeshInterface;
+class btTriangleIndexVertexArray;
+class btBvhTriangleMeshShape;
+class btOptimizedBvh;
 class btCompoundShape;
 class btCollisionShape;
 class PTree;
@@ -58,6 +67,7 @@ public:
 	Loader(
 		ContentManager & content,
 		DynamicsWorld & world,
+		JobSystem & jobs,
 		Track::Data & data,
 		std::ostream & info_output,
 		std::ostream & error_output,
@@ -65,6 +75,7 @@ public:
 		const std::string & trackdir,
 		const std::string & texturedir,
 		const std::string & sharedobjectpath,
+		const std::string & cachepath,
 		const int anisotropy,
 		const bool reverse,
 		const bool dynamic_shadows,
@@ -80,9 +91,25 @@ public:
 
 	int GetNumLoaded() const { return numloaded; }
 
+	// bvh cache key, mesh hash and size
+	struct BvhKey
+	{
+		BvhKey() : hash(0), vertices(0), triangles(0) {}
+		bool operator<(const BvhKey & other) const
+		{
+			if (hash != other.hash) return hash < other.hash;
+			if (vertices != other.vertices) return vertices < other.vertices;
+			return triangles < other.triangles;
+		}
+		unsigned hash;
+		unsigned vertices;
+		unsigned triangles;
+	};
+
 private:
 	ContentManager & content;
 	DynamicsWorld & world;
+	JobSystem & jobs;
 	Track::Data & data;
 	std::ostream & info_output;
 	std::ostream & error_output;
@@ -97,6 +124,7 @@ private:
 
 	std::string objectpath;
 	std::string objectdir;
+	std::string cachepath;
 	std::ifstream objectfile;
 	JoePack pack;
 	bool packload;
@@ -130,6 +158,27 @@ private:
 	typedef std::map<std::string, Body>::const_iterator body_iterator;
 	std::map<std::string, Body> bodies;
 
+	// static collision shapes built ahead on the job threads
+	struct Shape
+	{
+		Shape() : mesh(0), shape(0), bvh(0) {}
+		std::shared_ptr<Model> model;
+		btTriangleIndexVertexArray * mesh;
+		btBvhTriangleMeshShape * shape;
+		btOptimizedBvh * bvh; // from bvh cache, deserialized in place
+		std::string bvh_data; // serialized bvh, if it had to be built
+		BvhKey key;
+	};
+	std::map<const Model *, Shape> prefetched_shapes;
+
+	// serialized static mesh bvhs
+	std::map<BvhKey, std::string> bvh_cache;
+	std::set<BvhKey> bvh_used;
+	bool bvh_dirty;
+
+	// objects per prefetch batch
+	const int prefetch_count;
+
 	// compound track shape
 	btCompoundShape * track_shape;
 
@@ -137,11 +186,24 @@ private:
 	std::shared_ptr<PTree> track_config;
 	const PTree * nodes;
 	PTree::const_iterator node_it;
+	PTree::const_iterator prefetch_it;
+
+	unsigned HashSources() const;
+
+	bool LoadCache(unsigned hash);
+
+	void WriteCache(unsigned hash) const;
+
+	void LoadBvhCache();
+
+	void WriteBvhCache();
 
 	bool LoadSurfaces();
 
 	bool LoadRoads();
 
+	void OptimizeRacingLines();
+
 	bool CreateRacingLines();
 
 	void CreateRacingLine(const RoadStrip & strip);
@@ -164,6 +226,18 @@ private:
 
 	void CalculateNumOld();
 
+	void Prefetch(
+		const std::vector<std::pair<std::string, bool> > & models,
+		const std::vector<std::pair<std::string, TextureInfo> > & textures);
+
+	void PrefetchNodes();
+
+	bool PrefetchOld();
+
+	void BuildStaticShape(const Model & model, Shape & shape) const;
+
+	btBvhTriangleMeshShape * GetStaticShape(const Model & model, int surface);
+
 	bool LoadNode(const PTree & sec);
 
 	bool LoadShape(const PTree & body_cfg, const Model & body_model, Body & body);
@@ -172,7 +246,22 @@ private:
 
 	void AddBody(SceneNode & scene, const Body & body);
 
-	struct Object;
+	// list.txt object
+	struct Object
+	{
+		std::shared_ptr<Model> model;
+		std::string model_name;
+		std::string texture;
+		int transparent_blend;
+		int clamptexture;
+		int surface;
+		bool mipmap;
+		bool nolighting;
+		bool skybox;
+		bool collideable;
+		bool isashadow;
+	};
+	std::deque<Object> objects;
 	bool AddObject(const Object & object);
 
 	void Clear();